@@ -63,6 +63,7 @@ LOCAL_SRC_FILES := 	libtorrent.cpp \
 					src/file_pool.cpp \
 					src/file_storage.cpp \
 					src/gzip.cpp \
+					src/hash_pool.cpp \
 					src/GeoIP.c \
 					src/http_connection.cpp \
 					src/http_parser.cpp \
@@ -89,6 +90,7 @@ LOCAL_SRC_FILES := 	libtorrent.cpp \
 					src/policy.cpp \
 					src/puff.cpp \
 					src/random.cpp \
+					src/resolver.cpp \
 					src/rsa.cpp \
 					src/rss.cpp \
 					src/session.cpp \
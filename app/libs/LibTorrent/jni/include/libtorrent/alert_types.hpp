@@ -145,12 +145,22 @@ namespace libtorrent
 			, size(s)
 		{}
 
+		read_piece_alert(torrent_handle const& h
+			, int p, error_code const& e)
+			: torrent_alert(h)
+			, error(e)
+			, piece(p)
+			, size(0)
+		{}
+
 		TORRENT_DEFINE_ALERT(read_piece_alert);
 
 		const static int static_category = alert::storage_notification;
 		virtual std::string message() const;
 		virtual bool discardable() const { return false; }
 
+		// set if the piece couldn't be read. buffer is empty then
+		error_code error;
 		boost::shared_array<char> buffer;
 		int piece;
 		int size;
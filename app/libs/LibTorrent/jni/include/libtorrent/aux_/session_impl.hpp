@@ -86,6 +86,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/utp_socket_manager.hpp"
 #include "libtorrent/bloom_filter.hpp"
 #include "libtorrent/rss.hpp"
+#include "libtorrent/resolver.hpp"
 
 #if TORRENT_COMPLETE_TYPES_REQUIRED
 #include "libtorrent/peer_connection.hpp"
@@ -192,9 +193,6 @@ namespace libtorrent
 			boost::shared_ptr<logger> m_logger;
 #endif
 
-			// the size of each allocation that is chained in the send buffer
-			enum { send_buffer_size = 128 };
-
 #ifdef TORRENT_DEBUG
 			friend class ::libtorrent::peer_connection;
 #endif
@@ -247,6 +245,11 @@ namespace libtorrent
 				, error_code const& e);
 
 			void incoming_connection(boost::shared_ptr<socket_type> const& s);
+
+			// returns the io_service the next plain TCP peer socket should
+			// be created with. Picks round-robin between the main network
+			// thread and the network shard threads
+			io_service& peer_io_service();
 		
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 			bool is_network_thread() const
@@ -288,7 +291,7 @@ namespace libtorrent
 #endif
 			void on_dht_announce(error_code const& e);
 			void on_dht_router_name_lookup(error_code const& e
-				, tcp::resolver::iterator host);
+				, std::vector<address> const& addresses, int port);
 #endif
 
 			void maybe_update_udp_mapping(int nat, int local_port, int external_port);
@@ -318,6 +321,11 @@ namespace libtorrent
 			
 			void set_port_filter(port_filter const& f);
 
+			// rebuilds the connect candidates of all torrents. Called
+			// when something that decides whether a peer is a connect
+			// candidate changes for all of them
+			void rebuild_connect_candidates();
+
 			void  listen_on(
 				std::pair<int, int> const& port_range
 				, error_code& ec
@@ -398,6 +406,9 @@ namespace libtorrent
 			void set_proxy(proxy_settings const& s);
 			proxy_settings const& proxy() const { return m_proxy; }
 
+			void prefetch_hostname(std::string hostname)
+			{ m_host_resolver.prefetch(hostname); }
+
 #ifndef TORRENT_NO_DEPRECATE
 			void set_peer_proxy(proxy_settings const& s) { set_proxy(s); }
 			void set_web_seed_proxy(proxy_settings const& s) { set_proxy(s); }
@@ -429,7 +440,25 @@ namespace libtorrent
 #ifndef TORRENT_DISABLE_GEO_IP
 			std::string as_name_for_ip(address const& a);
 			int as_for_ip(address const& a);
-			std::pair<const int, int>* lookup_as(int as);
+
+			// returns the index of the given AS number in m_as_peaks,
+			// adding it if it isn't there yet. Returns
+			// policy::peer::unknown_as if the table is full
+			boost::uint16_t lookup_as(int as);
+
+			// the AS number and peak download rate of the AS with the
+			// given index, as returned by lookup_as()
+			std::pair<int, int> const& as_peak(boost::uint16_t index) const
+			{ return m_as_peaks[index]; }
+
+			// raises the peak download rate of the AS with the given
+			// index to rate, if it's lower
+			void update_as_peak(boost::uint16_t index, int rate);
+
+			// incremented every time an AS peak changes, or the
+			// AS database is (re)loaded. See policy::m_as_peak_generation
+			boost::uint32_t as_peak_generation() const { return m_as_peak_generation; }
+
 			void load_asnum_db(std::string file);
 			bool has_asnum_db() const { return m_asnum_db; }
 
@@ -468,9 +497,6 @@ namespace libtorrent
 				m_total_failed_bytes += b;
 			}
 
-			char* allocate_buffer();
-			void free_buffer(char* buf);
-
 			char* allocate_disk_buffer(char const* category);
 			void free_disk_buffer(char* buf);
 
@@ -540,7 +566,10 @@ namespace libtorrent
 			// this is a shared pool where policy_peer objects
 			// are allocated. It's a pool since we're likely
 			// to have tens of thousands of peers, and a pool
-			// saves significant overhead
+			// saves significant overhead. The IPv4 and IPv6 peers
+			// are constructed in place by the policy. Unlike
+			// object_pool::destroy(), pool::free() doesn't scan
+			// the free list, which matters with large peer lists
 #ifdef TORRENT_STATS
 			struct logging_allocator
 			{
@@ -563,20 +592,18 @@ namespace libtorrent
 				static int allocations;
 				static int allocated_bytes;
 			};
-			boost::object_pool<
-				policy::ipv4_peer, logging_allocator> m_ipv4_peer_pool;
+			boost::pool<logging_allocator> m_ipv4_peer_pool;
 #if TORRENT_USE_IPV6
-			boost::object_pool<
-				policy::ipv6_peer, logging_allocator> m_ipv6_peer_pool;
+			boost::pool<logging_allocator> m_ipv6_peer_pool;
 #endif
 #if TORRENT_USE_I2P
 			boost::object_pool<
 				policy::i2p_peer, logging_allocator> m_i2p_peer_pool;
 #endif
 #else
-			boost::object_pool<policy::ipv4_peer> m_ipv4_peer_pool;
+			boost::pool<> m_ipv4_peer_pool;
 #if TORRENT_USE_IPV6
-			boost::object_pool<policy::ipv6_peer> m_ipv6_peer_pool;
+			boost::pool<> m_ipv6_peer_pool;
 #endif
 #if TORRENT_USE_I2P
 			boost::object_pool<policy::i2p_peer> m_i2p_peer_pool;
@@ -588,12 +615,6 @@ namespace libtorrent
 			// by torrent::get_download_queue.
 			std::vector<block_info> m_block_info_storage;
 
-#ifndef TORRENT_DISABLE_POOL_ALLOCATOR
-			// this pool is used to allocate and recycle send
-			// buffers from.
-			boost::pool<> m_send_buffers;
-#endif
-
 			// the file pool that all storages in this session's
 			// torrents uses. It sets a limit on the number of
 			// open files by this session.
@@ -602,11 +623,35 @@ namespace libtorrent
 			// when they are destructed.
 			file_pool m_files;
 
+			// additional threads servicing peer sockets, see
+			// session_settings::network_threads. They are started on
+			// demand by peer_io_service() and stopped when the main
+			// thread exits.
+			// the shards must be destructed after m_io_service. Handlers
+			// still queued in it may hold on to peer connections whose
+			// sockets belong to a shard's io_service. The shards' own
+			// queues are drained by the time their threads are joined
+			struct network_shard
+			{
+				network_shard();
+				void run();
+
+				io_service ios;
+				boost::scoped_ptr<io_service::work> work;
+				boost::scoped_ptr<thread> shard_thread;
+			};
+			std::vector<boost::shared_ptr<network_shard> > m_network_shards;
+
 			// this is where all active sockets are stored.
 			// the selector can sleep while there's no activity on
 			// them
 			mutable io_service m_io_service;
 
+			// the index of the thread the last peer socket was assigned
+			// to. 0 is the main network thread, n > 0 is
+			// m_network_shards[n-1]
+			int m_next_network_shard;
+
 #ifdef TORRENT_USE_OPENSSL
 			// this is a generic SSL context used when talking to
 			// unauthenticated HTTPS servers
@@ -915,7 +960,9 @@ namespace libtorrent
 			// by Local service discovery
 			deadline_timer m_lsd_announce_timer;
 
-			tcp::resolver m_host_resolver;
+			// looks up and caches host names for trackers,
+			// web seeds and DHT routers
+			resolver m_host_resolver;
 
 			// the index of the torrent that will be offered to
 			// connect to a peer next time on_tick is called.
@@ -934,8 +981,6 @@ namespace libtorrent
 			void log_buffer_usage();
 			// used to log send buffer usage statistics
 			std::ofstream m_buffer_usage_logger;
-			// the number of send buffers that are allocated
-			int m_buffer_allocations;
 #endif
 
 #ifdef TORRENT_REQUEST_LOGGING
@@ -1115,11 +1160,16 @@ namespace libtorrent
 			GeoIP* m_asnum_db;
 			GeoIP* m_country_db;
 
-			// maps AS number to the peak download rate
-			// we've seen from it. Entries are never removed
-			// from this map. Pointers to its elements
-			// are kept in the policy::peer structures.
-			std::map<int, int> m_as_peak;
+			// the AS numbers we've seen, and the peak download rate
+			// we've seen from each. Entries are never removed. The
+			// policy::peer structures refer to their AS by its index
+			// in here, which is smaller than a pointer
+			std::vector<std::pair<int, int> > m_as_peaks;
+
+			// maps AS number to its index in m_as_peaks
+			std::map<int, boost::uint16_t> m_as_index;
+
+			boost::uint32_t m_as_peak_generation;
 #endif
 
 			// total redundant and failed bytes
@@ -58,6 +58,10 @@ struct TORRENT_EXTRA_EXPORT bandwidth_channel
 	int quota_left() const;
 	void update_quota(int dt_milliseconds);
 
+	// sets distribute_quota to the given percentage of the
+	// quota currently left in this channel
+	void set_distribute_quota(int percent);
+
 	// this is used when connections disconnect with
 	// some quota left. It's returned to its bandwidth
 	// channels.
@@ -76,8 +76,10 @@ struct TORRENT_EXTRA_EXPORT bandwidth_manager
 	// this is used by web seeds
 	// returns the number of bytes to assign to the peer, or 0
 	// if the peer's 'assign_bandwidth' callback will be called later
+	// guaranteed requests (from streaming torrents) are served from the
+	// reserved share of each channel before all other requests
 	int request_bandwidth(intrusive_ptr<bandwidth_socket> const& peer
-		, int blk, int priority
+		, int blk, int priority, bool guaranteed
 		, bandwidth_channel* chan1 = 0
 		, bandwidth_channel* chan2 = 0
 		, bandwidth_channel* chan3 = 0
@@ -88,14 +90,29 @@ struct TORRENT_EXTRA_EXPORT bandwidth_manager
 	void check_invariant() const;
 #endif
 
-	void update_quotas(time_duration const& dt);
-
-	// these are the consumers that want bandwidth
+	// refills the channels of all queued requests and hands out their
+	// quota. The channels form a hierarchy of token buckets (session,
+	// peer class, torrent and peer) and each request is limited by the
+	// most restrictive one. If any guaranteed requests are queued,
+	// they first split guaranteed_share percent of every channel among
+	// themselves, then all requests split what's left
+	void update_quotas(time_duration const& dt, int guaranteed_share = 0);
+
+	// these are the consumers that want bandwidth. Requests are
+	// appended, and satisfied ones are compacted out in the same pass
+	// that assigns quota, so both enqueueing and dequeueing a request
+	// is O(1)
 	typedef std::vector<bw_request> queue_t;
 	queue_t m_queue;
 	// the number of bytes all the requests in queue are for
 	int m_queued_bytes;
 
+	// distributes percent of the quota left in the given channels to the
+	// queued requests (only the guaranteed ones if guaranteed_only is
+	// set). Satisfied requests are moved from m_queue to tm
+	void assign_quota(std::vector<bandwidth_channel*> const& channels
+		, bool guaranteed_only, int percent, queue_t& tm);
+
 	// this is the channel within the consumers
 	// that bandwidth is assigned to (upload or download)
 	int m_channel;
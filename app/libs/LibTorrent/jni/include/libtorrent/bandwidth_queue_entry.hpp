@@ -58,6 +58,10 @@ struct TORRENT_EXTRA_EXPORT bw_request
 	// time to satisfy
 	int ttl;
 
+	// true if this request belongs to a streaming torrent and
+	// should be served from the guaranteed share first
+	bool guaranteed;
+
 	// loops over the bandwidth channels and assigns bandwidth
 	// from the most limiting one
 	int assign_bandwidth();
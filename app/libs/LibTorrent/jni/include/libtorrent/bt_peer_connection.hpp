@@ -233,6 +233,8 @@ namespace libtorrent
 		void write_bitfield();
 		void write_have(int index);
 		void write_piece(peer_request const& r, disk_buffer_holder& buffer);
+		void write_piece_sendfile(peer_request const& r);
+		bool plaintext_payload() const;
 		void write_handshake();
 #ifndef TORRENT_DISABLE_EXTENSIONS
 		void write_extensions();
@@ -265,6 +267,9 @@ namespace libtorrent
 	private:
 
 		bool dispatch_message(int received);
+		// writes the message header of a piece message (and the
+		// merkle hashes, if any) for the block r
+		void write_piece_header(peer_request const& r);
 		// returns the block currently being
 		// downloaded. And the progress of that
 		// block. If the peer isn't downloading
@@ -294,6 +299,15 @@ namespace libtorrent
 		// initializes m_enc_handler
 		void init_pe_rc4_handler(char const* secret, sha1_hash const& stream_key);
 
+		// once the stream is rc4 encrypted, what we receive is decrypted
+		// on the network shard, if we're on one. m_enc_handler keeps
+		// separate state for each direction, so this doesn't race with
+		// encrypting what we send on the main thread
+		virtual bool decrypt_on_shard() const
+		{ return m_rc4_encrypted && m_encrypted; }
+		virtual void decrypt_received(char* buf, int len)
+		{ m_enc_handler->decrypt(buf, len); }
+
 		// Returns offset at which bytestream (src, src + src_size)
 		// matches bytestream(target, target + target_size).
 		// If no sync found, return -1
@@ -309,14 +323,14 @@ public:
 		virtual void append_const_send_buffer(char const* buffer, int size);
 		virtual void send_buffer(char const* begin, int size, int flags = 0
 			, void (*fun)(char*, int, void*) = 0, void* userdata = 0);
-		template <class Destructor>
-		void bt_append_send_buffer(char* buffer, int size, Destructor const& destructor)
+		void bt_append_send_buffer(char* buffer, int size
+			, chained_buffer::free_buffer_fun destructor, void* userdata)
 		{
 #ifndef TORRENT_DISABLE_ENCRYPTION
 			if (m_rc4_encrypted)
 				m_enc_handler->encrypt(buffer, size);
 #endif
-			peer_connection::append_send_buffer(buffer, size, destructor, true);
+			peer_connection::append_send_buffer(buffer, size, destructor, userdata, true);
 		}
 
 private:
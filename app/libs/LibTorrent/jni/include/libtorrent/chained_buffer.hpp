@@ -35,14 +35,14 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/config.hpp"
 
-#include <boost/function/function1.hpp>
 #include <boost/version.hpp>
 #if BOOST_VERSION < 103500
 #include <asio/buffer.hpp>
 #else
 #include <boost/asio/buffer.hpp>
 #endif
-#include <list>
+#include <deque>
+#include <vector>
 #include <string.h> // for memcpy
 
 namespace libtorrent
@@ -59,9 +59,23 @@ namespace libtorrent
 #endif
 		}
 
+		// releases a buffer once it's been sent. userdata is the
+		// pointer that was passed in along with the buffer
+		typedef void (*free_buffer_fun)(char* buf, void* userdata);
+
+		// small messages are copied into blocks of this size. They're
+		// allocated from an arena owned by the chained_buffer, and
+		// returned to it once they've been sent
+		enum { arena_block_size = 512 };
+
+		// the max number of buffers handed to a single write. This is
+		// as many as asio gathers into one sendmsg() call
+		enum { max_iovec = 64 };
+
 		struct buffer_t
 		{
-			boost::function<void(char*)> free; // destructs the buffer
+			free_buffer_fun free; // destructs the buffer
+			void* userdata; // passed to free
 			char* buf; // the first byte of the buffer
 			int size; // the total size of the buffer
 
@@ -76,7 +90,24 @@ namespace libtorrent
 		void pop_front(int bytes_to_pop);
 
 		void append_buffer(char* buffer, int s, int used_size
-			, boost::function<void(char*)> const& destructor);
+			, free_buffer_fun destructor, void* userdata = 0);
+
+		// returns a block of arena_block_size bytes, or 0 if
+		// we're out of memory
+		char* allocate_arena_block();
+
+		// appends a block returned by allocate_arena_block(), with
+		// used_size bytes of it filled in
+		void append_arena_block(char* block, int used_size);
+
+		// appends s bytes that aren't held in memory. They are sent
+		// by some other means than the iovec, like sendfile(), and
+		// build_iovec() stops at them
+		void append_external(int s);
+
+		// returns the number of bytes left of the external
+		// segment at the front, or 0 if the front is a buffer
+		int front_external() const;
 
 		// returns the number of bytes available at the
 		// end of the last chained buffer.
@@ -92,15 +123,19 @@ namespace libtorrent
 		// enough room, returns 0
 		char* allocate_appendix(int s);
 
-		std::list<asio::const_buffer> const& build_iovec(int to_send);
+		// returns the buffers making up the first to_send bytes, but
+		// no more than max_iovec of them
+		std::vector<asio::const_buffer> const& build_iovec(int to_send);
 
 		~chained_buffer();
 
 	private:
 
+		static void free_arena_block(char* buf, void* userdata);
+
 		// this is the list of all the buffers we want to
 		// send
-		std::list<buffer_t> m_vec;
+		std::deque<buffer_t> m_vec;
 
 		// this is the number of bytes in the send buf.
 		// this will always be equal to the sum of the
@@ -113,7 +148,11 @@ namespace libtorrent
 
 		// this is the vector of buffers used when
 		// invoking the async write call
-		std::list<asio::const_buffer> m_tmp_vec;
+		std::vector<asio::const_buffer> m_tmp_vec;
+
+		// arena blocks that have been sent and are free to be
+		// reused. At most a few are kept around
+		std::vector<char*> m_arena;
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		bool m_destructed;
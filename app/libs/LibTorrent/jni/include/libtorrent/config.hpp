@@ -425,14 +425,44 @@ inline int snprintf(char* buf, int len, char const* fmt, ...)
 #define TORRENT_USE_MLOCK 1
 #endif
 
+// mmap_storage maps file regions with mmap(), which
+// is only available on posix systems
+#ifndef TORRENT_USE_MMAP
+#if defined TORRENT_WINDOWS || defined TORRENT_AMIGA
+#define TORRENT_USE_MMAP 0
+#else
+#define TORRENT_USE_MMAP 1
+#endif
+#endif
+
 #ifndef TORRENT_USE_WRITEV
 #define TORRENT_USE_WRITEV 1
 #endif
 
+// batched UDP receive and send with recvmmsg() and sendmmsg().
+// Whether the running kernel supports them is detected at run time
+#ifndef TORRENT_USE_MMSG
+#if defined TORRENT_LINUX
+#define TORRENT_USE_MMSG 1
+#else
+#define TORRENT_USE_MMSG 0
+#endif
+#endif
+
 #ifndef TORRENT_USE_READV
 #define TORRENT_USE_READV 1
 #endif
 
+// sending piece data straight from the page cache to peer
+// sockets with sendfile()
+#ifndef TORRENT_USE_SENDFILE
+#if defined TORRENT_LINUX
+#define TORRENT_USE_SENDFILE 1
+#else
+#define TORRENT_USE_SENDFILE 0
+#endif
+#endif
+
 #ifndef TORRENT_NO_FPU
 #define TORRENT_NO_FPU 0
 #endif
@@ -463,19 +493,22 @@ inline int snprintf(char* buf, int len, char const* fmt, ...)
 #endif
 #endif
 
+// the handlers of sockets on a network shard are wrapped in a
+// network_thread_handler, which adds an io_service::work to the socket
+// operation and an error_code and byte count to the posted completion
 #if !defined(TORRENT_READ_HANDLER_MAX_SIZE)
 # ifdef _GLIBCXX_DEBUG
-#  define TORRENT_READ_HANDLER_MAX_SIZE 400
+#  define TORRENT_READ_HANDLER_MAX_SIZE 448
 # else
-#  define TORRENT_READ_HANDLER_MAX_SIZE 300
+#  define TORRENT_READ_HANDLER_MAX_SIZE 348
 # endif
 #endif
 
 #if !defined(TORRENT_WRITE_HANDLER_MAX_SIZE)
 # ifdef _GLIBCXX_DEBUG
-#  define TORRENT_WRITE_HANDLER_MAX_SIZE 400
+#  define TORRENT_WRITE_HANDLER_MAX_SIZE 448
 # else
-#  define TORRENT_WRITE_HANDLER_MAX_SIZE 300
+#  define TORRENT_WRITE_HANDLER_MAX_SIZE 348
 # endif
 #endif
 
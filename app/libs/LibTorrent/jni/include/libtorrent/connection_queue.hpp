@@ -33,7 +33,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef TORRENT_CONNECTION_QUEUE
 #define TORRENT_CONNECTION_QUEUE
 
-#include <list>
+#include <deque>
+#include <map>
 #include <boost/function/function1.hpp>
 #include <boost/function/function0.hpp>
 #include <boost/noncopyable.hpp>
@@ -62,22 +63,51 @@ public:
 	void enqueue(boost::function<void(int)> const& on_connect
 		, boost::function<void()> const& on_timeout
 		, time_duration timeout, int priority = 0);
-	void done(int ticket);
+
+	// how a connection attempt ended, passed to done()
+	enum result_t
+	{
+		// we gave up on the attempt ourselves. It says nothing
+		// about the network
+		cancelled,
+		// the other end answered, by accepting or refusing the
+		// connection
+		responded,
+		// the attempt failed without an answer, e.g. the host or
+		// network is unreachable
+		failed
+	};
+
+	// called when a connection attempt completes or is cancelled.
+	// Unless it was cancelled, the result (and for responded, the
+	// time it took) is fed to the adaptive limit
+	void done(int ticket, int result = cancelled);
 	void limit(int limit);
 	int limit() const;
+
+	// when enabled, the number of concurrent connection attempts
+	// adapts to how well they're doing, between min_window and
+	// limit()
+	void adaptive(bool a);
+
+	// the number of connection attempts that may be in progress
+	// at once right now. This is limit(), or less if the adaptive
+	// limit is in effect
+	int current_limit() const;
+
 	void close();
-	int size() const { return m_queue.size(); }
-	int num_connecting() const { return m_num_connecting; }
+	int size() const
+	{ return m_priority_queue.size() + m_queue.size() + m_connecting.size(); }
+	int num_connecting() const { return m_connecting.size(); }
 #if defined TORRENT_ASIO_DEBUGGING
 	float next_timeout() const { return total_milliseconds(m_timer.expires_at() - time_now_hires()) / 1000.f; }
 	float max_timeout() const
 	{
 		ptime max_timeout = min_time();
-		for (std::list<entry>::const_iterator i = m_queue.begin()
-			, end(m_queue.end()); i != end; ++i)
+		for (connecting_t::const_iterator i = m_connecting.begin()
+			, end(m_connecting.end()); i != end; ++i)
 		{
-			if (!i->connecting) continue;
-			if (i->expires > max_timeout) max_timeout = i->expires;
+			if (i->second.expires > max_timeout) max_timeout = i->second.expires;
 		}
 		if (max_timeout == min_time()) return 0.f;
 		return total_milliseconds(max_timeout - time_now_hires()) / 1000.f;
@@ -88,6 +118,10 @@ public:
 	void check_invariant() const;
 #endif
 
+	// the adaptive limit starts out at initial_window
+	// and never goes below min_window
+	enum { min_window = 4, initial_window = 20 };
+
 private:
 
 	typedef mutex mutex_t;
@@ -95,10 +129,12 @@ private:
 	void try_connect(mutex_t::scoped_lock& l);
 	void on_timeout(error_code const& e);
 	void on_try_connect();
+	int current_limit_impl() const;
+	void update_window(bool responded, int rtt);
 
 	struct entry
 	{
-		entry(): connecting(false), ticket(0), expires(max_time()), priority(0) {}
+		entry(): ticket(0), expires(max_time()), priority(0) {}
 		// called when the connection is initiated
 		// this is when the timeout countdown starts
 		// TODO: if we don't actually need the connection queue
@@ -112,24 +148,55 @@ private:
 		// 2. on_connect, on_timeout
 		// 3. on_timeout
 		boost::function<void()> on_timeout;
-		bool connecting;
 		int ticket;
 		ptime expires;
 		time_duration timeout;
 		int priority;
 	};
 
-	// TODO: split this into a queue and connecting map. The key for the map
-	// is the ticket. Most field in entry would only be necessary for the
-	// connecting map.
-	std::list<entry> m_queue;
+	// the connection attempts waiting for a free slot. The ones
+	// with a priority are started before the others, but within
+	// each queue, attempts are started in the order they came in
+	std::deque<entry> m_priority_queue;
+	std::deque<entry> m_queue;
+
+	// the connection attempts in progress, keyed by ticket
+	typedef std::map<int, entry> connecting_t;
+	connecting_t m_connecting;
 
 	// the next ticket id a connection will be given
 	int m_next_ticket;
-	int m_num_connecting;
 	int m_half_open_limit;
 	bool m_abort;
 
+	// true if the number of concurrent connection attempts
+	// is adjusted by m_window
+	bool m_adaptive;
+
+	// the adaptive limit. It grows by one for every response
+	// until the first sign of congestion (slow start), and by
+	// one per window of responses after that. When the share
+	// of attempts that get a response drops, or the response
+	// time climbs, it's cut by a quarter
+	int m_window;
+	int m_window_threshold;
+	int m_window_credit;
+
+	// the number of outcomes to wait for after cutting the
+	// window, before it may be cut again
+	int m_backoff_holdoff;
+
+	// moving averages of the share of connection attempts
+	// that got a response (fixed point, 0x10000 is all of them),
+	// and of the response time (in microseconds, so that the
+	// long average still moves by 1/64th of a difference of a
+	// few milliseconds). The short ones follow the last 8 or so
+	// outcomes, the long ones the last 64 or so
+	int m_short_response_rate;
+	int m_long_response_rate;
+	int m_short_rtt;
+	int m_long_rtt;
+
 	// the number of outstanding timers
 	int m_num_timers;
 
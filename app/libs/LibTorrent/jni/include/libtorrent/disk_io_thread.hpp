@@ -43,8 +43,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/noncopyable.hpp>
 #include <boost/shared_array.hpp>
 #include <deque>
+#include <map>
+#include <cstring>
 #include "libtorrent/config.hpp"
 #include "libtorrent/thread.hpp"
+#include "libtorrent/hash_pool.hpp"
 #include "libtorrent/disk_buffer_pool.hpp"
 
 #include <boost/multi_index_container.hpp>
@@ -79,8 +82,11 @@ namespace libtorrent
 			, buffer_size(0)
 			, piece(0)
 			, offset(0)
+			, socket(-1)
 			, max_cache_line(0)
 			, cache_min_time(0)
+			, job_class(normal)
+			, deadline(min_time())
 		{}
 
 		enum action_t
@@ -101,11 +107,25 @@ namespace libtorrent
 			, update_settings
 			, read_and_hash
 			, cache_piece
+			, sendfile
+			, drop_piece
 #ifndef TORRENT_NO_DEPRECATE
 			, finalize_file
 #endif
 		};
 
+		// the scheduling class of a job. Jobs in the classes
+		// before normal are served in deadline order, ahead
+		// of the regular job queue
+		enum job_class_t
+		{
+			playback_read
+			, time_critical_hash
+			, normal
+			, background_check
+			, num_job_classes
+		};
+
 		action_t action;
 
 		char* buffer;
@@ -113,6 +133,8 @@ namespace libtorrent
 		boost::intrusive_ptr<piece_manager> storage;
 		// arguments used for read and write
 		int piece, offset;
+		// the socket a sendfile job writes to
+		int socket;
 		// used for move_storage and rename_file. On errors, this is set
 		// to the error message
 		std::string str;
@@ -141,6 +163,13 @@ namespace libtorrent
 		// the time when this job was issued. This is used to
 		// keep track of disk I/O congestion
 		ptime start_time;
+
+		// one of job_class_t
+		int job_class;
+
+		// the time by which this job should be completed. If this
+		// is min_time() for an expedited job, its start_time is used
+		ptime deadline;
 	};
 
 	// returns true if the fundamental operation
@@ -177,7 +206,10 @@ namespace libtorrent
 			, cumulative_sort_time(0)
 			, total_read_back(0)
 			, read_queue_size(0)
-		{}
+			, missed_deadlines(0)
+		{
+			std::memset(queue_time_histogram, 0, sizeof(queue_time_histogram));
+		}
 
 		// the number of 16kB blocks written
 		size_type blocks_written;
@@ -222,6 +254,17 @@ namespace libtorrent
 		boost::uint32_t cumulative_sort_time;
 		int total_read_back;
 		int read_queue_size;
+
+		// histograms of the time jobs spent in the queue, one per
+		// disk_io_job::job_class_t. Bucket n counts the jobs that
+		// waited less than 4^n milliseconds, the last bucket counts
+		// all jobs that waited longer
+		enum { num_queue_time_buckets = 8 };
+		boost::uint32_t queue_time_histogram[disk_io_job::num_job_classes][num_queue_time_buckets];
+
+		// the number of jobs that were picked up after
+		// their deadline had already passed
+		boost::uint32_t missed_deadlines;
 	};
 	
 	// this is a singleton consisting of the thread and a queue
@@ -257,6 +300,11 @@ namespace libtorrent
 
 		cache_status status() const;
 
+		// the threads the file check hashes pieces on, see
+		// session_settings::file_check_hash_threads. Only used
+		// from the disk thread
+		hash_pool& hash_threads() { return m_hash_pool; }
+
 		void thread_fun();
 
 #ifdef TORRENT_DEBUG
@@ -318,6 +366,10 @@ namespace libtorrent
 			, boost::function<void(int, disk_io_job const&)> const& f
 			= boost::function<void(int, disk_io_job const&)>());
 
+		// returns true if j may be moved to m_deadline_jobs, ahead
+		// of the jobs in m_jobs. Requires m_queue_mutex to be held
+		bool can_expedite(disk_io_job const& j) const;
+
 		bool test_error(disk_io_job& j);
 		void post_callback(disk_io_job const& j, int ret);
 
@@ -369,8 +421,8 @@ namespace libtorrent
 		int cache_piece(disk_io_job const& j, cache_piece_index_t::iterator& p
 			, bool& hit, int options, mutex::scoped_lock& l);
 
-		// this mutex only protects m_jobs, m_queue_buffer_size,
-		// m_exceeded_write_queue and m_abort
+		// this mutex only protects m_jobs, m_deadline_jobs,
+		// m_queue_buffer_size, m_exceeded_write_queue and m_abort
 		mutable mutex m_queue_mutex;
 		event m_signal;
 		bool m_abort;
@@ -378,6 +430,13 @@ namespace libtorrent
 		std::deque<disk_io_job> m_jobs;
 		size_type m_queue_buffer_size;
 
+		// jobs in the playback_read and time_critical_hash
+		// classes, ordered by deadline. The earliest one is
+		// always picked before anything in m_jobs or
+		// m_sorted_read_jobs
+		typedef std::multimap<ptime, disk_io_job> deadline_jobs_t;
+		deadline_jobs_t m_deadline_jobs;
+
 		ptime m_last_file_check;
 
 		// this protects the piece cache and related members
@@ -453,6 +512,8 @@ namespace libtorrent
 		// the session_impl object
 		file_pool& m_file_pool;
 
+		hash_pool m_hash_pool;
+
 		// when completion notifications are queued, they're stuck
 		// in this list
 		std::list<std::pair<disk_io_job, int> > m_queued_completions;
@@ -174,7 +174,7 @@ namespace libtorrent
 			invalid_dont_have,
 			requires_ssl_connection,
 			invalid_ssl_cert,
-			reserved113,
+			piece_dropped,
 			reserved114,
 			reserved115,
 			reserved116,
@@ -244,6 +244,23 @@ namespace libtorrent
 		size_type readv(size_type file_offset, iovec_t const* bufs, int num_bufs, error_code& ec);
 		void hint_read(size_type file_offset, int len);
 
+#if TORRENT_USE_MMAP
+		// these behave like readv() and writev(). Reads copy out of a
+		// shared, read-only mapping of the file instead of issuing a
+		// system call per operation. The mapped window is kept open
+		// between calls and is only moved when a read falls outside of
+		// it. Writes use writev(), since storing into a mapped page that
+		// has no disk blocks behind it raises SIGBUS
+		size_type mmap_readv(size_type file_offset, iovec_t const* bufs, int num_bufs, error_code& ec);
+		size_type mmap_writev(size_type file_offset, iovec_t const* bufs, int num_bufs, error_code& ec);
+#endif
+
+#if TORRENT_USE_SENDFILE
+		// writes len bytes at file_offset to the given socket with
+		// sendfile(). Returns the number of bytes sent, or -1 on error
+		int sendfile(int socket, size_type file_offset, int len, error_code& ec);
+#endif
+
 		size_type get_size(error_code& ec) const;
 
 		// return the offset of the first byte that
@@ -284,6 +301,20 @@ namespace libtorrent
 
 		static bool has_manage_volume_privs;
 #endif
+
+#if TORRENT_USE_MMAP
+		// makes sure the range [file_offset, file_offset + len) is
+		// covered by the mapped window and returns a pointer to
+		// file_offset within it. len is clamped to the size of the
+		// file. Returns 0 if the range can't be mapped
+		char* map_region(size_type file_offset, int& len, error_code& ec);
+		void unmap_region();
+
+		// the currently mapped window of the file, or 0
+		char* m_map_base;
+		size_type m_map_offset;
+		size_type m_map_size;
+#endif
 	};
 
 }
@@ -38,14 +38,16 @@ POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 #include <boost/intrusive_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/detail/atomic_count.hpp>
 
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
 
-#include <map>
+#include <vector>
 #include "libtorrent/file.hpp"
-#include "libtorrent/ptime.hpp"
 #include "libtorrent/thread.hpp"
 #include "libtorrent/file_storage.hpp"
 
@@ -66,26 +68,65 @@ namespace libtorrent
 
 	private:
 
-		void remove_oldest();
-
-		int m_size;
-		bool m_low_prio_io;
+		// files are spread over this many independently locked
+		// shards, keyed by the storage they belong to. Each shard
+		// keeps its own LRU list, so eviction is O(1)
+		enum { num_shards = 8 };
 
 		struct lru_file_entry
 		{
-			lru_file_entry(): key(0), last_use(time_now()), mode(0) {}
-			mutable boost::intrusive_ptr<file> file_ptr;
+			lru_file_entry(): key(0), file_index(0), mode(0), prev(0), next(0) {}
+			boost::intrusive_ptr<file> file_ptr;
 			void* key;
-			ptime last_use;
+			int file_index;
 			int mode;
+			// links in the shard's LRU list. prev is towards the
+			// most recently used end
+			lru_file_entry* prev;
+			lru_file_entry* next;
 		};
 
 		// maps storage pointer, file index pairs to the
 		// lru entry for the file
-		typedef std::map<std::pair<void*, int>, lru_file_entry> file_set;
-		
-		file_set m_files;
-		mutex m_mutex;
+		typedef std::pair<void*, int> file_key;
+		typedef boost::unordered_map<file_key, lru_file_entry
+			, boost::hash<file_key> > file_set;
+
+		struct shard
+		{
+			shard(): lru_head(0), lru_tail(0) {}
+			file_set files;
+			// most and least recently used entries
+			lru_file_entry* lru_head;
+			lru_file_entry* lru_tail;
+			mutex mtx;
+		};
+
+		shard& shard_for(void* st);
+
+		// these must be called with the shard's mutex held
+		static void lru_unlink(shard& s, lru_file_entry& e);
+		static void lru_push_front(shard& s, lru_file_entry& e);
+		void remove_entry(shard& s, file_set::iterator i
+			, std::vector<boost::intrusive_ptr<file> >& closed);
+		bool remove_oldest(shard& s
+			, std::vector<boost::intrusive_ptr<file> >& closed);
+
+		// closes the files outside of any shard mutex. If closing
+		// may block, the files are handed to the closer thread
+		void close_files(std::vector<boost::intrusive_ptr<file> >& files);
+
+		// evicts the least recently used files, starting with
+		// shard s, until we're within the size limit
+		void trim(shard& s);
+
+		int m_size;
+		bool m_low_prio_io;
+
+		// the number of files currently in the pool, across all shards
+		boost::detail::atomic_count m_num_open;
+
+		shard m_shards[num_shards];
 
 #if TORRENT_CLOSE_MAY_BLOCK
 		void closer_thread_fun();
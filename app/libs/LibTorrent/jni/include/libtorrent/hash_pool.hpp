@@ -0,0 +1,112 @@
+/*
+
+Copyright (c) 2026, PopcornTV contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_HASH_POOL_HPP_INCLUDED
+#define TORRENT_HASH_POOL_HPP_INCLUDED
+
+#include <deque>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/thread.hpp"
+#include "libtorrent/file.hpp"
+#include "libtorrent/peer_id.hpp" // for sha1_hash
+
+namespace libtorrent
+{
+
+// a set of threads computing SHA-1 hashes of buffers for the disk
+// thread. The file check hands them the pieces it has read, and reads
+// the next ones while they're being hashed (see
+// piece_manager::check_one_piece). With no threads, jobs are hashed
+// by the thread posting them, right away
+class TORRENT_EXTRA_EXPORT hash_pool : public boost::noncopyable
+{
+public:
+
+	struct job
+	{
+		job(): small_size(0), done(false) {}
+
+		// the data to hash. The buffers must not be touched until
+		// the job is done
+		std::vector<file::iovec_t> bufs;
+
+		// if > 0, small_hash is set to the hash of the first
+		// small_size bytes of the data
+		int small_size;
+
+		sha1_hash hash;
+		sha1_hash small_hash;
+
+		// set once hash and small_hash are valid. Protected by
+		// the pool's mutex, see wait()
+		bool done;
+	};
+
+	hash_pool();
+	~hash_pool();
+
+	// starts or stops threads to have num_threads of them. Stopping
+	// threads waits for the queued jobs to be hashed
+	void set_num_threads(int num_threads);
+	int num_threads() const { return m_threads.size(); }
+
+	// stops all threads, once they've hashed the queued jobs
+	void stop();
+
+	// the pool keeps a reference to the job until it's hashed
+	void async_hash(boost::shared_ptr<job> const& j);
+
+	// blocks until j has been hashed
+	void wait(job const& j);
+
+private:
+
+	void thread_fun();
+	static void hash(job& j);
+
+	mutex m_mutex;
+	// signalled both when a job is queued and when one is done
+	condition m_cond;
+	std::deque<boost::shared_ptr<job> > m_jobs;
+	std::vector<boost::shared_ptr<thread> > m_threads;
+	// set while stopping the threads
+	bool m_abort;
+};
+
+}
+
+#endif
+
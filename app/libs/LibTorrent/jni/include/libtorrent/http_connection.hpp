@@ -63,6 +63,7 @@ namespace libtorrent
 
 struct http_connection;
 class connection_queue;
+class resolver;
 	
 typedef boost::function<void(error_code const&
 	, http_parser const&, char const* data, int size, http_connection&)> http_handler;
@@ -82,7 +83,7 @@ struct TORRENT_EXTRA_EXPORT http_connection : boost::enable_shared_from_this<htt
 #ifdef TORRENT_USE_OPENSSL
 		, boost::asio::ssl::context* ssl_ctx = 0
 #endif
-		);
+		, resolver* host_resolver = 0);
 
 	~http_connection();
 
@@ -124,6 +125,9 @@ private:
 #endif
 	void on_resolve(error_code const& e
 		, tcp::resolver::iterator i);
+	void on_cached_resolve(error_code const& e
+		, std::vector<address> const& addresses);
+	void on_endpoints();
 	void queue_connect();
 	void connect(int ticket, tcp::endpoint target_address);
 	void on_connect_timeout();
@@ -143,6 +147,9 @@ private:
 #endif
 	int m_read_pos;
 	tcp::resolver m_resolver;
+	// if set, host names are looked up through this (the
+	// session's cache) instead of m_resolver
+	resolver* m_host_resolver;
 	http_parser m_parser;
 	http_handler m_handler;
 	http_connect_handler m_connect_handler;
@@ -44,6 +44,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/cstdint.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <boost/function/function2.hpp>
 
 #ifdef _MSC_VER
 #pragma warning(pop)
@@ -65,7 +66,18 @@ namespace libtorrent
 	class TORRENT_EXTRA_EXPORT http_parser
 	{
 	public:
-		enum flags_t { dont_parse_chunks = 1 };
+		enum flags_t
+		{
+			dont_parse_chunks = 1,
+
+			// don't copy the status line or the headers out of the
+			// receive buffer. header(), headers(), method(), path(),
+			// protocol() and message() are left empty, use header_view()
+			// and the other *_view() functions instead. Trailing headers
+			// of chunked responses are not recorded in this mode
+			dont_copy_headers = 2
+		};
+
 		http_parser(int flags = 0);
 		~http_parser();
 		std::string const& header(char const* key) const
@@ -82,6 +94,27 @@ namespace libtorrent
 		std::string const& method() const { return m_method; }
 		std::string const& path() const { return m_path; }
 		std::string const& message() const { return m_server_message; }
+
+		// these point into the buffer last passed to incoming(), so
+		// just like get_body(), they're only valid as long as that
+		// buffer is. They're only filled in with dont_copy_headers.
+		// The key passed to header_view() is expected to be lower case,
+		// header names are matched case insensitively. Headers that
+		// aren't present, are returned as an empty interval
+		buffer::const_interval header_view(char const* key) const;
+		buffer::const_interval protocol_view() const { return view(m_protocol_view); }
+		buffer::const_interval method_view() const { return view(m_method_view); }
+		buffer::const_interval path_view() const { return view(m_path_view); }
+		buffer::const_interval message_view() const { return view(m_message_view); }
+
+		// if set, every piece of the body is passed to this handler as
+		// soon as it's parsed, with the chunk headers left out (unless
+		// dont_parse_chunks is set). The chunks are then not recorded,
+		// so there's nothing for collapse_chunk_headers() to do and
+		// get_body() includes the chunk headers
+		typedef boost::function<void(char const*, int)> body_handler_t;
+		void set_body_handler(body_handler_t const& h) { m_body_handler = h; }
+
 		buffer::const_interval get_body() const;
 		bool header_finished() const { return m_state == read_body; }
 		bool finished() const { return m_finished; }
@@ -124,10 +157,41 @@ namespace libtorrent
 		// reset the whole state and start over
 		void reset();
 
+		// once a response is finished(), this starts parsing the next
+		// one, right where it ended in the same receive buffer. This is
+		// for pipelined responses, to not have to move the following
+		// responses to the front of the buffer. Offsets, like body_start(),
+		// are still relative to the start of the buffer. Returns the offset
+		// the next response starts at
+		int next_response();
+
 		std::multimap<std::string, std::string> const& headers() const { return m_header; }
 		std::vector<std::pair<size_type, size_type> > const& chunks() const { return m_chunked_ranges; }
 		
 	private:
+
+		// a string in the receive buffer, as offsets from its start
+		struct span
+		{
+			span(): offset(0), length(0) {}
+			int offset;
+			int length;
+		};
+
+		buffer::const_interval view(span const& s) const
+		{
+			return buffer::const_interval(m_recv_buffer.begin + s.offset
+				, m_recv_buffer.begin + s.offset + s.length);
+		}
+
+		span make_span(char const* begin, char const* end) const
+		{
+			span ret;
+			ret.offset = int(begin - m_recv_buffer.begin);
+			ret.length = int(end - begin);
+			return ret;
+		}
+
 		size_type m_recv_pos;
 		int m_status_code;
 		std::string m_method;
@@ -142,6 +206,17 @@ namespace libtorrent
 		enum { read_status, read_header, read_body, error_state } m_state;
 
 		std::multimap<std::string, std::string> m_header;
+
+		// used instead of the strings above with dont_copy_headers.
+		// The header names are as they were sent, not lower cased
+		span m_protocol_view;
+		span m_method_view;
+		span m_path_view;
+		span m_message_view;
+		std::vector<std::pair<span, span> > m_header_views;
+
+		body_handler_t m_body_handler;
+
 		buffer::const_interval m_recv_buffer;
 		int m_body_start_pos;
 
@@ -73,7 +73,7 @@ namespace libtorrent
 			, tracker_manager& man
 			, tracker_request const& req
 			, boost::weak_ptr<request_callback> c
-			, aux::session_impl const& ses
+			, aux::session_impl& ses
 			, proxy_settings const& ps
 			, std::string const& password = ""
 #if TORRENT_USE_I2P
@@ -101,7 +101,7 @@ namespace libtorrent
 
 		tracker_manager& m_man;
 		boost::shared_ptr<http_connection> m_tracker_connection;
-		aux::session_impl const& m_ses;
+		aux::session_impl& m_ses;
 		address m_tracker_ip;
 		proxy_settings const& m_ps;
 		connection_queue& m_cc;
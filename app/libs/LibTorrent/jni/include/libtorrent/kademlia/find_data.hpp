@@ -88,7 +88,6 @@ private:
 	nodes_callback m_nodes_callback;
 	std::map<node_id, std::string> m_write_tokens;
 	node_id const m_target;
-	bool m_done:1;
 	bool m_got_peers:1;
 	bool m_noseeds:1;
 };
@@ -49,9 +49,13 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libtorrent/assert.hpp>
 #include <libtorrent/thread.hpp>
 #include <libtorrent/bloom_filter.hpp>
+#include <libtorrent/random.hpp>
+#include <libtorrent/time.hpp>
 
 #include <boost/cstdint.hpp>
 #include <boost/ref.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
 
 #include "libtorrent/socket.hpp"
 
@@ -102,20 +106,26 @@ bool TORRENT_EXTRA_EXPORT verify_message(lazy_entry const* msg, key_desc_t const
 struct peer_entry
 {
 	tcp::endpoint addr;
-	ptime added;
 	bool seed;
+	ptime added;
 };
 
 // this is a group. It contains a set of group members
 struct torrent_entry
 {
+	torrent_entry(): next_expiry(min_time()) {}
 	std::string name;
-	std::set<peer_entry> peers;
+	// kept sorted by address (see operator<)
+	std::vector<peer_entry> peers;
+	// the time this torrent is due in the expiry wheel,
+	// or min_time() if it isn't in it
+	ptime next_expiry;
 };
 
 struct dht_immutable_item
 {
-	dht_immutable_item() : value(0), num_announcers(0), size(0) {}
+	dht_immutable_item() : value(0), next_expiry(min_time())
+		, num_announcers(0), size(0) {}
 	// malloced space for the actual value
 	char* value;
 	// this counts the number of IPs we have seen
@@ -124,6 +134,9 @@ struct dht_immutable_item
 	bloom_filter<128> ips;
 	// the last time we heard about this
 	ptime last_seen;
+	// the time this item is due in the expiry wheel,
+	// or min_time() if it isn't in it
+	ptime next_expiry;
 	// number of IPs in the bloom filter
 	int num_announcers;
 	// size of malloced space pointed to by value
@@ -153,6 +166,93 @@ inline bool operator<(peer_entry const& lhs, peer_entry const& rhs)
 
 struct null_type {};
 
+// hashes the keys of the storage tables. They're picked by
+// whoever sends us the announces and puts, so the hash is keyed
+// with a random number. That makes it hard to pick a lot of
+// keys that land in the same bucket
+struct node_id_hash
+{
+	node_id_hash(): m_key(random()) {}
+	std::size_t operator()(node_id const& id) const
+	{
+		std::size_t seed = m_key;
+		boost::hash_range(seed, id.begin(), id.end());
+		return seed;
+	}
+private:
+	std::size_t m_key;
+};
+
+// keeps track of the keys in a storage table that have something
+// expiring, and when. Each slot covers a minute, so purging only
+// looks at the entries that are due, instead of walking the whole
+// table
+struct expiry_wheel
+{
+	expiry_wheel(): m_size(0), m_cursor(0), m_cursor_time(time_now()) {}
+
+	// the key is handed back by expired() once t has passed.
+	// A key may be handed back for an entry that has since been
+	// removed, or removed and added again. The entries remember
+	// when they're due, to tell those apart. t must be less than
+	// num_slots minutes from now
+	void add(ptime t, node_id const& key);
+
+	// appends the keys of all the slots that have passed to keys
+	void expired(ptime now, std::vector<node_id>& keys);
+
+	// the number of keys in the wheel, including the ones left
+	// over from entries that have been removed
+	int size() const { return m_size; }
+
+	// drops the keys left over from removed entries, and all but
+	// one copy of the keys that were added more than once. The
+	// remaining keys are scheduled again at the time expiry_of(key)
+	// returns, or dropped if it returns min_time(), meaning the
+	// entry is gone. The storage tables call this when the wheel
+	// grows past twice their limit, which bounds the wheel by
+	// the table size rather than by the rate entries come and go
+	template <class F>
+	void compact(F expiry_of)
+	{
+		std::vector<node_id> keys;
+		keys.swap(m_due);
+		for (int i = 0; i < num_slots; ++i)
+		{
+			keys.insert(keys.end(), m_slots[i].begin(), m_slots[i].end());
+			std::vector<node_id>().swap(m_slots[i]);
+		}
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+		m_size = 0;
+		for (std::vector<node_id>::iterator i = keys.begin()
+			, end(keys.end()); i != end; ++i)
+		{
+			ptime t = expiry_of(*i);
+			if (t == min_time()) continue;
+			add(t, *i);
+		}
+	}
+
+	enum { num_slots = 64 };
+
+private:
+	// moves the keys of the slots that have passed to m_due, so
+	// that the cursor is never more than a minute behind now
+	void advance(ptime now);
+
+	std::vector<node_id> m_slots[num_slots];
+	// keys whose slots have passed, but that haven't
+	// been handed back by expired() yet
+	std::vector<node_id> m_due;
+	// the number of keys in m_slots and m_due
+	int m_size;
+	// the slot that starts at m_cursor_time
+	int m_cursor;
+	ptime m_cursor_time;
+};
+
 class announce_observer : public observer
 {
 public:
@@ -164,22 +264,12 @@ public:
 	void reply(msg const&) { flags |= flag_done; }
 };
 
-struct count_peers
-{
-	int& count;
-	count_peers(int& c): count(c) {}
-	void operator()(std::pair<libtorrent::dht::node_id
-		, libtorrent::dht::torrent_entry> const& t)
-	{
-		count += t.second.peers.size();
-	}
-};
 	
 class TORRENT_EXTRA_EXPORT node_impl : boost::noncopyable
 {
-typedef std::map<node_id, torrent_entry> table_t;
-typedef std::map<node_id, dht_immutable_item> dht_immutable_table_t;
-typedef std::map<node_id, dht_mutable_item> dht_mutable_table_t;
+typedef boost::unordered_map<node_id, torrent_entry, node_id_hash> table_t;
+typedef boost::unordered_map<node_id, dht_immutable_item, node_id_hash> dht_immutable_table_t;
+typedef boost::unordered_map<node_id, dht_mutable_item, node_id_hash> dht_mutable_table_t;
 
 public:
 	typedef boost::function3<void, address, int, address> external_ip_fun;
@@ -201,12 +291,7 @@ public:
 	void incoming(msg const& m);
 
 	int num_torrents() const { return m_map.size(); }
-	int num_peers() const
-	{
-		int ret = 0;
-		std::for_each(m_map.begin(), m_map.end(), count_peers(ret));
-		return ret;
-	}
+	int num_peers() const { return m_num_peers; }
 
 	int bucket_size(int bucket);
 
@@ -271,6 +356,14 @@ protected:
 	bool lookup_torrents(sha1_hash const& target, entry& reply
 		, char* tags) const;
 
+	// removes the peers and items that have timed out
+	void expire_entries(ptime now);
+
+	// removes the torrents with the fewest peers until there are
+	// at most num_torrents of them and at most num_peers peers
+	void evict_torrents(int num_torrents, int num_peers
+		, sha1_hash const& keep);
+
 	dht_settings const& m_settings;
 	
 private:
@@ -295,6 +388,14 @@ private:
 	table_t m_map;
 	dht_immutable_table_t m_immutable_table;
 	dht_mutable_table_t m_mutable_table;
+
+	// when the peers in m_map and the items in
+	// m_immutable_table are up for expiry
+	expiry_wheel m_peer_expiry;
+	expiry_wheel m_item_expiry;
+
+	// the number of peers stored in m_map, across all torrents
+	int m_num_peers;
 	
 	ptime m_last_tracker_tick;
 
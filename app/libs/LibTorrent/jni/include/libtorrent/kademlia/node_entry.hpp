@@ -42,10 +42,12 @@ namespace libtorrent { namespace dht
 
 struct node_entry
 {
-	node_entry(node_id const& id_, udp::endpoint ep, bool pinged = false)
+	node_entry(node_id const& id_, udp::endpoint ep, bool pinged = false
+		, int roundtriptime = 0xffff)
 		: addr(ep.address())
 		, port(ep.port())
 		, timeout_count(pinged ? 0 : 0xffff)
+		, rtt(roundtriptime)
 		, id(id_)
 	{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
@@ -57,6 +59,7 @@ struct node_entry
 		: addr(ep.address())
 		, port(ep.port())
 		, timeout_count(0xffff)
+		, rtt(0xffff)
 		, id(0)
 	{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
@@ -66,6 +69,7 @@ struct node_entry
 
 	node_entry()
 		: timeout_count(0xffff)
+		, rtt(0xffff)
 		, id(0)
 	{
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
@@ -80,6 +84,13 @@ struct node_entry
 	void reset_fail_count() { if (pinged()) timeout_count = 0; }
 	udp::endpoint ep() const { return udp::endpoint(addr, port); }
 	bool confirmed() const { return timeout_count == 0; }
+	void update_rtt(int new_rtt)
+	{
+		if (new_rtt == 0xffff) return;
+		if (new_rtt > 0xfffe) new_rtt = 0xfffe;
+		if (rtt == 0xffff) rtt = new_rtt;
+		else rtt = int(rtt) * 2 / 3 + new_rtt / 3;
+	}
 
 	// TODO: replace with a union of address_v4 and address_v6
 	address addr;
@@ -87,6 +98,10 @@ struct node_entry
 	// the number of times this node has failed to
 	// respond in a row
 	boost::uint16_t timeout_count;
+	// the round trip time to this node in milliseconds,
+	// averaged over its last few responses. 0xffff means
+	// we haven't measured it yet
+	boost::uint16_t rtt;
 	node_id id;
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 	ptime first_seen;
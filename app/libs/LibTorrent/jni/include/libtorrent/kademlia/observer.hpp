@@ -109,6 +109,8 @@ struct observer : boost::noncopyable
 
 	ptime sent() const { return m_sent; }
 
+	traversal_algorithm* algorithm() const { return m_algorithm.get(); }
+
 	void set_target(udp::endpoint const& ep);
 	address target_addr() const;
 	udp::endpoint target_ep() const;
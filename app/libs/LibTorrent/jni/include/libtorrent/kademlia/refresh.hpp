@@ -69,6 +69,7 @@ public:
 
 protected:
 
+	virtual void init();
 	virtual void done();
 
 };
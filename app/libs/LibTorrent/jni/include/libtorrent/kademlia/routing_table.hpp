@@ -109,8 +109,9 @@ public:
 	// this function is called every time the node sees
 	// a sign of a node being alive. This node will either
 	// be inserted in the k-buckets or be moved to the top
-	// of its bucket.
-	bool node_seen(node_id const& id, udp::endpoint ep);
+	// of its bucket. rtt is the round trip time of the request
+	// the node responded to, in milliseconds, if it was a response
+	bool node_seen(node_id const& id, udp::endpoint ep, int rtt = 0xffff);
 
 	// this may add a node to the routing table and mark it as
 	// not pinged. If the bucket the node falls into is full,
@@ -150,6 +151,10 @@ public:
 
 	boost::tuple<int, int> size() const;
 	size_type num_global_nodes() const;
+
+	// the average round trip time to the live nodes we've
+	// measured it for, in milliseconds. -1 if there are none
+	int average_rtt() const;
 	
 	// returns true if there are no working nodes
 	// in the routing table
@@ -78,13 +78,32 @@ struct traversal_algorithm : boost::noncopyable
 
 	void add_entry(node_id const& id, udp::endpoint addr, unsigned char flags);
 
+	// the bounds of the short timeout, in milliseconds
+	enum { min_short_timeout = 250, max_short_timeout = 1000 };
+
+	// requests that haven't been responded to after this long get
+	// a short timeout, and another node is queried in their place.
+	// It's a few round trip times of the nodes in this lookup
+	time_duration short_timeout_limit() const;
+
 	traversal_algorithm(node_impl& node, node_id target);
 
 protected:
 
 	void add_requests();
 	void add_router_entries();
-	void init();
+	virtual void init();
+
+	// true when we've heard back from the closest nodes we
+	// need, or from all the nodes we've queried. Requests
+	// that are past their short timeout aren't waited for
+	bool lookup_complete() const;
+
+	// the number of requests to keep outstanding. This is the
+	// branch factor plus the stalled requests, raised by the
+	// share of the nodes we've queried that haven't responded
+	// in time
+	int current_branch_factor() const;
 
 	virtual void done();
 	// should construct an algorithm dependent
@@ -114,7 +133,19 @@ protected:
 	int m_branch_factor;
 	int m_responses;
 	int m_timeouts;
+	// the number of requests that have had a short timeout,
+	// and the number of those we're still waiting for
+	int m_short_timeouts;
+	int m_stalled;
 	int m_num_target_nodes;
+	// the average round trip time of the responses in this
+	// lookup, in milliseconds. Before the first response it's
+	// the average of the nodes in our routing table, and -1
+	// if we don't know any
+	int m_rtt;
+	// set once the lookup is done. Responses that arrive
+	// after that don't add nodes or send new requests
+	bool m_done;
 };
 
 } } // namespace libtorrent::dht
@@ -50,11 +50,15 @@ struct rc4 {
 
 void TORRENT_EXTRA_EXPORT rc4_init(const unsigned char* in, unsigned long len, rc4 *state);
 unsigned long TORRENT_EXTRA_EXPORT rc4_encrypt(unsigned char *out, unsigned long outlen, rc4 *state);
+unsigned long TORRENT_EXTRA_EXPORT rc4_encrypt_copy(const unsigned char *in, unsigned char *out
+	, unsigned long len, rc4 *state);
 #endif
 
 #include "libtorrent/peer_id.hpp" // For sha1_hash
 #include "libtorrent/assert.hpp"
 
+#include <cstring>
+
 namespace libtorrent
 {
 	class TORRENT_EXTRA_EXPORT dh_key_exchange
@@ -91,6 +95,9 @@ namespace libtorrent
 		virtual void set_outgoing_key(unsigned char const* key, int len) = 0;
 		virtual void encrypt(char* pos, int len) = 0;
 		virtual void decrypt(char* pos, int len) = 0;
+		// encrypts len bytes from src into dst, in a single pass over
+		// the data. src and dst must not overlap
+		virtual void encrypt_copy(char const* src, char* dst, int len) = 0;
 		virtual ~encryption_handler() {}
 	};
 
@@ -166,6 +173,26 @@ namespace libtorrent
 #endif
 		}
 
+		void encrypt_copy(char const* src, char* dst, int len)
+		{
+			TORRENT_ASSERT(len >= 0);
+			TORRENT_ASSERT(src && dst);
+
+			if (!m_encrypt)
+			{
+				std::memcpy(dst, src, len);
+				return;
+			}
+
+#ifdef TORRENT_USE_GCRYPT
+			gcry_cipher_encrypt(m_rc4_outgoing, dst, len, src, len);
+#elif defined TORRENT_USE_OPENSSL
+			RC4(&m_local_key, len, (const unsigned char*)src, (unsigned char*)dst);
+#else
+			rc4_encrypt_copy((const unsigned char*)src, (unsigned char*)dst, len, &m_rc4_outgoing);
+#endif
+		}
+
 		void decrypt(char* pos, int len)
 		{
 			if (!m_decrypt) return;
@@ -36,6 +36,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <ctime>
 #include <algorithm>
 #include <vector>
+#include <deque>
 #include <string>
 
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_ERROR_LOGGING
@@ -55,6 +56,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/cstdint.hpp>
 #include <boost/pool/pool.hpp>
 #include <boost/aligned_storage.hpp>
+#include <boost/asio/detail/handler_alloc_helpers.hpp>
 
 #ifdef _MSC_VER
 #pragma warning(pop)
@@ -79,6 +81,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/socket_type_fwd.hpp"
 #include "libtorrent/error_code.hpp"
 #include "libtorrent/sliding_average.hpp"
+#include "libtorrent/io_service.hpp"
 
 #ifdef TORRENT_STATS
 #include "libtorrent/aux_/session_impl.hpp"
@@ -354,6 +357,10 @@ namespace libtorrent
 		ptime connected_time() const { return m_connect; }
 		ptime last_received() const { return m_last_receive; }
 
+		// the time it took to establish the outgoing connection,
+		// in milliseconds. 0 if it's unknown
+		int rtt() const { return m_rtt; }
+
 		void on_timeout();
 		// this will cause this peer_connection to be disconnected.
 		virtual void disconnect(error_code const& ec, int error = 0);
@@ -491,6 +498,10 @@ namespace libtorrent
 		void send_not_interested();
 		void send_suggest(int piece);
 
+		// rejects the requests in the queue for the given piece.
+		// Used when we no longer have it
+		void reject_piece(int index);
+
 		void snub_peer();
 
 		bool can_request_time_critical() const;
@@ -558,8 +569,8 @@ namespace libtorrent
 		void log_buffer_usage(char* buffer, int size, char const* label);
 #endif
 
-		template <class Destructor>
-		void append_send_buffer(char* buffer, int size, Destructor const& destructor
+		void append_send_buffer(char* buffer, int size
+			, chained_buffer::free_buffer_fun destructor, void* userdata
 			, bool encrypted)
 		{
 #if defined TORRENT_DISK_STATS
@@ -570,11 +581,15 @@ namespace libtorrent
 			// encryption. bt_peer_connection overrides this function with
 			// its own version.
 			TORRENT_ASSERT(encrypted || type() != bittorrent_connection);
-			m_send_buffer.append_buffer(buffer, size, size, destructor);
+			m_send_buffer.append_buffer(buffer, size, size, destructor, userdata);
 		}
 
 		virtual void append_const_send_buffer(char const* buffer, int size);
 
+		// queues the payload of the block r to be sent from the
+		// storage with sendfile(), see write_piece_sendfile()
+		void append_sendfile_segment(peer_request const& r);
+
 #ifndef TORRENT_DISABLE_RESOLVE_COUNTRIES	
 		void set_country(char const* c)
 		{
@@ -644,6 +659,13 @@ namespace libtorrent
 		virtual void write_have(int index) = 0;
 		virtual void write_keepalive() = 0;
 		virtual void write_piece(peer_request const& r, disk_buffer_holder& buffer) = 0;
+		// like write_piece(), but the payload is left in the storage and
+		// sent from there by the disk thread. Only called if
+		// can_sendfile() returns true
+		virtual void write_piece_sendfile(peer_request const& r) { TORRENT_ASSERT(false); }
+		// returns true if the payload of piece messages is sent as it
+		// is, i.e. not encrypted
+		virtual bool plaintext_payload() const { return false; }
 		virtual void write_suggest(int piece) = 0;
 		
 		virtual void write_reject_request(peer_request const& r) = 0;
@@ -673,6 +695,19 @@ namespace libtorrent
 		}
 
 		std::pair<buffer::interval, buffer::interval> wr_recv_buffers(int bytes);
+
+		// asked on the main network thread when a read is issued on a
+		// network shard. If it returns true, the bytes the read receives
+		// are passed to decrypt_received() on the shard thread, before
+		// the completion is posted back, and received_decrypted() is
+		// true while they're passed to on_receive()
+		virtual bool decrypt_on_shard() const { return false; }
+
+		// runs on the shard thread. It may only touch state the main
+		// network thread leaves alone while a read is outstanding
+		virtual void decrypt_received(char* buf, int len) {}
+
+		bool received_decrypted() const { return m_recv_decrypted; }
 #endif
 		
 		buffer::const_interval receive_buffer() const
@@ -735,6 +770,12 @@ namespace libtorrent
 		// web seeds also has a limit on the queue size.
 		int m_max_out_request_queue;
 
+		// the number of outstanding requests we keep to this peer
+		// even before we know its download rate. Web seeds keep
+		// more than one range in flight from the start, so that the
+		// next range is requested before the current one is done
+		int m_min_out_request_queue;
+
 		// the average rate of receiving complete piece messages
 		sliding_average<20> m_piece_rate;
 		sliding_average<20> m_send_rate;
@@ -765,6 +806,9 @@ namespace libtorrent
 		std::pair<int, int> preferred_caching() const;
 		void fill_send_buffer();
 		void on_disk_read_complete(int ret, disk_io_job const& j, peer_request r);
+		bool can_sendfile() const;
+		void on_sendfile_complete(int ret, disk_io_job const& j, int socket);
+		void on_sendfile_writable(error_code const& error);
 		void on_disk_write_complete(int ret, disk_io_job const& j
 			, peer_request r, boost::shared_ptr<torrent> t);
 		int request_upload_bandwidth(
@@ -916,6 +960,11 @@ namespace libtorrent
 		// the piece requests
 		std::vector<int> m_requests_in_buffer;
 
+		// the blocks whose payload is queued in the send buffer as
+		// external segments, in send order. The front one is advanced
+		// as it's being sent
+		std::deque<peer_request> m_sendfile_segments;
+
 		// the block we're currently receiving. Or
 		// (-1, -1) if we're not receiving one
 		piece_block m_receiving_block;
@@ -974,6 +1023,17 @@ namespace libtorrent
 
 		int m_disk_recv_buffer_size;
 
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		// the buffers of the outstanding read, if it's to be decrypted
+		// on the network shard (see decrypt_on_shard())
+		buffer::interval m_shard_recv_buf[2];
+
+		// set on the shard thread once the bytes of the outstanding read
+		// are decrypted. Not a bitfield, since it's written by another
+		// thread than the flags next to it
+		bool m_recv_decrypted;
+#endif
+
 		// the number of bytes we are currently reading
 		// from disk, that will be added to the send
 		// buffer as soon as they complete
@@ -1056,7 +1116,7 @@ namespace libtorrent
 		
 		// the number of request we should queue up
 		// at the remote end.
-		boost::uint8_t m_desired_queue_size;
+		boost::uint16_t m_desired_queue_size;
 
 		// the number of piece requests we have rejected
 		// in a row because the peer is choked. This is
@@ -1234,10 +1294,14 @@ namespace libtorrent
 				handler(a0, a1, a2);
 			}
 
+			// operations that don't fit in the storage (such as ones
+			// wrapped in a network_thread_handler on a build with larger
+			// handlers than anticipated) fall back to the heap rather
+			// than overrunning it
 			friend void* asio_handler_allocate(
 			    std::size_t size, allocating_handler<Handler, Size>* ctx)
 			{
-				TORRENT_ASSERT(size <= Size);
+				if (size > Size) return ::operator new(size);
 #ifdef TORRENT_DEBUG
 				TORRENT_ASSERT(!ctx->storage.used);
 				ctx->storage.used = true;
@@ -1246,8 +1310,14 @@ namespace libtorrent
 			}
 
 			friend void asio_handler_deallocate(
-				void*, std::size_t, allocating_handler<Handler, Size>* ctx)
+				void* p, std::size_t size, allocating_handler<Handler, Size>* ctx)
 			{
+				if (size > Size)
+				{
+					TORRENT_ASSERT(p != &ctx->storage.bytes);
+					::operator delete(p);
+					return;
+				}
 #ifdef TORRENT_DEBUG
 				ctx->storage.used = false;
 #endif
@@ -1275,6 +1345,128 @@ namespace libtorrent
 			);
 		}
 
+		// when the socket belongs to one of the session's network shards
+		// (see session_settings::network_threads) its completion handlers
+		// are invoked on the shard's thread. This wrapper posts them back
+		// to the main network thread, where all peer and torrent state
+		// lives. The work object keeps the main io_service from running
+		// out of work while a completion is on its way over.
+		// The wrapped handler holds a reference to the peer_connection.
+		// It lives in a heap allocated holder shared by every copy of the
+		// wrapper and of the posted completion, and is only taken out of
+		// it and destroyed on the main network thread, when the completion
+		// runs. Copies left behind on the shard thread just refer to an
+		// empty holder, so the last reference to the peer can never be
+		// dropped there. The holder only destroys the handler itself if
+		// the operation is abandoned without ever completing, i.e. when
+		// the io_services are torn down.
+		// Allocations are forwarded to the wrapped handler, so the
+		// handler_storage of allocating_handler is still used for both
+		// the socket operation and the posted completion
+		template <class Handler>
+		struct network_thread_handler
+		{
+			struct holder : boost::noncopyable
+			{
+				holder(Handler const& h): handler(new Handler(h)) {}
+				~holder() { delete handler; }
+				Handler* handler;
+			};
+
+			network_thread_handler(Handler const& h, io_service& ios
+				, peer_connection* decrypt = 0)
+			  : m_holder(new holder(h))
+			  , m_decrypt(decrypt)
+			  , work(ios)
+			{}
+
+			struct completion
+			{
+				completion(boost::shared_ptr<holder> const& h
+					, error_code const& e, std::size_t n)
+				  : m_holder(h), ec(e), bytes_transferred(n) {}
+
+				void operator()()
+				{
+					TORRENT_ASSERT(m_holder->handler);
+					boost::scoped_ptr<Handler> h(m_holder->handler);
+					m_holder->handler = 0;
+					(*h)(ec, bytes_transferred);
+				}
+
+				friend void* asio_handler_allocate(
+					std::size_t size, completion* ctx)
+				{
+					return boost_asio_handler_alloc_helpers::allocate(
+						size, *ctx->m_holder->handler);
+				}
+
+				friend void asio_handler_deallocate(
+					void* p, std::size_t size, completion* ctx)
+				{
+					boost_asio_handler_alloc_helpers::deallocate(
+						p, size, *ctx->m_holder->handler);
+				}
+
+				boost::shared_ptr<holder> m_holder;
+				error_code ec;
+				std::size_t bytes_transferred;
+			};
+
+			void operator()(error_code const& ec, std::size_t bytes_transferred = 0) const
+			{
+#ifndef TORRENT_DISABLE_ENCRYPTION
+				if (m_decrypt && !ec) m_decrypt->shard_decrypt(bytes_transferred);
+#endif
+				work.get_io_service().post(completion(m_holder, ec, bytes_transferred));
+			}
+
+			friend void* asio_handler_allocate(
+				std::size_t size, network_thread_handler<Handler>* ctx)
+			{
+				return boost_asio_handler_alloc_helpers::allocate(
+					size, *ctx->m_holder->handler);
+			}
+
+			friend void asio_handler_deallocate(
+				void* p, std::size_t size, network_thread_handler<Handler>* ctx)
+			{
+				boost_asio_handler_alloc_helpers::deallocate(
+					p, size, *ctx->m_holder->handler);
+			}
+
+			boost::shared_ptr<holder> m_holder;
+			// if set, the received bytes are decrypted on the shard
+			// thread. See decrypt_on_shard()
+			peer_connection* m_decrypt;
+			mutable io_service::work work;
+		};
+
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		// decrypts the first 'bytes' of m_shard_recv_buf. Called on
+		// the network shard thread the read completed on
+		void shard_decrypt(std::size_t bytes);
+#endif
+
+		// true if m_socket is serviced by a network shard thread rather
+		// than the main network thread
+		bool on_network_shard() const;
+
+		// these initiate operations on m_socket, wrapping the handler in a
+		// network_thread_handler if the socket lives on a network shard
+		// if decrypt is true, the received bytes are decrypted on the
+		// shard thread (see decrypt_on_shard())
+		template <class Buffers, class Handler>
+		void socket_async_read_some(Buffers const& b, Handler const& h
+			, bool decrypt = false);
+		template <class Buffers, class Handler>
+		void socket_async_write_some(Buffers const& b, Handler const& h);
+		template <class Handler>
+		void socket_async_connect(tcp::endpoint const& ep, Handler const& h);
+		// waits for m_socket to become writable. Only for plain TCP
+		template <class Handler>
+		void socket_async_wait_writable(Handler const& h);
+
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 	public:
 		bool m_in_constructor:1;
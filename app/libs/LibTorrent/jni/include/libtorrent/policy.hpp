@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <algorithm>
 #include <deque>
+#include <vector>
 #include "libtorrent/string_util.hpp" // for allocate_string_copy
 
 #include "libtorrent/peer.hpp"
@@ -140,6 +141,7 @@ namespace libtorrent
 		void ip_filter_updated();
 
 		void set_seed(policy::peer* p, bool s);
+		void set_proven(policy::peer* p, bool v);
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		bool has_connection(const peer_connection* p);
@@ -148,24 +150,25 @@ namespace libtorrent
 		void check_invariant() const;
 #endif
 
-// intended struct layout (on 32 bit architectures)
+// intended struct layout (on 32 bit architectures, release builds)
 // offset size  alignment field
 // 0      8     4         prev_amount_upload, prev_amount_download
 // 8      4     4         connection
-// 12     2     2         last_optimistically_unchoked
-// 14     2     2         last_connected
-// 16     16    1         addr
-// 32     2     2         port
-// 34     2     2         upload_rate_limit
-// 36     2     2         download_rate_limit
-// 38     1     1         hashfails
-// 39     1     1         failcount, connectable, optimistically_unchoked, seed
-// 40     1     1         fast_reconnects, trust_points
-// 41     1     1         source, pe_support, is_v6_addr
-// 42     1     1         on_parole, banned, added_to_dht, supports_utp,
-//                        supports_holepunch, web_seed
-// 43     1     1         <padding>
-// 44
+// 12     2     2         inet_as
+// 14     2     2         last_optimistically_unchoked
+// 16     2     2         last_connected
+// 18     2     2         port
+// 20     2     2         upload_rate_limit
+// 22     2     2         download_rate_limit
+// 24     1     1         hashfails
+// 25     1     1         failcount, connectable, optimistically_unchoked, seed
+// 26     1     1         fast_reconnects, trust_points
+// 27     1     1         source, pe_support, is_v6_addr
+// 28     1     1         on_parole, banned, added_to_dht, supports_utp,
+//                        confirmed_supports_utp, supports_holepunch,
+//                        web_seed, proven
+// 29     3     4         candidate_index
+// 32                     addr (4 bytes in ipv4_peer, 16 in ipv6_peer)
 		struct TORRENT_EXTRA_EXPORT peer
 		{
 			peer(boost::uint16_t port, bool connectable, int src);
@@ -199,13 +202,10 @@ namespace libtorrent
 			peer_connection* connection;
 
 #ifndef TORRENT_DISABLE_GEO_IP
-#ifdef TORRENT_DEBUG
-			// only used in debug mode to assert that
-			// the first entry in the AS pair keeps the same
-			boost::uint16_t inet_as_num;
-#endif
-			// The AS this peer belongs to
-			std::pair<const int, int>* inet_as;
+			// The AS this peer belongs to. This is an index into
+			// the session's AS table (see session_impl::lookup_as()),
+			// or unknown_as
+			boost::uint16_t inet_as;
 #endif
 
 			// the time when this peer was optimistically unchoked
@@ -318,9 +318,25 @@ namespace libtorrent
 			// so, any peer with the web_seed bit set, is
 			// never considered a connect candidate
 			bool web_seed:1;
+			// this is set for peers that the resume data listed
+			// as having given us good download rates the last
+			// time the torrent was running. They are tried
+			// before other peers we haven't connected to yet
+			bool proven:1;
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 			bool in_use:1;
 #endif
+
+			// the position of this peer in the policy's
+			// heap of connect candidates, or not_a_candidate.
+			// It shares a word with the flags above
+			unsigned candidate_index:24;
+
+			enum
+			{
+				unknown_as = 0xffff,
+				not_a_candidate = 0xffffff
+			};
 		};
 
 		struct TORRENT_EXTRA_EXPORT ipv4_peer : peer
@@ -416,9 +432,27 @@ namespace libtorrent
 		bool has_peer(policy::peer const* p) const;
 
 		int num_seeds() const { return m_num_seeds; }
-		int num_connect_candidates() const { return m_num_connect_candidates; }
+		int num_connect_candidates() const { return m_candidates.size(); }
 		void recalculate_connect_candidates();
 
+		// clears the last connected time of all peers, to
+		// allow reconnecting to them right away
+		void reset_last_connected();
+
+		// sets the time we last connected to p
+		void set_last_connected(policy::peer* p, int session_time);
+
+		// steps the peers' timestamps back, when the session moves
+		// its clock forward to keep them from wrapping. Timestamps
+		// older than that are set to 0
+		void step_session_time(int seconds);
+
+		// recomputes the set of connect candidates from scratch,
+		// and their order. This must be called when something
+		// is_connect_candidate() or compare_peer() depend on has
+		// changed for all peers, such as the session settings
+		void rebuild_connect_candidates();
+
 		void erase_peer(policy::peer* p);
 		void erase_peer(iterator i);
 
@@ -432,7 +466,17 @@ namespace libtorrent
 		bool compare_peer(policy::peer const& lhs, policy::peer const& rhs
 			, address const& external_ip) const;
 
-		iterator find_connect_candidate(int session_time);
+		peer* find_connect_candidate(int session_time);
+
+		// adds p to, or removes p from, the connect candidate
+		// heap depending on whether it's a connect candidate.
+		// This must be called every time a peer is changed in
+		// a way that may affect is_connect_candidate() or
+		// compare_peer()
+		void update_connect_candidate(peer* p);
+		void remove_connect_candidate(peer* p);
+		void candidate_sift_up(int i);
+		void candidate_sift_down(int i);
 
 		bool is_connect_candidate(peer const& p, bool finished) const;
 		bool is_erase_candidate(peer const& p, bool finished) const;
@@ -454,21 +498,42 @@ namespace libtorrent
 		// if so, don't delete it.
 		peer* m_locked_peer;
 
-		// since the peer list can grow too large
-		// to scan all of it, start at this iterator
-		int m_round_robin;
+		// the peers in our peer list that are connect
+		// candidates. i.e. they're not already connected
+		// and they have not yet reached their max try
+		// count and they have the connectable state (we
+		// have a listen port for them). This is a binary
+		// heap ordered by compare_peer(), with the best
+		// candidate first. Each peer knows its position
+		// in it through candidate_index
+		std::vector<peer*> m_candidates;
+
+		// the external IP compare_peer() ranks the peers
+		// in m_candidates against. When we don't know our
+		// external IP, or when we're finished, this is a
+		// random address, to not favour any peers
+		address m_candidate_ip;
+
+		// the external IP of the session when m_candidates
+		// was last sorted. If it changes, the heap is rebuilt
+		address m_last_external_ip;
 
-		// The number of peers in our peer list
-		// that are connect candidates. i.e. they're
-		// not already connected and they have not
-		// yet reached their max try count and they
-		// have the connectable state (we have a listen
-		// port for them).
-		int m_num_connect_candidates;
+#ifndef TORRENT_DISABLE_GEO_IP
+		// the session's AS peak generation when m_candidates
+		// was last sorted. compare_peer() ranks peers by the
+		// download rate peak of their AS. Those change behind
+		// our back, so when the generation has moved on the
+		// heap is rebuilt before picking from it
+		boost::uint32_t m_as_peak_generation;
+#endif
 
 		// the number of seeds in the peer list
 		int m_num_seeds;
 
+		// the session time find_connect_candidate() last weeded
+		// the peer list at. It's done at most once a second
+		int m_last_erase_time;
+
 		// this was the state of the torrent the
 		// last time we recalculated the number of
 		// connect candidates. Since seeds (or upload
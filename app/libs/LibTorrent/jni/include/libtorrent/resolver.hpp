@@ -0,0 +1,127 @@
+/*
+
+Copyright (c) 2026, PopcornTV contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_RESOLVER_HPP_INCLUDED
+#define TORRENT_RESOLVER_HPP_INCLUDED
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/function/function2.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/socket.hpp"
+#include "libtorrent/address.hpp"
+#include "libtorrent/error_code.hpp"
+#include "libtorrent/io_service_fwd.hpp"
+#include "libtorrent/ptime.hpp"
+
+namespace libtorrent
+{
+
+// looks up host names on behalf of the whole session (trackers, web
+// seeds, the DHT routers) and remembers the answers for a while, so
+// that the torrents announcing to the same tracker don't each wait for
+// their own lookup. Lookups of a name that's already being looked up
+// don't start another one, they wait for the first one to complete.
+// Failed lookups are remembered too, but not for as long.
+// This is only meant to be used from the network thread
+class TORRENT_EXTRA_EXPORT resolver : public boost::noncopyable
+{
+public:
+	typedef boost::function<void(error_code const&
+		, std::vector<address> const&)> callback_t;
+
+	resolver(io_service& ios);
+
+	// the handler is always called from the io_service, never
+	// from within this call, even if the name is cached. If owner
+	// is set, the handler can be cancelled with cancel(owner)
+	void async_resolve(std::string const& host, callback_t const& h
+		, void const* owner = 0);
+
+	// calls the handlers of owner that are still waiting for a
+	// lookup with operation_aborted. The lookups themselves keep
+	// going, other handlers may be waiting for them
+	void cancel(void const* owner);
+
+	// starts looking up host, unless it's already cached or
+	// being looked up, in order for it to be cached by the
+	// time it's needed
+	void prefetch(std::string const& host);
+
+	// the number of seconds successful lookups are cached for.
+	// Failed ones are cached for a tenth of this, but at most a minute
+	void set_cache_timeout(int seconds);
+
+	int num_cached() const { return m_cache.size(); }
+
+	// the cache never holds more names than this
+	enum { max_cache_size = 700 };
+
+private:
+
+	void on_lookup(error_code const& ec, tcp::resolver::iterator i
+		, std::string host);
+
+	struct dns_cache_entry
+	{
+		ptime expires;
+		error_code error;
+		std::vector<address> addresses;
+	};
+
+	typedef std::map<std::string, dns_cache_entry> cache_t;
+	cache_t m_cache;
+
+	struct pending_handler
+	{
+		callback_t handler;
+		void const* owner;
+	};
+
+	// the handlers waiting for each lookup in progress. An empty
+	// list means the lookup is a prefetch nobody's waiting for yet
+	typedef std::map<std::string, std::vector<pending_handler> > pending_t;
+	pending_t m_pending;
+
+	io_service& m_ios;
+	tcp::resolver m_resolver;
+
+	int m_timeout;
+};
+
+}
+
+#endif // TORRENT_RESOLVER_HPP_INCLUDED
+
@@ -382,6 +382,12 @@ namespace libtorrent
 		void set_proxy(proxy_settings const& s);
 		proxy_settings proxy() const;
 
+		// starts looking up the host name in the background, so that
+		// it's in the session's host name cache by the time a tracker,
+		// web seed or proxy on that host is contacted. The trackers and
+		// web seeds of a torrent are looked up like this when it's added
+		void prefetch_hostname(std::string const& hostname);
+
 #ifdef TORRENT_STATS
 		void enable_stats_logging(bool s);
 #endif
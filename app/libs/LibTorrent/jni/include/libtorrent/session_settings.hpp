@@ -125,6 +125,12 @@ namespace libtorrent
 		// the tracker connection will be aborted
 		int tracker_maximum_response_length;
 
+		// the number of seconds a host name lookup is cached for.
+		// Trackers, web seeds and DHT routers are all looked up through
+		// this cache. Failed lookups are cached for a tenth of this,
+		// but at most a minute. 0 disables the cache
+		int resolver_cache_timeout;
+
 		// the number of seconds from a request is sent until
 		// it times out if no piece response is returned.
 		int piece_timeout;
@@ -171,9 +177,18 @@ namespace libtorrent
 		// expected to be more reliable.
 		int urlseed_timeout;
 		
-		// controls the pipelining size of url-seeds
+		// controls the pipelining size of url-seeds. For url seeds
+		// this is the number of ranges (of 1 MiB or a piece) that
+		// may be requested at a time. At least two are kept requested
+		// from the start
 		int urlseed_pipeline_size;
 
+		// the max number of connections to open to each url-seed.
+		// Each connection downloads different pieces, so this splits
+		// the wanted ranges across them. Additional connections are
+		// opened once the first one has connected
+		int urlseed_max_connections;
+
 		// time to wait until a new retry takes place
 		int urlseed_wait_retry;
 		
@@ -588,6 +603,22 @@ namespace libtorrent
 		// the checking rate to 1.6 MiB per second
 		int file_checks_delay_per_block;
 
+		// when checking files, the disk thread reads this many pieces
+		// ahead of the one it's identifying and has them hashed by the
+		// file_check_hash_threads while it reads the next ones. The
+		// same number of pieces beyond those are hinted to the OS to be
+		// read ahead (if use_disk_read_ahead is enabled). The pieces
+		// read ahead are held in disk buffers, so this costs up to this
+		// many pieces worth of memory. Set to 0 to read and hash one
+		// piece at a time. Pieces are only read ahead when
+		// optimize_hashing_for_speed is enabled
+		int file_checks_read_ahead;
+
+		// the number of threads hashing the pieces read while checking
+		// files (see file_checks_read_ahead). With 0, the disk thread
+		// hashes them itself
+		int file_check_hash_threads;
+
 		enum disk_cache_algo_t
 		{ lru, largest_contiguous, avoid_readback };
 
@@ -799,9 +830,30 @@ namespace libtorrent
 		// the max number of half-open TCP connections
 		int half_open_limit;
 
+		// when true, the number of half-open connections is adjusted
+		// automatically, up to half_open_limit. It's lowered when the
+		// share of connection attempts that get a response drops, or
+		// when the response time climbs, and raised while attempts are
+		// answered promptly. This finds a suitable limit on networks
+		// where it's not known up front, like behind a VPN or a proxy.
+		// Defaults to false, so the limit is fixed unless this is turned on
+		bool adaptive_half_open_limit;
+
 		// the max number of connections in the session
 		int connections_limit;
 
+		// the number of threads servicing peer sockets. With the default
+		// of 1, all network I/O happens on the main network thread. With
+		// more than one, new plain TCP peer connections are spread
+		// round-robin across that many threads (the main thread being one
+		// of them), which perform the socket reads and writes, and decrypt
+		// what encrypted bittorrent connections receive. All other peer,
+		// torrent, piece picker and bandwidth state is still only touched
+		// by the main network thread; completions are posted back to it.
+		// uTP, SSL and proxied connections always stay on the main thread.
+		// Lowering this setting only affects new connections
+		int network_threads;
+
 		// target delay, milliseconds
 		int utp_target_delay;
 
@@ -840,6 +892,14 @@ namespace libtorrent
 		// in half
 		int utp_loss_multiplier;
 
+		// when set, uTP sockets use LEDBAT++ instead of plain LEDBAT as
+		// their congestion controller. LEDBAT++ exits slow start early
+		// based on delay, backs off multiplicatively when above the
+		// target delay and periodically drops its window to re-measure
+		// the base delay, which avoids latecomer unfairness between
+		// uTP flows sharing a bottleneck
+		bool utp_ledbat_plus_plus;
+
 		enum bandwidth_mixed_algo_t
 		{
 			// disables the mixed mode bandwidth balancing
@@ -858,6 +918,15 @@ namespace libtorrent
 		// defaults to false
 		bool rate_limit_utp;
 
+		// the percentage of the session-wide (and TCP/uTP class) download
+		// rate limits that is reserved, every bandwidth round, for torrents
+		// that are streaming (i.e. have pieces with deadlines set). Peers of
+		// streaming torrents are assigned quota from this share first, and
+		// then compete with all other peers for whatever is left. The
+		// reservation only applies while a streaming torrent is actually
+		// waiting for bandwidth, and the overall limits always hold
+		int streaming_bandwidth_share;
+
 		// this is the number passed in to listen(). i.e.
 		// the number of connections to accept while we're
 		// not waiting in an accept() call.
@@ -914,6 +983,13 @@ namespace libtorrent
 		// ahead of time
 		bool use_disk_read_ahead;
 
+		// when set, blocks uploaded to unencrypted TCP peers are sent
+		// from the file to the socket with sendfile(), from the disk
+		// thread, instead of being read into a disk buffer and then
+		// written from there. Rate limits still apply. This only has an
+		// effect on platforms where TORRENT_USE_SENDFILE is set
+		bool use_sendfile;
+
 		// if set to true, files will be locked when opened.
 		// preventing any other process from modifying them
 		bool lock_files;
@@ -932,6 +1008,12 @@ namespace libtorrent
 
 		// when true, web seeds sending bad data will be banned
 		bool ban_web_seeds;
+
+		// the number of bytes of piece data a torrent using a volatile
+		// storage (ram_storage) may hold, including pieces that are
+		// still being downloaded. When it's exceeded, pieces furthest
+		// behind the playhead are dropped
+		int ram_storage_size;
 	};
 
 #ifndef TORRENT_DISABLE_DHT
@@ -945,7 +1027,9 @@ namespace libtorrent
 #endif
 			, max_fail_count(20)
 			, max_torrents(2000)
-			, max_dht_items(700)
+			, max_peers(100)
+			, max_total_peers(4000)
+			, max_dht_items(200)
 			, max_torrent_search_reply(20)
 			, restrict_routing_ips(true)
 			, restrict_search_ips(true)
@@ -969,10 +1053,26 @@ namespace libtorrent
 		// in a row before it is removed from the table.
 		int max_fail_count;
 
-		// this is the max number of torrents the DHT will track
+		// this is the max number of torrents the DHT will track.
+		// The timer wheel expiring their peers holds at most twice
+		// this many 20 byte keys (40 kB by default)
 		int max_torrents;
 
-		// max number of items the DHT will store
+		// the max number of peers the DHT will store per torrent.
+		// When a torrent is full, a new peer replaces the one that
+		// announced the longest time ago
+		int max_peers;
+
+		// the max number of peers the DHT will store across all
+		// torrents. A stored peer takes about 55 bytes, so this
+		// caps the peer storage at around 220 kB by default. When
+		// it's reached, the torrents with the fewest peers are removed
+		int max_total_peers;
+
+		// max number of items the DHT will store, of each kind
+		// (mutable and immutable). An item is at most 767 bytes.
+		// Immutable items are also expired through a timer wheel of
+		// at most twice this many 20 byte keys
 		int max_dht_items;
 
 		// the max number of torrents to return in a
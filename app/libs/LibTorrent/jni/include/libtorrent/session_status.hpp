@@ -79,6 +79,20 @@ namespace libtorrent
 		int num_connected;
 		int num_fin_sent;
 		int num_close_wait;
+
+		// the average number of packets received and sent per
+		// system call on the uTP socket. With recvmmsg() and
+		// sendmmsg() this may be greater than one
+		float packets_per_recv_call;
+		float packets_per_send_call;
+
+		// uTP packet buffer pool statistics. Of the
+		// packet_allocations made, packet_pool_hits were served
+		// from a free-list rather than a new slab or malloc().
+		// packets_outstanding is the number of buffers in use
+		size_type packet_allocations;
+		size_type packet_pool_hits;
+		int packets_outstanding;
 	};
 
 	struct TORRENT_EXPORT session_status
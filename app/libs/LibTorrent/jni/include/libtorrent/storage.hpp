@@ -34,6 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TORRENT_STORAGE_HPP_INCLUDE
 
 #include <vector>
+#include <deque>
 #include <sys/types.h>
 
 #ifdef _MSC_VER
@@ -63,6 +64,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/storage_defs.hpp"
 #include "libtorrent/allocator.hpp"
 #include "libtorrent/bitfield.hpp"
+#include "libtorrent/ptime.hpp"
 
 namespace libtorrent
 {
@@ -115,7 +117,20 @@ namespace libtorrent
 		virtual int readv(file::iovec_t const* bufs, int slot, int offset, int num_bufs, int flags = file::random_access);
 		virtual int writev(file::iovec_t const* bufs, int slot, int offset, int num_bufs, int flags = file::random_access);
 
-		virtual void hint_read(int slot, int offset, int len) {}
+		// flags are the file open flags the range will be read with,
+		// to avoid having the file re-opened in a different mode
+		virtual void hint_read(int slot, int offset, int len, int flags = file::random_access) {}
+
+#if TORRENT_USE_SENDFILE
+		// sends size bytes at slot and offset to the socket. Returns the
+		// number of bytes sent, which is short, or 0 with ec set to
+		// would_block, if the socket's send buffer fills up. Socket errors
+		// are reported through ec and file errors through set_error(),
+		// both returning -1. The default implementation copies the data
+		// through a disk buffer
+		virtual int sendfile(int socket, int slot, int offset, int size, error_code& ec);
+#endif
+
 		// negative return value indicates an error
 		virtual int read(char* buf, int slot, int offset, int size) = 0;
 
@@ -161,6 +176,17 @@ namespace libtorrent
 		// non-zero return value indicates an error
 		virtual bool delete_files() = 0;
 
+		// returns true if this storage only keeps a bounded number of
+		// pieces (see ram_storage). The torrent will then drop pieces it
+		// has, behind the playhead, to stay within
+		// session_settings::ram_storage_size
+		virtual bool is_volatile() const { return false; }
+
+		// frees the data stored in the given slot. This is called from
+		// the disk thread when the torrent drops a piece from a
+		// volatile storage (see piece_manager::async_drop_piece)
+		virtual void drop_slot(int slot) {}
+
 #ifndef TORRENT_NO_DEPRECATE
 		virtual void finalize_file(int file) {}
 #endif
@@ -202,7 +228,10 @@ namespace libtorrent
 		int read(char* buf, int slot, int offset, int size);
 		int write(char const* buf, int slot, int offset, int size);
 		int sparse_end(int start) const;
-		void hint_read(int slot, int offset, int len);
+		void hint_read(int slot, int offset, int len, int flags = file::random_access);
+#if TORRENT_USE_SENDFILE
+		int sendfile(int socket, int slot, int offset, int size, error_code& ec);
+#endif
 		int readv(file::iovec_t const* bufs, int slot, int offset, int num_bufs, int flags = file::random_access);
 		int writev(file::iovec_t const* buf, int slot, int offset, int num_bufs, int flags = file::random_access);
 		size_type physical_offset(int slot, int offset);
@@ -237,6 +266,10 @@ namespace libtorrent
 
 		file_storage const& files() const { return m_mapped_files?*m_mapped_files:m_files; }
 
+		// returns the file the torrent offset 'offset' is in, and
+		// sets file_offset to the offset within that file
+		file_storage::iterator file_at(size_type offset, size_type& file_offset) const;
+
 		boost::scoped_ptr<file_storage> m_mapped_files;
 		file_storage const& m_files;
 
@@ -262,6 +295,82 @@ namespace libtorrent
 		bool m_allocate_files;
 	};
 
+#if TORRENT_USE_MMAP
+	// this storage lays out files exactly like default_storage, but
+	// reads go through shared memory mappings of the files instead of
+	// pread(). Writes still use pwrite(), so that running out of disk
+	// space is an error rather than a SIGBUS. Once a region of a file is mapped,
+	// reading from it is a page cache lookup without a system call.
+	// Each open file keeps one window mapped, so the number of mappings
+	// is bounded by the file pool size. Select it per torrent by setting
+	// add_torrent_params::storage to mmap_storage_constructor
+	class TORRENT_EXPORT mmap_storage : public default_storage
+	{
+	public:
+		mmap_storage(file_storage const& fs, file_storage const* mapped, std::string const& path
+			, file_pool& fp, std::vector<boost::uint8_t> const& file_prio);
+
+		int readv(file::iovec_t const* bufs, int slot, int offset, int num_bufs, int flags = file::random_access);
+		int writev(file::iovec_t const* buf, int slot, int offset, int num_bufs, int flags = file::random_access);
+	};
+#endif
+
+	// this storage keeps pieces in memory only and never touches the
+	// disk. It's meant for streaming content that won't be seeded
+	// afterwards. Since it's volatile, the torrent bounds the number of
+	// pieces it has to session_settings::ram_storage_size and drops the
+	// ones furthest behind the playhead, then the ones furthest ahead of
+	// it. Dropped pieces are not requested from peers until the playhead
+	// gets close to them again (see torrent::hold_off_piece), and
+	// reading them fails with errors::piece_dropped. Resume data is
+	// never accepted for this storage.
+	// All piece buffers, including the ones of pieces that are still
+	// being downloaded, count towards ram_storage_size. A write that
+	// would need a new buffer past that limit fails with
+	// not_enough_memory. The torrent drops the block without blaming the
+	// peer, makes room by dropping the pieces furthest from the
+	// playhead, and stops requesting the piece if it's too far ahead
+	// (see torrent::on_volatile_storage_full)
+	class TORRENT_EXPORT ram_storage : public storage_interface, boost::noncopyable
+	{
+	public:
+		ram_storage(file_storage const& fs);
+		~ram_storage();
+
+		bool has_any_file() { return false; }
+		bool rename_file(int index, std::string const& new_filename) { return false; }
+		bool release_files() { return false; }
+		bool delete_files();
+		bool initialize(bool allocate_files);
+		bool move_storage(std::string const& save_path) { return false; }
+		int read(char* buf, int slot, int offset, int size);
+		int write(char const* buf, int slot, int offset, int size);
+		size_type physical_offset(int slot, int offset);
+		int readv(file::iovec_t const* bufs, int slot, int offset, int num_bufs, int flags = file::random_access);
+		int writev(file::iovec_t const* bufs, int slot, int offset, int num_bufs, int flags = file::random_access);
+		bool move_slot(int src_slot, int dst_slot);
+		bool swap_slots(int slot1, int slot2);
+		bool swap_slots3(int slot1, int slot2, int slot3);
+		bool verify_resume_data(lazy_entry const& rd, error_code& error);
+		bool write_resume_data(entry& rd) const { return false; }
+		bool is_volatile() const { return true; }
+		void drop_slot(int slot);
+
+	private:
+
+		// frees the buffer of the given slot, if it has one
+		void free_slot(int slot);
+
+		file_storage const& m_files;
+
+		// one buffer per slot, or 0 if we don't hold any data for it.
+		// Buffers are allocated the first time a slot is written to
+		std::vector<char*> m_pieces;
+
+		// the number of bytes allocated by the buffers in m_pieces
+		size_type m_allocated;
+	};
+
 	// this storage implementation does not write anything to disk
 	// and it pretends to read, and just leaves garbage in the buffers
 	// this is useful when simulating many clients on the same machine
@@ -327,11 +436,23 @@ namespace libtorrent
 		void async_rename_file(int index, std::string const& name
 			, boost::function<void(int, disk_io_job const&)> const& handler);
 
+		// if a deadline is specified, the read is a playback read
+		// and is served ahead of the regular disk job queue
 		void async_read(
 			peer_request const& r
 			, boost::function<void(int, disk_io_job const&)> const& handler
 			, int cache_line_size = 0
-			, int cache_expiry = 0);
+			, int cache_expiry = 0
+			, ptime deadline = min_time());
+
+#if TORRENT_USE_SENDFILE
+		// sends the requested block straight from the storage to the
+		// socket. The handler is called with the number of bytes sent
+		void async_sendfile(
+			peer_request const& r
+			, int socket
+			, boost::function<void(int, disk_io_job const&)> const& handler);
+#endif
 
 		void async_read_and_hash(
 			peer_request const& r
@@ -348,7 +469,10 @@ namespace libtorrent
 			, disk_buffer_holder& buffer
 			, boost::function<void(int, disk_io_job const&)> const& f);
 
-		void async_hash(int piece, boost::function<void(int, disk_io_job const&)> const& f);
+		// if a deadline is specified, the piece is time critical and
+		// is hashed ahead of unrelated jobs in the disk job queue
+		void async_hash(int piece, boost::function<void(int, disk_io_job const&)> const& f
+			, ptime deadline = min_time());
 
 		void async_release_files(
 			boost::function<void(int, disk_io_job const&)> const& handler
@@ -360,6 +484,12 @@ namespace libtorrent
 			boost::function<void(int, disk_io_job const&)> const& handler
 			= boost::function<void(int, disk_io_job const&)>());
 
+		// frees the data of the given piece in a volatile storage,
+		// and evicts it from the read cache. See storage_interface::drop_slot
+		void async_drop_piece(int piece
+			, boost::function<void(int, disk_io_job const&)> const& handler
+			= boost::function<void(int, disk_io_job const&)>());
+
 		void async_delete_files(
 			boost::function<void(int, disk_io_job const&)> const& handler
 			= boost::function<void(int, disk_io_job const&)>());
@@ -439,6 +569,11 @@ namespace libtorrent
 			, int offset
 			, int num_bufs);
 
+#if TORRENT_USE_SENDFILE
+		int sendfile_impl(int socket, int piece_index, int offset, int size
+			, error_code& ec);
+#endif
+
 		int write_impl(
 			file::iovec_t* bufs
 			, int piece_index
@@ -448,10 +583,28 @@ namespace libtorrent
 		size_type physical_offset(int piece_index, int offset);
 
 		// returns the number of pieces left in the
-		// file currently being checked
-		int skip_file() const;
+		// file slot is in, starting at slot
+		int skip_file(int slot) const;
+		int skip_file() const { return skip_file(m_current_slot); }
 		// -1=error 0=ok >0=skip this many pieces
 		int check_one_piece(int& have_piece);
+
+		// issues read-ahead hints for file_checks_read_ahead slots
+		// starting at 'start' while checking
+		void hint_check_read_ahead(int start);
+		// while checking, reads the slots following m_current_slot,
+		// up to file_checks_read_ahead of them, into m_check_queue and
+		// has the hash threads hash them. Slots beyond those are hinted
+		// to the OS to be read ahead
+		void fill_check_queue();
+		// takes the hash of m_current_slot from m_check_queue, waiting
+		// for it to be hashed. Returns the number of bytes read from
+		// the slot, and restores the storage error the read failed with
+		int hash_checked_slot(sha1_hash& large_hash, sha1_hash& small_hash);
+		// called when the slots are moved around or the check starts over,
+		// the data read ahead is stale then
+		void clear_check_queue();
+		bool use_check_queue() const;
 		int identify_data(
 			sha1_hash const& large_hash
 			, sha1_hash const& small_hash
@@ -461,6 +614,7 @@ namespace libtorrent
 		sha1_hash hash_for_piece_impl(int piece, int* readback = 0);
 
 		int release_files_impl() { return m_storage->release_files(); }
+		void drop_piece_impl(int piece);
 		int delete_files_impl() { return m_storage->delete_files(); }
 		int rename_file_impl(int index, std::string const& new_filename)
 		{ return m_storage->rename_file(index, new_filename); }
@@ -520,6 +674,17 @@ namespace libtorrent
 			state_expand_pieces
 		} m_state;
 		int m_current_slot;
+		// while checking, all slots below this one have had
+		// read-ahead hints issued for them
+		int m_check_read_ahead;
+
+		// the slots read ahead of m_current_slot while checking, in
+		// order. Whatever hasn't been hashed yet is shared with the
+		// hash threads (see fill_check_queue())
+		struct check_slot;
+		std::deque<boost::shared_ptr<check_slot> > m_check_queue;
+		// the next slot to read into m_check_queue
+		int m_check_next_read;
 		// used during check. If any piece is found
 		// that is not in its final position, this
 		// is set to true
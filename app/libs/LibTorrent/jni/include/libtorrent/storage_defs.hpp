@@ -61,6 +61,16 @@ namespace libtorrent
 		file_storage const&, file_storage const* mapped, std::string const&, file_pool&
 		, std::vector<boost::uint8_t> const&);
 
+#if TORRENT_USE_MMAP
+	TORRENT_EXPORT storage_interface* mmap_storage_constructor(
+		file_storage const&, file_storage const* mapped, std::string const&, file_pool&
+		, std::vector<boost::uint8_t> const&);
+#endif
+
+	TORRENT_EXPORT storage_interface* ram_storage_constructor(
+		file_storage const&, file_storage const* mapped, std::string const&, file_pool&
+		, std::vector<boost::uint8_t> const&);
+
 	TORRENT_EXPORT storage_interface* disabled_storage_constructor(
 		file_storage const&, file_storage const* mapped, std::string const&, file_pool&
 		, std::vector<boost::uint8_t> const&);
@@ -38,6 +38,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <set>
 #include <list>
 #include <deque>
+#include <map>
 
 #ifdef _MSC_VER
 #pragma warning(push, 1)
@@ -193,6 +194,7 @@ namespace libtorrent
 			boost::shared_array<char> piece_data;
 			int blocks_left;
 			bool fail;
+			error_code error;
 		};
 		void read_piece(int piece);
 		void on_disk_read_complete(int ret, disk_io_job const& j, peer_request r, read_piece_struct* rp);
@@ -221,6 +223,12 @@ namespace libtorrent
 		void set_sequential_download(bool sd);
 		bool is_sequential_download() const
 		{ return m_sequential_download; }
+
+		// a torrent is streaming while it has pieces with deadlines.
+		// Its peers are served from the reserved streaming share of
+		// the download rate limits first
+		bool is_streaming() const
+		{ return !m_time_critical_pieces.empty(); }
 	
 		void queue_up();
 		void queue_down();
@@ -305,6 +313,7 @@ namespace libtorrent
 
 		void set_piece_deadline(int piece, int t, int flags);
 		void reset_piece_deadline(int piece);
+		void clear_piece_deadlines();
 		void update_piece_priorities();
 
 		void status(torrent_status* st, boost::uint32_t flags);
@@ -510,6 +519,48 @@ namespace libtorrent
 		// only once per piece
 		void we_have(int index);
 
+		// called when a piece we had is no longer available in
+		// the storage. It will be downloaded again
+		void we_dont_have(int index);
+
+		// the piece the user is currently consuming. This is the
+		// most urgent time critical piece, or the last piece read
+		// with read_piece(), or the first piece we don't have
+		int playhead_piece() const;
+
+		// when the storage is volatile, drop the pieces furthest
+		// behind the playhead until we're within ram_storage_size.
+		// If there are none, the pieces furthest ahead of it are
+		// dropped, as long as they have priority 0 or are beyond the
+		// window release_held_off_pieces() gives back. Dropped pieces
+		// are held off, so they're not downloaded again right away.
+		// The piece 'keep' (which we just got) is never dropped
+		void trim_volatile_pieces(int keep);
+
+		// held off pieces are not requested from peers, until the
+		// playhead gets close to them. Unlike setting their priority
+		// to 0, this doesn't change what the user asked for, and the
+		// torrent is not finished while they're missing
+		void hold_off_piece(int index);
+		bool is_held_off(int index) const
+		{ return m_held_off_pieces.count(index) > 0; }
+		bool has_held_off_pieces() const
+		{ return !m_held_off_pieces.empty(); }
+
+		// clears the bits of the held off pieces in 'pieces'
+		void mask_held_off_pieces(bitfield& pieces) const;
+
+		// called when a block of 'piece' couldn't be written because
+		// the volatile storage is full. Makes room if it can, and holds
+		// off downloading the piece if it's too far ahead of the
+		// playhead to be kept
+		void on_volatile_storage_full(int piece);
+
+		// lets the pieces trim_volatile_pieces() dropped be requested
+		// again, once the playhead has moved back to within
+		// ram_storage_size of them
+		void release_held_off_pieces();
+
 		int num_have() const
 		{
 			return has_picker()
@@ -596,25 +647,42 @@ namespace libtorrent
 
 		// this is the asio callback that is called when a name
 		// lookup for a PEER is completed.
-		void on_peer_name_lookup(error_code const& e, tcp::resolver::iterator i
-			, peer_id pid);
+		void on_peer_name_lookup(error_code const& e
+			, std::vector<address> const& host, int port, peer_id pid);
+
+		// starts looking up the host names of the trackers and
+		// web seeds, to have them cached by the time they're needed.
+		// Does nothing when a SOCKS5 proxy resolves host names, and
+		// skips i2p hosts
+		void prefetch_hostnames();
 
 		// this is the asio callback that is called when a name
 		// lookup for a WEB SEED is completed.
-		void on_name_lookup(error_code const& e, tcp::resolver::iterator i
-			, std::list<web_seed_entry>::iterator url, tcp::endpoint proxy);
+		void on_name_lookup(error_code const& e, std::vector<address> const& host
+			, std::list<web_seed_entry>::iterator url, tcp::endpoint proxy, int port);
 
 		void connect_web_seed(std::list<web_seed_entry>::iterator web, tcp::endpoint a);
 
 		// this is the asio callback that is called when a name
 		// lookup for a proxy for a web seed is completed.
-		void on_proxy_name_lookup(error_code const& e, tcp::resolver::iterator i
-			, std::list<web_seed_entry>::iterator url);
+		void on_proxy_name_lookup(error_code const& e, std::vector<address> const& host
+			, std::list<web_seed_entry>::iterator url, int proxy_port);
 
 		// remove a web seed, or schedule it for removal in case there
 		// are outstanding operations on it
 		void remove_web_seed(std::list<web_seed_entry>::iterator web);
 
+		// returns the web seed the connection p belongs to, and
+		// sets pi to the peer_info field it's using
+		std::list<web_seed_entry>::iterator find_web_seed(
+			peer_connection const* p, policy::peer** pi = 0);
+
+		// returns true if we should open another connection to this
+		// web seed. Additional connections are only opened once the
+		// ones we have are connected, not to pile up connection
+		// attempts to a server that isn't responding
+		bool want_web_seed_connection(web_seed_entry const& web) const;
+
 		// this is called when the torrent has finished. i.e.
 		// all the pieces we have not filtered have been downloaded.
 		// If no pieces are filtered, this is called first and then
@@ -878,6 +946,10 @@ namespace libtorrent
 
 		void on_tracker_announce();
 
+		// connects to a few peers right away, instead of waiting
+		// for the next session tick, if m_need_connect_boost is set
+		void do_connect_boost();
+
 #ifndef TORRENT_DISABLE_DHT
 		static void on_dht_announce_response_disp(boost::weak_ptr<torrent> t
 			, std::vector<tcp::endpoint> const& peers);
@@ -976,7 +1048,9 @@ namespace libtorrent
 		// this torrent belongs to.
 		aux::session_impl& m_ses;
 
-		// used to resolve hostnames for web seeds
+		// used for the country lookups of peers. Trackers, web seeds
+		// and peer host names are looked up through the session's
+		// cache instead
 		mutable tcp::resolver m_host_resolver;
 
 		std::vector<boost::uint8_t> m_file_priority;
@@ -1099,6 +1173,14 @@ namespace libtorrent
 		// monotonically increasing number for each added torrent
 		int m_sequence_number;
 
+		// the last piece requested through read_piece(), or -1.
+		// See playhead_piece()
+		int m_last_read_piece;
+
+		// the pieces dropped from volatile storage, or held off because
+		// it was full. See hold_off_piece()
+		std::set<int> m_held_off_pieces;
+
 		// ==============================
 		// The following members are specifically
 		// ordered to make the 24 bit members
@@ -1309,11 +1391,11 @@ namespace libtorrent
 		// before actually closing all connections
 		bool m_graceful_pause_mode:1;
 
-		// this is set to true when the torrent starts up
-		// The first tracker response, when this is true,
+		// this is set to true when the torrent starts up, and
+		// when it announces while it doesn't have any peers.
+		// The first tracker or DHT response, when this is true,
 		// will attempt to connect to a bunch of peers immediately
-		// and set this to false. We only do this once to get
-		// the torrent kick-started
+		// and set this to false, to get the torrent kick-started
 		bool m_need_connect_boost:1;
 
 		// rotating sequence number for LSD announces sent out.
@@ -187,6 +187,8 @@ namespace libtorrent
 		enum deadline_flags { alert_when_available = 1 };
 		void set_piece_deadline(int index, int deadline, int flags = 0) const;
 		void reset_piece_deadline(int index) const;
+		// removes the deadlines of all pieces
+		void clear_piece_deadlines() const;
 
 		void set_priority(int prio) const;
 		
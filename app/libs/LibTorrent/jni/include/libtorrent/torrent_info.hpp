@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <string>
 #include <vector>
+#include <deque>
 
 #ifdef _MSC_VER
 #pragma warning(push, 1)
@@ -106,6 +107,14 @@ namespace libtorrent
 		// no announces before this time
 		ptime min_announce;
 
+		// the time the last announce was sent to this tracker
+		ptime announce_sent;
+
+		// the number of milliseconds it took this tracker to
+		// respond to the last announce. -1 if it hasn't responded
+		// yet. Announces go to faster trackers first
+		int response_time;
+
 		// the tier this tracker belongs to
 		boost::uint8_t tier;
 
@@ -216,6 +225,12 @@ namespace libtorrent
 		// it's also used to hold the peer_connection
 		// pointer, when the web seed is connected
 		policy::peer peer_info;
+
+		// the peer_info fields of the additional connections
+		// to this web seed, when more than one is allowed
+		// (urlseed_max_connections). It's a deque since the
+		// connections hold pointers to these
+		std::deque<policy::peer> extra_peer_info;
 	};
 
 #ifndef BOOST_NO_EXCEPTIONS
@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <vector>
 #include <string>
+#include <list>
 #include <utility>
 #include <ctime>
 
@@ -40,8 +40,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/buffer.hpp"
 #include "libtorrent/thread.hpp"
 #include "libtorrent/deadline_timer.hpp"
+#include "libtorrent/size_type.hpp"
 
 #include <deque>
+#include <vector>
+#include <boost/function/function2.hpp>
 #include <boost/function/function4.hpp>
 
 namespace libtorrent
@@ -55,11 +58,16 @@ namespace libtorrent
 			, udp::endpoint const&, char const* buf, int size)> callback_t;
 		typedef boost::function<void(error_code const& ec
 			, char const*, char const* buf, int size)> callback2_t;
+		typedef boost::function<void(error_code const& ec
+			, udp::endpoint const&)> send_error_callback_t;
 
 		udp_socket(io_service& ios, callback_t const& c, callback2_t const& c2, connection_queue& cc);
 		~udp_socket();
 
-		enum flags_t { dont_drop = 1, peer_connection = 2 };
+		// batch means the packet may be held back and sent
+		// together with others at the end of the current
+		// event loop turn (using sendmmsg() where available)
+		enum flags_t { dont_drop = 1, peer_connection = 2, batch = 4 };
 
 		bool is_open() const
 		{
@@ -75,6 +83,17 @@ namespace libtorrent
 		void send_hostname(char const* hostname, int port, char const* p, int len, error_code& ec);
 
 		void send(udp::endpoint const& ep, char const* p, int len, error_code& ec, int flags = 0);
+#if TORRENT_USE_MMSG
+		// sends the packets queued with the batch flag right away
+		void flush_batch();
+
+		// a packet sent with the batch flag may fail after send()
+		// has returned. The error and the packet's destination are
+		// reported to this handler. It's called from the io_service,
+		// never from within send() or flush_batch()
+		void set_send_error_handler(send_error_callback_t const& h)
+		{ m_send_error_callback = h; }
+#endif
 		void bind(udp::endpoint const& ep, error_code& ec);
 		void bind(int port);
 		void close();
@@ -110,6 +129,13 @@ namespace libtorrent
 
 		udp::endpoint proxy_addr() const { return m_proxy_addr; }
 
+		// the average number of packets received and sent
+		// per system call
+		float packets_per_recv_call() const
+		{ return m_recv_calls == 0 ? 0.f : float(m_packets_in) / m_recv_calls; }
+		float packets_per_send_call() const
+		{ return m_send_calls == 0 ? 0.f : float(m_packets_out) / m_send_calls; }
+
 	protected:
 
 		struct queued_packet
@@ -144,7 +170,9 @@ namespace libtorrent
 		// name as source
 		callback2_t m_callback2;
 
+		void setup_read(udp::socket* s);
 		void on_read(udp::socket* sock, error_code const& e, std::size_t bytes_transferred);
+		void dispatch_packet(udp::endpoint const& ep, char* buf, int size);
 		void on_name_lookup(error_code const& e, tcp::resolver::iterator i);
 		void on_timeout();
 		void on_connect(int ticket);
@@ -160,6 +188,21 @@ namespace libtorrent
 
 		void drain_queue();
 
+#if TORRENT_USE_MMSG
+		void on_read_ready(udp::socket* s, error_code const& e);
+		void read_batch(udp::socket* s);
+		void on_flush_batch();
+
+		enum { batch_size = 32, max_batched_packet = 1500 };
+
+		struct batched_packet
+		{
+			udp::endpoint ep;
+			int len;
+			char buf[max_batched_packet];
+		};
+#endif
+
 		void wrap(udp::endpoint const& ep, char const* p, int len, error_code& ec);
 		void wrap(char const* hostname, int port, char const* p, int len, error_code& ec);
 		void unwrap(error_code const& e, char const* buf, int size);
@@ -241,6 +284,36 @@ namespace libtorrent
 		// operations hanging on this socket
 		int m_outstanding_ops;
 
+#if TORRENT_USE_MMSG
+		// packets sent with the batch flag are queued here
+		// and sent with sendmmsg() by flush_batch(), which is
+		// posted to run after the handlers already queued
+		// on the io_service. Allocated on first use
+		batched_packet* m_send_batch;
+		int m_num_batched;
+		bool m_flush_posted;
+
+		// the batched packets that failed to send, waiting to be
+		// reported to m_send_error_callback by on_flush_batch()
+		send_error_callback_t m_send_error_callback;
+		std::vector<std::pair<udp::endpoint, error_code> > m_send_errors;
+
+		// batch_size receive buffers for recvmmsg(), laid out
+		// back to back. Allocated on first use
+		char* m_recv_batch;
+		int m_recv_batch_size;
+
+		// cleared if the kernel turns out not to support
+		// recvmmsg() or sendmmsg()
+		bool m_mmsg_supported;
+#endif
+
+		// used to report the number of packets per system call
+		size_type m_packets_in;
+		size_type m_recv_calls;
+		size_type m_packets_out;
+		size_type m_send_calls;
+
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		bool m_started;
 		int m_magic;
@@ -250,6 +323,7 @@ namespace libtorrent
 		int m_outstanding_resolve;
 		int m_outstanding_connect_queue;
 		int m_outstanding_socks;
+		int m_outstanding_flush;
 #endif
 	};
 
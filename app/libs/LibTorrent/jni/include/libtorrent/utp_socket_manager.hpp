@@ -34,6 +34,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TORRENT_UTP_SOCKET_MANAGER_HPP_INCLUDED
 
 #include <map>
+#include <vector>
+#include <boost/noncopyable.hpp>
 
 #include "libtorrent/socket_type.hpp"
 #include "libtorrent/session_status.hpp"
@@ -47,6 +49,66 @@ namespace libtorrent
 
 	typedef boost::function<void(boost::shared_ptr<socket_type> const&)> incoming_utp_callback_t;
 
+	// allocator for uTP packet buffers. Buffers are carved out of
+	// larger slabs and recycled through one free-list per size
+	// class, rather than going through malloc() and free() for
+	// every packet sent, received and ACKed. Requests larger than
+	// the largest size class fall back to malloc()
+	struct packet_pool : boost::noncopyable
+	{
+		packet_pool();
+		~packet_pool();
+
+		void* allocate(int size);
+		void free(void* p);
+
+		// returns slabs that don't have any buffers in use to
+		// the system, if more than max_free bytes are idle
+		void trim(int max_free);
+
+		// fills in the packet_* fields
+		void get_status(utp_status& s) const;
+
+	private:
+
+		enum { num_size_classes = 3, slab_size = 32 * 1024 };
+
+		struct slab;
+
+		// every buffer is preceded by this header. The union
+		// keeps the buffer itself 8 byte aligned
+		union block_header
+		{
+			// the slab the buffer belongs to, or 0
+			// if it was allocated with malloc()
+			slab* owner;
+			double align;
+		};
+
+		struct slab
+		{
+			int size_class;
+			int num_blocks;
+			int in_use;
+			block_header align;
+		};
+
+		int block_size(int size_class) const;
+
+		// singly linked lists of free buffers, one per size
+		// class. The link is stored in the buffer itself
+		void* m_free[num_size_classes];
+		int m_num_free[num_size_classes];
+
+		std::vector<slab*> m_slabs;
+
+		// the number of allocations, the number of them served
+		// from a free-list and the number of buffers in use
+		size_type m_allocations;
+		size_type m_hits;
+		int m_outstanding;
+	};
+
 	struct utp_socket_manager
 	{
 		utp_socket_manager(session_settings const& sett, udp_socket& s, incoming_utp_callback_t cb);
@@ -67,6 +129,10 @@ namespace libtorrent
 		void send_packet(udp::endpoint const& ep, char const* p, int len
 			, error_code& ec, int flags = 0);
 
+		// a packet to ep that was queued by send_packet() failed
+		// to send (see udp_socket::set_send_error_handler())
+		void send_failed(error_code const& ec, udp::endpoint const& ep);
+
 		// internal, used by utp_stream
 		void remove_socket(boost::uint16_t id);
 
@@ -81,19 +147,55 @@ namespace libtorrent
 		int min_timeout() const { return m_sett.utp_min_timeout; }
 		int loss_multiplier() const { return m_sett.utp_loss_multiplier; }
 		bool allow_dynamic_sock_buf() const { return m_sett.utp_dynamic_sock_buf; }
+		bool ledbat_plus_plus() const { return m_sett.utp_ledbat_plus_plus; }
 
 		void mtu_for_dest(address const& addr, int& link_mtu, int& utp_mtu);
 		void set_sock_buf(int size);
 		int num_sockets() const { return m_utp_sockets.size(); }
 
+		// internal, used by utp_stream to allocate packets
+		void* alloc_packet(int size) { return m_packets.allocate(size); }
+		void free_packet(void* p) { m_packets.free(p); }
+
 	private:
+
+		utp_socket_impl* index_find(udp::endpoint const& ep, boost::uint16_t id) const;
+		void index_insert(utp_socket_impl* s, udp::endpoint const& ep, boost::uint16_t id);
+		void index_erase(utp_socket_impl* s);
+		void index_rehash(int capacity);
+
 		udp_socket& m_sock;
 		incoming_utp_callback_t m_cb;
 
-		// replace with a hash-map
+		// all sockets, keyed by their receive connection ID
 		typedef std::multimap<boost::uint16_t, utp_socket_impl*> socket_map_t;
 		socket_map_t m_utp_sockets;
 
+		struct index_slot
+		{
+			index_slot(): sock(0), id(0), deleted(false) {}
+			utp_socket_impl* sock;
+			udp::endpoint ep;
+			boost::uint16_t id;
+			// set for slots whose socket was removed. They
+			// must not end a probe sequence
+			bool deleted;
+		};
+
+		// open addressing (linear probing) hash table indexing
+		// sockets by remote endpoint and receive connection ID.
+		// This is what incoming packets are matched against.
+		// A socket is indexed the first time a packet is matched
+		// to it through m_utp_sockets, since the remote endpoint
+		// of a socket isn't known when it's created. The
+		// capacity is always a power of 2
+		std::vector<index_slot> m_socket_index;
+
+		// the number of slots holding a socket, and the
+		// number holding a socket or marked as deleted
+		int m_index_size;
+		int m_index_used;
+
 		// the last socket we received a packet on
 		utp_socket_impl* m_last_socket;
 
@@ -116,6 +218,8 @@ namespace libtorrent
 		// the buffer size of the socket. This is used
 		// to now lower the buffer size
 		int m_sock_buf_size;
+
+		packet_pool m_packets;
 	};
 }
 
@@ -96,6 +96,7 @@ JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_SetSession
 		sets.announce_to_all_tiers = true;
 		sets.prefer_udp_trackers = false;
 		sets.max_peerlist_size = 0;
+		sets.adaptive_half_open_limit = true;
 
 		gSession.set_settings(sets);
 
@@ -241,6 +242,16 @@ JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_AddTorrent
 					case 0: storageMode = libtorrent::storage_mode_allocate; break;
 					case 1: storageMode = libtorrent::storage_mode_sparse; break;
 					case 2: storageMode = libtorrent::storage_mode_compact; break;
+					case 3:
+						storageMode = libtorrent::storage_mode_sparse;
+						torrentParams.storage = libtorrent::mmap_storage_constructor;
+						break;
+					case 4:
+						// pieces are kept in memory only, nothing is written
+						// to the save path. Resume data doesn't apply
+						torrentParams.storage = libtorrent::ram_storage_constructor;
+						torrentParams.resume_data = 0;
+						break;
 					}
 					torrentParams.storage_mode = storageMode;
 					libtorrent::torrent_handle th = gSession.add_torrent(torrentParams,ec);
@@ -950,6 +961,55 @@ JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_HavePiece
 	return result;
 }
 //-----------------------------------------------------------------------------
+JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_SetPieceDeadline
+	(JNIEnv *env, jobject obj, jstring ContentFile, jint PieceIndex, jint Deadline)
+{
+	jboolean result = JNI_FALSE;
+	try {
+		if(gSessionState){
+			libtorrent::torrent_handle* pTorrent = GetTorrentHandle(env,ContentFile);
+			if(pTorrent){
+				if(pTorrent->has_metadata()) {
+					libtorrent::torrent_info const& info = pTorrent->get_torrent_info();
+					if (PieceIndex >= 0 && PieceIndex < info.num_pieces()) {
+						pTorrent->set_piece_deadline(PieceIndex, Deadline);
+						result = JNI_TRUE;
+					} else {
+						LOG_ERR("LibTorrent.SetPieceDeadline not correct piece index");
+					}
+				}
+			}
+		}
+	} catch(...){
+		LOG_ERR("Exception: failed to set piece deadline");
+		try	{
+			gTorrents.erase(TorrentFileInfo(env,ContentFile));
+		}catch(...){}
+	}
+	return result;
+}
+//-----------------------------------------------------------------------------
+JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_ClearPieceDeadlines
+	(JNIEnv *env, jobject obj, jstring ContentFile)
+{
+	jboolean result = JNI_FALSE;
+	try {
+		if(gSessionState){
+			libtorrent::torrent_handle* pTorrent = GetTorrentHandle(env,ContentFile);
+			if(pTorrent){
+				pTorrent->clear_piece_deadlines();
+				result = JNI_TRUE;
+			}
+		}
+	} catch(...){
+		LOG_ERR("Exception: failed to clear piece deadlines");
+		try	{
+			gTorrents.erase(TorrentFileInfo(env,ContentFile));
+		}catch(...){}
+	}
+	return result;
+}
+//-----------------------------------------------------------------------------
 JNIEXPORT jlong JNICALL Java_com_softwarrior_libtorrent_LibTorrent_GetPieceSize
 	(JNIEnv *env, jobject obj, jstring ContentFile, jint PieceIndex)
 {
@@ -996,4 +1056,75 @@ JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_SetSavePat
 	return result;
 }
 //-----------------------------------------------------------------------------
+JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_PrefetchHostName
+	(JNIEnv *env, jobject obj, jstring HostName)
+{
+	jboolean result = JNI_FALSE;
+	try {
+		if(gSessionState){
+			std::string hostName;
+			JniToStdString(env, &hostName, HostName);
+			gSession.prefetch_hostname(hostName);
+		}
+	} catch(...){
+		LOG_ERR("Exception: failed to prefetch host name");
+		gSessionState=false;
+	}
+	if(!gSessionState) LOG_ERR("LibTorrent.PrefetchHostName SessionState==false");
+	gSessionState==true ? result=JNI_TRUE : result=JNI_FALSE;
+	return result;
+}
+//-----------------------------------------------------------------------------
+JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_SaveSessionState
+	(JNIEnv *env, jobject obj, jstring StateFile)
+{
+	jboolean result = JNI_FALSE;
+	try {
+		if(gSessionState){
+			std::string stateFile;
+			JniToStdString(env, &stateFile, StateFile);
+			libtorrent::entry state;
+			// only the DHT state. The other settings are set by the
+			// app every time it starts the session
+			gSession.save_state(state, libtorrent::session::save_dht_state);
+			std::vector<char> out;
+			libtorrent::bencode(std::back_inserter(out), state);
+			if(SaveFile(stateFile, out) == 0) result = JNI_TRUE;
+			else LOG_ERR("Failed to save session state to %s", stateFile.c_str());
+		}
+	} catch(...){
+		LOG_ERR("Exception: failed to save session state");
+		gSessionState=false;
+	}
+	if(!gSessionState) LOG_ERR("LibTorrent.SaveSessionState SessionState==false");
+	return result;
+}
+//-----------------------------------------------------------------------------
+JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_LoadSessionState
+	(JNIEnv *env, jobject obj, jstring StateFile)
+{
+	jboolean result = JNI_FALSE;
+	try {
+		if(gSessionState){
+			std::string stateFile;
+			JniToStdString(env, &stateFile, StateFile);
+			std::vector<char> buf;
+			libtorrent::error_code ec;
+			libtorrent::lazy_entry state;
+			if (libtorrent::load_file(stateFile.c_str(), buf, ec) == 0
+				&& !buf.empty()
+				&& libtorrent::lazy_bdecode(&buf[0], &buf[0] + buf.size(), state, ec) == 0){
+				gSession.load_state(state);
+				result = JNI_TRUE;
+			}
+			else LOG_INFO("No session state loaded from %s", stateFile.c_str());
+		}
+	} catch(...){
+		LOG_ERR("Exception: failed to load session state");
+		gSessionState=false;
+	}
+	if(!gSessionState) LOG_ERR("LibTorrent.LoadSessionState SessionState==false");
+	return result;
+}
+//-----------------------------------------------------------------------------
 
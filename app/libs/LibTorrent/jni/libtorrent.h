@@ -35,6 +35,9 @@ JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_SetSession
 //0-storage_mode_allocate
 //1-storage_mode_sparse
 //2-storage_mode_compact
+//3-storage_mode_sparse, files accessed through mmap
+//4-pieces kept in RAM only (ram_storage), bounded by ram_storage_size.
+//  Nothing is written to SavePath, the data is only available through the session
 JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_AddTorrent
 	(JNIEnv *env, jobject obj, jstring SavePath, jstring TorrentFile, jint StorageMode);
 //-----------------------------------------------------------------------------
@@ -124,9 +127,31 @@ JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_HavePiece
 JNIEXPORT jlong JNICALL Java_com_softwarrior_libtorrent_LibTorrent_GetPieceSize
 	(JNIEnv *env, jobject obj, jstring ContentFile, jint PieceIndex);
 //-----------------------------------------------------------------------------
+//Asks for the piece to be downloaded within Deadline milliseconds. While a
+//torrent has pieces with deadlines it is streaming, and gets a reserved share
+//of the download rate limit and its connection attempts go first
+JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_SetPieceDeadline
+	(JNIEnv *env, jobject obj, jstring ContentFile, jint PieceIndex, jint Deadline);
+//-----------------------------------------------------------------------------
+JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_ClearPieceDeadlines
+	(JNIEnv *env, jobject obj, jstring ContentFile);
+//-----------------------------------------------------------------------------
 JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_SetSavePath
 	(JNIEnv *env, jobject obj, jstring SavePath);
 //-----------------------------------------------------------------------------
+//Looks up the host name in the background, so that it's cached
+//by the time a tracker or web seed on that host is contacted
+JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_PrefetchHostName
+	(JNIEnv *env, jobject obj, jstring HostName);
+//-----------------------------------------------------------------------------
+//Saves the DHT state, including the DHT nodes, so that it can
+//be restored with LoadSessionState the next time. Call before AbortSession
+JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_SaveSessionState
+	(JNIEnv *env, jobject obj, jstring StateFile);
+//-----------------------------------------------------------------------------
+JNIEXPORT jboolean JNICALL Java_com_softwarrior_libtorrent_LibTorrent_LoadSessionState
+	(JNIEnv *env, jobject obj, jstring StateFile);
+//-----------------------------------------------------------------------------
 #ifdef __cplusplus
 }
 #endif
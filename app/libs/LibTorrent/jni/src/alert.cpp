@@ -79,6 +79,12 @@ namespace libtorrent {
 	std::string read_piece_alert::message() const
 	{
 		char msg[200];
+		if (error)
+		{
+			snprintf(msg, sizeof(msg), "%s: piece failed %u (%s)", torrent_alert::message().c_str()
+				, piece, convert_from_native(error.message()).c_str());
+			return msg;
+		}
 		snprintf(msg, sizeof(msg), "%s: piece %s %u", torrent_alert::message().c_str()
 			, buffer ? "successful" : "failed", piece);
 		return msg;
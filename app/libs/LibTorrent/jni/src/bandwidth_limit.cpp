@@ -68,6 +68,13 @@ namespace libtorrent
 //			, m_quota_left);
 	}
 
+	void bandwidth_channel::set_distribute_quota(int percent)
+	{
+		TORRENT_ASSERT(percent >= 0 && percent <= 100);
+		if (m_limit == 0) return;
+		distribute_quota = int((std::max)(m_quota_left, boost::int64_t(0)) * percent / 100);
+	}
+
 	// this is used when connections disconnect with
 	// some quota left. It's returned to its bandwidth
 	// channels.
@@ -85,7 +85,7 @@ namespace libtorrent
 	// others will cut in front of the non-prioritized peers.
 	// this is used by web seeds
 	int bandwidth_manager::request_bandwidth(boost::intrusive_ptr<bandwidth_socket> const& peer
-		, int blk, int priority
+		, int blk, int priority, bool guaranteed
 		, bandwidth_channel* chan1
 		, bandwidth_channel* chan2
 		, bandwidth_channel* chan3
@@ -101,6 +101,7 @@ namespace libtorrent
 		TORRENT_ASSERT(!is_queued(peer.get()));
 
 		bw_request bwr(peer, blk, priority);
+		bwr.guaranteed = guaranteed;
 		int i = 0;
 		if (chan1 && chan1->throttle() > 0) bwr.channel[i++] = chan1;
 		if (chan2 && chan2->throttle() > 0) bwr.channel[i++] = chan2;
@@ -133,7 +134,7 @@ namespace libtorrent
 	}
 #endif
 
-	void bandwidth_manager::update_quotas(time_duration const& dt)
+	void bandwidth_manager::update_quotas(time_duration const& dt, int guaranteed_share)
 	{
 		if (m_abort) return;
 		if (m_queue.empty()) return;
@@ -143,14 +144,16 @@ namespace libtorrent
 		int dt_milliseconds = total_milliseconds(dt);
 		if (dt_milliseconds > 3000) dt_milliseconds = 3000;
 
-		// for each bandwidth channel, call update_quota(dt)
-
 		std::vector<bandwidth_channel*> channels;
 
 		queue_t tm;
 
-		for (queue_t::iterator i = m_queue.begin();
-			i != m_queue.end();)
+		// drop requests from disconnecting peers, compacting the queue
+		// in place
+		bool has_guaranteed = false;
+		queue_t::iterator out = m_queue.begin();
+		for (queue_t::iterator i = m_queue.begin()
+			, end(m_queue.end()); i != end; ++i)
 		{
 			if (i->peer->is_disconnecting())
 			{
@@ -166,7 +169,6 @@ namespace libtorrent
 
 				i->assigned = 0;
 				tm.push_back(*i);
-				i = m_queue.erase(i);
 				continue;
 			}
 			for (int j = 0; j < bw_request::max_bandwidth_channels && i->channel[j]; ++j)
@@ -174,18 +176,23 @@ namespace libtorrent
 				bandwidth_channel* bwc = i->channel[j];
 				bwc->tmp = 0;
 			}
-			++i;
+			--i->ttl;
+			has_guaranteed |= i->guaranteed;
+			if (out != i) *out = *i;
+			++out;
 		}
+		m_queue.erase(out, m_queue.end());
 
+		// for each bandwidth channel, call update_quota(dt)
 		for (queue_t::iterator i = m_queue.begin()
 			, end(m_queue.end()); i != end; ++i)
 		{
 			for (int j = 0; j < bw_request::max_bandwidth_channels && i->channel[j]; ++j)
 			{
 				bandwidth_channel* bwc = i->channel[j];
-				if (bwc->tmp == 0) channels.push_back(bwc);
-				TORRENT_ASSERT(INT_MAX - bwc->tmp > i->priority);
-				bwc->tmp += i->priority;
+				if (bwc->tmp != 0) continue;
+				bwc->tmp = 1;
+				channels.push_back(bwc);
 			}
 		}
 
@@ -195,24 +202,9 @@ namespace libtorrent
 			(*i)->update_quota(dt_milliseconds);
 		}
 
-		for (queue_t::iterator i = m_queue.begin();
-			i != m_queue.end();)
-		{
-			int a = i->assign_bandwidth();
-			if (i->assigned == i->request_size
-				|| (i->ttl <= 0 && i->assigned > 0))
-			{
-				a += i->request_size - i->assigned;
-				TORRENT_ASSERT(i->assigned <= i->request_size);
-				tm.push_back(*i);
-				i = m_queue.erase(i);
-			}
-			else
-			{
-				++i;
-			}
-			m_queued_bytes -= a;
-		}
+		if (has_guaranteed && guaranteed_share > 0)
+			assign_quota(channels, true, (std::min)(guaranteed_share, 100), tm);
+		assign_quota(channels, false, 100, tm);
 
 		while (!tm.empty())
 		{
@@ -221,5 +213,52 @@ namespace libtorrent
 			tm.pop_back();
 		}
 	}
-}
 
+	void bandwidth_manager::assign_quota(std::vector<bandwidth_channel*> const& channels
+		, bool guaranteed_only, int percent, queue_t& tm)
+	{
+		for (std::vector<bandwidth_channel*>::const_iterator i = channels.begin()
+			, end(channels.end()); i != end; ++i)
+		{
+			(*i)->tmp = 0;
+			(*i)->set_distribute_quota(percent);
+		}
+
+		// sum up the priorities of the requests sharing each channel,
+		// each request gets its priority's portion of the channel
+		for (queue_t::iterator i = m_queue.begin()
+			, end(m_queue.end()); i != end; ++i)
+		{
+			if (guaranteed_only && !i->guaranteed) continue;
+			for (int j = 0; j < bw_request::max_bandwidth_channels && i->channel[j]; ++j)
+			{
+				bandwidth_channel* bwc = i->channel[j];
+				TORRENT_ASSERT(INT_MAX - bwc->tmp > i->priority);
+				bwc->tmp += i->priority;
+			}
+		}
+
+		queue_t::iterator out = m_queue.begin();
+		for (queue_t::iterator i = m_queue.begin()
+			, end(m_queue.end()); i != end; ++i)
+		{
+			if (!guaranteed_only || i->guaranteed)
+			{
+				int a = i->assign_bandwidth();
+				if (i->assigned == i->request_size
+					|| (!guaranteed_only && i->ttl <= 0 && i->assigned > 0))
+				{
+					a += i->request_size - i->assigned;
+					TORRENT_ASSERT(i->assigned <= i->request_size);
+					m_queued_bytes -= a;
+					tm.push_back(*i);
+					continue;
+				}
+				m_queued_bytes -= a;
+			}
+			if (out != i) *out = *i;
+			++out;
+		}
+		m_queue.erase(out, m_queue.end());
+	}
+}
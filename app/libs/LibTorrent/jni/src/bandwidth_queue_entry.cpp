@@ -44,6 +44,7 @@ namespace libtorrent
 		, assigned(0)
 		, request_size(blk)
 		, ttl(20)
+		, guaranteed(false)
 	{
 		TORRENT_ASSERT(priority > 0);
 		std::memset(channel, 0, sizeof(channel));
@@ -54,7 +55,6 @@ namespace libtorrent
 		TORRENT_ASSERT(assigned < request_size);
 		int quota = request_size - assigned;
 		TORRENT_ASSERT(quota >= 0);
-		--ttl;
 		if (quota == 0) return quota;
 
 		for (int j = 0; j < 5 && channel[j]; ++j)
@@ -93,6 +93,14 @@ namespace libtorrent
 		&bt_peer_connection::on_extended
 	};
 
+	namespace
+	{
+		// destructors for the buffers handed to append_send_buffer()
+		void free_malloced(char* buf, void*) { ::free(buf); }
+
+		void free_disk_buffer(char* buf, void* ses)
+		{ static_cast<session_impl*>(ses)->free_disk_buffer(buf); }
+	}
 
 	bt_peer_connection::bt_peer_connection(
 		session_impl& ses
@@ -700,10 +708,11 @@ namespace libtorrent
 		if (m_encrypted && m_rc4_encrypted)
 		{
 			// if we're encrypting this buffer, we need to make a copy
-			// since we'll mutate it
+			// since we'll mutate it. Encrypt while copying, to only
+			// touch the data once
 			char* buf = (char*)malloc(size);
-			memcpy(buf, buffer, size);
-			bt_append_send_buffer(buf, size, boost::bind(&::free, _1));
+			m_enc_handler->encrypt_copy(buffer, buf, size);
+			peer_connection::append_send_buffer(buf, size, &free_malloced, 0, true);
 		}
 		else
 #endif
@@ -2294,10 +2303,8 @@ namespace libtorrent
 		send_buffer(msg, sizeof(msg));
 	}
 
-	void bt_peer_connection::write_piece(peer_request const& r, disk_buffer_holder& buffer)
+	void bt_peer_connection::write_piece_header(peer_request const& r)
 	{
-		INVARIANT_CHECK;
-
 		TORRENT_ASSERT(m_sent_handshake && m_sent_bitfield);
 
 		boost::shared_ptr<torrent> t = associated_torrent().lock();
@@ -2350,16 +2357,42 @@ namespace libtorrent
 		{
 			send_buffer(msg, 13);
 		}
+	}
 
-		bt_append_send_buffer(buffer.get(), r.length
-			, boost::bind(&session_impl::free_disk_buffer
-			, boost::ref(m_ses), _1));
+	void bt_peer_connection::write_piece(peer_request const& r, disk_buffer_holder& buffer)
+	{
+		INVARIANT_CHECK;
+
+		write_piece_header(r);
+
+		bt_append_send_buffer(buffer.get(), r.length, &free_disk_buffer, &m_ses);
 		buffer.release();
 
 		m_payloads.push_back(range(send_buffer_size() - r.length, r.length));
 		setup_send();
 	}
 
+	void bt_peer_connection::write_piece_sendfile(peer_request const& r)
+	{
+		INVARIANT_CHECK;
+
+		TORRENT_ASSERT(plaintext_payload());
+		write_piece_header(r);
+		append_sendfile_segment(r);
+
+		m_payloads.push_back(range(send_buffer_size() - r.length, r.length));
+		setup_send();
+	}
+
+	bool bt_peer_connection::plaintext_payload() const
+	{
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		return !m_rc4_encrypted;
+#else
+		return true;
+#endif
+	}
+
 	namespace
 	{
 		struct match_peer_id
@@ -2401,8 +2434,14 @@ namespace libtorrent
 	
 #ifndef TORRENT_DISABLE_ENCRYPTION
 		TORRENT_ASSERT(in_handshake() || !m_rc4_encrypted || m_encrypted);
-		if (m_rc4_encrypted && m_encrypted)
-		{
+		TORRENT_ASSERT(!received_decrypted() || (m_rc4_encrypted && m_encrypted));
+		if (m_rc4_encrypted && m_encrypted && !received_decrypted())
+		{
+			// decrypt in place. For piece messages the payload is received
+			// straight into the disk buffer (see
+			// allocate_disk_receive_buffer()), so the second interval is
+			// decrypted where it will be written to disk from, and the
+			// payload is never copied
 			std::pair<buffer::interval, buffer::interval> wr_buf = wr_recv_buffers(bytes_transferred);
 			m_enc_handler->decrypt(wr_buf.first.begin, wr_buf.first.left());
 			if (wr_buf.second.left()) m_enc_handler->decrypt(wr_buf.second.begin, wr_buf.second.left());
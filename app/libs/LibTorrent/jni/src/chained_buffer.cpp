@@ -33,6 +33,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/chained_buffer.hpp"
 #include "libtorrent/assert.hpp"
 
+#include <cstdlib> // for malloc
+
 namespace libtorrent
 {
 	void chained_buffer::pop_front(int bytes_to_pop)
@@ -43,7 +45,7 @@ namespace libtorrent
 			buffer_t& b = m_vec.front();
 			if (b.used_size > bytes_to_pop)
 			{
-				b.start += bytes_to_pop;
+				if (b.buf) b.start += bytes_to_pop;
 				b.used_size -= bytes_to_pop;
 				m_bytes -= bytes_to_pop;
 				TORRENT_ASSERT(m_bytes <= m_capacity);
@@ -52,7 +54,7 @@ namespace libtorrent
 				break;
 			}
 
-			b.free(b.buf);
+			b.free(b.buf, b.userdata);
 			m_bytes -= b.used_size;
 			m_capacity -= b.size;
 			bytes_to_pop -= b.used_size;
@@ -64,7 +66,7 @@ namespace libtorrent
 	}
 
 	void chained_buffer::append_buffer(char* buffer, int s, int used_size
-		, boost::function<void(char*)> const& destructor)
+		, free_buffer_fun destructor, void* userdata)
 	{
 		TORRENT_ASSERT(s >= used_size);
 		buffer_t b;
@@ -73,6 +75,7 @@ namespace libtorrent
 		b.start = buffer;
 		b.used_size = used_size;
 		b.free = destructor;
+		b.userdata = userdata;
 		m_vec.push_back(b);
 
 		m_bytes += used_size;
@@ -80,12 +83,66 @@ namespace libtorrent
 		TORRENT_ASSERT(m_bytes <= m_capacity);
 	}
 
+	// the number of sent arena blocks kept for reuse
+	enum { max_free_arena_blocks = 4 };
+
+	char* chained_buffer::allocate_arena_block()
+	{
+		if (m_arena.empty()) return (char*)malloc(arena_block_size);
+		char* ret = m_arena.back();
+		m_arena.pop_back();
+		return ret;
+	}
+
+	void chained_buffer::append_arena_block(char* block, int used_size)
+	{
+		append_buffer(block, arena_block_size, used_size, &free_arena_block, this);
+	}
+
+	void chained_buffer::free_arena_block(char* buf, void* userdata)
+	{
+		chained_buffer* self = static_cast<chained_buffer*>(userdata);
+		if (int(self->m_arena.size()) < max_free_arena_blocks)
+			self->m_arena.push_back(buf);
+		else
+			free(buf);
+	}
+
+	namespace
+	{
+		void no_free(char*, void*) {}
+	}
+
+	void chained_buffer::append_external(int s)
+	{
+		TORRENT_ASSERT(s > 0);
+		// external segments are buffers without memory
+		buffer_t b;
+		b.buf = 0;
+		b.size = s;
+		b.start = 0;
+		b.used_size = s;
+		b.free = &no_free;
+		b.userdata = 0;
+		m_vec.push_back(b);
+
+		m_bytes += s;
+		m_capacity += s;
+	}
+
+	int chained_buffer::front_external() const
+	{
+		if (m_vec.empty() || m_vec.front().buf != 0) return 0;
+		return m_vec.front().used_size;
+	}
+
 	// returns the number of bytes available at the
 	// end of the last chained buffer.
 	int chained_buffer::space_in_last_buffer()
 	{
 		if (m_vec.empty()) return 0;
 		buffer_t& b = m_vec.back();
+		if (b.buf == 0) return 0;
 		return b.size - b.used_size - (b.start - b.buf);
 	}
 
@@ -107,6 +164,7 @@ namespace libtorrent
 	{
 		if (m_vec.empty()) return 0;
 		buffer_t& b = m_vec.back();
+		if (b.buf == 0) return 0;
 		char* insert = b.start + b.used_size;
 		if (insert + s > b.buf + b.size) return 0;
 		b.used_size += s;
@@ -115,13 +173,15 @@ namespace libtorrent
 		return insert;
 	}
 
-	std::list<asio::const_buffer> const& chained_buffer::build_iovec(int to_send)
+	std::vector<asio::const_buffer> const& chained_buffer::build_iovec(int to_send)
 	{
 		m_tmp_vec.clear();
 
-		for (std::list<buffer_t>::iterator i = m_vec.begin()
-			, end(m_vec.end()); to_send > 0 && i != end; ++i)
+		for (std::deque<buffer_t>::iterator i = m_vec.begin()
+			, end(m_vec.end()); to_send > 0 && i != end
+			&& int(m_tmp_vec.size()) < max_iovec; ++i)
 		{
+			if (i->buf == 0) break;
 			if (i->used_size > to_send)
 			{
 				TORRENT_ASSERT(to_send > 0);
@@ -143,10 +203,15 @@ namespace libtorrent
 #endif
 		TORRENT_ASSERT(m_bytes >= 0);
 		TORRENT_ASSERT(m_capacity >= 0);
-		for (std::list<buffer_t>::iterator i = m_vec.begin()
+		for (std::deque<buffer_t>::iterator i = m_vec.begin()
 			, end(m_vec.end()); i != end; ++i)
 		{
-			i->free(i->buf);
+			i->free(i->buf, i->userdata);
+		}
+		for (std::vector<char*>::iterator i = m_arena.begin()
+			, end(m_arena.end()); i != end; ++i)
+		{
+			free(*i);
 		}
 #ifdef TORRENT_DEBUG
 		m_bytes = -1;
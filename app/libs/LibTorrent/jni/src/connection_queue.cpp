@@ -46,9 +46,17 @@ namespace libtorrent
 {
 
 	connection_queue::connection_queue(io_service& ios): m_next_ticket(0)
-		, m_num_connecting(0)
 		, m_half_open_limit(0)
 		, m_abort(false)
+		, m_adaptive(false)
+		, m_window(initial_window)
+		, m_window_threshold((std::numeric_limits<int>::max)())
+		, m_window_credit(0)
+		, m_backoff_holdoff(0)
+		, m_short_response_rate(0)
+		, m_long_response_rate(-1)
+		, m_short_rtt(0)
+		, m_long_rtt(0)
 		, m_num_timers(0)
 		, m_timer(ios)
 #ifdef TORRENT_DEBUG
@@ -63,8 +71,9 @@ namespace libtorrent
 	int connection_queue::free_slots() const
 	{
 		mutex_t::scoped_lock l(m_mutex);
-		return m_half_open_limit == 0 ? (std::numeric_limits<int>::max)()
-			: m_half_open_limit - m_queue.size();
+		int limit = current_limit_impl();
+		return limit == 0 ? (std::numeric_limits<int>::max)()
+			: limit - size();
 	}
 
 	void connection_queue::enqueue(boost::function<void(int)> const& on_connect
@@ -87,8 +96,8 @@ namespace libtorrent
 		}
 		else // priority > 0
 		{
-			m_queue.push_front(entry());
-			e = &m_queue.front();
+			m_priority_queue.push_back(entry());
+			e = &m_priority_queue.back();
 		}
 
 		e->priority = priority;
@@ -98,30 +107,39 @@ namespace libtorrent
 		e->timeout = timeout;
 		++m_next_ticket;
 
-		if (m_num_connecting < m_half_open_limit
-			|| m_half_open_limit == 0)
+		int limit = current_limit_impl();
+		if (int(m_connecting.size()) < limit || limit == 0)
 			m_timer.get_io_service().post(boost::bind(
 				&connection_queue::on_try_connect, this));
 	}
 
-	void connection_queue::done(int ticket)
+	void connection_queue::done(int ticket, int result)
 	{
 		mutex_t::scoped_lock l(m_mutex);
 
 		INVARIANT_CHECK;
 
-		std::list<entry>::iterator i = std::find_if(m_queue.begin()
-			, m_queue.end(), boost::bind(&entry::ticket, _1) == ticket);
-		if (i == m_queue.end())
+		connecting_t::iterator i = m_connecting.find(ticket);
+		if (i == m_connecting.end())
 		{
 			// this might not be here in case on_timeout calls remove
 			return;
 		}
-		if (i->connecting) --m_num_connecting;
-		m_queue.erase(i);
 
-		if (m_num_connecting < m_half_open_limit
-			|| m_half_open_limit == 0)
+		if (result == responded && m_adaptive)
+		{
+			entry const& e = i->second;
+			update_window(true, total_microseconds(
+				time_now_hires() - (e.expires - e.timeout)));
+		}
+		else if (result == failed && m_adaptive)
+		{
+			update_window(false, 0);
+		}
+		m_connecting.erase(i);
+
+		int limit = current_limit_impl();
+		if (int(m_connecting.size()) < limit || limit == 0)
 			m_timer.get_io_service().post(boost::bind(
 				&connection_queue::on_try_connect, this));
 	}
@@ -130,33 +148,48 @@ namespace libtorrent
 	{
 		error_code ec;
 		mutex_t::scoped_lock l(m_mutex);
-		if (m_num_connecting == 0) m_timer.cancel(ec);
+		if (m_connecting.empty()) m_timer.cancel(ec);
 		m_abort = true;
 
-		std::list<entry> tmp;
-		tmp.swap(m_queue);
-		m_num_connecting = 0;
+		std::deque<entry> tmp_queue;
+		tmp_queue.swap(m_priority_queue);
+		tmp_queue.insert(tmp_queue.end(), m_queue.begin(), m_queue.end());
+		m_queue.clear();
+		connecting_t tmp_connecting;
+		tmp_connecting.swap(m_connecting);
 
 		// we don't want to call the timeout callback while we're locked
 		// since that is a recipie for dead-locks
 		l.unlock();
 
-		while (!tmp.empty())
+		for (connecting_t::iterator i = tmp_connecting.begin()
+			, end(tmp_connecting.end()); i != end; ++i)
 		{
-			entry& e = tmp.front();
+			if (i->second.priority > 1)
+			{
+				mutex_t::scoped_lock ll(m_mutex);
+				m_connecting.insert(*i);
+				continue;
+			}
+			TORRENT_TRY {
+				i->second.on_timeout();
+			} TORRENT_CATCH(std::exception&) {}
+		}
+
+		while (!tmp_queue.empty())
+		{
+			entry& e = tmp_queue.front();
 			if (e.priority > 1)
 			{
 				mutex_t::scoped_lock ll(m_mutex);
-				if (e.connecting) ++m_num_connecting;
-				m_queue.push_back(e);
-				tmp.pop_front();
+				m_priority_queue.push_back(e);
+				tmp_queue.pop_front();
 				continue;
 			}
 			TORRENT_TRY {
-				if (e.connecting) e.on_timeout();
-				else e.on_connect(-1);
+				e.on_connect(-1);
 			} TORRENT_CATCH(std::exception&) {}
-			tmp.pop_front();
+			tmp_queue.pop_front();
 		}
 	}
 
@@ -169,18 +202,132 @@ namespace libtorrent
 	int connection_queue::limit() const
 	{ return m_half_open_limit; }
 
+	void connection_queue::adaptive(bool a)
+	{
+		mutex_t::scoped_lock l(m_mutex);
+		if (m_adaptive == a) return;
+		m_adaptive = a;
+
+		// start over learning what the network can take
+		m_window = initial_window;
+		m_window_threshold = (std::numeric_limits<int>::max)();
+		m_window_credit = 0;
+		m_backoff_holdoff = 0;
+		m_long_response_rate = -1;
+		m_long_rtt = 0;
+
+		m_timer.get_io_service().post(boost::bind(
+			&connection_queue::on_try_connect, this));
+	}
+
+	int connection_queue::current_limit() const
+	{
+		mutex_t::scoped_lock l(m_mutex);
+		return current_limit_impl();
+	}
+
+	int connection_queue::current_limit_impl() const
+	{
+		if (!m_adaptive) return m_half_open_limit;
+		if (m_half_open_limit > 0 && m_half_open_limit < m_window)
+			return m_half_open_limit;
+		return m_window;
+	}
+
+	// this is called for every connection attempt that got a response
+	// (rtt is the time it took, in microseconds) and for every attempt
+	// that timed out or failed otherwise, like with the host being
+	// unreachable. Timeouts are normal, since many peers we know
+	// about aren't there anymore, so the window isn't cut because of the
+	// share of timeouts, but when that share suddenly gets worse, or the
+	// response time does. That's what happens when there are more
+	// connection attempts in flight than the network (or NAT, or proxy)
+	// can take
+	void connection_queue::update_window(bool responded, int rtt)
+	{
+		// the response rates are fixed point, 0x10000 is 1
+		int sample = responded ? 0x10000 : 0;
+		if (m_long_response_rate < 0)
+		{
+			m_short_response_rate = sample;
+			m_long_response_rate = sample;
+		}
+		else
+		{
+			m_short_response_rate += (sample - m_short_response_rate) / 8;
+			m_long_response_rate += (sample - m_long_response_rate) / 64;
+		}
+
+		if (responded)
+		{
+			if (m_long_rtt == 0)
+			{
+				m_short_rtt = (std::max)(rtt, 1);
+				m_long_rtt = m_short_rtt;
+			}
+			else
+			{
+				m_short_rtt += (rtt - m_short_rtt) / 8;
+				m_long_rtt += (rtt - m_long_rtt) / 64;
+			}
+		}
+
+		if (m_backoff_holdoff > 0) --m_backoff_holdoff;
+
+		bool congested = m_short_response_rate * 2 < m_long_response_rate
+			|| m_short_rtt > m_long_rtt * 3;
+
+		if (congested)
+		{
+			if (m_backoff_holdoff > 0) return;
+			m_window = (std::max)(int(min_window), m_window * 3 / 4);
+			m_window_threshold = m_window;
+			m_window_credit = 0;
+			// let the smaller window take effect before
+			// cutting it again
+			m_backoff_holdoff = m_window;
+			return;
+		}
+
+		// only grow the window while it's in use. The session
+		// hands out at most half of the free slots per second,
+		// so half full is as full as it gets
+		if (!responded || int(size()) * 2 < m_window) return;
+		if (m_half_open_limit > 0 && m_window >= m_half_open_limit) return;
+
+		if (m_window < m_window_threshold)
+		{
+			++m_window;
+		}
+		else if (++m_window_credit >= m_window)
+		{
+			++m_window;
+			m_window_credit = 0;
+		}
+	}
+
 #ifdef TORRENT_DEBUG
 
 	void connection_queue::check_invariant() const
 	{
-		int num_connecting = 0;
-		for (std::list<entry>::const_iterator i = m_queue.begin();
+		for (std::deque<entry>::const_iterator i = m_priority_queue.begin();
+			i != m_priority_queue.end(); ++i)
+		{
+			TORRENT_ASSERT(i->priority > 0);
+			TORRENT_ASSERT(i->expires == max_time());
+		}
+		for (std::deque<entry>::const_iterator i = m_queue.begin();
 			i != m_queue.end(); ++i)
 		{
-			if (i->connecting) ++num_connecting;
-			else TORRENT_ASSERT(i->expires == max_time());
+			TORRENT_ASSERT(i->priority <= 0);
+			TORRENT_ASSERT(i->expires == max_time());
 		}
-		TORRENT_ASSERT(num_connecting == m_num_connecting);
+		for (connecting_t::const_iterator i = m_connecting.begin();
+			i != m_connecting.end(); ++i)
+		{
+			TORRENT_ASSERT(i->first == i->second.ticket);
+		}
+		TORRENT_ASSERT(m_window >= min_window);
 	}
 
 #endif
@@ -195,30 +342,28 @@ namespace libtorrent
 		// if this is enabled, UPnP connections will be blocked when shutting down
 //		if (m_abort) return;
 
-		if (m_num_connecting >= m_half_open_limit
-			&& m_half_open_limit > 0) return;
-	
-		if (m_queue.empty())
+		int limit = current_limit_impl();
+		if (int(m_connecting.size()) >= limit && limit > 0) return;
+
+		if (m_priority_queue.empty() && m_queue.empty())
 		{
-			error_code ec;
-			m_timer.cancel(ec);
+			if (m_connecting.empty())
+			{
+				error_code ec;
+				m_timer.cancel(ec);
+			}
 			return;
 		}
 
-		// all entries are connecting, no need to look for new ones
-		if (m_queue.size() == m_num_connecting)
-			return;
-
-		std::list<entry>::iterator i = std::find_if(m_queue.begin()
-			, m_queue.end(), boost::bind(&entry::connecting, _1) == false);
+		std::deque<entry> to_connect;
 
-		std::list<entry> to_connect;
-
-		while (i != m_queue.end())
+		while (!m_priority_queue.empty() || !m_queue.empty())
 		{
-			TORRENT_ASSERT(i->connecting == false);
-			ptime expire = time_now_hires() + i->timeout;
-			if (m_num_connecting == 0)
+			std::deque<entry>& q = m_priority_queue.empty()
+				? m_queue : m_priority_queue;
+			entry& e = q.front();
+			ptime expire = time_now_hires() + e.timeout;
+			if (m_connecting.empty())
 			{
 #if defined TORRENT_ASIO_DEBUGGING
 				add_outstanding_async("connection_queue::on_timeout");
@@ -228,22 +373,18 @@ namespace libtorrent
 				m_timer.async_wait(boost::bind(&connection_queue::on_timeout, this, _1));
 				++m_num_timers;
 			}
-			i->connecting = true;
-			++m_num_connecting;
-			i->expires = expire;
+			e.expires = expire;
+			to_connect.push_back(e);
+			m_connecting.insert(std::make_pair(e.ticket, e));
+			q.pop_front();
 
 			INVARIANT_CHECK;
 
-			to_connect.push_back(*i);
-
 #ifdef TORRENT_CONNECTION_LOGGING
 			m_log << log_time() << " " << free_slots() << std::endl;
 #endif
 
-			if (m_num_connecting >= m_half_open_limit
-				&& m_half_open_limit > 0) break;
-			if (m_num_connecting == m_queue.size()) break;
-			i = std::find_if(i, m_queue.end(), boost::bind(&entry::connecting, _1) == false);
+			if (int(m_connecting.size()) >= limit && limit > 0) break;
 		}
 
 		l.unlock();
@@ -288,24 +429,23 @@ namespace libtorrent
 		// we should just quit. However, in case there are still connections
 		// in connecting state, and there are no other timer invocations
 		// we need to stick around still.
-		if (e && (m_num_connecting == 0 || m_num_timers > 0)) return;
+		if (e && (m_connecting.empty() || m_num_timers > 0)) return;
 
 		ptime next_expire = max_time();
 		ptime now = time_now_hires() + milliseconds(100);
-		std::list<entry> timed_out;
-		for (std::list<entry>::iterator i = m_queue.begin();
-			!m_queue.empty() && i != m_queue.end();)
+		std::deque<entry> timed_out;
+		for (connecting_t::iterator i = m_connecting.begin();
+			i != m_connecting.end();)
 		{
-			if (i->connecting && i->expires < now)
+			if (i->second.expires < now)
 			{
-				std::list<entry>::iterator j = i;
-				++i;
-				timed_out.splice(timed_out.end(), m_queue, j, i);
-				--m_num_connecting;
+				timed_out.push_back(i->second);
+				m_connecting.erase(i++);
+				if (m_adaptive) update_window(false, 0);
 				continue;
 			}
-			if (i->connecting && i->expires < next_expire)
-				next_expire = i->expires;
+			if (i->second.expires < next_expire)
+				next_expire = i->second.expires;
 			++i;
 		}
 
@@ -313,10 +453,9 @@ namespace libtorrent
 		// since that is a recepie for dead-locks
 		l.unlock();
 
-		for (std::list<entry>::iterator i = timed_out.begin()
+		for (std::deque<entry>::iterator i = timed_out.begin()
 			, end(timed_out.end()); i != end; ++i)
 		{
-			TORRENT_ASSERT(i->connecting);
 			TORRENT_ASSERT(i->ticket != -1);
 			TORRENT_TRY {
 				i->on_timeout();
@@ -59,6 +59,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <sys/resource.h>
 #endif
 
+#if TORRENT_USE_SENDFILE
+#include <signal.h>
+#include <pthread.h>
+#endif
+
 #ifdef TORRENT_LINUX
 #include <linux/unistd.h>
 #endif
@@ -184,7 +189,8 @@ namespace libtorrent
 
 		cache_status ret = m_cache_stats;
 
-		ret.job_queue_length = m_jobs.size() + m_sorted_read_jobs.size();
+		ret.job_queue_length = m_jobs.size() + m_sorted_read_jobs.size()
+			+ m_deadline_jobs.size();
 		ret.read_queue_size = m_sorted_read_jobs.size();
 
 		return ret;
@@ -216,6 +222,17 @@ namespace libtorrent
 			}
 			++i;
 		}
+		for (deadline_jobs_t::iterator i = m_deadline_jobs.begin();
+			i != m_deadline_jobs.end();)
+		{
+			if (i->second.storage != s || !should_cancel_on_abort(i->second))
+			{
+				++i;
+				continue;
+			}
+			post_callback(i->second, -3);
+			m_deadline_jobs.erase(i++);
+		}
 		disk_io_job j;
 		j.action = disk_io_job::abort_torrent;
 		j.storage = s;
@@ -1353,6 +1370,15 @@ namespace libtorrent
 			const_cast<disk_io_job&>(j).buffer = 0;
 		}
 */
+		if (j.job_class < disk_io_job::normal && can_expedite(j))
+		{
+			deadline_jobs_t::iterator i = m_deadline_jobs.insert(std::make_pair(
+				j.deadline == min_time() ? j.start_time : j.deadline, j));
+			i->second.callback.swap(const_cast<boost::function<void(int, disk_io_job const&)>&>(f));
+			m_signal.signal(l);
+			return m_queue_buffer_size;
+		}
+
 		m_jobs.push_back(j);
 		m_jobs.back().callback.swap(const_cast<boost::function<void(int, disk_io_job const&)>&>(f));
 
@@ -1372,6 +1398,43 @@ namespace libtorrent
 		return add_job(j, l, f);
 	}
 
+	bool disk_io_thread::can_expedite(disk_io_job const& j) const
+	{
+		if (j.action != disk_io_job::read
+			&& j.action != disk_io_job::hash) return false;
+
+		// a read or hash job must not overtake writes to its own
+		// piece, nor any job affecting the whole storage (move,
+		// release, delete etc.). Those may change or remove the
+		// files it's about to read from
+		for (std::deque<disk_io_job>::const_iterator i = m_jobs.begin()
+			, end(m_jobs.end()); i != end; ++i)
+		{
+			if (i->storage != j.storage) continue;
+			if (i->action == disk_io_job::read
+				|| i->action == disk_io_job::sendfile) continue;
+			if ((i->action == disk_io_job::write
+				|| i->action == disk_io_job::hash
+				|| i->action == disk_io_job::read_and_hash
+				|| i->action == disk_io_job::cache_piece
+				|| i->action == disk_io_job::drop_piece)
+				&& i->piece != j.piece) continue;
+			return false;
+		}
+		return true;
+	}
+
+	// returns the queue_time_histogram bucket for a job
+	// that waited the given number of microseconds
+	static int queue_time_bucket(int us)
+	{
+		int bucket = 0;
+		for (int limit = 1000; us >= limit
+			&& bucket < cache_status::num_queue_time_buckets - 1; limit *= 4)
+			++bucket;
+		return bucket;
+	}
+
 	bool disk_io_thread::test_error(disk_io_job& j)
 	{
 		TORRENT_ASSERT(j.storage);
@@ -1422,6 +1485,8 @@ namespace libtorrent
 		, cancel_on_abort // update_settings
 		, read_operation + cancel_on_abort // read_and_hash
 		, read_operation + cancel_on_abort // cache_piece
+		, read_operation + cancel_on_abort // sendfile
+		, 0 // drop_piece
 #ifndef TORRENT_NO_DEPRECATE
 		, 0 // finalize_file
 #endif
@@ -1447,6 +1512,16 @@ namespace libtorrent
 
 	void disk_io_thread::thread_fun()
 	{
+#if TORRENT_USE_SENDFILE
+		// sendfile() can't be asked not to raise SIGPIPE when the
+		// peer has closed the connection. Block it on this thread,
+		// the error is still returned as EPIPE
+		sigset_t sigpipe;
+		sigemptyset(&sigpipe);
+		sigaddset(&sigpipe, SIGPIPE);
+		pthread_sigmask(SIG_BLOCK, &sigpipe, 0);
+#endif
+
 #ifdef TORRENT_DISK_STATS
 		m_log.open("disk_io_thread.log", std::ios::trunc);
 #endif
@@ -1509,7 +1584,8 @@ namespace libtorrent
 
 			mutex::scoped_lock jl(m_queue_mutex);
 
-			if (m_queued_completions.size() >= 30 || (m_jobs.empty() && !m_queued_completions.empty()))
+			if (m_queued_completions.size() >= 30 || (m_jobs.empty()
+				&& m_deadline_jobs.empty() && !m_queued_completions.empty()))
 			{
 				job_queue_t* q = new job_queue_t;
 				q->swap(m_queued_completions);
@@ -1518,7 +1594,8 @@ namespace libtorrent
 
 
 			ptime job_start;
-			while (m_jobs.empty() && m_sorted_read_jobs.empty() && !m_abort)
+			while (m_jobs.empty() && m_sorted_read_jobs.empty()
+				&& m_deadline_jobs.empty() && !m_abort)
 			{
 				// if there hasn't been an event in one second
 				// see if we should flush the cache
@@ -1531,10 +1608,12 @@ namespace libtorrent
 				if (job_start >= m_last_stats_flip + seconds(1)) flip_stats(job_start);
 			}
 
-			if (m_abort && m_jobs.empty())
+			if (m_abort && m_jobs.empty() && m_deadline_jobs.empty())
 			{
 				jl.unlock();
 
+				m_hash_pool.stop();
+
 				mutex::scoped_lock l(m_piece_mutex);
 				// flush all disk caches
 				cache_piece_index_t& widx = m_pieces.get<0>();
@@ -1589,7 +1668,18 @@ namespace libtorrent
 				|| (immediate_jobs_in_row >= read_job_every
 					&& !m_sorted_read_jobs.empty());
 
-			if (!pick_read_job)
+			if (!m_deadline_jobs.empty())
+			{
+				// expedited jobs go first, earliest deadline first.
+				// They bypass the elevator and don't count towards
+				// the read/write mix
+				deadline_jobs_t::iterator i = m_deadline_jobs.begin();
+				j = i->second;
+				if (i->first < now) ++m_cache_stats.missed_deadlines;
+				m_deadline_jobs.erase(i);
+				jl.unlock();
+			}
+			else if (!pick_read_job)
 			{
 				// we have a job in the job queue. If it's
 				// a read operation and we are allowed to
@@ -1727,7 +1817,10 @@ namespace libtorrent
 				m_sorted_read_jobs.erase(to_erase);
 			}
 
-			m_queue_time.add_sample(total_microseconds(now - j.start_time));
+			int queue_time = total_microseconds(now - j.start_time);
+			m_queue_time.add_sample(queue_time);
+			TORRENT_ASSERT(j.job_class >= 0 && j.job_class < disk_io_job::num_job_classes);
+			++m_cache_stats.queue_time_histogram[j.job_class][queue_time_bucket(queue_time)];
 
 			// if there's a buffer in this job, it will be freed
 			// when this holder is destructed, unless it has been
@@ -1841,6 +1934,18 @@ namespace libtorrent
 						if (elevator_job_pos == i) ++elevator_job_pos;
 						m_sorted_read_jobs.erase(i++);
 					}
+					for (deadline_jobs_t::iterator i = m_deadline_jobs.begin();
+						i != m_deadline_jobs.end();)
+					{
+						if (i->second.storage != j.storage
+							|| !should_cancel_on_abort(i->second))
+						{
+							++i;
+							continue;
+						}
+						post_callback(i->second, -3);
+						m_deadline_jobs.erase(i++);
+					}
 					jl.unlock();
 
 					mutex::scoped_lock l(m_piece_mutex);
@@ -1890,6 +1995,17 @@ namespace libtorrent
 						}
 						++i;
 					}
+					for (deadline_jobs_t::iterator i = m_deadline_jobs.begin();
+						i != m_deadline_jobs.end();)
+					{
+						if (!should_cancel_on_abort(i->second))
+						{
+							++i;
+							continue;
+						}
+						post_callback(i->second, -3);
+						m_deadline_jobs.erase(i++);
+					}
 					jl.unlock();
 
 					for (read_jobs_t::iterator i = m_sorted_read_jobs.begin();
@@ -2057,6 +2173,43 @@ namespace libtorrent
 #endif
 					break;
 				}
+#if TORRENT_USE_SENDFILE
+				case disk_io_job::sendfile:
+				{
+					if (test_error(j))
+					{
+						ret = -1;
+						break;
+					}
+#ifdef TORRENT_DISK_STATS
+					m_log << log_time() << " sendfile " << j.buffer_size << std::endl;
+#endif
+					INVARIANT_CHECK;
+					TORRENT_ASSERT(j.buffer_size <= m_block_size);
+
+					// a piece is flushed out of the write cache before
+					// it's hashed, so the file always has the data of
+					// pieces we have
+					error_code ec;
+					ret = j.storage->sendfile_impl(j.socket, j.piece, j.offset
+						, j.buffer_size, ec);
+
+					// -1 is a failure to read the file, -2 is a failure
+					// to write to the socket
+					if (test_error(j))
+					{
+						ret = -1;
+						break;
+					}
+					if (ret < 0) ret = -2;
+					j.error = ec;
+
+					ptime now = time_now_hires();
+					m_read_time.add_sample(total_microseconds(now - operation_start));
+					m_cache_stats.cumulative_read_time += total_milliseconds(now - operation_start);
+					break;
+				}
+#endif
 				case disk_io_job::write:
 				{
 #ifdef TORRENT_DISK_STATS
@@ -2311,6 +2464,32 @@ namespace libtorrent
 					ret = 0;
 					break;
 				}
+				case disk_io_job::drop_piece:
+				{
+#ifdef TORRENT_DISK_STATS
+					m_log << log_time() << " drop-piece" << std::endl;
+#endif
+					TORRENT_ASSERT(j.buffer == 0);
+
+					mutex::scoped_lock l(m_piece_mutex);
+					INVARIANT_CHECK;
+
+					// the piece passed its hash check before it was dropped,
+					// so it can't be in the write cache
+					TORRENT_ASSERT(find_cached_piece(m_pieces, j, l) == m_pieces.end());
+					cache_piece_index_t::iterator i = find_cached_piece(m_read_pieces, j, l);
+					if (i != m_read_pieces.end())
+					{
+						free_piece(const_cast<cached_piece_entry&>(*i), l);
+						m_read_pieces.erase(i);
+					}
+					l.unlock();
+					release_memory();
+
+					j.storage->drop_piece_impl(j.piece);
+					ret = 0;
+					break;
+				}
 				case disk_io_job::delete_files:
 				{
 #ifdef TORRENT_DISK_STATS
@@ -162,7 +162,7 @@ namespace libtorrent
 			"invalid dont-have message",
 			"SSL connection required",
 			"invalid SSL certificate",
-			"",
+			"piece is no longer in the storage",
 			"",
 			"",
 			"",
@@ -53,6 +53,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/scoped_ptr.hpp>
 #include <boost/static_assert.hpp>
 
+#include <climits> // for INT_MAX
+
 #include <sys/stat.h>
 
 #ifdef TORRENT_WINDOWS
@@ -84,6 +86,14 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <errno.h>
 #include <dirent.h>
 
+#if TORRENT_USE_MMAP
+#include <sys/mman.h>
+#endif
+
+#if TORRENT_USE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 #ifdef TORRENT_LINUX
 // linux specifics
 
@@ -933,6 +943,11 @@ namespace libtorrent
 		, m_open_mode(0)
 #if defined TORRENT_WINDOWS || defined TORRENT_LINUX
 		, m_sector_size(0)
+#endif
+#if TORRENT_USE_MMAP
+		, m_map_base(0)
+		, m_map_offset(0)
+		, m_map_size(0)
 #endif
 	{}
 
@@ -943,6 +958,11 @@ namespace libtorrent
 		: m_fd(-1)
 #endif
 		, m_open_mode(0)
+#if TORRENT_USE_MMAP
+		, m_map_base(0)
+		, m_map_offset(0)
+		, m_map_size(0)
+#endif
 	{
 		// the return value is not important, since the
 		// error code contains the same information
@@ -1327,6 +1347,9 @@ typedef struct _FILE_ALLOCATED_RANGE_BUFFER {
 		m_file_handle = INVALID_HANDLE_VALUE;
 		m_path.clear();
 #else
+#if TORRENT_USE_MMAP
+		unmap_region();
+#endif
 		if (m_fd == -1) return;
 		::close(m_fd);
 		m_fd = -1;
@@ -1364,6 +1387,126 @@ typedef struct _FILE_ALLOCATED_RANGE_BUFFER {
 #endif
 	}
 
+#if TORRENT_USE_SENDFILE
+	int file::sendfile(int socket, size_type file_offset, int len, error_code& ec)
+	{
+		TORRENT_ASSERT(is_open());
+		off_t offset = file_offset;
+		if (offset != file_offset)
+		{
+			// off_t is only 32 bits on this platform
+			ec.assign(EOVERFLOW, boost::system::get_generic_category());
+			return -1;
+		}
+		int ret = ::sendfile(socket, m_fd, &offset, len);
+		if (ret < 0)
+		{
+			ec.assign(errno, boost::system::get_generic_category());
+			return -1;
+		}
+		return ret;
+	}
+#endif
+
+#if TORRENT_USE_MMAP
+
+	// the size of the window of the file that is kept mapped. Accesses
+	// within the same window don't need any system call. This has to be
+	// a multiple of the page size
+	enum { mmap_window_size = 8 * 1024 * 1024 };
+
+	void file::unmap_region()
+	{
+		if (m_map_base == 0) return;
+		munmap(m_map_base, m_map_size);
+		m_map_base = 0;
+		m_map_offset = 0;
+		m_map_size = 0;
+	}
+
+	char* file::map_region(size_type file_offset, int& len, error_code& ec)
+	{
+		if (m_map_base
+			&& file_offset >= m_map_offset
+			&& file_offset + len <= m_map_offset + m_map_size)
+			return m_map_base + (file_offset - m_map_offset);
+
+		unmap_region();
+
+		size_type file_size = get_size(ec);
+		if (ec) return 0;
+
+		// touching pages past the end of the file raises SIGBUS.
+		// Reads past the end are short instead, just like pread()
+		if (file_offset >= file_size) { len = 0; return 0; }
+		if (file_offset + len > file_size) len = int(file_size - file_offset);
+
+		size_type start = file_offset - (file_offset % mmap_window_size);
+		size_type end = (std::max)(start + mmap_window_size, file_offset + len);
+		if (end > file_size) end = file_size;
+
+		// without large file support, offsets past 2 GiB can't be
+		// expressed. Let the caller fall back to regular I/O
+		if (sizeof(off_t) < 8 && end > size_type(INT_MAX)) return 0;
+
+		void* base = mmap(0, size_t(end - start), PROT_READ, MAP_SHARED, m_fd, off_t(start));
+		if (base == MAP_FAILED)
+		{
+			ec.assign(errno, get_posix_category());
+			return 0;
+		}
+
+		m_map_base = (char*)base;
+		m_map_offset = start;
+		m_map_size = end - start;
+		madvise(m_map_base, m_map_size
+			, (m_open_mode & random_access) ? MADV_RANDOM : MADV_SEQUENTIAL);
+		return m_map_base + (file_offset - m_map_offset);
+	}
+
+	size_type file::mmap_readv(size_type file_offset, iovec_t const* bufs, int num_bufs, error_code& ec)
+	{
+		if (m_fd == -1)
+		{
+			ec = error_code(EBADF, get_system_category());
+			return -1;
+		}
+		TORRENT_ASSERT(bufs);
+		TORRENT_ASSERT(num_bufs > 0);
+
+		// files opened with O_DIRECT bypass the page cache, there's
+		// nothing to gain from mapping them
+		if (m_open_mode & no_buffer) return readv(file_offset, bufs, num_bufs, ec);
+
+		int size = bufs_size(bufs, num_bufs);
+		char* p = map_region(file_offset, size, ec);
+		if (ec) return -1;
+		if (size == 0) return 0;
+		if (p == 0) return readv(file_offset, bufs, num_bufs, ec);
+
+		int left = size;
+		for (iovec_t const* i = bufs, *end(bufs + num_bufs); i != end && left > 0; ++i)
+		{
+			int len = (std::min)(int(i->iov_len), left);
+			memcpy(i->iov_base, p, len);
+			p += len;
+			left -= len;
+		}
+		return size;
+	}
+
+	size_type file::mmap_writev(size_type file_offset, iovec_t const* bufs, int num_bufs, error_code& ec)
+	{
+		// writes don't go through the mapping. Storing into a mapped
+		// page whose blocks aren't allocated yet (a sparse file, or a
+		// full disk) raises SIGBUS instead of failing with ENOSPC.
+		// pwrite() reports that as an error, and since the mapping is
+		// of the page cache, reads through it see the new data
+		return writev(file_offset, bufs, num_bufs, ec);
+	}
+
+#endif // TORRENT_USE_MMAP
+
 	size_type file::readv(size_type file_offset, iovec_t const* bufs, int num_bufs, error_code& ec)
 	{
 #ifdef TORRENT_WINDOWS
@@ -2033,6 +2176,11 @@ typedef struct _FILE_ALLOCATED_RANGE_BUFFER {
   		TORRENT_ASSERT(is_open());
   		TORRENT_ASSERT(s >= 0);
 
+#if TORRENT_USE_MMAP
+		// the mapped window may extend past the new end of the file
+		unmap_region();
+#endif
+
 #ifdef TORRENT_WINDOWS
 
 		if ((m_open_mode & no_buffer) && (s & (size_alignment()-1)) != 0)
@@ -44,6 +44,7 @@ namespace libtorrent
 	file_pool::file_pool(int size)
 		: m_size(size)
 		, m_low_prio_io(true)
+		, m_num_open(0)
 #if TORRENT_CLOSE_MAY_BLOCK
 		, m_stop_thread(false)
 		, m_closer_thread(boost::bind(&file_pool::closer_thread_fun, this))
@@ -101,6 +102,79 @@ namespace libtorrent
 	}
 #endif
 
+	file_pool::shard& file_pool::shard_for(void* st)
+	{
+		// the low bits of a heap pointer are always zero
+		return m_shards[(std::size_t(st) >> 4) % num_shards];
+	}
+
+	void file_pool::lru_unlink(shard& s, lru_file_entry& e)
+	{
+		if (e.prev) e.prev->next = e.next;
+		else s.lru_head = e.next;
+		if (e.next) e.next->prev = e.prev;
+		else s.lru_tail = e.prev;
+		e.prev = 0;
+		e.next = 0;
+	}
+
+	void file_pool::lru_push_front(shard& s, lru_file_entry& e)
+	{
+		TORRENT_ASSERT(e.prev == 0 && e.next == 0);
+		e.next = s.lru_head;
+		if (s.lru_head) s.lru_head->prev = &e;
+		s.lru_head = &e;
+		if (s.lru_tail == 0) s.lru_tail = &e;
+	}
+
+	void file_pool::remove_entry(shard& s, file_set::iterator i
+		, std::vector<boost::intrusive_ptr<file> >& closed)
+	{
+		lru_unlink(s, i->second);
+		closed.push_back(i->second.file_ptr);
+		s.files.erase(i);
+		--m_num_open;
+	}
+
+	bool file_pool::remove_oldest(shard& s
+		, std::vector<boost::intrusive_ptr<file> >& closed)
+	{
+		lru_file_entry* e = s.lru_tail;
+		if (e == 0) return false;
+		file_set::iterator i = s.files.find(file_key(e->key, e->file_index));
+		TORRENT_ASSERT(i != s.files.end());
+		remove_entry(s, i, closed);
+		return true;
+	}
+
+	void file_pool::close_files(std::vector<boost::intrusive_ptr<file> >& files)
+	{
+		if (files.empty()) return;
+#if TORRENT_CLOSE_MAY_BLOCK
+		mutex::scoped_lock l(m_closer_mutex);
+		m_queued_for_close.insert(m_queued_for_close.end(), files.begin(), files.end());
+		l.unlock();
+#endif
+		// unless some other thread still holds a reference, this
+		// closes the files
+		files.clear();
+	}
+
+	void file_pool::trim(shard& s)
+	{
+		std::vector<boost::intrusive_ptr<file> > closed;
+		// start with the shard we just added a file to. It's the
+		// most likely to have cold files belonging to the same torrent
+		int start = &s - m_shards;
+		for (int k = 0; k < num_shards && m_num_open > m_size; ++k)
+		{
+			shard& sh = m_shards[(start + k) % num_shards];
+			mutex::scoped_lock l(sh.mtx);
+			while (m_num_open > m_size && remove_oldest(sh, closed));
+		}
+		close_files(closed);
+	}
+
 	boost::intrusive_ptr<file> file_pool::open_file(void* st, std::string const& p
 		, file_storage::iterator fe, file_storage const& fs, int m, error_code& ec)
 	{
@@ -108,12 +182,15 @@ namespace libtorrent
 		TORRENT_ASSERT(is_complete(p));
 		TORRENT_ASSERT((m & file::rw_mask) == file::read_only
 			|| (m & file::rw_mask) == file::read_write);
-		mutex::scoped_lock l(m_mutex);
-		file_set::iterator i = m_files.find(std::make_pair(st, fs.file_index(*fe)));
-		if (i != m_files.end())
+		file_key k(st, fs.file_index(*fe));
+		shard& s = shard_for(st);
+		std::vector<boost::intrusive_ptr<file> > closed;
+
+		mutex::scoped_lock l(s.mtx);
+		file_set::iterator i = s.files.find(k);
+		if (i != s.files.end())
 		{
 			lru_file_entry& e = i->second;
-			e.last_use = time_now();
 
 			if (e.key != st && ((e.mode & file::rw_mask) != file::read_only
 				|| (m & file::rw_mask) != file::read_only))
@@ -126,7 +203,6 @@ namespace libtorrent
 				return boost::intrusive_ptr<file>();
 			}
 
-			e.key = st;
 			// if we asked for a file in write mode,
 			// and the cached file is is not opened in
 			// write mode, re-open it
@@ -136,127 +212,121 @@ namespace libtorrent
 				|| (e.mode & file::random_access) != (m & file::random_access))
 			{
 				// close the file before we open it with
-				// the new read/write privilages
+				// the new read/write privilages. It's taken out
+				// of the pool while we don't hold the mutex
 				TORRENT_ASSERT(e.file_ptr->refcount() == 1);
+				remove_entry(s, i, closed);
+			}
+			else
+			{
+				lru_unlink(s, e);
+				lru_push_front(s, e);
+				return e.file_ptr;
+			}
+		}
+		l.unlock();
+		close_files(closed);
 
-#if TORRENT_CLOSE_MAY_BLOCK
-				mutex::scoped_lock l(m_closer_mutex);
-				m_queued_for_close.push_back(e.file_ptr);
-				l.unlock();
-				e.file_ptr = new file;
-#else
-				e.file_ptr->close();
-#endif
-				std::string full_path = combine_path(p, fs.file_path(*fe));
-				if (!e.file_ptr->open(full_path, m, ec))
-				{
-					m_files.erase(i);
-					return boost::intrusive_ptr<file>();
-				}
+		// the file is not in our cache. Open it without holding
+		// the mutex, since open() may block on the disk
+		boost::intrusive_ptr<file> f(new (std::nothrow) file);
+		if (!f)
+		{
+			ec = error_code(ENOMEM, get_posix_category());
+			return f;
+		}
+		std::string full_path = combine_path(p, fs.file_path(*fe));
+		if (!f->open(full_path, m, ec))
+			return boost::intrusive_ptr<file>();
 #ifdef TORRENT_WINDOWS
 // file prio is supported on vista and up
 #if _WIN32_WINNT >= 0x0600
-				if (m_low_prio_io)
-				{
-					// TODO: load this function dynamically from Kernel32.dll
-					FILE_IO_PRIORITY_HINT_INFO priorityHint;
-					priorityHint.PriorityHint = IoPriorityHintLow;
-					SetFileInformationByHandle(e.file_ptr->native_handle(),
-						FileIoPriorityHintInfo, &priorityHint, sizeof(priorityHint));
-				}
+		if (m_low_prio_io)
+		{
+			// TODO: load this function dynamically from Kernel32.dll
+			FILE_IO_PRIORITY_HINT_INFO priorityHint;
+			priorityHint.PriorityHint = IoPriorityHintLow;
+			SetFileInformationByHandle(f->native_handle(),
+				FileIoPriorityHintInfo, &priorityHint, sizeof(priorityHint));
+		}
 #endif
 #endif
-				TORRENT_ASSERT(e.file_ptr->is_open());
-				e.mode = m;
-			}
-			TORRENT_ASSERT((e.mode & file::no_buffer) == (m & file::no_buffer));
-			return e.file_ptr;
-		}
-		// the file is not in our cache
-		if ((int)m_files.size() >= m_size)
+		TORRENT_ASSERT(f->is_open());
+
+		l.lock();
+		std::pair<file_set::iterator, bool> r = s.files.insert(
+			std::make_pair(k, lru_file_entry()));
+		lru_file_entry& e = r.first->second;
+		if (r.second)
 		{
-			// the file cache is at its maximum size, close
-			// the least recently used (lru) file from it
-			remove_oldest();
+			e.key = st;
+			e.file_index = k.second;
+			++m_num_open;
 		}
-		lru_file_entry e;
-		e.file_ptr.reset(new (std::nothrow)file);
-		if (!e.file_ptr)
+		else
 		{
-			ec = error_code(ENOMEM, get_posix_category());
-			return e.file_ptr;
+			// another thread opened the same file while we
+			// were opening it. Replace its handle with ours,
+			// which is known to have the requested mode
+			closed.push_back(e.file_ptr);
+			lru_unlink(s, e);
 		}
-		std::string full_path = combine_path(p, fs.file_path(*fe));
-		if (!e.file_ptr->open(full_path, m, ec))
-			return boost::intrusive_ptr<file>();
+		e.file_ptr = f;
 		e.mode = m;
-		e.key = st;
-		m_files.insert(std::make_pair(std::make_pair(st, fs.file_index(*fe)), e));
-		TORRENT_ASSERT(e.file_ptr->is_open());
-		return e.file_ptr;
-	}
-
-	void file_pool::remove_oldest()
-	{
-		file_set::iterator i = std::min_element(m_files.begin(), m_files.end()
-			, boost::bind(&lru_file_entry::last_use, boost::bind(&file_set::value_type::second, _1))
-				< boost::bind(&lru_file_entry::last_use, boost::bind(&file_set::value_type::second, _2)));
-		if (i == m_files.end()) return;
-
-#if TORRENT_CLOSE_MAY_BLOCK
-		mutex::scoped_lock l(m_closer_mutex);
-		m_queued_for_close.push_back(i->second.file_ptr);
+		lru_push_front(s, e);
 		l.unlock();
-#endif
-		m_files.erase(i);
+		close_files(closed);
+
+		// the file cache is at its maximum size, close
+		// the least recently used (lru) files from it
+		if (m_num_open > m_size) trim(s);
+		return f;
 	}
 
 	void file_pool::release(void* st, int file_index)
 	{
-		mutex::scoped_lock l(m_mutex);
-		file_set::iterator i = m_files.find(std::make_pair(st, file_index));
-		if (i == m_files.end()) return;
-		
-#if TORRENT_CLOSE_MAY_BLOCK
-		mutex::scoped_lock l2(m_closer_mutex);
-		m_queued_for_close.push_back(i->second.file_ptr);
-		l2.unlock();
-#endif
-		m_files.erase(i);
+		shard& s = shard_for(st);
+		std::vector<boost::intrusive_ptr<file> > closed;
+		mutex::scoped_lock l(s.mtx);
+		file_set::iterator i = s.files.find(file_key(st, file_index));
+		if (i == s.files.end()) return;
+		remove_entry(s, i, closed);
+		l.unlock();
+		close_files(closed);
 	}
 
 	// closes files belonging to the specified
 	// storage. If 0 is passed, all files are closed
 	void file_pool::release(void* st)
 	{
-		mutex::scoped_lock l(m_mutex);
-		if (st == 0)
+		std::vector<boost::intrusive_ptr<file> > closed;
+		for (int k = 0; k < num_shards; ++k)
 		{
-			m_files.clear();
-			return;
-		}
+			shard& s = m_shards[k];
+			if (st != 0 && &s != &shard_for(st)) continue;
 
-		for (file_set::iterator i = m_files.begin();
-			i != m_files.end();)
-		{
-			if (i->second.key == st)
-				m_files.erase(i++);
-			else
-				++i;
+			mutex::scoped_lock l(s.mtx);
+			for (file_set::iterator i = s.files.begin();
+				i != s.files.end();)
+			{
+				if (st == 0 || i->second.key == st)
+					remove_entry(s, i++, closed);
+				else
+					++i;
+			}
 		}
+		close_files(closed);
 	}
 
 	void file_pool::resize(int size)
 	{
 		TORRENT_ASSERT(size > 0);
 		if (size == m_size) return;
-		mutex::scoped_lock l(m_mutex);
 		m_size = size;
-		if (int(m_files.size()) <= m_size) return;
+		if (m_num_open <= m_size) return;
 
 		// close the least recently used files
-		while (int(m_files.size()) > m_size)
-			remove_oldest();
+		trim(m_shards[0]);
 	}
 
 }
@@ -0,0 +1,154 @@
+/*
+
+Copyright (c) 2026, PopcornTV contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <boost/bind.hpp>
+#include "libtorrent/hash_pool.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/assert.hpp"
+
+namespace libtorrent
+{
+	hash_pool::hash_pool()
+		: m_abort(false)
+	{}
+
+	hash_pool::~hash_pool()
+	{
+		stop();
+	}
+
+	void hash_pool::set_num_threads(int num_threads)
+	{
+		if (num_threads < 0) num_threads = 0;
+		if (num_threads == int(m_threads.size())) return;
+
+		// there's no way to stop individual threads. Stop all of
+		// them and start the ones we want
+		if (num_threads < int(m_threads.size())) stop();
+
+		while (int(m_threads.size()) < num_threads)
+		{
+			m_threads.push_back(boost::shared_ptr<thread>(
+				new thread(boost::bind(&hash_pool::thread_fun, this))));
+		}
+	}
+
+	void hash_pool::stop()
+	{
+		if (m_threads.empty()) return;
+
+		mutex::scoped_lock l(m_mutex);
+		m_abort = true;
+		m_cond.signal_all(l);
+		l.unlock();
+
+		for (std::vector<boost::shared_ptr<thread> >::iterator i = m_threads.begin()
+			, end(m_threads.end()); i != end; ++i)
+			(*i)->join();
+		m_threads.clear();
+
+		l.lock();
+		TORRENT_ASSERT(m_jobs.empty());
+		m_abort = false;
+	}
+
+	void hash_pool::async_hash(boost::shared_ptr<job> const& j)
+	{
+		TORRENT_ASSERT(!j->done);
+		if (m_threads.empty())
+		{
+			hash(*j);
+			j->done = true;
+			return;
+		}
+
+		mutex::scoped_lock l(m_mutex);
+		m_jobs.push_back(j);
+		m_cond.signal_all(l);
+	}
+
+	void hash_pool::wait(job const& j)
+	{
+		mutex::scoped_lock l(m_mutex);
+		while (!j.done) m_cond.wait(l);
+	}
+
+	void hash_pool::thread_fun()
+	{
+		mutex::scoped_lock l(m_mutex);
+		for (;;)
+		{
+			// the queue is drained before the threads exit, anyone
+			// waiting for a job relies on it being hashed
+			while (m_jobs.empty() && !m_abort) m_cond.wait(l);
+			if (m_jobs.empty()) return;
+
+			boost::shared_ptr<job> j = m_jobs.front();
+			m_jobs.pop_front();
+			l.unlock();
+
+			hash(*j);
+
+			l.lock();
+			j->done = true;
+			m_cond.signal_all(l);
+		}
+	}
+
+	void hash_pool::hash(job& j)
+	{
+		hasher h;
+		int small_left = j.small_size;
+		for (std::vector<file::iovec_t>::iterator i = j.bufs.begin()
+			, end(j.bufs.end()); i != end; ++i)
+		{
+			char const* buf = (char const*)i->iov_base;
+			int len = i->iov_len;
+			if (small_left > 0 && small_left <= len)
+			{
+				// the small hash ends in this buffer
+				h.update(buf, small_left);
+				j.small_hash = hasher(h).final();
+				buf += small_left;
+				len -= small_left;
+				small_left = 0;
+			}
+			else if (small_left > 0)
+			{
+				small_left -= len;
+			}
+			if (len > 0) h.update(buf, len);
+		}
+		j.hash = h.final();
+	}
+}
+
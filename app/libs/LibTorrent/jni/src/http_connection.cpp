@@ -37,6 +37,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/parse_url.hpp"
 #include "libtorrent/socket.hpp"
 #include "libtorrent/connection_queue.hpp"
+#include "libtorrent/resolver.hpp"
 #include "libtorrent/socket_type.hpp" // for async_shutdown
 
 #if defined TORRENT_ASIO_DEBUGGING
@@ -58,13 +59,14 @@ http_connection::http_connection(io_service& ios, connection_queue& cc
 #ifdef TORRENT_USE_OPENSSL
 	, boost::asio::ssl::context* ssl_ctx
 #endif
-	)
+	, resolver* host_resolver)
 	: m_sock(ios)
 #if TORRENT_USE_I2P
 	, m_i2p_conn(0)
 #endif
 	, m_read_pos(0)
 	, m_resolver(ios)
+	, m_host_resolver(host_resolver)
 	, m_handler(handler)
 	, m_connect_handler(ch)
 	, m_filter_handler(fh)
@@ -373,9 +375,17 @@ void http_connection::start(std::string const& hostname, std::string const& port
 			add_outstanding_async("http_connection::on_resolve");
 #endif
 			m_endpoints.clear();
-			tcp::resolver::query query(hostname, port);
-			m_resolver.async_resolve(query, boost::bind(&http_connection::on_resolve
-				, me, _1, _2));
+			if (m_host_resolver)
+			{
+				m_host_resolver->async_resolve(hostname, boost::bind(
+					&http_connection::on_cached_resolve, me, _1, _2));
+			}
+			else
+			{
+				tcp::resolver::query query(hostname, port);
+				m_resolver.async_resolve(query, boost::bind(&http_connection::on_resolve
+					, me, _1, _2));
+			}
 		}
 		m_hostname = hostname;
 		m_port = port;
@@ -514,6 +524,38 @@ void http_connection::on_resolve(error_code const& e
 	std::transform(i, tcp::resolver::iterator(), std::back_inserter(m_endpoints)
 		, boost::bind(&tcp::resolver::iterator::value_type::endpoint, _1));
 
+	on_endpoints();
+}
+
+void http_connection::on_cached_resolve(error_code const& e
+	, std::vector<address> const& addresses)
+{
+#if defined TORRENT_ASIO_DEBUGGING
+	complete_async("http_connection::on_resolve");
+#endif
+	// a lookup through the shared resolver can't be cancelled
+	// by close(), so it may complete after we've been closed
+	if (m_abort) return;
+
+	if (e)
+	{
+		boost::shared_ptr<http_connection> me(shared_from_this());
+
+		callback(e);
+		close();
+		return;
+	}
+
+	int port = atoi(m_port.c_str());
+	for (std::vector<address>::const_iterator i = addresses.begin()
+		, end(addresses.end()); i != end; ++i)
+		m_endpoints.push_back(tcp::endpoint(*i, port));
+
+	on_endpoints();
+}
+
+void http_connection::on_endpoints()
+{
 	if (m_filter_handler) m_filter_handler(*this, m_endpoints);
 	if (m_endpoints.empty())
 	{
@@ -590,7 +632,12 @@ void http_connection::on_connect(error_code const& e)
 #endif
 	if (m_connection_ticket >= 0)
 	{
-		m_cc.done(m_connection_ticket);
+		m_cc.done(m_connection_ticket
+			, !e || e == boost::system::errc::connection_refused
+			? connection_queue::responded
+			: e == asio::error::operation_aborted
+			? connection_queue::cancelled
+			: connection_queue::failed);
 		m_connection_ticket = -1;
 	}
 
@@ -60,6 +60,35 @@ namespace libtorrent
 			&& http_status < 400;
 	}
 
+	namespace
+	{
+		// like read_until(), but returns the token as a pointer
+		// range into the string, rather than a copy
+		std::pair<char const*, char const*> read_token(char const*& str
+			, char delim, char const* end)
+		{
+			TORRENT_ASSERT(str <= end);
+			char const* start = str;
+			while (str != end && *str != delim) ++str;
+			std::pair<char const*, char const*> ret(start, str);
+			// skip the delimiter as well
+			while (str != end && *str == delim) ++str;
+			return ret;
+		}
+
+		// returns true if [begin, end) is the same string as the lower
+		// case key, ignoring case
+		bool name_equals(char const* begin, char const* end, char const* key)
+		{
+			for (; begin != end; ++begin, ++key)
+			{
+				if (*key == 0) return false;
+				if (to_lower(*begin) != *key) return false;
+			}
+			return *key == 0;
+		}
+	}
+
 	http_parser::~http_parser() {}
 
 	http_parser::http_parser(int flags)
@@ -128,8 +157,31 @@ restart_response:
 			boost::get<1>(ret) += newline - (m_recv_buffer.begin + start_pos);
 			pos = newline;
 
-			m_protocol = read_until(line, ' ', line_end);
-			if (m_protocol.substr(0, 5) == "HTTP/")
+			if (m_flags & dont_copy_headers)
+			{
+				std::pair<char const*, char const*> token = read_token(line, ' ', line_end);
+				m_protocol_view = make_span(token.first, token.second);
+				if (token.second - token.first >= 5
+					&& std::equal(token.first, token.first + 5, "HTTP/"))
+				{
+					token = read_token(line, ' ', line_end);
+					m_status_code = token.first == token.second ? 0 : atoi(token.first);
+					token = read_token(line, '\r', line_end);
+					m_message_view = make_span(token.first, token.second);
+				}
+				else
+				{
+					m_method_view = m_protocol_view;
+					// the content length is assumed to be 0 for requests
+					m_content_length = 0;
+					token = read_token(line, ' ', line_end);
+					m_path_view = make_span(token.first, token.second);
+					token = read_token(line, ' ', line_end);
+					m_protocol_view = make_span(token.first, token.second);
+					m_status_code = 0;
+				}
+			}
+			else if ((m_protocol = read_until(line, ' ', line_end)).substr(0, 5) == "HTTP/")
 			{
 				m_status_code = atoi(read_until(line, ' ', line_end).c_str());
 				m_server_message = read_until(line, '\r', line_end);
@@ -153,21 +205,20 @@ restart_response:
 		{
 			TORRENT_ASSERT(!m_finished);
 			char const* newline = std::find(pos, recv_buffer.end, '\n');
-			std::string line;
 
 			while (newline != recv_buffer.end && m_state == read_header)
 			{
 				// if the LF character is preceeded by a CR
-				// charachter, don't copy it into the line string.
+				// charachter, it's not part of the line
+				char const* line = pos;
 				char const* line_end = newline;
 				if (pos != line_end && *(line_end - 1) == '\r') --line_end;
-				line.assign(pos, line_end);
 				++newline;
 				m_recv_pos += newline - pos;
 				pos = newline;
 
-				std::string::size_type separator = line.find(':');
-				if (separator == std::string::npos)
+				char const* separator = std::find(line, line_end, ':');
+				if (separator == line_end)
 				{
 					if (m_status_code == 100)
 					{
@@ -189,38 +240,50 @@ restart_response:
 					break;
 				}
 
-				std::string name = line.substr(0, separator);
-				std::transform(name.begin(), name.end(), name.begin(), &to_lower);
-				++separator;
+				char const* value = separator + 1;
 				// skip whitespace
-				while (separator < line.size()
-					&& (line[separator] == ' ' || line[separator] == '\t'))
-					++separator;
-				std::string value = line.substr(separator, std::string::npos);
-				m_header.insert(std::make_pair(name, value));
+				while (value < line_end && (*value == ' ' || *value == '\t'))
+					++value;
+
+				if (m_flags & dont_copy_headers)
+				{
+					m_header_views.push_back(std::make_pair(make_span(line, separator)
+						, make_span(value, line_end)));
+				}
+				else
+				{
+					std::string name(line, separator);
+					std::transform(name.begin(), name.end(), name.begin(), &to_lower);
+					m_header.insert(std::make_pair(name, std::string(value, line_end)));
+				}
 
-				if (name == "content-length")
+				// the values below are parsed straight out of the receive
+				// buffer. The number parsing stops at the end of the line,
+				// as long as the value isn't empty (strtoll() would skip
+				// the line break)
+				if (name_equals(line, separator, "content-length"))
 				{
-					m_content_length = strtoll(value.c_str(), 0, 10);
+					m_content_length = value == line_end ? 0 : strtoll(value, 0, 10);
 				}
-				else if (name == "content-range")
+				else if (name_equals(line, separator, "content-range"))
 				{
 					bool success = true;
-					char const* ptr = value.c_str();
+					char const* ptr = value;
 
 					// apparently some web servers do not send the "bytes"
 					// in their content-range. Don't treat it as an error
 					// if we can't find it, just assume the byte counters
 					// start immediately
 					if (string_begins_no_case("bytes ", ptr)) ptr += 6;
-					char* end;
-					m_range_start = strtoll(ptr, &end, 10);
+					char* end = const_cast<char*>(ptr);
+					if (ptr < line_end) m_range_start = strtoll(ptr, &end, 10);
 					if (end == ptr) success = false;
 					else if (*end != '-') success = false;
 					else
 					{
 						ptr = end + 1;
-						m_range_end = strtoll(ptr, &end, 10);
+						end = const_cast<char*>(ptr);
+						if (ptr < line_end) m_range_end = strtoll(ptr, &end, 10);
 						if (end == ptr) success = false;
 					}
 
@@ -233,9 +296,9 @@ restart_response:
 					// the http range is inclusive
 					m_content_length = m_range_end - m_range_start + 1;
 				}
-				else if (name == "transfer-encoding")
+				else if (name_equals(line, separator, "transfer-encoding"))
 				{
-					m_chunked_encoding = string_begins_no_case("chunked", value.c_str());
+					m_chunked_encoding = string_begins_no_case("chunked", value);
 				}
 
 				TORRENT_ASSERT(m_recv_pos <= recv_buffer.left());
@@ -259,6 +322,8 @@ restart_response:
 					if (payload > 0)
 					{
 						TORRENT_ASSERT(payload < INT_MAX);
+						if (m_body_handler)
+							m_body_handler(recv_buffer.begin + m_recv_pos, int(payload));
 						m_recv_pos += payload;
 						boost::get<0>(ret) += int(payload);
 						incoming -= int(payload);
@@ -268,7 +333,7 @@ restart_response:
 					int header_size;
 					if (parse_chunk_header(buf, &chunk_size, &header_size))
 					{
-						if (chunk_size > 0)
+						if (chunk_size > 0 && !m_body_handler)
 						{
 							std::pair<size_type, size_type> chunk_range(m_cur_chunk_end + header_size
 								, m_cur_chunk_end + header_size + chunk_size);
@@ -305,8 +370,12 @@ restart_response:
 					boost::get<1>(ret) += header_size;
 					incoming -= header_size;
 				}
-				if (incoming > 0)
+				// once the terminating chunk has been read, whatever
+				// follows belongs to the next (pipelined) response
+				if (incoming > 0 && !m_finished)
 				{
+					if (m_body_handler)
+						m_body_handler(recv_buffer.begin + m_recv_pos, incoming);
 					m_recv_pos += incoming;
 					boost::get<0>(ret) += incoming;
 //					incoming = 0;
@@ -323,6 +392,8 @@ restart_response:
 				}
 
 				TORRENT_ASSERT(incoming >= 0);
+				if (m_body_handler && incoming > 0)
+					m_body_handler(recv_buffer.begin + m_recv_pos, incoming);
 				m_recv_pos += incoming;
 				boost::get<0>(ret) += incoming;
 			}
@@ -399,6 +470,7 @@ restart_response:
 
 				// we were successfull in parsing the headers.
 				// add them to the headers in the parser
+				if (m_flags & dont_copy_headers) return true;
 				for (std::map<std::string, std::string>::const_iterator i = tail_headers.begin();
 					i != tail_headers.end(); ++i)
 					m_header.insert(std::make_pair(i->first, i->second));
@@ -449,6 +521,11 @@ restart_response:
 		m_recv_buffer.begin = 0;
 		m_recv_buffer.end = 0;
 		m_header.clear();
+		m_protocol_view = span();
+		m_method_view = span();
+		m_path_view = span();
+		m_message_view = span();
+		m_header_views.clear();
 		m_chunked_encoding = false;
 		m_chunked_ranges.clear();
 		m_cur_chunk_end = -1;
@@ -456,6 +533,32 @@ restart_response:
 		m_partial_chunk_header = 0;
 	}
 	
+	int http_parser::next_response()
+	{
+		TORRENT_ASSERT(m_finished);
+		TORRENT_ASSERT(m_recv_pos < INT_MAX);
+		int start = int(m_recv_pos);
+		buffer::const_interval recv_buffer = m_recv_buffer;
+		reset();
+		m_recv_pos = start;
+		// make incoming() treat everything past the end of the
+		// previous response as new
+		m_recv_buffer = buffer::const_interval(recv_buffer.begin
+			, recv_buffer.begin + start);
+		return start;
+	}
+
+	buffer::const_interval http_parser::header_view(char const* key) const
+	{
+		for (std::vector<std::pair<span, span> >::const_iterator i = m_header_views.begin()
+			, end(m_header_views.end()); i != end; ++i)
+		{
+			buffer::const_interval name = view(i->first);
+			if (name_equals(name.begin, name.end, key)) return view(i->second);
+		}
+		return buffer::const_interval(0, 0);
+	}
+
 	int http_parser::collapse_chunk_headers(char* buffer, int size) const
 	{
 		if (!chunked_encoding()) return size;
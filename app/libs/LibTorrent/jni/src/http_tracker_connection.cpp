@@ -76,7 +76,7 @@ namespace libtorrent
 		, tracker_manager& man
 		, tracker_request const& req
 		, boost::weak_ptr<request_callback> c
-		, aux::session_impl const& ses
+		, aux::session_impl& ses
 		, proxy_settings const& ps
 		, std::string const& auth
 #if TORRENT_USE_I2P
@@ -219,7 +219,7 @@ namespace libtorrent
 #ifdef TORRENT_USE_OPENSSL
 			, tracker_req().ssl_ctx
 #endif
-			));
+			, &m_ses.m_host_resolver));
 
 		int timeout = tracker_req().event==tracker_request::stopped
 			?settings.stop_tracker_timeout
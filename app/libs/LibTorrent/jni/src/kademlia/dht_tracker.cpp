@@ -93,6 +93,26 @@ namespace
 		}
 	}
 
+	// reads nodes saved by dht_tracker::state(), in the compact node
+	// info format used in find_node responses. 20 bytes node ID, 4
+	// bytes IPv4 address and 2 bytes port
+	void read_node_info(libtorrent::entry const* n
+		, std::vector<std::pair<node_id, libtorrent::udp::endpoint> >& nodes)
+	{
+		using namespace libtorrent;
+		if (n == 0 || n->type() != entry::string_t) return;
+		std::string const& p = n->string();
+		char const* in = p.c_str();
+		char const* end = in + p.size();
+		while (end - in >= 26)
+		{
+			node_id id;
+			std::copy(in, in + 20, id.begin());
+			in += 20;
+			nodes.push_back(std::make_pair(id, read_v4_endpoint<udp::endpoint>(in)));
+		}
+	}
+
 }
 
 namespace libtorrent { namespace dht
@@ -258,6 +278,8 @@ namespace libtorrent { namespace dht
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
 		std::vector<udp::endpoint> initial_nodes;
+		std::vector<std::pair<node_id, udp::endpoint> > good_nodes;
+		std::vector<std::pair<node_id, udp::endpoint> > known_nodes;
 
 		if (bootstrap.type() == entry::dictionary_t)
 		{
@@ -265,8 +287,29 @@ namespace libtorrent { namespace dht
 				if (entry const* nodes = bootstrap.find_key("nodes"))
 					read_endpoint_list<udp::endpoint>(nodes, initial_nodes);
 			} TORRENT_CATCH(std::exception&) {}
+			read_node_info(bootstrap.find_key("good-nodes"), good_nodes);
+			read_node_info(bootstrap.find_key("known-nodes"), known_nodes);
 		}
 
+		// put the nodes we knew about last time back into the routing
+		// table as candidates, rather than starting over from the router
+		// nodes. They are not pinged, so they are not handed out to other
+		// nodes until they respond to us. The bootstrap below, and the
+		// first searches, start out querying them right away. The ones
+		// that were responding last time are also pinged, so that they
+		// are confirmed, and the buckets split the way they were, as soon
+		// as they reply. The ones that have gone away will time out and
+		// be replaced like any other node
+		for (std::vector<std::pair<node_id, udp::endpoint> >::iterator i
+			= good_nodes.begin(), end(good_nodes.end()); i != end; ++i)
+		{
+			m_dht.m_table.heard_about(i->first, i->second);
+			m_dht.add_node(i->second);
+		}
+		for (std::vector<std::pair<node_id, udp::endpoint> >::iterator i
+			= known_nodes.begin(), end(known_nodes.end()); i != end; ++i)
+			m_dht.m_table.heard_about(i->first, i->second);
+
 		error_code ec;
 		m_timer.expires_from_now(seconds(1), ec);
 		m_timer.async_wait(boost::bind(&dht_tracker::tick, self(), _1));
@@ -547,13 +590,20 @@ namespace libtorrent { namespace dht
 		m_dht.incoming(m);
 	}
 
+	// first is the nodes that responded the last time we talked to
+	// them, second is all the others, in the compact node info format.
+	// The routing table only holds IPv4 nodes (it indexes them by their
+	// IPv4 address), so there are no IPv6 nodes to save
 	void add_node_fun(void* userdata, node_entry const& e)
 	{
-		entry* n = (entry*)userdata;
-		std::string node;
-		std::back_insert_iterator<std::string> out(node);
-		write_endpoint(e.ep(), out);
-		n->list().push_back(entry(node));
+		TORRENT_ASSERT(e.addr.is_v4());
+		if (!e.addr.is_v4()) return;
+		std::pair<std::string, std::string>* n
+			= (std::pair<std::string, std::string>*)userdata;
+		std::string& out = e.confirmed() ? n->first : n->second;
+		std::copy(e.id.begin(), e.id.end(), std::back_inserter(out));
+		std::back_insert_iterator<std::string> i(out);
+		write_endpoint(e.ep(), i);
 	}
 	
 	entry dht_tracker::state() const
@@ -561,20 +611,11 @@ namespace libtorrent { namespace dht
 		TORRENT_ASSERT(m_ses.is_network_thread());
 		entry ret(entry::dictionary_t);
 		{
-			entry nodes(entry::list_t);
+			// the routing table and the replacement cache
+			std::pair<std::string, std::string> nodes;
 			m_dht.m_table.for_each_node(&add_node_fun, &add_node_fun, &nodes);
-			bucket_t cache;
-			m_dht.replacement_cache(cache);
-			for (bucket_t::iterator i(cache.begin())
-				, end(cache.end()); i != end; ++i)
-			{
-				std::string node;
-				std::back_insert_iterator<std::string> out(node);
-				write_endpoint(udp::endpoint(i->addr, i->port), out);
-				nodes.list().push_back(entry(node));
-			}
-			if (!nodes.list().empty())
-				ret["nodes"] = nodes;
+			if (!nodes.first.empty()) ret["good-nodes"] = nodes.first;
+			if (!nodes.second.empty()) ret["known-nodes"] = nodes.second;
 		}
 
 		ret["node-id"] = m_dht.nid().to_string();
@@ -185,7 +185,6 @@ find_data::find_data(
 	, m_data_callback(dcallback)
 	, m_nodes_callback(ncallback)
 	, m_target(target)
-	, m_done(false)
 	, m_got_peers(false)
 	, m_noseeds(noseeds)
 {
@@ -236,9 +235,7 @@ void find_data::got_peers(std::vector<tcp::endpoint> const& peers)
 
 void find_data::done()
 {
-	if (m_invoke_count != 0) return;
-
-	m_done = true;
+	if (m_done || !lookup_complete()) return;
 
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 	TORRENT_LOG(traversal) << time_now_string() << "[" << this << "] " << name() << " DONE";
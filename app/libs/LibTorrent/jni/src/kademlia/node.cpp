@@ -69,23 +69,117 @@ extern int g_announces;
 extern int g_failed_announces;
 #endif
 
-// remove peers that have timed out
-void purge_peers(std::set<peer_entry>& peers)
+// the time peers and immutable items are kept after they
+// were last announced
+time_duration const peer_lifetime = minutes(int(announce_interval * 1.5f));
+time_duration const item_lifetime = minutes(60);
+
+bool peer_timed_out(peer_entry const& p, ptime now)
 {
-	for (std::set<peer_entry>::iterator i = peers.begin()
-		  , end(peers.end()); i != end;)
-	{
-		// the peer has timed out
-		if (i->added + minutes(int(announce_interval * 1.5f)) < time_now())
-		{
+	if (p.added + peer_lifetime > now) return false;
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
-			TORRENT_LOG(node) << "peer timed out at: " << i->addr;
+	TORRENT_LOG(node) << "peer timed out at: " << p.addr;
 #endif
-			peers.erase(i++);
-		}
-		else
-			++i;
+	return true;
+}
+
+// remove peers that have timed out. Returns the time the
+// oldest of the remaining peers was added
+ptime purge_peers(std::vector<peer_entry>& peers, ptime now)
+{
+	peers.erase(std::remove_if(peers.begin(), peers.end()
+		, boost::bind(&peer_timed_out, _1, now)), peers.end());
+
+	ptime oldest = max_time();
+	for (std::vector<peer_entry>::const_iterator i = peers.begin()
+		, end(peers.end()); i != end; ++i)
+	{
+		if (i->added < oldest) oldest = i->added;
+	}
+	return oldest;
+}
+
+void expiry_wheel::add(ptime t, node_id const& key)
+{
+	// the cursor may be far behind if we haven't been ticked in a
+	// while, e.g. when the device was asleep. Catch up first, so that
+	// the offset is counted from now, and t fits in the wheel
+	advance(time_now());
+
+	int offset = t < m_cursor_time ? 0
+		: int(total_seconds(t - m_cursor_time) / 60);
+	TORRENT_ASSERT(offset < num_slots);
+	if (offset >= num_slots) offset = num_slots - 1;
+	m_slots[(m_cursor + offset) % num_slots].push_back(key);
+	++m_size;
+}
+
+void expiry_wheel::advance(ptime now)
+{
+	// a slot is done once the minute it covers has passed
+	for (int i = 0; i < num_slots && m_cursor_time + minutes(1) <= now; ++i)
+	{
+		std::vector<node_id>& slot = m_slots[m_cursor];
+		m_due.insert(m_due.end(), slot.begin(), slot.end());
+		// free the memory, the slot won't be used again for a while
+		std::vector<node_id>().swap(slot);
+		m_cursor = (m_cursor + 1) % num_slots;
+		m_cursor_time += minutes(1);
 	}
+	// if we've been away for longer than the wheel spans, every
+	// slot has been handed out. Start over from now
+	if (m_cursor_time + minutes(1) <= now) m_cursor_time = now;
+}
+
+void expiry_wheel::expired(ptime now, std::vector<node_id>& keys)
+{
+	advance(now);
+	keys.insert(keys.end(), m_due.begin(), m_due.end());
+	m_size -= m_due.size();
+	TORRENT_ASSERT(m_size >= 0);
+	std::vector<node_id>().swap(m_due);
+}
+
+// when the entry with the given key in a storage table is due to
+// expire, or min_time() if there's no such entry. Used to compact
+// the expiry wheels
+template <class Table>
+ptime entry_expiry(Table const& table, node_id const& key)
+{
+	typename Table::const_iterator i = table.find(key);
+	if (i == table.end()) return min_time();
+	return i->second.next_expiry;
+}
+
+// removes the items that the fewest nodes have put, until there
+// are at most count left. This sorts the whole table, but only
+// runs once the table is full, and frees a batch of entries so that
+// it isn't needed again for a while
+template <class Table>
+void evict_items(Table& table, int count)
+{
+	std::vector<std::pair<int, node_id> > order;
+	order.reserve(table.size());
+	for (typename Table::const_iterator i = table.begin()
+		, end(table.end()); i != end; ++i)
+		order.push_back(std::make_pair(i->second.num_announcers, i->first));
+	std::sort(order.begin(), order.end());
+
+	for (std::vector<std::pair<int, node_id> >::iterator i = order.begin()
+		, end(order.end()); i != end && int(table.size()) > count; ++i)
+	{
+		typename Table::iterator j = table.find(i->second);
+		TORRENT_ASSERT(j != table.end());
+		free(j->second.value);
+		table.erase(j);
+	}
+}
+
+// the number of entries to keep when a table of size limit
+// is full. An eighth of it is freed at a time
+int eviction_target(int limit)
+{
+	return (std::max)(0, (std::min)(limit - limit / 8, limit - 1));
 }
 
 void nop() {}
@@ -99,6 +193,7 @@ node_impl::node_impl(libtorrent::alert_manager& alerts
 	, m_table(m_id, 8, settings)
 	, m_rpc(m_id, m_table, f, userdata)
 	, m_ext_ip(ext_ip)
+	, m_num_peers(0)
 	, m_last_tracker_tick(time_now())
 	, m_alerts(alerts)
 	, m_send(f)
@@ -364,38 +459,89 @@ time_duration node_impl::connection_timeout()
 {
 	time_duration d = m_rpc.tick();
 	ptime now(time_now());
-	if (now - m_last_tracker_tick < minutes(2)) return d;
+	if (now - m_last_tracker_tick < minutes(1)) return d;
 	m_last_tracker_tick = now;
 
-	for (dht_immutable_table_t::iterator i = m_immutable_table.begin();
-		i != m_immutable_table.end();)
+	expire_entries(now);
+	return d;
+}
+
+void node_impl::expire_entries(ptime now)
+{
+	std::vector<node_id> keys;
+	m_item_expiry.expired(now, keys);
+	for (std::vector<node_id>::iterator k = keys.begin()
+		, end(keys.end()); k != end; ++k)
 	{
-		if (i->second.last_seen + minutes(60) > now)
+		dht_immutable_table_t::iterator i = m_immutable_table.find(*k);
+		// the item may have been evicted already
+		if (i == m_immutable_table.end()) continue;
+		dht_immutable_item& item = i->second;
+		// this is left over from an item by the same key that
+		// was evicted. The one we have is due later
+		if (item.next_expiry > now) continue;
+		if (item.last_seen + item_lifetime > now)
 		{
-			++i;
+			// it's been put again since it was scheduled
+			item.next_expiry = item.last_seen + item_lifetime;
+			m_item_expiry.add(item.next_expiry, *k);
 			continue;
 		}
-		free(i->second.value);
-		m_immutable_table.erase(i++);
+		free(item.value);
+		m_immutable_table.erase(i);
 	}
 
-	// look through all peers and see if any have timed out
-	for (table_t::iterator i = m_map.begin(), end(m_map.end()); i != end;)
+	keys.clear();
+	m_peer_expiry.expired(now, keys);
+	for (std::vector<node_id>::iterator k = keys.begin()
+		, end(keys.end()); k != end; ++k)
 	{
+		table_t::iterator i = m_map.find(*k);
+		if (i == m_map.end()) continue;
 		torrent_entry& t = i->second;
-		node_id const& key = i->first;
-		++i;
-		purge_peers(t.peers);
+		if (t.next_expiry > now) continue;
+		int num_peers = t.peers.size();
+		ptime oldest = purge_peers(t.peers, now);
+		m_num_peers -= num_peers - int(t.peers.size());
 
 		// if there are no more peers, remove the entry altogether
 		if (t.peers.empty())
 		{
-			table_t::iterator i = m_map.find(key);
-			if (i != m_map.end()) m_map.erase(i);
+			m_map.erase(i);
+			continue;
 		}
+
+		// come back when the next peer is due
+		t.next_expiry = oldest + peer_lifetime;
+		m_peer_expiry.add(t.next_expiry, *k);
 	}
+}
 
-	return d;
+void node_impl::evict_torrents(int num_torrents, int num_peers
+	, sha1_hash const& keep)
+{
+	// remove the ones with the fewest peers first. Like evict_items()
+	// this sorts the whole table, but frees enough room that it won't
+	// run again until an eighth of the limits have been used up
+	std::vector<std::pair<int, node_id> > order;
+	order.reserve(m_map.size());
+	for (table_t::const_iterator i = m_map.begin()
+		, end(m_map.end()); i != end; ++i)
+	{
+		if (i->first == keep) continue;
+		order.push_back(std::make_pair(int(i->second.peers.size()), i->first));
+	}
+	std::sort(order.begin(), order.end());
+
+	for (std::vector<std::pair<int, node_id> >::iterator i = order.begin()
+		, end(order.end()); i != end; ++i)
+	{
+		if (int(m_map.size()) <= num_torrents && m_num_peers <= num_peers) break;
+		table_t::iterator j = m_map.find(i->second);
+		TORRENT_ASSERT(j != m_map.end());
+		m_num_peers -= j->second.peers.size();
+		m_map.erase(j);
+	}
 }
 
 void node_impl::status(session_status& s)
@@ -421,15 +567,25 @@ void node_impl::lookup_peers(sha1_hash const& info_hash, int prefix, entry& repl
 	if (m_alerts.should_post<dht_get_peers_alert>())
 		m_alerts.post_alert(dht_get_peers_alert(info_hash));
 
-	table_t::const_iterator i = m_map.lower_bound(info_hash);
-	if (i == m_map.end()) return;
-	if (i->first != info_hash && prefix == 20) return;
-	if (prefix != 20)
+	table_t::const_iterator i = m_map.find(info_hash);
+	if (i == m_map.end() && prefix != 20)
 	{
+		// the table isn't ordered, so for a prefix query, find
+		// the first info-hash at or after the one asked for the
+		// hard way. Hardly anyone sends these
+		for (table_t::const_iterator j = m_map.begin()
+			, end(m_map.end()); j != end; ++j)
+		{
+			if (j->first < info_hash) continue;
+			if (i == m_map.end() || j->first < i->first) i = j;
+		}
+		if (i == m_map.end()) return;
+
 		sha1_hash mask = sha1_hash::max();
 		mask <<= (20 - prefix) * 8;
 		if ((i->first & mask) != (info_hash & mask)) return;
 	}
+	if (i == m_map.end()) return;
 
 	torrent_entry const& v = i->second;
 
@@ -440,7 +596,7 @@ void node_impl::lookup_peers(sha1_hash const& info_hash, int prefix, entry& repl
 		bloom_filter<256> downloaders;
 		bloom_filter<256> seeds;
 
-		for (std::set<peer_entry>::const_iterator i = v.peers.begin()
+		for (std::vector<peer_entry>::const_iterator i = v.peers.begin()
 			, end(v.peers.end()); i != end; ++i)
 		{
 			sha1_hash iphash;
@@ -455,7 +611,7 @@ void node_impl::lookup_peers(sha1_hash const& info_hash, int prefix, entry& repl
 	else
 	{
 		int num = (std::min)((int)v.peers.size(), m_settings.max_peers_reply);
-		std::set<peer_entry>::const_iterator iter = v.peers.begin();
+		std::vector<peer_entry>::const_iterator iter = v.peers.begin();
 		entry::list_type& pe = reply["values"].list();
 		std::string endpoint;
 
@@ -774,21 +930,13 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		// the table get a chance to add it.
 		m_table.node_seen(id, m.addr);
 
-		if (!m_map.empty() && int(m_map.size()) >= m_settings.max_torrents)
+		if ((int(m_map.size()) >= m_settings.max_torrents
+				&& m_map.find(info_hash) == m_map.end())
+			|| m_num_peers >= m_settings.max_total_peers)
 		{
-			// we need to remove some. Remove the ones with the
-			// fewest peers
-			int num_peers = m_map.begin()->second.peers.size();
-			table_t::iterator candidate = m_map.begin();
-			for (table_t::iterator i = m_map.begin()
-				, end(m_map.end()); i != end; ++i)
-			{
-				if (int(i->second.peers.size()) > num_peers) continue;
-				if (i->first == info_hash) continue;
-				num_peers = i->second.peers.size();
-				candidate = i;
-			}
-			m_map.erase(candidate);
+			// we need to remove some
+			evict_torrents(eviction_target(m_settings.max_torrents)
+				, eviction_target(m_settings.max_total_peers), info_hash);
 		}
 		torrent_entry& v = m_map[info_hash];
 
@@ -805,9 +953,41 @@ void node_impl::incoming_request(msg const& m, entry& e)
 		peer.addr = tcp::endpoint(m.addr.address(), port);
 		peer.added = time_now();
 		peer.seed = msg_keys[4] && msg_keys[4]->int_value();
-		std::set<peer_entry>::iterator i = v.peers.find(peer);
-		if (i != v.peers.end()) v.peers.erase(i++);
-		v.peers.insert(i, peer);
+		std::vector<peer_entry>::iterator i = std::lower_bound(
+			v.peers.begin(), v.peers.end(), peer);
+		if (i != v.peers.end() && !(peer < *i))
+		{
+			// we already have this peer, just refresh it
+			*i = peer;
+		}
+		else
+		{
+			if (int(v.peers.size()) >= m_settings.max_peers && !v.peers.empty())
+			{
+				// the torrent is full. Replace the peer that
+				// announced the longest time ago. This is a scan,
+				// but of at most max_peers entries
+				v.peers.erase(std::min_element(v.peers.begin(), v.peers.end()
+					, boost::bind(&peer_entry::added, _1)
+					< boost::bind(&peer_entry::added, _2)));
+				i = std::lower_bound(v.peers.begin(), v.peers.end(), peer);
+			}
+			else
+			{
+				++m_num_peers;
+			}
+			v.peers.insert(i, peer);
+		}
+
+		if (v.next_expiry == min_time())
+		{
+			v.next_expiry = peer.added + peer_lifetime;
+			m_peer_expiry.add(v.next_expiry, info_hash);
+			// the keys of evicted torrents are still in the wheel
+			if (m_peer_expiry.size() > 2 * (std::max)(m_settings.max_torrents, 1))
+				m_peer_expiry.compact(boost::bind(&entry_expiry<table_t>
+					, boost::cref(m_map), _1));
+		}
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 		++g_announces;
 #endif
@@ -869,21 +1049,11 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			dht_immutable_table_t::iterator i = m_immutable_table.find(target);
 			if (i == m_immutable_table.end())
 			{
-				// make sure we don't add too many items
+				// make sure we don't add too many items. Delete the
+				// least important ones (i.e. the ones the fewest
+				// peers are announcing)
 				if (int(m_immutable_table.size()) >= m_settings.max_dht_items)
-				{
-					// delete the least important one (i.e. the one
-					// the fewest peers are announcing)
-					dht_immutable_table_t::iterator j = std::min_element(m_immutable_table.begin()
-						, m_immutable_table.end()
-						, boost::bind(&dht_immutable_item::num_announcers
-							, boost::bind(&dht_immutable_table_t::value_type::second, _1))
-							< boost::bind(&dht_immutable_item::num_announcers
-							, boost::bind(&dht_immutable_table_t::value_type::second, _2)));
-					TORRENT_ASSERT(j != m_immutable_table.end());
-					free(j->second.value);
-					m_immutable_table.erase(j);
-				}
+					evict_items(m_immutable_table, eviction_target(m_settings.max_dht_items));
 				dht_immutable_item to_add;
 				to_add.value = (char*)malloc(buf.second);
 				to_add.size = buf.second;
@@ -924,19 +1094,11 @@ void node_impl::incoming_request(msg const& m, entry& e)
 			dht_mutable_table_t::iterator i = m_mutable_table.find(target);
 			if (i == m_mutable_table.end())
 			{
-				// make sure we don't add too many items
+				// make sure we don't add too many items. Delete the
+				// least important ones (i.e. the ones the fewest
+				// peers are announcing)
 				if (int(m_mutable_table.size()) >= m_settings.max_dht_items)
-				{
-					// delete the least important one (i.e. the one
-					// the fewest peers are announcing)
-					dht_mutable_table_t::iterator j = std::min_element(m_mutable_table.begin()
-						, m_mutable_table.end()
-						, boost::bind(&dht_immutable_item::num_announcers
-							, boost::bind(&dht_mutable_table_t::value_type::second, _1)));
-					TORRENT_ASSERT(j != m_mutable_table.end());
-					free(j->second.value);
-					m_mutable_table.erase(j);
-				}
+					evict_items(m_mutable_table, eviction_target(m_settings.max_dht_items));
 				dht_mutable_item to_add;
 				to_add.value = (char*)malloc(buf.second);
 				to_add.size = buf.second;
@@ -983,6 +1145,16 @@ void node_impl::incoming_request(msg const& m, entry& e)
 
 		f->last_seen = time_now();
 
+		if (!mutable_put && f->next_expiry == min_time())
+		{
+			f->next_expiry = f->last_seen + item_lifetime;
+			m_item_expiry.add(f->next_expiry, target);
+			// the keys of evicted items are still in the wheel
+			if (m_item_expiry.size() > 2 * (std::max)(m_settings.max_dht_items, 1))
+				m_item_expiry.compact(boost::bind(&entry_expiry<dht_immutable_table_t>
+					, boost::cref(m_immutable_table), _1));
+		}
+
 		// maybe increase num_announcers if we haven't seen this IP before
 		sha1_hash iphash;
 		hash_address(m.addr.address(), iphash);
@@ -91,6 +91,16 @@ bootstrap::bootstrap(
 
 char const* bootstrap::name() const { return "bootstrap"; }
 
+void bootstrap::init()
+{
+	refresh::init();
+	// when starting from the nodes saved from last time, query a
+	// whole bucket worth of them at once. Many of them are likely
+	// to have gone away, and we don't want to wait for each of them
+	// to time out before trying the next
+	m_branch_factor = (std::max)(m_branch_factor, m_node.m_table.bucket_size());
+}
+
 void bootstrap::done()
 {
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
@@ -117,6 +117,24 @@ size_type routing_table::num_global_nodes() const
 	else return (size_type(2) << deepest_bucket) * deepest_size;
 }
 
+int routing_table::average_rtt() const
+{
+	int sum = 0;
+	int num = 0;
+	for (table_t::const_iterator i = m_buckets.begin()
+		, end(m_buckets.end()); i != end; ++i)
+	{
+		for (bucket_t::const_iterator j = i->live_nodes.begin()
+			, end(i->live_nodes.end()); j != end; ++j)
+		{
+			if (j->rtt == 0xffff) continue;
+			sum += j->rtt;
+			++num;
+		}
+	}
+	return num == 0 ? -1 : sum / num;
+}
+
 #if (defined TORRENT_DHT_VERBOSE_LOGGING || defined TORRENT_DEBUG) && TORRENT_USE_IOSTREAM
 
 void routing_table::print_state(std::ostream& os) const
@@ -173,6 +191,7 @@ void routing_table::print_state(std::ostream& os) const
 				<< " ip: " << j->ep()
 				<< " fails: " << j->fail_count()
 				<< " pinged: " << j->pinged()
+				<< " rtt: " << j->rtt
 				<< " dist: " << distance_exp(m_id, j->id)
 				<< "\n";
 		}
@@ -379,8 +398,9 @@ bool routing_table::add_node(node_entry const& e)
 		else if (existing && existing->id == e.id)
 		{
 			// if the node ID is the same, just update the failcount
-			// and be done with it
+			// and round trip time and be done with it
 			existing->timeout_count = 0;
+			existing->update_rtt(e.rtt);
 			return ret;
 		}
 		else if (existing)
@@ -415,6 +435,7 @@ bool routing_table::add_node(node_entry const& e)
 		// in this bucket
 		TORRENT_ASSERT(j->id == e.id && j->ep() == e.ep());
 		j->timeout_count = 0;
+		j->update_rtt(e.rtt);
 //		TORRENT_LOG(table) << "updating node: " << i->id << " " << i->addr;
 		return ret;
 	}
@@ -742,9 +763,9 @@ void routing_table::heard_about(node_id const& id, udp::endpoint const& ep)
 // the return value indicates if the table needs a refresh.
 // if true, the node should refresh the table (i.e. do a find_node
 // on its own id)
-bool routing_table::node_seen(node_id const& id, udp::endpoint ep)
+bool routing_table::node_seen(node_id const& id, udp::endpoint ep, int rtt)
 {
-	return add_node(node_entry(id, ep, true));
+	return add_node(node_entry(id, ep, true, rtt));
 }
 
 bool routing_table::need_bootstrap() const
@@ -86,12 +86,9 @@ void intrusive_ptr_release(observer const* o)
 
 void observer::set_target(udp::endpoint const& ep)
 {
-#ifdef TORRENT_DHT_VERBOSE_LOGGING
-	// use high resolution timers for logging
+	// use high resolution timers, the time is
+	// used to measure the round trip time
 	m_sent = time_now_hires();
-#else
-	m_sent = time_now();
-#endif
 
 	m_port = ep.port();
 #if TORRENT_USE_IPV6
@@ -312,10 +309,11 @@ bool rpc_manager::incoming(msg const& m, node_id* id)
 		return false;
 	}
 
+	int rtt = int(total_milliseconds(time_now_hires() - o->sent()));
+
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 	std::ofstream reply_stats("round_trip_ms.log", std::ios::app);
-	reply_stats << m.addr << "\t" << total_milliseconds(time_now_hires() - o->sent())
-		<< std::endl;
+	reply_stats << m.addr << "\t" << rtt << std::endl;
 #endif
 
 	lazy_entry const* ret_ent = m.message.dict_find_dict("r");
@@ -347,24 +345,23 @@ bool rpc_manager::incoming(msg const& m, node_id* id)
 
 	// we found an observer for this reply, hence the node is not spoofing
 	// add it to the routing table
-	return m_table.node_seen(*id, m.addr);
+	return m_table.node_seen(*id, m.addr, rtt);
 }
 
 time_duration rpc_manager::tick()
 {
 	INVARIANT_CHECK;
 
-	const static int short_timeout = 1;
 	const static int timeout = 8;
 
 	//	look for observers that have timed out
 
-	if (m_transactions.empty()) return seconds(short_timeout);
+	if (m_transactions.empty()) return seconds(1);
 
 	std::list<observer_ptr> timeouts;
 
-	time_duration ret = seconds(short_timeout);
-	ptime now = time_now();
+	time_duration ret = seconds(1);
+	ptime now = time_now_hires();
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 	ptime last = min_time();
@@ -407,20 +404,30 @@ time_duration rpc_manager::tick()
 	{
 		observer_ptr o = *i;
 
-		// if we reach an observer that hasn't timed out
-		// break, because every observer after this one will
-		// also not have timed out yet
+		// no lookup has a short timeout shorter than
+		// min_short_timeout, so if we reach an observer that
+		// isn't that old, break, because every observer after
+		// this one is younger still
 		time_duration diff = now - o->sent();
-		if (diff < seconds(short_timeout))
+		if (diff < milliseconds(traversal_algorithm::min_short_timeout))
 		{
-			ret = seconds(short_timeout) - diff;
+			// none of the younger ones can be due before this
+			ret = (std::min)(ret, milliseconds(traversal_algorithm::min_short_timeout) - diff);
 			break;
 		}
 		
 		if (o->has_short_timeout()) continue;
 
-		// TODO: don't call short_timeout() again if we've
-		// already called it once
+		// the short timeout depends on how quickly the
+		// nodes in this lookup have been responding
+		time_duration limit = o->algorithm()->short_timeout_limit();
+		if (diff < limit)
+		{
+			// come back when it's due
+			ret = (std::min)(ret, limit - diff);
+			continue;
+		}
+
 		timeouts.push_back(o);
 	}
 
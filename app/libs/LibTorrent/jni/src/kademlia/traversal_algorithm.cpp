@@ -69,7 +69,11 @@ traversal_algorithm::traversal_algorithm(
 	, m_branch_factor(3)
 	, m_responses(0)
 	, m_timeouts(0)
+	, m_short_timeouts(0)
+	, m_stalled(0)
 	, m_num_target_nodes(m_node.m_table.bucket_size() * 2)
+	, m_rtt(-1)
+	, m_done(false)
 {
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 	TORRENT_LOG(traversal) << " [" << this << "] new traversal process. Target: " << target;
@@ -93,6 +97,8 @@ bool compare_ip_cidr(observer_ptr const& lhs, observer_ptr const& rhs)
 
 void traversal_algorithm::add_entry(node_id const& id, udp::endpoint addr, unsigned char flags)
 {
+	if (m_done) return;
+
 	TORRENT_ASSERT(m_node.m_rpc.allocation_size() >= sizeof(find_data_observer));
 	void* ptr = m_node.m_rpc.allocate_observer();
 	if (ptr == 0)
@@ -174,7 +180,7 @@ void traversal_algorithm::start()
 	if (m_results.empty()) add_router_entries();
 	init();
 	add_requests();
-	if (m_invoke_count == 0) done();
+	if (lookup_complete()) done();
 }
 
 void* traversal_algorithm::allocate_observer()
@@ -199,6 +205,11 @@ void traversal_algorithm::traverse(node_id const& id, udp::endpoint addr)
 
 void traversal_algorithm::finished(observer_ptr o)
 {
+	// this is a late response to a lookup that completed
+	// without waiting for it. m_results has been cleared
+	// and the counters don't matter anymore
+	if (m_done) return;
+
 #ifdef TORRENT_DEBUG
 	std::vector<observer_ptr>::iterator i = std::find(
 		m_results.begin(), m_results.end(), o);
@@ -206,19 +217,30 @@ void traversal_algorithm::finished(observer_ptr o)
 	TORRENT_ASSERT(i != m_results.end() || m_results.size() == 100);
 #endif
 
-	// if this flag is set, it means we increased the
-	// branch factor for it, and we should restore it
+	// if this flag is set, it means we opened up another
+	// slot for it, and we should close it again
 	if (o->flags & observer::flag_short_timeout)
-		--m_branch_factor;
+		--m_stalled;
 
 	TORRENT_ASSERT(o->flags & observer::flag_queried);
 	o->flags |= observer::flag_alive;
 
+	// only count responses that came in before the short
+	// timeout. Late responses would inflate the round trip
+	// time, and with it the short timeout
+	if ((o->flags & observer::flag_short_timeout) == 0)
+	{
+		int rtt = int(total_milliseconds(time_now_hires() - o->sent()));
+		if (m_rtt < 0 || m_responses == 0) m_rtt = rtt;
+		else m_rtt = (m_rtt * 3 + rtt) / 4;
+	}
+
 	++m_responses;
 	--m_invoke_count;
 	TORRENT_ASSERT(m_invoke_count >= 0);
+
 	add_requests();
-	if (m_invoke_count == 0) done();
+	if (lookup_complete()) done();
 }
 
 // prevent request means that the total number of requests has
@@ -228,7 +250,20 @@ void traversal_algorithm::failed(observer_ptr o, int flags)
 {
 	TORRENT_ASSERT(m_invoke_count >= 0);
 
-	if (m_results.empty()) return;
+	// the lookup completed without waiting for this one. The node
+	// still failed to respond though, and the routing table needs to
+	// know, or dead nodes would never be evicted. Only the counters
+	// and the requests of the lookup itself are left alone
+	if (m_done || m_results.empty())
+	{
+		if ((flags & short_timeout) == 0)
+		{
+			o->flags |= observer::flag_failed;
+			if ((o->flags & observer::flag_no_id) == 0)
+				m_node.m_table.node_failed(o->id(), o->target_ep());
+		}
+		return;
+	}
 
 	TORRENT_ASSERT(o->flags & observer::flag_queried);
 	if (flags & short_timeout)
@@ -238,30 +273,33 @@ void traversal_algorithm::failed(observer_ptr o, int flags)
 		// we'll most likely not get a response. But, in case
 		// we do get a late response, keep the handler
 		// around for some more, but open up the slot
-		// by increasing the branch factor
+		// by counting it as stalled
 		if ((o->flags & observer::flag_short_timeout) == 0)
-			++m_branch_factor;
+		{
+			++m_stalled;
+			++m_short_timeouts;
+		}
 		o->flags |= observer::flag_short_timeout;
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 		TORRENT_LOG(traversal) << " [" << this << ":" << name()
 			<< "] first chance timeout: "
 			<< o->id() << " " << o->target_ep()
-			<< " branch-factor: " << m_branch_factor
+			<< " branch-factor: " << current_branch_factor()
 			<< " invoke-count: " << m_invoke_count;
 #endif
 	}
 	else
 	{
 		o->flags |= observer::flag_failed;
-		// if this flag is set, it means we increased the
-		// branch factor for it, and we should restore it
+		// if this flag is set, it means we opened up another
+		// slot for it, and we should close it again
 		if (o->flags & observer::flag_short_timeout)
-			--m_branch_factor;
+			--m_stalled;
 
 #ifdef TORRENT_DHT_VERBOSE_LOGGING
 		TORRENT_LOG(traversal) << " [" << this << ":" << name()
 			<< "] failed: " << o->id() << " " << o->target_ep()
-			<< " branch-factor: " << m_branch_factor
+			<< " branch-factor: " << current_branch_factor()
 			<< " invoke-count: " << m_invoke_count
 			<< " type: " << name()
 			;
@@ -281,24 +319,70 @@ void traversal_algorithm::failed(observer_ptr o, int flags)
 		if (m_branch_factor <= 0) m_branch_factor = 1;
 	}
 	add_requests();
-	if (m_invoke_count == 0) done();
+	if (lookup_complete()) done();
 }
 
 void traversal_algorithm::done()
 {
+	m_done = true;
+	// requests we didn't wait for may still hold on to this
+	// object for a while, but it's not running anymore
+	m_node.remove_traversal_algorithm(this);
+
 	// delete all our references to the observer objects so
 	// they will in turn release the traversal algorithm
 	m_results.clear();
 }
 
+time_duration traversal_algorithm::short_timeout_limit() const
+{
+	if (m_rtt < 0) return milliseconds(max_short_timeout);
+	return milliseconds((std::min)((std::max)(m_rtt * 3
+		, int(min_short_timeout)), int(max_short_timeout)));
+}
+
+int traversal_algorithm::current_branch_factor() const
+{
+	// every request that's waiting past its short timeout
+	// gets a slot of its own. When many of the nodes don't
+	// respond though, don't wait for that, but keep more
+	// requests outstanding up front, so that about as many of
+	// them are answered as if every node responded. At most
+	// twice as many
+	int extra = m_branch_factor * m_short_timeouts / (m_responses + 1);
+	return m_branch_factor + m_stalled + (std::min)(extra, m_branch_factor);
+}
+
+bool traversal_algorithm::lookup_complete() const
+{
+	if (m_invoke_count == 0) return true;
+
+	// we're still waiting for requests that may be answered
+	if (m_invoke_count > m_stalled) return false;
+
+	// all the outstanding requests are past their short timeout.
+	// Most likely those nodes are gone. If every node closer than
+	// the results we need has responded (or failed, or stalled)
+	// there's nothing left to wait for
+	int results_target = m_num_target_nodes;
+	for (std::vector<observer_ptr>::const_iterator i = m_results.begin()
+		, end(m_results.end()); i != end && results_target > 0; ++i)
+	{
+		if ((*i)->flags & observer::flag_alive) --results_target;
+		else if (((*i)->flags & observer::flag_queried) == 0) return false;
+	}
+	return true;
+}
+
 void traversal_algorithm::add_requests()
 {
 	int results_target = m_num_target_nodes;
+	int branch_factor = current_branch_factor();
 
 	// Find the first node that hasn't already been queried.
 	for (std::vector<observer_ptr>::iterator i = m_results.begin()
 		, end(m_results.end()); i != end
-		&& results_target > 0 && m_invoke_count < m_branch_factor; ++i)
+		&& results_target > 0 && m_invoke_count < branch_factor; ++i)
 	{
 		if ((*i)->flags & observer::flag_alive) --results_target;
 		if ((*i)->flags & observer::flag_queried) continue;
@@ -307,7 +391,7 @@ void traversal_algorithm::add_requests()
 		TORRENT_LOG(traversal) << " [" << this << ":" << name() << "]"
 			<< " nodes-left: " << (m_results.end() - i)
 			<< " invoke-count: " << m_invoke_count
-			<< " branch-factor: " << m_branch_factor;
+			<< " branch-factor: " << branch_factor;
 #endif
 
 		(*i)->flags |= observer::flag_queried;
@@ -341,6 +425,9 @@ void traversal_algorithm::init()
 	// update the last activity of this bucket
 	m_node.m_table.touch_bucket(m_target);
 	m_branch_factor = m_node.branch_factor();
+	// until the first response, expect the nodes in this
+	// lookup to be as quick as the ones we already know
+	m_rtt = m_node.m_table.average_rtt();
 	m_node.add_traversal_algorithm(this);
 }
 
@@ -354,7 +441,7 @@ void traversal_algorithm::status(dht_lookup& l)
 	l.timeouts = m_timeouts;
 	l.responses = m_responses;
 	l.outstanding_requests = m_invoke_count;
-	l.branch_factor = m_branch_factor;
+	l.branch_factor = current_branch_factor();
 	l.type = name();
 	l.nodes_left = 0;
 	l.first_timeout = 0;
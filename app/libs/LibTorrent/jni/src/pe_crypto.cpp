@@ -41,9 +41,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <openssl/bn.h>
 #include "libtorrent/random.hpp"
 #elif defined TORRENT_USE_TOMMATH
-extern "C" {
-#include "libtorrent/tommath.h"
-}
+#include <cstring>
 #include "libtorrent/random.hpp"
 #endif
 
@@ -65,6 +63,143 @@ namespace libtorrent
 			0xE4, 0x85, 0xB5, 0x76, 0x62, 0x5E, 0x7E, 0xC6, 0xF4, 0x4C, 0x42, 0xE9,
 			0xA6, 0x3A, 0x36, 0x21, 0x00, 0x00, 0x00, 0x00, 0x00, 0x09, 0x05, 0x63
 		};
+
+#if defined TORRENT_USE_TOMMATH
+		// the key exchange always works on 768 bit numbers modulo dh_prime,
+		// so instead of going through a general purpose bignum library, the
+		// modular exponentiation is done with fixed size montgomery arithmetic.
+		// Every number is 24 little endian 32 bit limbs. The loops and the
+		// memory access pattern don't depend on the secret exponent, which
+		// means the exponentiation runs in constant time
+		enum { dh_limbs = 24 };
+		typedef boost::uint32_t limb_t;
+		typedef boost::uint64_t dlimb_t;
+
+		// dh_prime as limbs
+		const limb_t dh_p[dh_limbs] = {
+			0x00090563, 0x00000000, 0xa63a3621, 0xf44c42e9, 0x625e7ec6, 0xe485b576,
+			0x6d51c245, 0x4fe1356d, 0xf25f1437, 0x302b0a6d, 0xcd3a431b, 0xef9519b3,
+			0x8e3404dd, 0x514a0879, 0x3b139b22, 0x020bbea6, 0x8a67cc74, 0x29024e08,
+			0x80dc1cd1, 0xc4c6628b, 0x2168c234, 0xc90fdaa2, 0xffffffff, 0xffffffff
+		};
+
+		// R^2 mod dh_prime, where R = 2^768. Used to convert
+		// numbers into montgomery form
+		const limb_t dh_r2[dh_limbs] = {
+			0x46281a8e, 0x95f01940, 0xd838c985, 0xff0ca2a3, 0x93af6d83, 0x6d9f1759,
+			0xa99a751f, 0xd4c85168, 0x2ddc6158, 0x3423ecee, 0xd4ace6dd, 0xd515b23c,
+			0x82e51749, 0x112ce562, 0x3a35e04b, 0x3361bff3, 0x54e85ee3, 0xafbc0835,
+			0xc5679266, 0xa95d0ecb, 0x8c6f28c7, 0x8d001cb9, 0x54da3d53, 0xa6130c9d
+		};
+
+		// -dh_prime^-1 mod 2^32
+		const limb_t dh_pinv = 0x95075bb5;
+
+		// r = a * b / R mod dh_prime. a and b must be less than R and at
+		// least one of them less than dh_prime. r may alias a or b
+		void mont_mul(limb_t* r, limb_t const* a, limb_t const* b)
+		{
+			limb_t t[dh_limbs + 1];
+			memset(t, 0, sizeof(t));
+
+			for (int i = 0; i < dh_limbs; ++i)
+			{
+				// t = (t + a * b[i] + m * dh_prime) / 2^32, where m is
+				// picked to make the lowest limb of the sum zero. c carries
+				// the product and d the reduction
+				limb_t const bi = b[i];
+				dlimb_t c = dlimb_t(t[0]) + dlimb_t(a[0]) * bi;
+				limb_t const m = limb_t(c) * dh_pinv;
+				dlimb_t d = (dlimb_t(limb_t(c)) + dlimb_t(m) * dh_p[0]) >> 32;
+				c >>= 32;
+				for (int j = 1; j < dh_limbs; ++j)
+				{
+					c += dlimb_t(t[j]) + dlimb_t(a[j]) * bi;
+					d += dlimb_t(limb_t(c)) + dlimb_t(m) * dh_p[j];
+					t[j - 1] = limb_t(d);
+					c >>= 32;
+					d >>= 32;
+				}
+				c += dlimb_t(t[dh_limbs]) + d;
+				t[dh_limbs - 1] = limb_t(c);
+				t[dh_limbs] = limb_t(c >> 32);
+			}
+
+			// t < 2 * dh_prime. Subtract the prime once, and keep the
+			// difference unless it went negative. The selection is done
+			// with a mask rather than a branch
+			limb_t d[dh_limbs];
+			limb_t borrow = 0;
+			for (int j = 0; j < dh_limbs; ++j)
+			{
+				dlimb_t x = dlimb_t(t[j]) - dh_p[j] - borrow;
+				d[j] = limb_t(x);
+				borrow = limb_t(x >> 32) & 1;
+			}
+			limb_t const keep_t = limb_t(0) - (borrow & ~t[dh_limbs] & 1);
+			for (int j = 0; j < dh_limbs; ++j)
+				r[j] = (t[j] & keep_t) | (d[j] & ~keep_t);
+		}
+
+		// out = base ^ exp mod dh_prime. All three are 96 byte big endian
+		// numbers. The exponent is scanned 4 bits at a time, always doing
+		// 4 squarings and one multiplication by a table entry, which is
+		// picked by reading every entry of the table
+		void dh_exptmod(unsigned char* out, unsigned char const* base
+			, unsigned char const* exp)
+		{
+			limb_t b[dh_limbs];
+			for (int i = 0; i < dh_limbs; ++i)
+			{
+				unsigned char const* p = base + 96 - 4 - i * 4;
+				b[i] = (limb_t(p[0]) << 24) | (limb_t(p[1]) << 16)
+					| (limb_t(p[2]) << 8) | limb_t(p[3]);
+			}
+
+			limb_t one[dh_limbs];
+			memset(one, 0, sizeof(one));
+			one[0] = 1;
+
+			// table[k] = base ^ k, in montgomery form
+			limb_t table[16][dh_limbs];
+			mont_mul(table[0], one, dh_r2);
+			mont_mul(table[1], b, dh_r2);
+			for (int k = 2; k < 16; ++k)
+				mont_mul(table[k], table[k - 1], table[1]);
+
+			limb_t x[dh_limbs];
+			limb_t f[dh_limbs];
+			memcpy(x, table[0], sizeof(x));
+			for (int i = 0; i < 96 * 2; ++i)
+			{
+				limb_t const nibble = (i & 1) ? (exp[i / 2] & 0xf) : (exp[i / 2] >> 4);
+
+				for (int k = 0; k < 4; ++k) mont_mul(x, x, x);
+
+				memset(f, 0, sizeof(f));
+				for (int k = 0; k < 16; ++k)
+				{
+					// all ones if k == nibble, otherwise zero
+					limb_t const diff = limb_t(k) ^ nibble;
+					limb_t const mask = ((diff | (limb_t(0) - diff)) >> 31) - 1;
+					for (int j = 0; j < dh_limbs; ++j)
+						f[j] |= table[k][j] & mask;
+				}
+				mont_mul(x, x, f);
+			}
+
+			// convert back out of montgomery form
+			mont_mul(x, x, one);
+			for (int i = 0; i < dh_limbs; ++i)
+			{
+				unsigned char* p = out + 96 - 4 - i * 4;
+				p[0] = (unsigned char)(x[i] >> 24);
+				p[1] = (unsigned char)(x[i] >> 16);
+				p[2] = (unsigned char)(x[i] >> 8);
+				p[3] = (unsigned char)(x[i]);
+			}
+		}
+#endif
 	}
 
 
@@ -148,36 +283,13 @@ get_out:
 		for (int i = 0; i < int(sizeof(m_dh_local_secret)); ++i)
 			m_dh_local_secret[i] = random();
 
-		mp_int prime;
-		mp_int secret;
-		mp_int key;
-		int e;
-		int size;
-
-		mp_init(&prime);
-		mp_init(&secret);
-		mp_init(&key);
-
-		e = mp_read_unsigned_bin(&prime, dh_prime, sizeof(dh_prime));
-		if (e) goto get_out;
-		e = mp_read_unsigned_bin(&secret, (unsigned char*)m_dh_local_secret, sizeof(m_dh_local_secret));
-		if (e) goto get_out;
-
 		// generator is 2
-		mp_set_int(&key, 2);
+		unsigned char generator[96];
+		memset(generator, 0, sizeof(generator));
+		generator[95] = 2;
 		// key = (2 ^ secret) % prime
-		e = mp_exptmod(&key, &secret, &prime, &key);
-		if (e) goto get_out;
-
-		// key is now our local key
-		size = mp_unsigned_bin_size(&key);
-		memset(m_dh_local_key, 0, sizeof(m_dh_local_key) - size);
-		mp_to_unsigned_bin(&key, (unsigned char*)m_dh_local_key + sizeof(m_dh_local_key) - size);
-
-get_out:
-		mp_clear(&key);
-		mp_clear(&prime);
-		mp_clear(&secret);
+		dh_exptmod((unsigned char*)m_dh_local_key, generator
+			, (unsigned char const*)m_dh_local_secret);
 #else
 #error you must define which bigint library to use
 #endif
@@ -259,35 +371,9 @@ get_out:
 		BN_free(secret);
 		BN_free(prime);
 #elif defined TORRENT_USE_TOMMATH
-		mp_int prime;
-		mp_int secret;
-		mp_int remote_key;
-		int size;
-		int e;
-
-		mp_init(&prime);
-		mp_init(&secret);
-		mp_init(&remote_key);
-
-		e = mp_read_unsigned_bin(&prime, dh_prime, sizeof(dh_prime));
-		if (e) { ret = 1; goto get_out; }
-		e = mp_read_unsigned_bin(&secret, (unsigned char*)m_dh_local_secret, sizeof(m_dh_local_secret));
-		if (e) { ret = 1; goto get_out; }
-		e = mp_read_unsigned_bin(&remote_key, (unsigned char*)remote_pubkey, 96);
-		if (e) { ret = 1; goto get_out; }
-
-		e = mp_exptmod(&remote_key, &secret, &prime, &remote_key);
-		if (e) goto get_out;
-
-		// remote_key is now the shared secret
-		size = mp_unsigned_bin_size(&remote_key);
-		memset(m_dh_shared_secret, 0, sizeof(m_dh_shared_secret) - size);
-		mp_to_unsigned_bin(&remote_key, (unsigned char*)m_dh_shared_secret + sizeof(m_dh_shared_secret) - size);
-
-get_out:
-		mp_clear(&remote_key);
-		mp_clear(&secret);
-		mp_clear(&prime);
+		dh_exptmod((unsigned char*)m_dh_shared_secret
+			, (unsigned char const*)remote_pubkey
+			, (unsigned char const*)m_dh_local_secret);
 #else
 #error you must define which bigint library to use
 #endif
@@ -342,25 +428,90 @@ void rc4_init(const unsigned char* in, unsigned long len, rc4 *state)
 	state->y = 0;
 }
 
+namespace
+{
+	// advances the cipher by one step and returns the next byte of
+	// key stream. x and y are bytes, so they wrap around at 256 on
+	// their own
+	inline unsigned char rc4_next(unsigned char& x, unsigned char& y
+		, unsigned char* s)
+	{
+		++x;
+		unsigned char const sx = s[x];
+		y += sx;
+		unsigned char const sy = s[y];
+		s[x] = sy;
+		s[y] = sx;
+		return s[(unsigned char)(sx + sy)];
+	}
+
+	// the next 4 bytes of key stream, in memory order
+	inline boost::uint32_t rc4_next_word(unsigned char& x, unsigned char& y
+		, unsigned char* s)
+	{
+		unsigned char k[4];
+		k[0] = rc4_next(x, y, s);
+		k[1] = rc4_next(x, y, s);
+		k[2] = rc4_next(x, y, s);
+		k[3] = rc4_next(x, y, s);
+		boost::uint32_t ret;
+		memcpy(&ret, k, 4);
+		return ret;
+	}
+}
+
+// the key stream is generated 4 bytes at a time and xored into the
+// buffer a 32 bit word at a time. The state indices are kept in
+// local variables for the duration of the call
 unsigned long rc4_encrypt(unsigned char *out, unsigned long outlen, rc4 *state)
 {
-	unsigned char x, y, *s, tmp;
-	unsigned long n;
+	TORRENT_ASSERT(out != 0);
+	TORRENT_ASSERT(state != 0);
+
+	unsigned long n = outlen;
+	unsigned char x = state->x;
+	unsigned char y = state->y;
+	unsigned char* s = state->buf;
+	boost::uint32_t w;
+	for (; outlen >= 8; outlen -= 8, out += 8)
+	{
+		memcpy(&w, out, 4);
+		w ^= rc4_next_word(x, y, s);
+		memcpy(out, &w, 4);
+		memcpy(&w, out + 4, 4);
+		w ^= rc4_next_word(x, y, s);
+		memcpy(out + 4, &w, 4);
+	}
+	while (outlen--) *out++ ^= rc4_next(x, y, s);
+	state->x = x;
+	state->y = y;
+	return n;
+}
 
+// same as rc4_encrypt(), but reads the plaintext from in and writes
+// the ciphertext to out, saving a separate copy of the data
+unsigned long rc4_encrypt_copy(const unsigned char *in, unsigned char *out
+	, unsigned long len, rc4 *state)
+{
+	TORRENT_ASSERT(in != 0);
 	TORRENT_ASSERT(out != 0);
 	TORRENT_ASSERT(state != 0);
 
-	n = outlen;
-	x = state->x;
-	y = state->y;
-	s = state->buf;
-	while (outlen--) {
-		x = (x + 1) & 255;
-		y = (y + s[x]) & 255;
-		tmp = s[x]; s[x] = s[y]; s[y] = tmp;
-		tmp = (s[x] + s[y]) & 255;
-		*out++ ^= s[tmp];
+	unsigned long n = len;
+	unsigned char x = state->x;
+	unsigned char y = state->y;
+	unsigned char* s = state->buf;
+	boost::uint32_t w;
+	for (; len >= 8; len -= 8, in += 8, out += 8)
+	{
+		memcpy(&w, in, 4);
+		w ^= rc4_next_word(x, y, s);
+		memcpy(out, &w, 4);
+		memcpy(&w, in + 4, 4);
+		w ^= rc4_next_word(x, y, s);
+		memcpy(out + 4, &w, 4);
 	}
+	while (len--) *out++ = *in++ ^ rc4_next(x, y, s);
 	state->x = x;
 	state->y = y;
 	return n;
@@ -57,6 +57,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/bt_peer_connection.hpp"
 #include "libtorrent/error.hpp"
 
+#if TORRENT_USE_SENDFILE
+#include <unistd.h> // for dup() and close()
+#endif
+
 #ifdef TORRENT_DEBUG
 #include <set>
 #endif
@@ -118,6 +122,7 @@ namespace libtorrent
 #endif
 		  m_ses(ses)
 		, m_max_out_request_queue(m_ses.settings().max_out_request_queue)
+		, m_min_out_request_queue(min_request_queue)
 		, m_work(ses.m_io_service)
 		, m_last_piece(time_now())
 		, m_last_request(time_now())
@@ -151,6 +156,9 @@ namespace libtorrent
 		, m_soft_packet_size(0)
 		, m_recv_pos(0)
 		, m_disk_recv_buffer_size(0)
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		, m_recv_decrypted(false)
+#endif
 		, m_reading_bytes(0)
 		, m_num_invalid_requests(0)
 		, m_priority(1)
@@ -278,6 +286,7 @@ namespace libtorrent
 #endif
 		  m_ses(ses)
 		, m_max_out_request_queue(m_ses.settings().max_out_request_queue)
+		, m_min_out_request_queue(min_request_queue)
 		, m_work(ses.m_io_service)
 		, m_last_piece(time_now())
 		, m_last_request(time_now())
@@ -310,6 +319,9 @@ namespace libtorrent
 		, m_soft_packet_size(0)
 		, m_recv_pos(0)
 		, m_disk_recv_buffer_size(0)
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		, m_recv_decrypted(false)
+#endif
 		, m_reading_bytes(0)
 		, m_num_invalid_requests(0)
 		, m_priority(1)
@@ -3237,6 +3249,26 @@ namespace libtorrent
 		write_cancel(r);
 	}
 
+	void peer_connection::reject_piece(int index)
+	{
+		for (std::vector<peer_request>::iterator i = m_requests.begin();
+			i != m_requests.end();)
+		{
+			if (i->piece != index)
+			{
+				++i;
+				continue;
+			}
+			peer_request const& r = *i;
+#ifdef TORRENT_VERBOSE_LOGGING
+			peer_log("==> REJECT_PIECE [ piece: %d s: %d l: %d ]"
+				, r.piece , r.start , r.length);
+#endif
+			write_reject_request(r);
+			i = m_requests.erase(i);
+		}
+	}
+
 	bool peer_connection::send_choke()
 	{
 		INVARIANT_CHECK;
@@ -3556,7 +3588,16 @@ namespace libtorrent
 
 		if (m_connection_ticket != -1)
 		{
-			m_ses.m_half_open.done(m_connection_ticket);
+			// a refused connection still means the
+			// connection attempt got through. If it timed
+			// out, the connection queue has counted that
+			// already
+			m_ses.m_half_open.done(m_connection_ticket
+				, e == boost::system::errc::connection_refused
+				? connection_queue::responded
+				: e == error::operation_aborted
+				? connection_queue::cancelled
+				: connection_queue::failed);
 		}
 
 		// a connection attempt using uTP just failed
@@ -3715,6 +3756,8 @@ namespace libtorrent
 		}
 		if (m_connection_ticket >= 0)
 		{
+			// connect_failed() has passed on how the attempt
+			// failed already. Otherwise we're giving up on it
 			m_ses.m_half_open.done(m_connection_ticket);
 			m_connection_ticket = -1;
 		}
@@ -3986,7 +4029,8 @@ namespace libtorrent
 			p.flags |= pi->on_parole ? peer_info::on_parole : 0;
 			p.flags |= pi->optimistically_unchoked ? peer_info::optimistic_unchoke : 0;
 #ifndef TORRENT_DISABLE_GEO_IP
-			p.inet_as = pi->inet_as ? pi->inet_as->first : 0xffff;
+			p.inet_as = pi->inet_as != policy::peer::unknown_as
+				? m_ses.as_peak(pi->inet_as).first : 0xffff;
 #endif
 		}
 		else
@@ -4162,12 +4206,17 @@ namespace libtorrent
 
 		TORRENT_ASSERT(block_size > 0);
 		
-		m_desired_queue_size = queue_time * download_rate / block_size;
-
-		if (m_desired_queue_size > m_max_out_request_queue)
-			m_desired_queue_size = m_max_out_request_queue;
-		if (m_desired_queue_size < min_request_queue)
-			m_desired_queue_size = min_request_queue;
+		// compute this in an int, fast peers easily want
+		// more requests than m_desired_queue_size can hold
+		int queue_size = queue_time * download_rate / block_size;
+
+		if (queue_size > m_max_out_request_queue)
+			queue_size = m_max_out_request_queue;
+		if (queue_size < m_min_out_request_queue)
+			queue_size = m_min_out_request_queue;
+		if (queue_size > (std::numeric_limits<boost::uint16_t>::max)())
+			queue_size = (std::numeric_limits<boost::uint16_t>::max)();
+		m_desired_queue_size = queue_size;
 	}
 
 	void peer_connection::second_tick(int tick_interval_ms)
@@ -4388,9 +4437,9 @@ namespace libtorrent
 #ifndef TORRENT_DISABLE_GEO_IP
 			if (peer_info_struct())
 			{
-				std::pair<const int, int>* as_stats = peer_info_struct()->inet_as;
-				if (as_stats && as_stats->second < m_download_rate_peak)
-					as_stats->second = m_download_rate_peak;
+				boost::uint16_t as = peer_info_struct()->inet_as;
+				if (as != policy::peer::unknown_as)
+					m_ses.update_as_peak(as, m_download_rate_peak);
 			}
 #endif
 		}
@@ -4659,10 +4708,34 @@ namespace libtorrent
 			
 			TORRENT_ASSERT(r.piece >= 0);
 			TORRENT_ASSERT(r.piece < (int)m_have_piece.size());
-			TORRENT_ASSERT(t->have_piece(r.piece));
 			TORRENT_ASSERT(r.start + r.length <= t->torrent_file().piece_size(r.piece));
 			TORRENT_ASSERT(r.length > 0 && r.start >= 0);
 
+			if (!t->have_piece(r.piece))
+			{
+				// the piece was dropped from volatile storage after
+				// the request was queued
+#if defined TORRENT_VERBOSE_LOGGING
+				peer_log("==> REJECT_PIECE [ piece: %d s: %d l: %d ]"
+					, r.piece , r.start , r.length);
+#endif
+				write_reject_request(r);
+				m_requests.erase(m_requests.begin());
+				continue;
+			}
+
+			if (can_sendfile() && (!t->seed_mode() || t->verified_piece(r.piece)))
+			{
+				// the payload is sent straight from the storage once it
+				// reaches the front of the send buffer, there's nothing
+				// to read ahead of time
+				peer_request req = r;
+				m_requests.erase(m_requests.begin());
+				sent_a_piece = true;
+				write_piece_sendfile(req);
+				continue;
+			}
+
 			std::pair<int, int> cache = preferred_caching();
 
 			if (!t->seed_mode() || t->verified_piece(r.piece))
@@ -4717,7 +4790,9 @@ namespace libtorrent
 		
 		if (ret != r.length)
 		{
-			if (ret == -3)
+			// a piece dropped from volatile storage only fails
+			// this request
+			if (ret == -3 || j.error == error_code(errors::piece_dropped))
 			{
 #if defined TORRENT_VERBOSE_LOGGING
 				peer_log("==> REJECT_PIECE [ piece: %d s: %d l: %d ]"
@@ -4751,6 +4826,100 @@ namespace libtorrent
 		write_piece(r, buffer);
 	}
 
+	bool peer_connection::can_sendfile() const
+	{
+#if TORRENT_USE_SENDFILE
+		if (!m_ses.settings().use_sendfile) return false;
+		// the piece header is sent before the payload is read, so a
+		// piece dropped from volatile storage in between can't be
+		// rejected anymore. There's no file to send from anyway
+		boost::shared_ptr<torrent> t = m_torrent.lock();
+		if (!t) return false;
+		storage_interface* st = t->get_storage();
+		if (st && st->is_volatile()) return false;
+		// sendfile() writes straight to the socket, so it has to be a
+		// plain TCP connection that sends the payload as it is
+		return m_socket->get<stream_socket>() != 0 && plaintext_payload();
+#else
+		return false;
+#endif
+	}
+
+	void peer_connection::append_sendfile_segment(peer_request const& r)
+	{
+		m_send_buffer.append_external(r.length);
+		m_sendfile_segments.push_back(r);
+	}
+
+	void peer_connection::on_sendfile_complete(int ret, disk_io_job const& j, int socket)
+	{
+#if TORRENT_USE_SENDFILE
+		TORRENT_ASSERT(m_ses.is_network_thread());
+#if defined TORRENT_ASIO_DEBUGGING
+		complete_async("peer_connection::on_sendfile_complete");
+#endif
+		::close(socket);
+
+		TORRENT_ASSERT(m_channel_state[upload_channel] & peer_info::bw_network);
+
+		if (ret == 0 && j.error == asio::error::would_block)
+		{
+			// the socket's send buffer is full. Try again once
+			// there's room in it
+#if defined TORRENT_ASIO_DEBUGGING
+			add_outstanding_async("peer_connection::on_sendfile_writable");
+#endif
+			socket_async_wait_writable(make_write_handler(boost::bind(
+				&peer_connection::on_sendfile_writable, self(), _1)));
+			return;
+		}
+
+		if (ret > 0)
+		{
+			peer_request& r = m_sendfile_segments.front();
+			TORRENT_ASSERT(ret <= r.length);
+			r.start += ret;
+			r.length -= ret;
+			if (r.length == 0) m_sendfile_segments.pop_front();
+			on_send_data(error_code(), ret);
+			return;
+		}
+
+		if (ret == -1 && j.error)
+		{
+			m_channel_state[upload_channel] &= ~peer_info::bw_network;
+			boost::shared_ptr<torrent> t = m_torrent.lock();
+			// handle_disk_error may disconnect us
+			if (t) t->handle_disk_error(j, this);
+			// the rest of the send buffer is stuck behind the
+			// block we failed to send
+			if (!m_disconnecting) disconnect(j.error);
+			return;
+		}
+
+		// the job was aborted or writing to the socket failed
+		on_send_data(j.error ? j.error
+			: error_code(asio::error::operation_aborted), 0);
+#endif
+	}
+
+	void peer_connection::on_sendfile_writable(error_code const& error)
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+#if defined TORRENT_ASIO_DEBUGGING
+		complete_async("peer_connection::on_sendfile_writable");
+#endif
+		TORRENT_ASSERT(m_channel_state[upload_channel] & peer_info::bw_network);
+		m_channel_state[upload_channel] &= ~peer_info::bw_network;
+
+		if (error)
+		{
+			disconnect(error);
+			return;
+		}
+		setup_send();
+	}
+
 	void peer_connection::assign_bandwidth(int channel, int amount)
 	{
 #ifdef TORRENT_VERBOSE_LOGGING
@@ -4828,7 +4997,7 @@ namespace libtorrent
 		return m_ses.m_upload_rate.request_bandwidth(self()
 			, (std::max)(m_send_buffer.size(), m_statistics.upload_rate() * 2
 				* m_ses.m_settings.tick_interval / 1000)
-			, priority
+			, priority, false
 			, bwc1, bwc2, bwc3, bwc4);
 	}
 
@@ -4860,7 +5029,53 @@ namespace libtorrent
 		return m_ses.m_download_rate.request_bandwidth(self()
 			, (std::max)((std::max)(m_outstanding_bytes, m_packet_size - m_recv_pos) + 30
 				, m_statistics.download_rate() * 2 * m_ses.m_settings.tick_interval / 1000)
-			, priority , bwc1, bwc2, bwc3, bwc4);
+			, priority, t && t->is_streaming()
+			, bwc1, bwc2, bwc3, bwc4);
+	}
+
+	bool peer_connection::on_network_shard() const
+	{
+		return &m_socket->get_io_service() != &m_ses.m_io_service;
+	}
+
+	template <class Buffers, class Handler>
+	void peer_connection::socket_async_read_some(Buffers const& b, Handler const& h
+		, bool decrypt)
+	{
+		if (on_network_shard())
+			m_socket->async_read_some(b, network_thread_handler<Handler>(h
+				, m_ses.m_io_service, decrypt ? this : 0));
+		else
+			m_socket->async_read_some(b, h);
+	}
+
+	template <class Buffers, class Handler>
+	void peer_connection::socket_async_write_some(Buffers const& b, Handler const& h)
+	{
+		if (on_network_shard())
+			m_socket->async_write_some(b, network_thread_handler<Handler>(h, m_ses.m_io_service));
+		else
+			m_socket->async_write_some(b, h);
+	}
+
+	template <class Handler>
+	void peer_connection::socket_async_connect(tcp::endpoint const& ep, Handler const& h)
+	{
+		if (on_network_shard())
+			m_socket->async_connect(ep, network_thread_handler<Handler>(h, m_ses.m_io_service));
+		else
+			m_socket->async_connect(ep, h);
+	}
+
+	template <class Handler>
+	void peer_connection::socket_async_wait_writable(Handler const& h)
+	{
+		stream_socket* s = m_socket->get<stream_socket>();
+		TORRENT_ASSERT(s);
+		if (on_network_shard())
+			s->async_write_some(asio::null_buffers(), network_thread_handler<Handler>(h, m_ses.m_io_service));
+		else
+			s->async_write_some(asio::null_buffers(), h);
 	}
 
 	void peer_connection::uncork_socket()
@@ -4999,14 +5214,52 @@ namespace libtorrent
 		}
 
 		TORRENT_ASSERT((m_channel_state[upload_channel] & peer_info::bw_network) == 0);
+
+#if TORRENT_USE_SENDFILE
+		int external = m_send_buffer.front_external();
+		if (external > 0)
+		{
+			// the front of the send buffer is the payload of a block
+			// that's sent by the disk thread, directly from the file.
+			// It gets its own duplicate of the socket, since this one
+			// may be closed before the job runs
+			if (amount_to_send > external) amount_to_send = external;
+			TORRENT_ASSERT(!m_sendfile_segments.empty());
+			TORRENT_ASSERT(m_sendfile_segments.front().length == external);
+			if (!t)
+			{
+				disconnect(errors::torrent_aborted);
+				return;
+			}
+			int s = ::dup(m_socket->get<stream_socket>()->native_handle());
+			if (s < 0)
+			{
+				disconnect(error_code(errno, get_posix_category()));
+				return;
+			}
+			peer_request r = m_sendfile_segments.front();
+			r.length = amount_to_send;
+#ifdef TORRENT_VERBOSE_LOGGING
+			peer_log(">>> SENDFILE [ piece: %d s: %d l: %d ]", r.piece, r.start, r.length);
+#endif
+#if defined TORRENT_ASIO_DEBUGGING
+			add_outstanding_async("peer_connection::on_sendfile_complete");
+#endif
+			t->filesystem().async_sendfile(r, s, boost::bind(
+				&peer_connection::on_sendfile_complete, self(), _1, _2, s));
+			m_channel_state[upload_channel] |= peer_info::bw_network;
+			return;
+		}
+#endif
+
 #ifdef TORRENT_VERBOSE_LOGGING
 		peer_log(">>> ASYNC_WRITE [ bytes: %d ]", amount_to_send);
 #endif
-		std::list<asio::const_buffer> const& vec = m_send_buffer.build_iovec(amount_to_send);
+		std::vector<asio::const_buffer> const& vec = m_send_buffer.build_iovec(amount_to_send);
 #if defined TORRENT_ASIO_DEBUGGING
 		add_outstanding_async("peer_connection::on_send_data");
 #endif
-		m_socket->async_write_some(
+		socket_async_write_some(
 			vec, make_write_handler(boost::bind(
 				&peer_connection::on_send_data, self(), _1, _2)));
 
@@ -5170,18 +5423,34 @@ namespace libtorrent
 
 #if defined TORRENT_ASIO_DEBUGGING
 			add_outstanding_async("peer_connection::on_receive_data");
+#endif
+			bool decrypt = false;
+#ifndef TORRENT_DISABLE_ENCRYPTION
+			// spread the cost of decrypting the stream across the shards
+			if (on_network_shard() && decrypt_on_shard())
+			{
+				decrypt = true;
+				// vec[1] is empty if there's only one buffer
+				for (int i = 0; i < 2; ++i)
+				{
+					char* b = asio::buffer_cast<char*>(vec[i]);
+					m_shard_recv_buf[i] = buffer::interval(b, b + asio::buffer_size(vec[i]));
+				}
+			}
 #endif
 			if (num_bufs == 1)
 			{
-				m_socket->async_read_some(
+				socket_async_read_some(
 					asio::mutable_buffers_1(vec[0]), make_read_handler(
-						boost::bind(&peer_connection::on_receive_data, self(), _1, _2)));
+						boost::bind(&peer_connection::on_receive_data, self(), _1, _2))
+					, decrypt);
 			}
 			else
 			{
-				m_socket->async_read_some(
+				socket_async_read_some(
 					vec, make_read_handler(
-						boost::bind(&peer_connection::on_receive_data, self(), _1, _2)));
+						boost::bind(&peer_connection::on_receive_data, self(), _1, _2))
+					, decrypt);
 			}
 			return 0;
 		}
@@ -5237,6 +5506,19 @@ namespace libtorrent
 		TORRENT_ASSERT(vec.first.left() + vec.second.left() == bytes);
 		return vec;
 	}
+
+	void peer_connection::shard_decrypt(std::size_t bytes)
+	{
+		TORRENT_ASSERT(!m_recv_decrypted);
+		for (int i = 0; i < 2 && bytes > 0; ++i)
+		{
+			int len = (std::min)(int(bytes), m_shard_recv_buf[i].left());
+			if (len > 0) decrypt_received(m_shard_recv_buf[i].begin, len);
+			bytes -= len;
+		}
+		TORRENT_ASSERT(bytes == 0);
+		m_recv_decrypted = true;
+	}
 #endif
 
 	void peer_connection::reset_recv_buffer(int packet_size)
@@ -5251,7 +5533,7 @@ namespace libtorrent
 		m_packet_size = packet_size;
 	}
 
-	void nop(char*) {}
+	void nop(char*, void*) {}
 
 	void peer_connection::append_const_send_buffer(char const* buffer, int size)
 	{
@@ -5292,20 +5574,19 @@ namespace libtorrent
 		int i = 0;
 		while (size > 0)
 		{
-			char* chain_buf = m_ses.allocate_buffer();
+			char* chain_buf = m_send_buffer.allocate_arena_block();
 			if (chain_buf == 0)
 			{
 				disconnect(errors::no_memory);
 				return;
 			}
 
-			int buf_size = (std::min)(int(aux::session_impl::send_buffer_size), size);
+			int buf_size = (std::min)(int(chained_buffer::arena_block_size), size);
 			memcpy(chain_buf, buf, buf_size);
 			if (fun) fun(chain_buf, buf_size, userdata);
 			buf += buf_size;
 			size -= buf_size;
-			m_send_buffer.append_buffer(chain_buf, aux::session_impl::send_buffer_size, buf_size
-				, boost::bind(&session_impl::free_buffer, boost::ref(m_ses), _1));
+			m_send_buffer.append_arena_block(chain_buf, buf_size);
 			++i;
 		}
 		setup_send();
@@ -5381,6 +5662,12 @@ namespace libtorrent
 			return;
 		}
 
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		// only the bytes of the async read may have been decrypted on
+		// the shard, not the ones read synchronously below
+		set_to_zero<bool> clear_decrypted(m_recv_decrypted, true);
+#endif
+
 		int num_loops = 0;
 		do
 		{
@@ -5414,6 +5701,9 @@ namespace libtorrent
 				INVARIANT_CHECK;
 				on_receive(error, bytes_transferred);
 			}
+#ifndef TORRENT_DISABLE_ENCRYPTION
+			clear_decrypted.fire();
+#endif
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 			TORRENT_ASSERT(m_statistics.last_payload_downloaded() - cur_payload_dl >= 0);
 			TORRENT_ASSERT(m_statistics.last_protocol_downloaded() - cur_protocol_dl >= 0);
@@ -5597,7 +5887,7 @@ namespace libtorrent
 #if defined TORRENT_ASIO_DEBUGGING
 		add_outstanding_async("peer_connection::on_connection_complete");
 #endif
-		m_socket->async_connect(m_remote
+		socket_async_connect(m_remote
 			, boost::bind(&peer_connection::on_connection_complete, self(), _1));
 		m_connect = time_now_hires();
 		m_statistics.sent_syn(m_remote.address().is_v6());
@@ -5650,7 +5940,7 @@ namespace libtorrent
 			t->dec_num_connecting();
 			m_connecting = false;
 		}
-		m_ses.m_half_open.done(m_connection_ticket);
+		m_ses.m_half_open.done(m_connection_ticket, connection_queue::responded);
 
 		if (m_disconnecting) return;
 		m_last_receive = time_now();
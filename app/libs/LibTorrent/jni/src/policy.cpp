@@ -111,6 +111,14 @@ namespace
 	};
 #endif
 
+	// used to rank peers by, when we don't want to
+	// favour the ones close to our own IP
+	address random_address()
+	{
+		address_v4::bytes_type bytes;
+		std::generate(bytes.begin(), bytes.end(), &libtorrent::random);
+		return address_v4(bytes);
+	}
 }
 
 namespace libtorrent
@@ -161,6 +169,21 @@ namespace libtorrent
 		// don't have to make any new requests yet
 		if (num_requests <= 0) return;
 
+		// peers we request large blocks from (web seeds) turn every
+		// run of adjacent blocks into a single range request. Topping
+		// their queue up one block at a time, as blocks arrive, would
+		// mean one HTTP request per block. Instead, wait until there's
+		// room for a whole range, as long as there's still one in flight
+		if (c.request_large_blocks()
+			&& !c.download_queue().empty()
+			&& c.prefer_whole_pieces() > 0)
+		{
+			int blocks_per_range = c.prefer_whole_pieces()
+				* t.torrent_file().piece_length() / t.block_size();
+			if (num_requests < (std::min)(blocks_per_range, int(c.desired_queue_size())))
+				return;
+		}
+
 		piece_picker& p = t.picker();
 		std::vector<piece_block> interesting_pieces;
 		interesting_pieces.reserve(100);
@@ -207,6 +230,16 @@ namespace libtorrent
 			bits = &fast_mask;
 		}
 
+		// pieces dropped from volatile storage, or too far ahead of the
+		// playhead to be kept there, are not requested for now
+		bitfield held_off_mask;
+		if (t.has_held_off_pieces())
+		{
+			held_off_mask = *bits;
+			t.mask_held_off_pieces(held_off_mask);
+			bits = &held_off_mask;
+		}
+
 		piece_picker::piece_state_t state;
 		peer_connection::peer_speed_t speed = c.peer_speed();
 		if (speed == peer_connection::fast) state = piece_picker::fast;
@@ -346,9 +379,12 @@ namespace libtorrent
 	policy::policy(torrent* t)
 		: m_torrent(t)
 		, m_locked_peer(NULL)
-		, m_round_robin(0)
-		, m_num_connect_candidates(0)
+		, m_candidate_ip(random_address())
+#ifndef TORRENT_DISABLE_GEO_IP
+		, m_as_peak_generation(0)
+#endif
 		, m_num_seeds(0)
+		, m_last_erase_time(-1)
 		, m_finished(false)
 	{ TORRENT_ASSERT(t); }
 
@@ -430,14 +466,7 @@ namespace libtorrent
 		if (m_torrent->has_picker())
 			m_torrent->picker().clear_peer(*i);
 		if ((*i)->seed) --m_num_seeds;
-		if (is_connect_candidate(**i, m_finished))
-		{
-			TORRENT_ASSERT(m_num_connect_candidates > 0);
-			--m_num_connect_candidates;
-		}
-		TORRENT_ASSERT(m_num_connect_candidates < int(m_peers.size()));
-		if (m_round_robin > i - m_peers.begin()) --m_round_robin;
-		if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
+		if ((*i)->candidate_index != peer::not_a_candidate) remove_connect_candidate(*i);
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		TORRENT_ASSERT((*i)->in_use);
@@ -447,10 +476,9 @@ namespace libtorrent
 #if TORRENT_USE_IPV6
 		if ((*i)->is_v6_addr)
 		{
-			TORRENT_ASSERT(m_torrent->session().m_ipv6_peer_pool.is_from(
-				static_cast<ipv6_peer*>(*i)));
-			m_torrent->session().m_ipv6_peer_pool.destroy(
-				static_cast<ipv6_peer*>(*i));
+			TORRENT_ASSERT(m_torrent->session().m_ipv6_peer_pool.is_from(*i));
+			static_cast<ipv6_peer*>(*i)->~ipv6_peer();
+			m_torrent->session().m_ipv6_peer_pool.free(*i);
 		}
 		else
 #endif
@@ -465,10 +493,9 @@ namespace libtorrent
 		else
 #endif
 		{
-			TORRENT_ASSERT(m_torrent->session().m_ipv4_peer_pool.is_from(
-				static_cast<ipv4_peer*>(*i)));
-			m_torrent->session().m_ipv4_peer_pool.destroy(
-				static_cast<ipv4_peer*>(*i));
+			TORRENT_ASSERT(m_torrent->session().m_ipv4_peer_pool.is_from(*i));
+			static_cast<ipv4_peer*>(*i)->~ipv4_peer();
+			m_torrent->session().m_ipv4_peer_pool.free(*i);
 		}
 		m_peers.erase(i);
 	}
@@ -578,15 +605,13 @@ namespace libtorrent
 		if (!m_torrent->settings().ban_web_seeds && p->web_seed)
 			return;
 
-		if (is_connect_candidate(*p, m_finished))
-			--m_num_connect_candidates;
-
 #ifdef TORRENT_STATS
 		aux::session_impl& ses = m_torrent->session();
 		++ses.m_num_banned_peers;
 #endif
 
 		p->banned = true;
+		update_connect_candidate(p);
 		TORRENT_ASSERT(!is_connect_candidate(*p, m_finished));
 	}
 
@@ -597,9 +622,8 @@ namespace libtorrent
 		TORRENT_ASSERT(p->in_use);
 		TORRENT_ASSERT(c);
 
-		const bool was_conn_cand = is_connect_candidate(*p, m_finished);
 		p->connection = c;
-		if (was_conn_cand) --m_num_connect_candidates;
+		update_connect_candidate(p);
 	}
 
 	void policy::set_failcount(policy::peer* p, int f)
@@ -607,13 +631,8 @@ namespace libtorrent
 		INVARIANT_CHECK;
 
 		TORRENT_ASSERT(p->in_use);
-		const bool was_conn_cand = is_connect_candidate(*p, m_finished);
 		p->failcount = f;
-		if (was_conn_cand != is_connect_candidate(*p, m_finished))
-		{
-			if (was_conn_cand) --m_num_connect_candidates;
-			else ++m_num_connect_candidates;
-		}
+		update_connect_candidate(p);
 	}
 
 	bool policy::is_connect_candidate(peer const& p, bool finished) const
@@ -641,124 +660,208 @@ namespace libtorrent
 		return true;
 	}
 
-	policy::iterator policy::find_connect_candidate(int session_time)
+	void policy::update_connect_candidate(peer* p)
 	{
-		INVARIANT_CHECK;
+		TORRENT_ASSERT(p->in_use);
+		if (!is_connect_candidate(*p, m_finished))
+		{
+			if (p->candidate_index != peer::not_a_candidate) remove_connect_candidate(p);
+			return;
+		}
 
-		int candidate = -1;
-		int erase_candidate = -1;
+		int i = p->candidate_index;
+		if (i == peer::not_a_candidate)
+		{
+			// the index has to fit in 24 bits. Peers that don't fit
+			// are picked up by the next rebuild, if there's room then
+			if (m_candidates.size() >= peer::not_a_candidate) return;
+			i = m_candidates.size();
+			m_candidates.push_back(p);
+			p->candidate_index = i;
+		}
+		// the peer may have moved in either direction
+		candidate_sift_up(i);
+		candidate_sift_down(p->candidate_index);
+	}
 
-		TORRENT_ASSERT(m_finished == m_torrent->is_finished());
+	void policy::remove_connect_candidate(peer* p)
+	{
+		int i = p->candidate_index;
+		TORRENT_ASSERT(i >= 0 && i < int(m_candidates.size()));
+		TORRENT_ASSERT(m_candidates[i] == p);
+		p->candidate_index = peer::not_a_candidate;
+
+		peer* last = m_candidates.back();
+		m_candidates.pop_back();
+		if (last == p) return;
+
+		m_candidates[i] = last;
+		last->candidate_index = i;
+		candidate_sift_up(i);
+		candidate_sift_down(last->candidate_index);
+	}
 
-		int min_reconnect_time = m_torrent->settings().min_reconnect_time;
-		address external_ip = m_torrent->session().external_address();
+	void policy::rebuild_connect_candidates()
+	{
+		m_last_external_ip = m_finished
+			? address() : m_torrent->session().external_address();
 
 		// don't bias any particular peers when seeding
-		if (m_finished || external_ip == address())
+		m_candidate_ip = m_last_external_ip == address()
+			? random_address() : m_last_external_ip;
+
+#ifndef TORRENT_DISABLE_GEO_IP
+		m_as_peak_generation = m_torrent->session().as_peak_generation();
+#endif
+
+		for (std::vector<peer*>::iterator i = m_candidates.begin()
+			, end(m_candidates.end()); i != end; ++i)
+			(*i)->candidate_index = peer::not_a_candidate;
+		m_candidates.clear();
+
+		for (iterator i = m_peers.begin(), end(m_peers.end()); i != end; ++i)
 		{
-			// set external_ip to a random value, to
-			// radomize which peers we prefer
-			address_v4::bytes_type bytes;
-			std::generate(bytes.begin(), bytes.end(), &random);
-			external_ip = address_v4(bytes);
+			if (!is_connect_candidate(**i, m_finished)) continue;
+			if (m_candidates.size() >= peer::not_a_candidate) break;
+			(*i)->candidate_index = m_candidates.size();
+			m_candidates.push_back(*i);
 		}
 
-		if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
+		for (int i = int(m_candidates.size()) / 2 - 1; i >= 0; --i)
+			candidate_sift_down(i);
+	}
 
-#ifndef TORRENT_DISABLE_DHT
-		bool pinged = false;
+	void policy::candidate_sift_up(int i)
+	{
+		peer* p = m_candidates[i];
+		while (i > 0)
+		{
+			int parent = (i - 1) / 2;
+			if (!compare_peer(*p, *m_candidates[parent], m_candidate_ip)) break;
+			m_candidates[i] = m_candidates[parent];
+			m_candidates[i]->candidate_index = i;
+			i = parent;
+		}
+		m_candidates[i] = p;
+		p->candidate_index = i;
+	}
+
+	void policy::candidate_sift_down(int i)
+	{
+		peer* p = m_candidates[i];
+		const int size = m_candidates.size();
+		for (;;)
+		{
+			int child = i * 2 + 1;
+			if (child >= size) break;
+			if (child + 1 < size && compare_peer(*m_candidates[child + 1]
+				, *m_candidates[child], m_candidate_ip)) ++child;
+			if (!compare_peer(*m_candidates[child], *p, m_candidate_ip)) break;
+			m_candidates[i] = m_candidates[child];
+			m_candidates[i]->candidate_index = i;
+			i = child;
+		}
+		m_candidates[i] = p;
+		p->candidate_index = i;
+	}
+
+	policy::peer* policy::find_connect_candidate(int session_time)
+	{
+		INVARIANT_CHECK;
+
+		TORRENT_ASSERT(m_finished == m_torrent->is_finished());
+
+		int min_reconnect_time = m_torrent->settings().min_reconnect_time;
+
+		// the candidates are ranked by their distance to our
+		// external IP, and by how fast their AS has been. If either
+		// has changed, they need to be re-sorted
+		aux::session_impl const& ses = m_torrent->session();
+		bool resort = (m_finished ? address() : ses.external_address())
+			!= m_last_external_ip;
+#ifndef TORRENT_DISABLE_GEO_IP
+		if (!m_finished && ses.has_asnum_db()
+			&& ses.as_peak_generation() != m_as_peak_generation)
+			resort = true;
 #endif
+		if (resort) rebuild_connect_candidates();
 
 		int max_peerlist_size = m_torrent->is_paused()
 			?m_torrent->settings().max_paused_peerlist_size
 			:m_torrent->settings().max_peerlist_size;
 
-		for (int iterations = (std::min)(int(m_peers.size()), 300);
-			iterations > 0; --iterations)
+		// if the number of peers is growing large
+		// we need to start weeding. erase_peers() scans
+		// the whole list, and we may be called many
+		// times per tick, so only do it once a second
+		if (int(m_peers.size()) >= max_peerlist_size * 0.95
+			&& max_peerlist_size > 0
+			&& session_time != m_last_erase_time)
+		{
+			m_last_erase_time = session_time;
+			erase_peers();
+		}
+
+		// the best candidates may have been connected to
+		// too recently to be tried again. Set those aside
+		// until we find one we can connect to
+		peer* candidate = 0;
+		std::vector<peer*> deferred;
+		for (int iterations = 300; iterations > 0
+			&& !m_candidates.empty(); --iterations)
 		{
-			if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
+			peer* pe = m_candidates.front();
+			TORRENT_ASSERT(pe->in_use);
 
-			peer& pe = *m_peers[m_round_robin];
-			TORRENT_ASSERT(pe.in_use);
-			int current = m_round_robin;
+			remove_connect_candidate(pe);
 
-#ifndef TORRENT_DISABLE_DHT
-			// try to send a DHT ping to this peer
-			// as well, to figure out if it supports
-			// DHT (uTorrent and BitComet doesn't
-			// advertise support)
-			if (!pinged && !pe.added_to_dht)
-			{
-				udp::endpoint node(pe.address(), pe.port);
-				m_torrent->session().add_dht_node(node);
-				pe.added_to_dht = true;
-				pinged = true;
-			}
-#endif
-			// if the number of peers is growing large
-			// we need to start weeding.
+			// the settings is_connect_candidate() depends on may
+			// have changed since the peer was added
+			if (!is_connect_candidate(*pe, m_finished)) continue;
 
-			if (int(m_peers.size()) >= max_peerlist_size * 0.95
-				&& max_peerlist_size > 0)
+			if (pe->last_connected
+				&& session_time - pe->last_connected <
+				(int(pe->failcount) + 1) * min_reconnect_time)
 			{
-				if (is_erase_candidate(pe, m_finished)
-					&& (erase_candidate == -1
-						|| !compare_peer_erase(*m_peers[erase_candidate], pe)))
-				{
-					if (should_erase_immediately(pe))
-					{
-						if (erase_candidate > current) --erase_candidate;
-						if (candidate > current) --candidate;
-						erase_peer(m_peers.begin() + current);
-						continue;
-					}
-					else
-					{
-						erase_candidate = current;
-					}
-				}
+				deferred.push_back(pe);
+				continue;
 			}
 
-			++m_round_robin;
+			candidate = pe;
+			update_connect_candidate(pe);
+			break;
+		}
 
-			if (!is_connect_candidate(pe, m_finished)) continue;
+		for (std::vector<peer*>::iterator i = deferred.begin()
+			, end(deferred.end()); i != end; ++i)
+			update_connect_candidate(*i);
 
-			// compare peer returns true if lhs is better than rhs. In this
-			// case, it returns true if the current candidate is better than
-			// pe, which is the peer m_round_robin points to. If it is, just
-			// keep looking.
-			if (candidate != -1
-				&& compare_peer(*m_peers[candidate], pe, external_ip)) continue;
+		if (candidate == 0) return 0;
 
-			if (pe.last_connected
-				&& session_time - pe.last_connected <
-				(int(pe.failcount) + 1) * min_reconnect_time)
-				continue;
-
-			candidate = current;
-		}
-		
-		if (erase_candidate > -1)
+#ifndef TORRENT_DISABLE_DHT
+		// try to send a DHT ping to this peer
+		// as well, to figure out if it supports
+		// DHT (uTorrent and BitComet doesn't
+		// advertise support)
+		if (!candidate->added_to_dht)
 		{
-			if (candidate > erase_candidate) --candidate;
-			erase_peer(m_peers.begin() + erase_candidate);
+			udp::endpoint node(candidate->address(), candidate->port);
+			m_torrent->session().add_dht_node(node);
+			candidate->added_to_dht = true;
 		}
+#endif
 
 #if defined TORRENT_LOGGING || defined TORRENT_VERBOSE_LOGGING
-		if (candidate != -1)
-		{
-			(*m_torrent->session().m_logger) << time_now_string()
-				<< " *** FOUND CONNECTION CANDIDATE ["
-				" ip: " << m_peers[candidate]->ip() <<
-				" d: " << cidr_distance(external_ip, m_peers[candidate]->address()) <<
-				" external: " << external_ip <<
-				" t: " << (session_time - m_peers[candidate]->last_connected) <<
-				" ]\n";
-		}
+		(*m_torrent->session().m_logger) << time_now_string()
+			<< " *** FOUND CONNECTION CANDIDATE ["
+			" ip: " << candidate->ip() <<
+			" d: " << cidr_distance(m_candidate_ip, candidate->address()) <<
+			" external: " << m_candidate_ip <<
+			" t: " << (session_time - candidate->last_connected) <<
+			" ]\n";
 #endif
 
-		if (candidate == -1) return m_peers.end();
-		return m_peers.begin() + candidate;
+		return candidate;
 	}
 
 	bool policy::new_connection(peer_connection& c, int session_time)
@@ -943,13 +1046,6 @@ namespace libtorrent
 					}
 				}
 			}
-
-			if (is_connect_candidate(*i, m_finished))
-			{
-				m_num_connect_candidates--;
-				TORRENT_ASSERT(m_num_connect_candidates >= 0);
-				if (m_num_connect_candidates < 0) m_num_connect_candidates = 0;
-			}
 		}
 		else
 		{
@@ -1016,15 +1112,9 @@ namespace libtorrent
 
 			iter = m_peers.insert(iter, p);
 
-			if (m_round_robin >= iter - m_peers.begin()) ++m_round_robin;
-
 			i = *iter;
 #ifndef TORRENT_DISABLE_GEO_IP
-			int as = ses.as_for_ip(c.remote().address());
-#ifdef TORRENT_DEBUG
-			i->inet_as_num = as;
-#endif
-			i->inet_as = ses.lookup_as(as);
+			i->inet_as = ses.lookup_as(ses.as_for_ip(c.remote().address()));
 #endif
 			i->source = peer_info::incoming;
 		}
@@ -1047,6 +1137,7 @@ namespace libtorrent
 		TORRENT_ASSERT(i->connection);
 		if (!c.fast_reconnect())
 			i->last_connected = session_time;
+		update_connect_candidate(i);
 
 		// this cannot be a connect candidate anymore, since i->connection is set
 		TORRENT_ASSERT(!is_connect_candidate(*i, m_finished));
@@ -1077,13 +1168,11 @@ namespace libtorrent
 				TORRENT_ASSERT(pp.in_use);
 				if (pp.connection)
 				{
-					bool was_conn_cand = is_connect_candidate(pp, m_finished);
 					// if we already have an entry with this
 					// new endpoint, disconnect this one
 					pp.connectable = true;
 					pp.source |= src;
-					if (!was_conn_cand && is_connect_candidate(pp, m_finished))
-						++m_num_connect_candidates;
+					update_connect_candidate(&pp);
 					// calling disconnect() on a peer, may actually end
 					// up "garbage collecting" its policy::peer entry
 					// as well, if it's considered useless (which this specific)
@@ -1115,17 +1204,10 @@ namespace libtorrent
 		}
 #endif
 
-		bool was_conn_cand = is_connect_candidate(*p, m_finished);
 		p->port = port;
 		p->source |= src;
 		p->connectable = true;
-
-		if (was_conn_cand != is_connect_candidate(*p, m_finished))
-		{
-			m_num_connect_candidates += was_conn_cand ? -1 : 1;
-			TORRENT_ASSERT(m_num_connect_candidates >= 0);
-			if (m_num_connect_candidates < 0) m_num_connect_candidates = 0;
-		}
+		update_connect_candidate(p);
 		return true;
 	}
 
@@ -1149,14 +1231,8 @@ namespace libtorrent
 		if (p == 0) return;
 		TORRENT_ASSERT(p->in_use);
 		if (p->seed == s) return;
-		bool was_conn_cand = is_connect_candidate(*p, m_finished);
 		p->seed = s;
-		if (was_conn_cand && !is_connect_candidate(*p, m_finished))
-		{
-			--m_num_connect_candidates;
-			TORRENT_ASSERT(m_num_connect_candidates >= 0);
-			if (m_num_connect_candidates < 0) m_num_connect_candidates = 0;
-		}
+		update_connect_candidate(p);
 
 		if (p->web_seed) return;
 		if (s) ++m_num_seeds;
@@ -1165,6 +1241,15 @@ namespace libtorrent
 		TORRENT_ASSERT(m_num_seeds <= int(m_peers.size()));
 	}
 
+	void policy::set_proven(policy::peer* p, bool v)
+	{
+		if (p == 0) return;
+		TORRENT_ASSERT(p->in_use);
+		if (p->proven == v) return;
+		p->proven = v;
+		update_connect_candidate(p);
+	}
+
 	bool policy::insert_peer(policy::peer* p, iterator iter, int flags)
 	{
 		TORRENT_ASSERT(p);
@@ -1201,8 +1286,6 @@ namespace libtorrent
 
 		iter = m_peers.insert(iter, p);
 
-		if (m_round_robin >= iter - m_peers.begin()) ++m_round_robin;
-
 #ifndef TORRENT_DISABLE_ENCRYPTION
 		if (flags & 0x01) p->pe_support = true;
 #endif
@@ -1217,14 +1300,10 @@ namespace libtorrent
 			p->supports_holepunch = true;
 
 #ifndef TORRENT_DISABLE_GEO_IP
-		int as = m_torrent->session().as_for_ip(p->address());
-#ifdef TORRENT_DEBUG
-		p->inet_as_num = as;
-#endif
-		p->inet_as = m_torrent->session().lookup_as(as);
+		aux::session_impl& ses = m_torrent->session();
+		p->inet_as = ses.lookup_as(ses.as_for_ip(p->address()));
 #endif
-		if (is_connect_candidate(*p, m_finished))
-			++m_num_connect_candidates;
+		update_connect_candidate(p);
 
 		m_torrent->state_updated();
 
@@ -1234,8 +1313,6 @@ namespace libtorrent
 	void policy::update_peer(policy::peer* p, int src, int flags
 		, tcp::endpoint const& remote, char const* destination)
 	{
-		bool was_conn_cand = is_connect_candidate(*p, m_finished);
-
 		TORRENT_ASSERT(p->in_use);
 		p->connectable = true;
 
@@ -1282,11 +1359,7 @@ namespace libtorrent
 		}
 #endif
 
-		if (was_conn_cand != is_connect_candidate(*p, m_finished))
-		{
-			m_num_connect_candidates += was_conn_cand ? -1 : 1;
-			if (m_num_connect_candidates < 0) m_num_connect_candidates = 0;
-		}
+		update_connect_candidate(p);
 	}
 
 #if TORRENT_USE_I2P
@@ -1457,10 +1530,17 @@ namespace libtorrent
 				p->in_use = false;
 #endif
 #if TORRENT_USE_IPV6
-				if (is_v6) m_torrent->session().m_ipv6_peer_pool.destroy((ipv6_peer*)p);
+				if (is_v6)
+				{
+					static_cast<ipv6_peer*>(p)->~ipv6_peer();
+					m_torrent->session().m_ipv6_peer_pool.free(p);
+				}
 				else
 #endif
-				m_torrent->session().m_ipv4_peer_pool.destroy((ipv4_peer*)p);
+				{
+					static_cast<ipv4_peer*>(p)->~ipv4_peer();
+					m_torrent->session().m_ipv4_peer_pool.free(p);
+				}
 				return 0;
 			}
 #ifndef TORRENT_DISABLE_EXTENSIONS
@@ -1486,9 +1566,9 @@ namespace libtorrent
 
 		TORRENT_ASSERT(m_torrent->want_more_peers());
 		
-		iterator i = find_connect_candidate(session_time);
-		if (i == m_peers.end()) return false;
-		peer& p = **i;
+		peer* i = find_connect_candidate(session_time);
+		if (i == 0) return false;
+		peer& p = *i;
 		TORRENT_ASSERT(p.in_use);
 
 		TORRENT_ASSERT(!p.banned);
@@ -1500,10 +1580,8 @@ namespace libtorrent
 		if (!m_torrent->connect_to_peer(&p))
 		{
 			// failcount is a 5 bit value
-			const bool was_conn_cand = is_connect_candidate(p, m_finished);
 			if (p.failcount < 31) ++p.failcount;
-			if (was_conn_cand && !is_connect_candidate(p, m_finished))
-				--m_num_connect_candidates;
+			update_connect_candidate(&p);
 			return false;
 		}
 		TORRENT_ASSERT(p.connection);
@@ -1554,8 +1632,7 @@ namespace libtorrent
 			if (p->failcount < 31) ++p->failcount;
 		}
 
-		if (is_connect_candidate(*p, m_finished))
-			++m_num_connect_candidates;
+		update_connect_candidate(p);
 
 		// if we're already a seed, it's not as important
 		// to keep all the possibly stale peers
@@ -1606,13 +1683,47 @@ namespace libtorrent
 		const bool is_finished = m_torrent->is_finished();
 		if (is_finished == m_finished) return;
 
-		m_num_connect_candidates = 0;
 		m_finished = is_finished;
-		for (const_iterator i = m_peers.begin();
-			i != m_peers.end(); ++i)
+		rebuild_connect_candidates();
+	}
+
+	void policy::reset_last_connected()
+	{
+		for (iterator i = m_peers.begin(), end(m_peers.end()); i != end; ++i)
+			(*i)->last_connected = 0;
+
+		// this changes the order of the candidates
+		rebuild_connect_candidates();
+	}
+
+	void policy::set_last_connected(policy::peer* p, int session_time)
+	{
+		TORRENT_ASSERT(p->in_use);
+		p->last_connected = session_time;
+		update_connect_candidate(p);
+	}
+
+	void policy::step_session_time(int seconds)
+	{
+		for (iterator i = m_peers.begin(), end(m_peers.end()); i != end; ++i)
 		{
-			m_num_connect_candidates += is_connect_candidate(**i, m_finished);
+			peer* pe = *i;
+
+			if (pe->last_optimistically_unchoked < seconds)
+				pe->last_optimistically_unchoked = 0;
+			else
+				pe->last_optimistically_unchoked -= seconds;
+
+			if (pe->last_connected < seconds)
+				pe->last_connected = 0;
+			else
+				pe->last_connected -= seconds;
 		}
+		m_last_erase_time = -1;
+
+		// peers whose last_connected was clamped to 0 may rank
+		// differently now
+		rebuild_connect_candidates();
 	}
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
@@ -1640,8 +1751,7 @@ namespace libtorrent
 #ifdef TORRENT_DEBUG
 	void policy::check_invariant() const
 	{
-		TORRENT_ASSERT(m_num_connect_candidates >= 0);
-		TORRENT_ASSERT(m_num_connect_candidates <= int(m_peers.size()));
+		TORRENT_ASSERT(m_candidates.size() <= m_peers.size());
 		if (m_torrent->is_aborted()) return;
 
 #ifdef TORRENT_EXPENSIVE_INVARIANT_CHECKS
@@ -1668,9 +1778,6 @@ namespace libtorrent
 			peer const& p = **i;
 			TORRENT_ASSERT(p.in_use);
 			if (is_connect_candidate(p, m_finished)) ++connect_candidates;
-#ifndef TORRENT_DISABLE_GEO_IP
-			TORRENT_ASSERT(p.inet_as == 0 || p.inet_as->first == p.inet_as_num);
-#endif
 			if (!m_torrent->settings().allow_multiple_connections_per_ip)
 			{
 				std::pair<const_iterator, const_iterator> range = find_peers(p.address());
@@ -1699,7 +1806,9 @@ namespace libtorrent
 				++connected_peers;
 		}
 
-		TORRENT_ASSERT(m_num_connect_candidates == connect_candidates);
+		TORRENT_ASSERT(int(m_candidates.size()) == connect_candidates);
+		for (int i = 0; i < int(m_candidates.size()); ++i)
+			TORRENT_ASSERT(m_candidates[i]->candidate_index == i);
 
 		int num_torrent_peers = 0;
 		for (torrent::const_peer_iterator i = m_torrent->begin();
@@ -1766,7 +1875,7 @@ namespace libtorrent
 		, prev_amount_download(0)
 		, connection(0)
 #ifndef TORRENT_DISABLE_GEO_IP
-		, inet_as(0)
+		, inet_as(unknown_as)
 #endif
 		, last_optimistically_unchoked(0)
 		, last_connected(0)
@@ -1803,9 +1912,11 @@ namespace libtorrent
 		, confirmed_supports_utp(false)
 		, supports_holepunch(false)
 		, web_seed(false)
+		, proven(false)
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		, in_use(false)
 #endif
+		, candidate_index(not_a_candidate)
 	{
 		TORRENT_ASSERT((src & 0xff) == src);
 	}
@@ -1846,6 +1957,10 @@ namespace libtorrent
 		if (lhs.failcount != rhs.failcount)
 			return lhs.failcount > rhs.failcount;
 
+		// hang on to peers that have served us well before
+		if (lhs.proven != rhs.proven)
+			return lhs.proven < rhs.proven;
+
 		bool lhs_resume_data_source = lhs.source == peer_info::resume_data;
 		bool rhs_resume_data_source = rhs.source == peer_info::resume_data;
 
@@ -1875,6 +1990,11 @@ namespace libtorrent
 		if (lhs.last_connected != rhs.last_connected)
 			return lhs.last_connected < rhs.last_connected;
 
+		// among the peers we haven't tried yet (or tried
+		// equally long ago), prefer the ones that gave us
+		// good download rates in a previous session
+		if (lhs.proven != rhs.proven) return lhs.proven > rhs.proven;
+
 		int lhs_rank = source_rank(lhs.source);
 		int rhs_rank = source_rank(rhs.source);
 		if (lhs_rank != rhs_rank) return lhs_rank > rhs_rank;
@@ -1883,8 +2003,9 @@ namespace libtorrent
 		// don't bias fast peers when seeding
 		if (!m_finished && m_torrent->session().has_asnum_db())
 		{
-			int lhs_as = lhs.inet_as ? lhs.inet_as->second : 0;
-			int rhs_as = rhs.inet_as ? rhs.inet_as->second : 0;
+			aux::session_impl const& ses = m_torrent->session();
+			int lhs_as = lhs.inet_as != peer::unknown_as ? ses.as_peak(lhs.inet_as).second : 0;
+			int rhs_as = rhs.inet_as != peer::unknown_as ? ses.as_peak(rhs.inet_as).second : 0;
 			if (lhs_as != rhs_as) return lhs_as > rhs_as;
 		}
 #endif
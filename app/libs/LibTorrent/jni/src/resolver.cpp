@@ -0,0 +1,183 @@
+/*
+
+Copyright (c) 2026, PopcornTV contributors
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <boost/bind.hpp>
+#include "libtorrent/resolver.hpp"
+#include "libtorrent/io_service.hpp"
+#include "libtorrent/time.hpp"
+#include "libtorrent/error.hpp"
+#include "libtorrent/assert.hpp"
+
+namespace libtorrent
+{
+	resolver::resolver(io_service& ios)
+		: m_ios(ios)
+		, m_resolver(ios)
+		, m_timeout(1200)
+	{}
+
+	void resolver::async_resolve(std::string const& host, callback_t const& h
+		, void const* owner)
+	{
+		// numeric addresses don't need a lookup
+		error_code ec;
+		address a = address::from_string(host.c_str(), ec);
+		if (!ec)
+		{
+			m_ios.post(boost::bind(h, ec, std::vector<address>(1, a)));
+			return;
+		}
+
+		cache_t::iterator i = m_cache.find(host);
+		if (i != m_cache.end())
+		{
+			if (i->second.expires > time_now())
+			{
+				m_ios.post(boost::bind(h, i->second.error, i->second.addresses));
+				return;
+			}
+			m_cache.erase(i);
+		}
+
+		pending_handler ph;
+		ph.handler = h;
+		ph.owner = owner;
+
+		pending_t::iterator p = m_pending.find(host);
+		if (p != m_pending.end())
+		{
+			// someone else is already looking this name up
+			p->second.push_back(ph);
+			return;
+		}
+
+		m_pending[host].push_back(ph);
+		tcp::resolver::query q(host, "0");
+		m_resolver.async_resolve(q, boost::bind(&resolver::on_lookup, this, _1, _2, host));
+	}
+
+	void resolver::prefetch(std::string const& host)
+	{
+		if (host.empty()) return;
+
+		error_code ec;
+		address::from_string(host.c_str(), ec);
+		if (!ec) return;
+
+		cache_t::iterator i = m_cache.find(host);
+		// refresh entries that are about to expire
+		if (i != m_cache.end() && i->second.expires > time_now() + seconds(m_timeout / 10))
+			return;
+
+		if (m_pending.find(host) != m_pending.end()) return;
+
+		m_pending[host];
+		tcp::resolver::query q(host, "0");
+		m_resolver.async_resolve(q, boost::bind(&resolver::on_lookup, this, _1, _2, host));
+	}
+
+	void resolver::cancel(void const* owner)
+	{
+		TORRENT_ASSERT(owner);
+		for (pending_t::iterator i = m_pending.begin(); i != m_pending.end(); ++i)
+		{
+			std::vector<pending_handler>& handlers = i->second;
+			for (std::vector<pending_handler>::iterator h = handlers.begin();
+				h != handlers.end();)
+			{
+				if (h->owner != owner) { ++h; continue; }
+				m_ios.post(boost::bind(h->handler
+					, error_code(asio::error::operation_aborted)
+					, std::vector<address>()));
+				h = handlers.erase(h);
+			}
+			// if that was the last handler, the lookup is left
+			// to complete as a prefetch
+		}
+	}
+
+	void resolver::on_lookup(error_code const& ec, tcp::resolver::iterator i
+		, std::string host)
+	{
+		std::vector<pending_handler> handlers;
+		pending_t::iterator p = m_pending.find(host);
+		if (p != m_pending.end())
+		{
+			handlers.swap(p->second);
+			m_pending.erase(p);
+		}
+
+		std::vector<address> addresses;
+		for (; i != tcp::resolver::iterator(); ++i)
+			addresses.push_back(i->endpoint().address());
+
+		error_code e = ec;
+		if (!e && addresses.empty()) e = asio::error::host_not_found;
+
+		if (e != asio::error::operation_aborted && m_timeout > 0)
+		{
+			ptime now = time_now();
+			if (int(m_cache.size()) >= max_cache_size)
+			{
+				// make room by dropping the entry closest to expiring
+				cache_t::iterator oldest = m_cache.begin();
+				for (cache_t::iterator j = m_cache.begin(); j != m_cache.end(); ++j)
+				{
+					if (j->second.expires < oldest->second.expires) oldest = j;
+				}
+				m_cache.erase(oldest);
+			}
+			dns_cache_entry& ce = m_cache[host];
+			ce.error = e;
+			ce.addresses = addresses;
+			// a failure may well be the network being down for a moment,
+			// don't hold on to it for long
+			ce.expires = now + seconds(e ? (std::min)(m_timeout / 10, 60) : m_timeout);
+		}
+
+		for (std::vector<pending_handler>::iterator h = handlers.begin()
+			, end(handlers.end()); h != end; ++h)
+		{
+			TORRENT_TRY {
+				h->handler(e, addresses);
+			} TORRENT_CATCH(std::exception&) {}
+		}
+	}
+
+	void resolver::set_cache_timeout(int s)
+	{
+		TORRENT_ASSERT(s >= 0);
+		m_timeout = s;
+		if (m_timeout == 0) m_cache.clear();
+	}
+}
+
@@ -585,7 +585,12 @@ int feed::update_feed()
 	boost::shared_ptr<http_connection> feed(
 		new http_connection(m_ses.m_io_service, m_ses.m_half_open
 			, boost::bind(&feed::on_feed, shared_from_this()
-			, _1, _2, _3, _4)));
+			, _1, _2, _3, _4), true, http_connect_handler()
+			, http_filter_handler()
+#ifdef TORRENT_USE_OPENSSL
+			, 0
+#endif
+			, &m_ses.m_host_resolver));
 
 	m_updating = true;
 	feed->get(m_settings.url, seconds(30), 0, 0, 5, m_ses.m_settings.user_agent);
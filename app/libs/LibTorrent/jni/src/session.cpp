@@ -865,6 +865,11 @@ namespace libtorrent
 		return r;
 	}
 
+	void session::prefetch_hostname(std::string const& hostname)
+	{
+		TORRENT_ASYNC_CALL1(prefetch_hostname, hostname);
+	}
+
 #ifndef TORRENT_NO_DEPRECATE
 	void session::set_peer_proxy(proxy_settings const& s)
 	{
@@ -1125,6 +1130,7 @@ namespace libtorrent
 		, tracker_receive_timeout(40)
 		, stop_tracker_timeout(5)
 		, tracker_maximum_response_length(1024*1024)
+		, resolver_cache_timeout(1200)
 		, piece_timeout(20)
 		, request_timeout(50)
 		, request_queue_time(3)
@@ -1134,6 +1140,7 @@ namespace libtorrent
 		, peer_timeout(120)
 		, urlseed_timeout(20)
 		, urlseed_pipeline_size(5)
+		, urlseed_max_connections(2)
 		, urlseed_wait_retry(30)
 		, file_pool_size(40)
 		, allow_multiple_connections_per_ip(false)
@@ -1224,6 +1231,8 @@ namespace libtorrent
 		, send_socket_buffer_size(0)
 		, optimize_hashing_for_speed(true)
 		, file_checks_delay_per_block(0)
+		, file_checks_read_ahead(4)
+		, file_check_hash_threads(2)
 		, disk_cache_algorithm(avoid_readback)
 		, read_cache_line_size(32)
 		, write_cache_line_size(32)
@@ -1267,7 +1276,9 @@ namespace libtorrent
 		, dht_upload_rate_limit(4000)
 		, unchoke_slots_limit(8)
 		, half_open_limit(0)
+		, adaptive_half_open_limit(false)
 		, connections_limit(200)
+		, network_threads(1)
 		, utp_target_delay(100) // milliseconds
 		, utp_gain_factor(1500) // bytes per rtt
 		, utp_min_timeout(500) // milliseconds
@@ -1278,8 +1289,10 @@ namespace libtorrent
 		, utp_delayed_ack(0) // milliseconds
 		, utp_dynamic_sock_buf(false) // this doesn't seem quite reliable yet
 		, utp_loss_multiplier(50) // specified in percent
+		, utp_ledbat_plus_plus(false)
 		, mixed_mode_algorithm(peer_proportional)
 		, rate_limit_utp(true)
+		, streaming_bandwidth_share(50)
 		, listen_queue_size(5)
 		, announce_double_nat(false)
 		, torrent_connect_boost(10)
@@ -1292,10 +1305,12 @@ namespace libtorrent
 		, apply_ip_filter_to_trackers(true)
 		, read_job_every(10)
 		, use_disk_read_ahead(true)
+		, use_sendfile(true)
 		, lock_files(false)
 		, ssl_listen(4433)
 		, tracker_backoff(250)
 		, ban_web_seeds(true)
+		, ram_storage_size(32 * 1024 * 1024)
 	{}
 
 	session_settings::~session_settings() {}
@@ -286,6 +286,7 @@ namespace aux {
 		TORRENT_SETTING(integer, tracker_receive_timeout)
 		TORRENT_SETTING(integer, stop_tracker_timeout)
 		TORRENT_SETTING(integer, tracker_maximum_response_length)
+		TORRENT_SETTING(integer, resolver_cache_timeout)
 		TORRENT_SETTING(integer, piece_timeout)
 		TORRENT_SETTING(integer, request_timeout)
 		TORRENT_SETTING(integer, request_queue_time)
@@ -295,6 +296,7 @@ namespace aux {
 		TORRENT_SETTING(integer, peer_timeout)
 		TORRENT_SETTING(integer, urlseed_timeout)
 		TORRENT_SETTING(integer, urlseed_pipeline_size)
+		TORRENT_SETTING(integer, urlseed_max_connections)
 		TORRENT_SETTING(integer, urlseed_wait_retry)
 		TORRENT_SETTING(integer, file_pool_size)
 		TORRENT_SETTING(boolean, allow_multiple_connections_per_ip)
@@ -378,6 +380,8 @@ namespace aux {
 		TORRENT_SETTING(integer, send_socket_buffer_size)
 		TORRENT_SETTING(boolean, optimize_hashing_for_speed)
 		TORRENT_SETTING(integer, file_checks_delay_per_block)
+		TORRENT_SETTING(integer, file_checks_read_ahead)
+		TORRENT_SETTING(integer, file_check_hash_threads)
 		TORRENT_SETTING(integer, disk_cache_algorithm)
 		TORRENT_SETTING(integer, read_cache_line_size)
 		TORRENT_SETTING(integer, write_cache_line_size)
@@ -421,7 +425,9 @@ namespace aux {
 		TORRENT_SETTING(integer, dht_upload_rate_limit)
 		TORRENT_SETTING(integer, unchoke_slots_limit)
 		TORRENT_SETTING(integer, half_open_limit)
+		TORRENT_SETTING(boolean, adaptive_half_open_limit)
 		TORRENT_SETTING(integer, connections_limit)
+		TORRENT_SETTING(integer, network_threads)
 		TORRENT_SETTING(integer, utp_target_delay)
 		TORRENT_SETTING(integer, utp_gain_factor)
 		TORRENT_SETTING(integer, utp_syn_resends)
@@ -430,8 +436,10 @@ namespace aux {
 		TORRENT_SETTING(integer, utp_connect_timeout)
 		TORRENT_SETTING(integer, utp_delayed_ack)
 		TORRENT_SETTING(boolean, utp_dynamic_sock_buf)
+		TORRENT_SETTING(boolean, utp_ledbat_plus_plus)
 		TORRENT_SETTING(integer, mixed_mode_algorithm)
 		TORRENT_SETTING(boolean, rate_limit_utp)
+		TORRENT_SETTING(integer, streaming_bandwidth_share)
 		TORRENT_SETTING(integer, listen_queue_size)
 		TORRENT_SETTING(boolean, announce_double_nat)
 		TORRENT_SETTING(integer, torrent_connect_boost)
@@ -444,9 +452,11 @@ namespace aux {
 		TORRENT_SETTING(boolean, apply_ip_filter_to_trackers)
 		TORRENT_SETTING(integer, read_job_every)
 		TORRENT_SETTING(boolean, use_disk_read_ahead)
+		TORRENT_SETTING(boolean, use_sendfile)
 		TORRENT_SETTING(boolean, lock_files)
 		TORRENT_SETTING(integer, ssl_listen)
 		TORRENT_SETTING(integer, tracker_backoff)
+		TORRENT_SETTING(integer, ram_storage_size)
 	};
 
 #undef TORRENT_SETTING
@@ -474,6 +484,10 @@ namespace aux {
 		TORRENT_SETTING(integer, service_port)
 #endif
 		TORRENT_SETTING(integer, max_fail_count)
+		TORRENT_SETTING(integer, max_torrents)
+		TORRENT_SETTING(integer, max_peers)
+		TORRENT_SETTING(integer, max_total_peers)
+		TORRENT_SETTING(integer, max_dht_items)
 		TORRENT_SETTING(integer, max_torrent_search_reply)
 	};
 #undef TORRENT_SETTING
@@ -597,15 +611,13 @@ namespace aux {
 		, std::string const& logpath
 #endif
 		)
-		: m_ipv4_peer_pool(500)
+		: m_ipv4_peer_pool(sizeof(policy::ipv4_peer), 500)
 #if TORRENT_USE_IPV6
-		, m_ipv6_peer_pool(500)
-#endif
-#ifndef TORRENT_DISABLE_POOL_ALLOCATOR
-		, m_send_buffers(send_buffer_size)
+		, m_ipv6_peer_pool(sizeof(policy::ipv6_peer), 500)
 #endif
 		, m_files(40)
 		, m_io_service()
+		, m_next_network_shard(0)
 #ifdef TORRENT_USE_OPENSSL
 		, m_ssl_ctx(m_io_service, asio::ssl::context::sslv23)
 #endif
@@ -667,6 +679,7 @@ namespace aux {
 #ifndef TORRENT_DISABLE_GEO_IP
 		, m_asnum_db(0)
 		, m_country_db(0)
+		, m_as_peak_generation(0)
 #endif
 		, m_total_failed_bytes(0)
 		, m_total_redundant_bytes(0)
@@ -911,9 +924,6 @@ namespace aux {
 		PRINT_OFFSETOF(policy::peer, prev_amount_download)
 		PRINT_OFFSETOF(policy::peer, connection)
 #ifndef TORRENT_DISABLE_GEO_IP
-#ifdef TORRENT_DEBUG
-		PRINT_OFFSETOF(policy::peer, inet_as_num)
-#endif
 		PRINT_OFFSETOF(policy::peer, inet_as)
 #endif
 		PRINT_OFFSETOF(policy::peer, last_optimistically_unchoked)
@@ -1032,7 +1042,6 @@ namespace aux {
 #endif
 #ifdef TORRENT_DISK_STATS
 		m_buffer_usage_logger.open("buffer_stats.log", std::ios::trunc);
-		m_buffer_allocations = 0;
 #endif
 
 #if defined TORRENT_BSD || defined TORRENT_LINUX
@@ -1408,8 +1417,8 @@ namespace aux {
 		{
 			entry::dictionary_type& as_map = e["AS map"].dict();
 			char buf[10];
-			for (std::map<int, int>::const_iterator i = m_as_peak.begin()
-				, end(m_as_peak.end()); i != end; ++i)
+			for (std::vector<std::pair<int, int> >::const_iterator i = m_as_peaks.begin()
+				, end(m_as_peaks.end()); i != end; ++i)
 			{
 				if (i->second == 0) continue;
 					sprintf(buf, "%05d", i->first);
@@ -1449,6 +1458,9 @@ namespace aux {
 		// open the socks incoming connection
 		if (!m_socks_listen_socket) open_new_incoming_socks_connection();
 		m_udp_socket.set_proxy_settings(m_proxy);
+
+		if (m_proxy.type != proxy_settings::none)
+			m_host_resolver.prefetch(m_proxy.hostname);
 	}
 
 	void session_impl::load_state(lazy_entry const* e)
@@ -1482,6 +1494,10 @@ namespace aux {
 		if (settings)
 		{
 			m_dht_state = *settings;
+			// the DHT may already be running, started from an empty
+			// state. Restart it from the one we just loaded, so that
+			// the saved node ID and routing table are actually used
+			if (m_dht) start_dht(m_dht_state);
 		}
 #endif
 
@@ -1504,8 +1520,9 @@ namespace aux {
 				std::pair<std::string, lazy_entry const*> item = settings->dict_at(i);
 				int as_num = atoi(item.first.c_str());
 				if (item.second->type() != lazy_entry::int_t || item.second->int_value() == 0) continue;
-				int& peak = m_as_peak[as_num];
-				if (peak < item.second->int_value()) peak = item.second->int_value();
+				boost::uint16_t index = lookup_as(as_num);
+				if (index == policy::peer::unknown_as) continue;
+				update_as_peak(index, item.second->int_value());
 			}
 		}
 #endif
@@ -1584,18 +1601,29 @@ namespace aux {
 		return tmp + 1;
 	}
 
-	std::pair<const int, int>* session_impl::lookup_as(int as)
+	boost::uint16_t session_impl::lookup_as(int as)
 	{
 		TORRENT_ASSERT(is_network_thread());
 
-		std::map<int, int>::iterator i = m_as_peak.lower_bound(as);
+		std::map<int, boost::uint16_t>::iterator i = m_as_index.lower_bound(as);
+		if (i != m_as_index.end() && i->first == as) return i->second;
 
-		if (i == m_as_peak.end() || i->first != as)
-		{
-			// we don't have any data for this AS, insert a new entry
-			i = m_as_peak.insert(i, std::pair<int, int>(as, 0));
-		}
-		return &(*i);
+		// we don't have any data for this AS, insert a new entry
+		if (m_as_peaks.size() >= policy::peer::unknown_as)
+			return policy::peer::unknown_as;
+		boost::uint16_t index = m_as_peaks.size();
+		m_as_peaks.push_back(std::pair<int, int>(as, 0));
+		m_as_index.insert(i, std::make_pair(as, index));
+		return index;
+	}
+
+	void session_impl::update_as_peak(boost::uint16_t index, int rate)
+	{
+		TORRENT_ASSERT(index < m_as_peaks.size());
+		int& peak = m_as_peaks[index].second;
+		if (peak >= rate) return;
+		peak = rate;
+		++m_as_peak_generation;
 	}
 
 	void session_impl::load_asnum_db(std::string file)
@@ -1604,6 +1632,7 @@ namespace aux {
 
 		if (m_asnum_db) GeoIP_delete(m_asnum_db);
 		m_asnum_db = GeoIP_open(file.c_str(), GEOIP_STANDARD);
+		++m_as_peak_generation;
 //		return m_asnum_db;
 	}
 
@@ -1617,6 +1646,7 @@ namespace aux {
 		std::string utf8;
 		wchar_utf8(file, utf8);
 		m_asnum_db = GeoIP_open(utf8.c_str(), GEOIP_STANDARD);
+		++m_as_peak_generation;
 //		return m_asnum_db;
 	}
 
@@ -1886,7 +1916,14 @@ namespace aux {
 	void session_impl::set_port_filter(port_filter const& f)
 	{
 		m_port_filter = f;
-		// TODO: recalculate all connect candidates for all torrents
+		rebuild_connect_candidates();
+	}
+
+	void session_impl::rebuild_connect_candidates()
+	{
+		for (torrent_map::iterator i = m_torrents.begin()
+			, end(m_torrents.end()); i != end; ++i)
+			i->second->get_policy().rebuild_connect_candidates();
 	}
 
 	void session_impl::set_ip_filter(ip_filter const& f)
@@ -1932,6 +1969,8 @@ namespace aux {
 			|| m_settings.cache_expiry != s.cache_expiry
 			|| m_settings.optimize_hashing_for_speed != s.optimize_hashing_for_speed
 			|| m_settings.file_checks_delay_per_block != s.file_checks_delay_per_block
+			|| m_settings.file_checks_read_ahead != s.file_checks_read_ahead
+			|| m_settings.file_check_hash_threads != s.file_check_hash_threads
 			|| m_settings.disk_cache_algorithm != s.disk_cache_algorithm
 			|| m_settings.read_cache_line_size != s.read_cache_line_size
 			|| m_settings.write_cache_line_size != s.write_cache_line_size
@@ -2046,6 +2085,9 @@ namespace aux {
 		if (m_settings.alert_queue_size != s.alert_queue_size)
 			m_alerts.set_alert_queue_size_limit(s.alert_queue_size);
 
+		if (m_settings.resolver_cache_timeout != s.resolver_cache_timeout)
+			m_host_resolver.set_cache_timeout(s.resolver_cache_timeout);
+
 		if (m_settings.dht_upload_rate_limit != s.dht_upload_rate_limit)
 			m_udp_socket.set_rate_limit(s.dht_upload_rate_limit);
 
@@ -2062,8 +2104,15 @@ namespace aux {
 		if (m_settings.ssl_listen != s.ssl_listen)
 			reopen_listen_port = true;
 
+		// these decide which peers are connect candidates
+		bool connect_candidates_changed
+			= m_settings.max_failcount != s.max_failcount
+			|| m_settings.no_connect_privileged_ports != s.no_connect_privileged_ports;
+
 		m_settings = s;
 
+		if (connect_candidates_changed) rebuild_connect_candidates();
+
 		if (m_settings.cache_buffer_chunk_size <= 0)
 			m_settings.cache_buffer_chunk_size = 1;
 
@@ -2629,10 +2678,43 @@ retry:
 		}
 	}
 
+	session_impl::network_shard::network_shard()
+		: work(new io_service::work(ios))
+	{
+		shard_thread.reset(new thread(boost::bind(&network_shard::run, this)));
+	}
+
+	void session_impl::network_shard::run()
+	{
+		// the only handlers running on this thread are socket operation
+		// completions, which immediately post themselves to the main
+		// network thread (see peer_connection::network_thread_handler)
+		error_code ec;
+		ios.run(ec);
+		TORRENT_ASSERT(!ec);
+	}
+
+	io_service& session_impl::peer_io_service()
+	{
+		TORRENT_ASSERT(is_network_thread());
+		int num_threads = m_settings.network_threads;
+		if (num_threads <= 1 || m_abort) return m_io_service;
+
+		m_next_network_shard = (m_next_network_shard + 1) % num_threads;
+		if (m_next_network_shard == 0) return m_io_service;
+
+		while (int(m_network_shards.size()) < m_next_network_shard)
+			m_network_shards.push_back(boost::shared_ptr<network_shard>(new network_shard));
+		return m_network_shards[m_next_network_shard - 1]->ios;
+	}
+
 	void session_impl::async_accept(boost::shared_ptr<socket_acceptor> const& listener, bool ssl)
 	{
 		TORRENT_ASSERT(!m_abort);
-		shared_ptr<socket_type> c(new socket_type(m_io_service));
+		// SSL sockets run composed operations on the stream, and must stay
+		// on the main network thread
+		io_service& ios = ssl ? m_io_service : peer_io_service();
+		shared_ptr<socket_type> c(new socket_type(ios));
 		stream_socket* str = 0;
 
 #ifdef TORRENT_USE_OPENSSL
@@ -2648,7 +2730,7 @@ retry:
 		else
 #endif
 		{
-			c->instantiate<stream_socket>(m_io_service);
+			c->instantiate<stream_socket>(ios);
 			str = c->get<stream_socket>();
 		}
 
@@ -3155,7 +3237,9 @@ retry:
 		m_timer.expires_at(now + milliseconds(m_settings.tick_interval), ec);
 		m_timer.async_wait(bind(&session_impl::on_tick, this, _1));
 
-		m_download_rate.update_quotas(now - m_last_tick);
+		// the streaming share is only reserved on the download side,
+		// that's what a torrent that's being played back is waiting for
+		m_download_rate.update_quotas(now - m_last_tick, m_settings.streaming_bandwidth_share);
 		m_upload_rate.update_quotas(now - m_last_tick);
 
 		m_last_tick = now;
@@ -3184,22 +3268,7 @@ retry:
 			for (torrent_map::iterator i = m_torrents.begin()
 				, end(m_torrents.end()); i != end; ++i)
 			{
-				policy& p = i->second->get_policy();
-				for (policy::iterator j = p.begin_peer()
-					, end(p.end_peer()); j != end; ++j)
-				{
-					policy::peer* pe = *j;
-
-					if (pe->last_optimistically_unchoked < four_hours)
-						pe->last_optimistically_unchoked = 0;
-					else
-						pe->last_optimistically_unchoked -= four_hours;
-
-					if (pe->last_connected < four_hours)
-						pe->last_connected = 0;
-					else
-						pe->last_connected -= four_hours;
-				}
+				i->second->get_policy().step_session_time(four_hours);
 			}
 		}
 
@@ -3529,7 +3598,7 @@ retry:
 			max_connections = (limit+1) / 2;
 
 		if (!m_torrents.empty()
-			&& free_slots > -m_half_open.limit()
+			&& free_slots > -m_half_open.current_limit()
 			&& num_connections() < m_settings.connections_limit
 			&& !m_abort
 			&& m_settings.connection_speed > 0
@@ -3554,13 +3623,16 @@ retry:
 					// have a bias to give more connection attempts
 					// to downloading torrents than seed, and even
 					// more to downloading torrents with less than
-					// average number of connections
+					// average number of connections, or that are
+					// streaming
 					int num_attempts = 1;
 					if (!t.is_seed())
 					{
 						++num_attempts;
 						if (t.num_peers() < average_peers)
 							++num_attempts;
+						if (t.is_streaming())
+							++num_attempts;
 					}
 					for (int i = 0; i < num_attempts; ++i)
 					{
@@ -3585,7 +3657,7 @@ retry:
 							if (m_settings.connections_limit < 2) m_settings.connections_limit = 2;
 						}
 						if (!t.want_more_peers()) break;
-						if (free_slots <= -m_half_open.limit()) break;
+						if (free_slots <= -m_half_open.current_limit()) break;
 						if (max_connections == 0) break;
 						if (num_connections() >= m_settings.connections_limit) break;
 					}
@@ -3600,7 +3672,7 @@ retry:
 				// handing out a single connection, break
 				if (steps_since_last_connect > num_torrents + 1) break;
 				// if there are no more free connection slots, abort
-				if (free_slots <= -m_half_open.limit()) break;
+				if (free_slots <= -m_half_open.current_limit()) break;
 				// if we should not make any more connections
 				// attempts this tick, abort
 				if (max_connections == 0) break;
@@ -4818,6 +4890,15 @@ retry:
 		TORRENT_ASSERT(m_torrents.empty());
 		TORRENT_ASSERT(m_connections.empty());
 
+		// all peer sockets are closed by now, so the shard threads will
+		// run out of work and exit as soon as we release their work objects
+		for (std::vector<boost::shared_ptr<network_shard> >::iterator i
+			= m_network_shards.begin(), end(m_network_shards.end()); i != end; ++i)
+		{
+			(*i)->work.reset();
+			(*i)->shard_thread->join();
+		}
+
 #if (defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS) && defined BOOST_HAS_PTHREADS
 		m_network_thread = 0;
 #endif
@@ -5502,6 +5583,22 @@ retry:
 	void session_impl::start_dht()
 	{ start_dht(m_dht_state); }
 
+	// the number of nodes saved in a DHT state. Older states
+	// have a list of endpoints, newer ones compact node info
+	// strings, 26 bytes per node
+	int num_dht_state_nodes(entry const& s)
+	{
+		if (s.type() != entry::dictionary_t) return 0;
+		int ret = 0;
+		entry const* e = s.find_key("nodes");
+		if (e && e->type() == entry::list_t) ret += e->list().size();
+		e = s.find_key("good-nodes");
+		if (e && e->type() == entry::string_t) ret += e->string().size() / 26;
+		e = s.find_key("known-nodes");
+		if (e && e->type() == entry::string_t) ret += e->string().size() / 26;
+		return ret;
+	}
+
 	void on_bootstrap(alert_manager& alerts)
 	{
 		if (alerts.should_post<dht_bootstrap_alert>())
@@ -5565,28 +5662,25 @@ retry:
 #if defined TORRENT_ASIO_DEBUGGING
 		add_outstanding_async("session_impl::on_dht_router_name_lookup");
 #endif
-		char port[7];
-		snprintf(port, sizeof(port), "%d", node.second);
-		tcp::resolver::query q(node.first, port);
-		m_host_resolver.async_resolve(q,
-			boost::bind(&session_impl::on_dht_router_name_lookup, this, _1, _2));
+		m_host_resolver.async_resolve(node.first,
+			boost::bind(&session_impl::on_dht_router_name_lookup, this, _1, _2, node.second));
 	}
 
 	void session_impl::on_dht_router_name_lookup(error_code const& e
-		, tcp::resolver::iterator host)
+		, std::vector<address> const& addresses, int port)
 	{
 #if defined TORRENT_ASIO_DEBUGGING
 		complete_async("session_impl::on_dht_router_name_lookup");
 #endif
 		// TODO: report errors as alerts
 		if (e) return;
-		while (host != tcp::resolver::iterator())
+		for (std::vector<address>::const_iterator i = addresses.begin()
+			, end(addresses.end()); i != end; ++i)
 		{
 			// router nodes should be added before the DHT is started (and bootstrapped)
-			udp::endpoint ep(host->endpoint().address(), host->endpoint().port());
+			udp::endpoint ep(*i, port);
 			if (m_dht) m_dht->add_router_node(ep);
 			m_dht_router_nodes.push_back(ep);
-			++host;
 		}
 	}
 #endif
@@ -5785,6 +5879,7 @@ retry:
 		if (m_settings.half_open_limit <= 0) m_settings.half_open_limit
 			= (std::numeric_limits<int>::max)();
 		m_half_open.limit(m_settings.half_open_limit);
+		m_half_open.adaptive(m_settings.adaptive_half_open_limit);
 
 		if (m_settings.local_download_rate_limit < 0)
 			m_settings.local_download_rate_limit = 0;
@@ -6110,12 +6205,8 @@ retry:
 		if (m_dht)
 		{
 			entry s = m_dht->state();
-			int cur_state = 0;
-			int prev_state = 0;
-			entry* nodes1 = s.find_key("nodes");
-			if (nodes1 && nodes1->type() == entry::list_t) cur_state = nodes1->list().size();
-			entry* nodes2 = m_dht_state.find_key("nodes");
-			if (nodes2 && nodes2->type() == entry::list_t) prev_state = nodes2->list().size();
+			int cur_state = num_dht_state_nodes(s);
+			int prev_state = num_dht_state_nodes(m_dht_state);
 			if (cur_state > prev_state) m_dht_state = s;
 			start_dht(m_dht_state);
 		}
@@ -6132,24 +6223,6 @@ retry:
 		return m_disk_thread.allocate_buffer(category);
 	}
 	
-	char* session_impl::allocate_buffer()
-	{
-		TORRENT_ASSERT(is_network_thread());
-
-#ifdef TORRENT_DISK_STATS
-		TORRENT_ASSERT(m_buffer_allocations >= 0);
-		m_buffer_allocations++;
-		m_buffer_usage_logger << log_time() << " protocol_buffer: "
-			<< (m_buffer_allocations * send_buffer_size) << std::endl;
-#endif
-#ifdef TORRENT_DISABLE_POOL_ALLOCATOR
-		int num_bytes = send_buffer_size;
-		return (char*)malloc(num_bytes);
-#else
-		return (char*)m_send_buffers.malloc();
-#endif
-	}
-
 #ifdef TORRENT_DISK_STATS
 	void session_impl::log_buffer_usage()
 	{
@@ -6171,23 +6244,6 @@ retry:
 	}
 #endif
 
-	void session_impl::free_buffer(char* buf)
-	{
-		TORRENT_ASSERT(is_network_thread());
-
-#ifdef TORRENT_DISK_STATS
-		m_buffer_allocations--;
-		TORRENT_ASSERT(m_buffer_allocations >= 0);
-		m_buffer_usage_logger << log_time() << " protocol_buffer: "
-			<< (m_buffer_allocations * send_buffer_size) << std::endl;
-#endif
-#ifdef TORRENT_DISABLE_POOL_ALLOCATOR
-		free(buf);
-#else
-		m_send_buffers.free(buf);
-#endif
-	}	
-
 #ifdef TORRENT_DEBUG
 	void session_impl::check_invariant() const
 	{
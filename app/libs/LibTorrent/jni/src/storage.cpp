@@ -64,10 +64,14 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/file_pool.hpp"
 #include "libtorrent/aux_/session_impl.hpp"
 #include "libtorrent/disk_buffer_holder.hpp"
+#include "libtorrent/disk_io_thread.hpp"
+#include "libtorrent/hash_pool.hpp"
 #include "libtorrent/alloca.hpp"
 #include "libtorrent/allocator.hpp" // page_size
 
 #include <cstdio>
+#include <cstdlib> // for malloc
+#include <cstring> // for memcpy
 
 //#define TORRENT_PARTIAL_HASH_LOG
 
@@ -86,6 +90,12 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <sys/mount.h>
 #endif
 
+#if TORRENT_USE_SENDFILE
+#include <boost/asio/error.hpp>
+#include <sys/socket.h>
+#include <errno.h>
+#endif
+
 #if defined(__linux__)
 #include <sys/statfs.h>
 #endif
@@ -250,6 +260,45 @@ namespace libtorrent
 		return ret;
 	}
 
+#if TORRENT_USE_SENDFILE
+	int storage_interface::sendfile(int socket, int slot, int offset, int size
+		, error_code& ec)
+	{
+		TORRENT_ASSERT(m_disk_pool);
+		TORRENT_ASSERT(size <= m_disk_pool->block_size());
+		char* buf = m_disk_pool->allocate_buffer("send buffer");
+		if (buf == 0)
+		{
+			ec = error_code(boost::system::errc::not_enough_memory, get_posix_category());
+			return -1;
+		}
+
+		file::iovec_t b = { buf, size_t(size) };
+		int ret = readv(&b, slot, offset, 1);
+		if (ret >= 0 && ret < size)
+		{
+			// the file wasn't big enough for this read
+			set_error("", errors::file_too_short);
+			ret = -1;
+		}
+		if (ret > 0)
+		{
+			ret = ::send(socket, buf, ret, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				ec = asio::error::would_block;
+				ret = 0;
+			}
+			else if (ret < 0)
+			{
+				ec.assign(errno, boost::system::get_generic_category());
+			}
+		}
+		m_disk_pool->free_buffer(buf);
+		return ret;
+	}
+#endif
+
 	int copy_bufs(file::iovec_t const* bufs, int bytes, file::iovec_t* target)
 	{
 		int size = 0;
@@ -620,23 +669,28 @@ namespace libtorrent
 		return false;
 	}
 
+	file_storage::iterator default_storage::file_at(size_type offset
+		, size_type& file_offset) const
+	{
+		TORRENT_ASSERT(offset >= 0);
+		TORRENT_ASSERT(offset < files().total_size());
+		// this skips the empty files at offset too, since they share
+		// it with the file that follows them
+		file_storage::iterator file_iter = files().file_at_offset(offset);
+		TORRENT_ASSERT(file_iter != files().end());
+		file_offset = offset - file_iter->offset;
+		TORRENT_ASSERT(file_offset < file_iter->size);
+		return file_iter;
+	}
+
 	int default_storage::sparse_end(int slot) const
 	{
 		TORRENT_ASSERT(slot >= 0);
 		TORRENT_ASSERT(slot < files().num_pieces());
 
-		size_type file_offset = (size_type)slot * m_files.piece_length();
-		file_storage::iterator file_iter;
-
-		for (file_iter = files().begin();;)
-		{
-			if (file_offset < file_iter->size)
-				break;
-
-			file_offset -= file_iter->size;
-			++file_iter;
-			TORRENT_ASSERT(file_iter != files().end());
-		}
+		size_type file_offset;
+		file_storage::iterator file_iter = file_at(
+			(size_type)slot * m_files.piece_length(), file_offset);
 	
 		error_code ec;
 		boost::intrusive_ptr<file> file_handle = open_file(file_iter, file::read_only, ec);
@@ -1014,24 +1068,13 @@ ret:
 		return ret;
 	}
 
-	void default_storage::hint_read(int slot, int offset, int size)
+	void default_storage::hint_read(int slot, int offset, int size, int flags)
 	{
 		size_type start = slot * (size_type)m_files.piece_length() + offset;
 		TORRENT_ASSERT(start + size <= m_files.total_size());
 
-		size_type file_offset = start;
-		file_storage::iterator file_iter;
-
-		// TODO: use binary search!
-		for (file_iter = files().begin();;)
-		{
-			if (file_offset < file_iter->size)
-				break;
-
-			file_offset -= file_iter->size;
-			++file_iter;
-			TORRENT_ASSERT(file_iter != files().end());
-		}
+		size_type file_offset;
+		file_storage::iterator file_iter = file_at(start, file_offset);
 
 		boost::intrusive_ptr<file> file_handle;
 		int bytes_left = size;
@@ -1056,7 +1099,7 @@ ret:
 			if (file_iter->pad_file) continue;
 
 			error_code ec;
-			file_handle = open_file(file_iter, file::read_only | file::random_access, ec);
+			file_handle = open_file(file_iter, file::read_only | flags, ec);
 
 			// failing to hint that we want to read is not a big deal
 			// just swollow the error and keep going
@@ -1067,6 +1110,59 @@ ret:
 		}
 	}
 
+#if TORRENT_USE_SENDFILE
+	int default_storage::sendfile(int socket, int slot, int offset, int size
+		, error_code& ec)
+	{
+		size_type start = slot * (size_type)m_files.piece_length() + offset;
+		TORRENT_ASSERT(start + size <= m_files.total_size());
+
+		size_type file_offset;
+		file_storage::iterator file_iter = file_at(start, file_offset);
+
+		// blocks spanning more than one file and pad files are
+		// rare, they are copied instead
+		if (file_iter->pad_file || file_offset + size > file_iter->size)
+			return storage_interface::sendfile(socket, slot, offset, size, ec);
+
+		error_code e;
+		boost::intrusive_ptr<file> file_handle = open_file(file_iter
+			, file::read_only | file::random_access, e);
+		if (!file_handle || e)
+		{
+			set_error(combine_path(m_save_path, files().file_path(*file_iter)), e);
+			return -1;
+		}
+
+		int ret = file_handle->sendfile(socket
+			, files().file_base(*file_iter) + file_offset, size, e);
+		if (ret >= 0) return ret;
+
+		switch (e.value())
+		{
+			case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+			case EWOULDBLOCK:
+#endif
+				ec = asio::error::would_block;
+				return 0;
+			case EINVAL:
+			case ENOSYS:
+			case EOVERFLOW:
+				// the file can't be used with sendfile(), for instance
+				// because it's opened with O_DIRECT or its offset
+				// doesn't fit in off_t
+				return storage_interface::sendfile(socket, slot, offset, size, ec);
+			case EIO:
+				set_error(combine_path(m_save_path, files().file_path(*file_iter)), e);
+				return -1;
+			default:
+				ec = e;
+				return -1;
+		}
+	}
+#endif
+
 	int default_storage::readv(file::iovec_t const* bufs, int slot, int offset
 		, int num_bufs, int flags)
 	{
@@ -1125,19 +1221,8 @@ ret:
 		TORRENT_ASSERT(start + size <= m_files.total_size());
 
 		// find the file iterator and file offset
-		size_type file_offset = start;
-		file_storage::iterator file_iter;
-
-		// TODO: use binary search!
-		for (file_iter = files().begin();;)
-		{
-			if (file_offset < file_iter->size)
-				break;
-
-			file_offset -= file_iter->size;
-			++file_iter;
-			TORRENT_ASSERT(file_iter != files().end());
-		}
+		size_type file_offset;
+		file_storage::iterator file_iter = file_at(start, file_offset);
 
 		int buf_pos = 0;
 		error_code ec;
@@ -1438,6 +1523,36 @@ ret:
 		return new default_storage(fs, mapped, path, fp, file_prio);
 	}
 
+#if TORRENT_USE_MMAP
+	mmap_storage::mmap_storage(file_storage const& fs, file_storage const* mapped, std::string const& path
+		, file_pool& fp, std::vector<boost::uint8_t> const& file_prio)
+		: default_storage(fs, mapped, path, fp, file_prio)
+	{}
+
+	int mmap_storage::readv(file::iovec_t const* bufs, int slot, int offset
+		, int num_bufs, int flags)
+	{
+		fileop op = { &file::mmap_readv, &default_storage::read_unaligned
+			, m_settings ? settings().disk_io_read_mode : 0, file::read_only | flags };
+		return readwritev(bufs, slot, offset, num_bufs, op);
+	}
+
+	int mmap_storage::writev(file::iovec_t const* bufs, int slot, int offset
+		, int num_bufs, int flags)
+	{
+		fileop op = { &file::mmap_writev, &default_storage::write_unaligned
+			, m_settings ? settings().disk_io_write_mode : 0, file::read_write | flags };
+		return readwritev(bufs, slot, offset, num_bufs, op);
+	}
+
+	storage_interface* mmap_storage_constructor(file_storage const& fs
+		, file_storage const* mapped, std::string const& path, file_pool& fp
+		, std::vector<boost::uint8_t> const& file_prio)
+	{
+		return new mmap_storage(fs, mapped, path, fp, file_prio);
+	}
+#endif
+
 	int disabled_storage::readv(file::iovec_t const* bufs, int slot, int offset, int num_bufs, int flags)
 	{
 #ifdef TORRENT_DISK_STATS
@@ -1491,6 +1606,179 @@ ret:
 		return new disabled_storage(fs.piece_length());
 	}
 
+	ram_storage::ram_storage(file_storage const& fs)
+		: m_files(fs)
+		, m_allocated(0)
+	{}
+
+	ram_storage::~ram_storage()
+	{
+		delete_files();
+	}
+
+	bool ram_storage::initialize(bool allocate_files)
+	{
+		m_pieces.resize(m_files.num_pieces(), 0);
+		return false;
+	}
+
+	bool ram_storage::delete_files()
+	{
+		for (int i = 0; i < int(m_pieces.size()); ++i)
+			free_slot(i);
+		TORRENT_ASSERT(m_allocated == 0);
+		return false;
+	}
+
+	void ram_storage::free_slot(int slot)
+	{
+		if (m_pieces[slot] == 0) return;
+		std::free(m_pieces[slot]);
+		m_pieces[slot] = 0;
+		m_allocated -= m_files.piece_length();
+		TORRENT_ASSERT(m_allocated >= 0);
+	}
+
+	void ram_storage::drop_slot(int slot)
+	{
+		if (slot < 0 || slot >= int(m_pieces.size())) return;
+		free_slot(slot);
+	}
+
+	size_type ram_storage::physical_offset(int slot, int offset)
+	{
+		return size_type(slot) * m_files.piece_length() + offset;
+	}
+
+	bool ram_storage::verify_resume_data(lazy_entry const& rd, error_code& error)
+	{
+		// whatever the resume data says we had is gone
+		error = errors::missing_pieces;
+		return false;
+	}
+
+	int ram_storage::readv(file::iovec_t const* bufs, int slot, int offset
+		, int num_bufs, int flags)
+	{
+		TORRENT_ASSERT(slot >= 0);
+		TORRENT_ASSERT(slot < m_files.num_pieces());
+		TORRENT_ASSERT(offset >= 0);
+
+		// the slot may have been dropped after the read was issued.
+		// This only fails the read, not the storage (see
+		// torrent::handle_disk_error)
+		if (slot >= int(m_pieces.size()) || m_pieces[slot] == 0)
+		{
+			set_error("", errors::piece_dropped);
+			return -1;
+		}
+
+		int left = m_files.piece_size(slot) - offset;
+		char const* src = m_pieces[slot] + offset;
+		int ret = 0;
+		for (int i = 0; i < num_bufs && left > 0; ++i)
+		{
+			int len = (std::min)(int(bufs[i].iov_len), left);
+			std::memcpy(bufs[i].iov_base, src, len);
+			src += len;
+			left -= len;
+			ret += len;
+		}
+		return ret;
+	}
+
+	int ram_storage::writev(file::iovec_t const* bufs, int slot, int offset
+		, int num_bufs, int flags)
+	{
+		TORRENT_ASSERT(slot >= 0);
+		TORRENT_ASSERT(slot < m_files.num_pieces());
+		TORRENT_ASSERT(offset >= 0);
+
+		if (slot >= int(m_pieces.size())) m_pieces.resize(m_files.num_pieces(), 0);
+
+		int piece_size = m_files.piece_size(slot);
+		char*& piece = m_pieces[slot];
+		if (piece == 0)
+		{
+			// the torrent keeps the pieces it has within this limit, but
+			// pieces being downloaded take up room too. Don't let them
+			// grow past it. Always leave room for two pieces though,
+			// the same as torrent::trim_volatile_pieces()
+			// buffers are always a full piece, so that they can be moved
+			// between slots in compact mode
+			size_type limit = (std::max)(size_type(m_settings ? settings().ram_storage_size : 0)
+				, size_type(m_files.piece_length()) * 2);
+			if (m_allocated + m_files.piece_length() <= limit)
+				piece = (char*)std::malloc(m_files.piece_length());
+			if (piece == 0)
+			{
+				set_error("", error_code(boost::system::errc::not_enough_memory
+					, get_posix_category()));
+				return -1;
+			}
+			m_allocated += m_files.piece_length();
+		}
+
+		int left = piece_size - offset;
+		char* dst = piece + offset;
+		int ret = 0;
+		for (int i = 0; i < num_bufs && left > 0; ++i)
+		{
+			int len = (std::min)(int(bufs[i].iov_len), left);
+			std::memcpy(dst, bufs[i].iov_base, len);
+			dst += len;
+			left -= len;
+			ret += len;
+		}
+		return ret;
+	}
+
+	int ram_storage::read(char* buf, int slot, int offset, int size)
+	{
+		file::iovec_t b = { (file::iovec_base_t)buf, size_t(size) };
+		return readv(&b, slot, offset, 1);
+	}
+
+	int ram_storage::write(char const* buf, int slot, int offset, int size)
+	{
+		file::iovec_t b = { (file::iovec_base_t)buf, size_t(size) };
+		return writev(&b, slot, offset, 1);
+	}
+
+	// moving pieces around (in compact mode) is just a matter of
+	// moving the buffer pointers
+
+	bool ram_storage::move_slot(int src_slot, int dst_slot)
+	{
+		free_slot(dst_slot);
+		m_pieces[dst_slot] = m_pieces[src_slot];
+		m_pieces[src_slot] = 0;
+		return false;
+	}
+
+	bool ram_storage::swap_slots(int slot1, int slot2)
+	{
+		std::swap(m_pieces[slot1], m_pieces[slot2]);
+		return false;
+	}
+
+	bool ram_storage::swap_slots3(int slot1, int slot2, int slot3)
+	{
+		// the data in slot1 goes to slot2, slot2 to slot3 and slot3 to slot1
+		char* tmp = m_pieces[slot3];
+		m_pieces[slot3] = m_pieces[slot2];
+		m_pieces[slot2] = m_pieces[slot1];
+		m_pieces[slot1] = tmp;
+		return false;
+	}
+
+	storage_interface* ram_storage_constructor(file_storage const& fs
+		, file_storage const* mapped, std::string const& path, file_pool& fp
+		, std::vector<boost::uint8_t> const&)
+	{
+		return new ram_storage(fs);
+	}
+
 	// -- piece_manager -----------------------------------------------------
 
 	piece_manager::piece_manager(
@@ -1510,6 +1798,8 @@ ret:
 		, m_save_path(complete(save_path))
 		, m_state(state_none)
 		, m_current_slot(0)
+		, m_check_read_ahead(0)
+		, m_check_next_read(0)
 		, m_out_of_place(false)
 		, m_scratch_piece(-1)
 		, m_last_piece(-1)
@@ -1542,6 +1832,23 @@ ret:
 		m_io_thread.add_job(j, handler);
 	}
 
+	void piece_manager::async_drop_piece(int piece
+		, boost::function<void(int, disk_io_job const&)> const& handler)
+	{
+		disk_io_job j;
+		j.storage = this;
+		j.action = disk_io_job::drop_piece;
+		j.piece = piece;
+		m_io_thread.add_job(j, handler);
+	}
+
+	void piece_manager::drop_piece_impl(int piece)
+	{
+		int slot = slot_for(piece);
+		if (slot < 0) return;
+		m_storage->drop_slot(slot);
+	}
+
 	void piece_manager::async_release_files(
 		boost::function<void(int, disk_io_job const&)> const& handler)
 	{
@@ -1582,6 +1889,7 @@ ret:
 		disk_io_job j;
 		j.storage = this;
 		j.action = disk_io_job::check_fastresume;
+		j.job_class = disk_io_job::background_check;
 		j.buffer = (char*)resume_data;
 		m_io_thread.add_job(j, handler);
 	}
@@ -1603,8 +1911,27 @@ ret:
 		disk_io_job j;
 		j.storage = this;
 		j.action = disk_io_job::check_files;
+		j.job_class = disk_io_job::background_check;
+		m_io_thread.add_job(j, handler);
+	}
+
+#if TORRENT_USE_SENDFILE
+	void piece_manager::async_sendfile(
+		peer_request const& r
+		, int socket
+		, boost::function<void(int, disk_io_job const&)> const& handler)
+	{
+		disk_io_job j;
+		j.storage = this;
+		j.action = disk_io_job::sendfile;
+		j.piece = r.piece;
+		j.offset = r.start;
+		j.buffer_size = r.length;
+		j.socket = socket;
+		TORRENT_ASSERT(r.length <= 16 * 1024);
 		m_io_thread.add_job(j, handler);
 	}
+#endif
 
 	void piece_manager::async_read_and_hash(
 		peer_request const& r
@@ -1648,7 +1975,8 @@ ret:
 		peer_request const& r
 		, boost::function<void(int, disk_io_job const&)> const& handler
 		, int cache_line_size
-		, int cache_expiry)
+		, int cache_expiry
+		, ptime deadline)
 	{
 		disk_io_job j;
 		j.storage = this;
@@ -1659,6 +1987,11 @@ ret:
 		j.buffer = 0;
 		j.max_cache_line = cache_line_size;
 		j.cache_min_time = cache_expiry;
+		if (deadline != min_time())
+		{
+			j.job_class = disk_io_job::playback_read;
+			j.deadline = deadline;
+		}
 
 		// if a buffer is not specified, only one block can be read
 		// since that is the size of the pool allocator's buffers
@@ -1695,12 +2028,18 @@ ret:
 	}
 
 	void piece_manager::async_hash(int piece
-		, boost::function<void(int, disk_io_job const&)> const& handler)
+		, boost::function<void(int, disk_io_job const&)> const& handler
+		, ptime deadline)
 	{
 		disk_io_job j;
 		j.storage = this;
 		j.action = disk_io_job::hash;
 		j.piece = piece;
+		if (deadline != min_time())
+		{
+			j.job_class = disk_io_job::time_critical_hash;
+			j.deadline = deadline;
+		}
 
 		m_io_thread.add_job(j, handler);
 	}
@@ -1812,6 +2151,16 @@ ret:
 		return m_storage->readv(bufs, slot, offset, num_bufs);
 	}
 
+#if TORRENT_USE_SENDFILE
+	int piece_manager::sendfile_impl(int socket, int piece_index, int offset
+		, int size, error_code& ec)
+	{
+		m_last_piece = piece_index;
+		int slot = slot_for(piece_index);
+		return m_storage->sendfile(socket, slot, offset, size, ec);
+	}
+#endif
+
 	int piece_manager::write_impl(
 		file::iovec_t* bufs
 	  , int piece_index
@@ -2047,6 +2396,8 @@ ret:
 			if (has_files)
 			{
 				m_state = state_full_check;
+				m_check_read_ahead = 0;
+				clear_check_queue();
 				m_piece_to_slot.clear();
 				m_piece_to_slot.resize(m_files.num_pieces(), has_no_slot);
 				m_slot_to_piece.clear();
@@ -2471,6 +2822,7 @@ ret:
 
 			// clear the memory we've been using
 			std::multimap<sha1_hash, int>().swap(m_hash_to_piece);
+			clear_check_queue();
 
 			if (m_storage_mode != internal_storage_mode_compact_deprecated)
 			{
@@ -2506,10 +2858,152 @@ ret:
 		return need_full_check;
 	}
 
-	int piece_manager::skip_file() const
+	void piece_manager::hint_check_read_ahead(int start)
+	{
+		session_settings const& s = m_storage->settings();
+		if (!s.use_disk_read_ahead || s.file_checks_read_ahead <= 0) return;
+
+		// ask the OS to start reading the next few pieces while we're
+		// busy with the ones before them, so that they're more likely
+		// to be in the page cache by the time we read them
+		int const end = (std::min)(start + s.file_checks_read_ahead
+			, m_files.num_pieces());
+		if (m_check_read_ahead < start) m_check_read_ahead = start;
+		for (; m_check_read_ahead < end; ++m_check_read_ahead)
+		{
+			// use the same flags as the check's reads do, so that
+			// the file isn't re-opened in random access mode
+			m_storage->hint_read(m_check_read_ahead, 0
+				, m_files.piece_size(m_check_read_ahead), 0);
+		}
+	}
+
+	struct piece_manager::check_slot : hash_pool::job
+	{
+		check_slot(disk_buffer_pool& p, int s)
+			: pool(p), slot(s), num_read(0) {}
+
+		// this may be destructed by a hash thread, if the check
+		// didn't wait for it. The buffer pool is thread safe
+		~check_slot()
+		{
+			for (std::vector<file::iovec_t>::iterator i = bufs.begin()
+				, end(bufs.end()); i != end; ++i)
+				pool.free_buffer((char*)i->iov_base);
+		}
+
+		disk_buffer_pool& pool;
+		int slot;
+		int num_read;
+		// the error the read failed with, if it was short
+		error_code error;
+		std::string error_file;
+	};
+
+	bool piece_manager::use_check_queue() const
+	{
+		// the slots read ahead are held in memory. When optimizing
+		// for memory, hash_for_slot() reads one block at a time
+		session_settings const& s = m_storage->settings();
+		return s.file_checks_read_ahead > 0
+			&& s.optimize_hashing_for_speed
+			&& m_storage->disk_pool();
+	}
+
+	void piece_manager::clear_check_queue()
+	{
+		// slots still being hashed are kept alive by the hash threads
+		m_check_queue.clear();
+		m_check_next_read = 0;
+	}
+
+	void piece_manager::fill_check_queue()
+	{
+		session_settings const& s = m_storage->settings();
+		hash_pool& hashers = m_io_thread.hash_threads();
+		hashers.set_num_threads(s.file_check_hash_threads);
+
+		disk_buffer_pool& pool = *m_storage->disk_pool();
+		int const block_size = pool.block_size();
+		int const num_pieces = m_files.num_pieces();
+		int const small_piece_size = m_files.piece_size(num_pieces - 1);
+
+		if (m_check_next_read < m_current_slot) m_check_next_read = m_current_slot;
+		while (int(m_check_queue.size()) < s.file_checks_read_ahead
+			&& m_check_next_read < num_pieces)
+		{
+			int const slot = m_check_next_read++;
+			int const piece_size = m_files.piece_size(slot);
+			boost::shared_ptr<check_slot> e(new check_slot(pool, slot));
+			for (int size = piece_size; size > 0; size -= block_size)
+			{
+				file::iovec_t b;
+				b.iov_base = pool.allocate_buffer("hash temp");
+				b.iov_len = (std::min)(block_size, size);
+				e->bufs.push_back(b);
+			}
+
+			// deliberately pass in 0 as flags, to disable random_access
+			e->num_read = m_storage->readv(&e->bufs[0], slot, 0, e->bufs.size(), 0);
+			m_check_queue.push_back(e);
+
+			if (e->num_read != piece_size)
+			{
+				// check_one_piece() decides what to do about this once it
+				// gets to the slot. Keep the error until then, the next
+				// reads mustn't see it. If the file is missing, there's
+				// no point in reading the rest of it
+				e->error = m_storage->error();
+				e->error_file = m_storage->error_file();
+				m_storage->clear_error();
+				m_check_next_read = slot + skip_file(slot);
+				continue;
+			}
+
+			// the last piece may be smaller than the others, a slot
+			// could hold it too (see identify_data())
+			if (piece_size != small_piece_size) e->small_size = small_piece_size;
+			hashers.async_hash(e);
+		}
+
+		hint_check_read_ahead(m_check_next_read);
+	}
+
+	int piece_manager::hash_checked_slot(sha1_hash& large_hash, sha1_hash& small_hash)
+	{
+		// drop the slots the check skipped
+		while (!m_check_queue.empty() && m_check_queue.front()->slot < m_current_slot)
+			m_check_queue.pop_front();
+		// the check started over at an earlier slot
+		if (!m_check_queue.empty() && m_check_queue.front()->slot != m_current_slot)
+			clear_check_queue();
+		if (m_check_queue.empty()) m_check_next_read = m_current_slot;
+
+		fill_check_queue();
+		TORRENT_ASSERT(!m_check_queue.empty());
+		boost::shared_ptr<check_slot> e = m_check_queue.front();
+		TORRENT_ASSERT(e->slot == m_current_slot);
+		m_check_queue.pop_front();
+
+		// keep the reads going while we wait for this one to be hashed
+		fill_check_queue();
+
+		if (e->num_read != m_files.piece_size(m_current_slot))
+		{
+			if (e->error) m_storage->set_error(e->error_file, e->error);
+			return e->num_read;
+		}
+
+		m_io_thread.hash_threads().wait(*e);
+		large_hash = e->hash;
+		small_hash = e->small_hash;
+		return e->num_read;
+	}
+
+	int piece_manager::skip_file(int slot) const
 	{
 		size_type file_offset = 0;
-		size_type current_offset = size_type(m_current_slot) * m_files.piece_length();
+		size_type current_offset = size_type(slot) * m_files.piece_length();
 		for (file_storage::iterator i = m_files.begin()
 			, end(m_files.end()); i != end; ++i)
 		{
@@ -2543,20 +3037,35 @@ ret:
 				m_hash_to_piece.insert(std::pair<const sha1_hash, int>(m_info->hash_for_piece(i), i));
 		}
 
-		partial_hash ph;
 		int num_read = 0;
 		int piece_size = m_files.piece_size(m_current_slot);
 		int small_piece_size = m_files.piece_size(m_files.num_pieces() - 1);
 		bool read_short = true;
+		sha1_hash large_hash;
 		sha1_hash small_hash;
-		if (piece_size == small_piece_size)
+		if (use_check_queue())
 		{
-			num_read = hash_for_slot(m_current_slot, ph, piece_size, 0, 0);
+			// the slot was read ahead of time, and hashed by
+			// the hash threads while we were busy with the ones
+			// before it
+			num_read = hash_checked_slot(large_hash, small_hash);
 		}
 		else
 		{
-			num_read = hash_for_slot(m_current_slot, ph, piece_size
-				, small_piece_size, &small_hash);
+			clear_check_queue();
+			hint_check_read_ahead(m_current_slot + 1);
+
+			partial_hash ph;
+			if (piece_size == small_piece_size)
+			{
+				num_read = hash_for_slot(m_current_slot, ph, piece_size, 0, 0);
+			}
+			else
+			{
+				num_read = hash_for_slot(m_current_slot, ph, piece_size
+					, small_piece_size, &small_hash);
+			}
+			if (num_read == piece_size) large_hash = ph.h.final();
 		}
 		read_short = num_read != piece_size;
 
@@ -2578,7 +3087,6 @@ ret:
 			return skip_file();
 		}
 
-		sha1_hash large_hash = ph.h.final();
 		int piece_index = identify_data(large_hash, small_hash, m_current_slot);
 
 		if (piece_index >= 0) have_piece = piece_index;
@@ -2618,6 +3126,9 @@ ret:
 
 		// swap piece_index with this slot
 
+		// the slots read ahead may be among the ones moved
+		if (this_should_move || other_should_move) clear_check_queue();
+
 		// case 1
 		if (this_should_move && !other_should_move)
 		{
@@ -375,6 +375,7 @@ namespace libtorrent
 		, m_total_failed_bytes(0)
 		, m_total_redundant_bytes(0)
 		, m_sequence_number(seq)
+		, m_last_read_piece(-1)
 		, m_upload_mode_time(0)
 		, m_state(torrent_status::checking_resume_data)
 		, m_storage_mode(p.storage_mode)
@@ -857,6 +858,10 @@ namespace libtorrent
 #endif
 		TORRENT_ASSERT(!m_picker);
 
+		// we won't announce or connect to web seeds until the files
+		// have been checked. Look their hosts up in the meantime
+		prefetch_hostnames();
+
 		if (!m_seed_mode)
 		{
 			m_picker.reset(new piece_picker());
@@ -900,6 +905,50 @@ namespace libtorrent
 		}
 	}
 
+	void torrent::prefetch_hostnames()
+	{
+		// when the proxy resolves host names for us, looking them up
+		// locally would leak every tracker and web seed host to the
+		// local resolver
+		proxy_settings const& ps = m_ses.proxy();
+		if (ps.proxy_hostnames
+			&& (ps.type == proxy_settings::socks5
+				|| ps.type == proxy_settings::socks5_pw))
+			return;
+
+		std::vector<std::string> urls;
+		for (std::vector<announce_entry>::const_iterator i = m_trackers.begin()
+			, end(m_trackers.end()); i != end; ++i)
+			urls.push_back(i->url);
+		for (std::list<web_seed_entry>::const_iterator i = m_web_seeds.begin()
+			, end(m_web_seeds.end()); i != end; ++i)
+			urls.push_back(i->url);
+		// the web seeds in the .torrent file aren't added
+		// to m_web_seeds until init()
+		if (m_torrent_file->is_valid())
+		{
+			std::vector<web_seed_entry> const& web_seeds = m_torrent_file->web_seeds();
+			for (std::vector<web_seed_entry>::const_iterator i = web_seeds.begin()
+				, end(web_seeds.end()); i != end; ++i)
+				urls.push_back(i->url);
+		}
+
+		using boost::tuples::ignore;
+		for (std::vector<std::string>::iterator i = urls.begin()
+			, end(urls.end()); i != end; ++i)
+		{
+			std::string hostname;
+			error_code ec;
+			boost::tie(ignore, ignore, hostname, ignore, ignore)
+				= parse_url_components(*i, ec);
+			if (ec) continue;
+			// i2p names are looked up through the SAM bridge
+			char const* top_domain = strrchr(hostname.c_str(), '.');
+			if (top_domain && strcmp(top_domain, ".i2p") == 0) continue;
+			m_ses.m_host_resolver.prefetch(hostname);
+		}
+	}
+
 	void torrent::start_download_url()
 	{
 		TORRENT_ASSERT(!m_url.empty());
@@ -907,7 +956,12 @@ namespace libtorrent
 		boost::shared_ptr<http_connection> conn(
 			new http_connection(m_ses.m_io_service, m_ses.m_half_open
 				, boost::bind(&torrent::on_torrent_download, shared_from_this()
-					, _1, _2, _3, _4)));
+					, _1, _2, _3, _4), true, http_connect_handler()
+				, http_filter_handler()
+#ifdef TORRENT_USE_OPENSSL
+				, 0
+#endif
+				, &m_ses.m_host_resolver));
 		conn->get(m_url, seconds(30), 0, 0, 5, m_ses.m_settings.user_agent);
 		set_state(torrent_status::downloading_metadata);
 	}
@@ -1010,6 +1064,31 @@ namespace libtorrent
 		TORRENT_ASSERT(blocks_in_piece > 0);
 		TORRENT_ASSERT(piece_size > 0);
 
+		m_last_read_piece = piece;
+
+		storage_interface* st = get_storage();
+		if (has_picker() && !m_picker->have_piece(piece) && st && st->is_volatile())
+		{
+			// the piece was dropped from volatile storage, or never
+			// made it there. Reading it would only fail on the disk thread
+			release_held_off_pieces();
+			m_ses.m_alerts.post_alert(read_piece_alert(
+				get_handle(), piece, error_code(errors::piece_dropped)));
+			return;
+		}
+
+		// the piece is being read for playback. Let the disk thread
+		// serve it ahead of regular jobs, by the piece's deadline
+		// if it has one, otherwise as soon as possible
+		ptime deadline = time_now();
+		for (std::deque<time_critical_piece>::iterator i = m_time_critical_pieces.begin()
+			, end(m_time_critical_pieces.end()); i != end; ++i)
+		{
+			if (i->piece != piece) continue;
+			deadline = (std::min)(deadline, i->deadline);
+			break;
+		}
+
 		read_piece_struct* rp = new read_piece_struct;
 		rp->piece_data.reset(new (std::nothrow) char[piece_size]);
 		rp->blocks_left = 0;
@@ -1022,7 +1101,7 @@ namespace libtorrent
 		{
 			r.length = (std::min)(piece_size - r.start, block_size());
 			filesystem().async_read(r, boost::bind(&torrent::on_disk_read_complete
-				, shared_from_this(), _1, _2, r, rp));
+				, shared_from_this(), _1, _2, r, rp), 0, 0, deadline);
 			++rp->blocks_left;
 		}
 	}
@@ -1099,11 +1178,7 @@ namespace libtorrent
 		else
 		{
 			// reset last_connected, to force fast reconnect after leaving upload mode
-			for (policy::iterator i = m_policy.begin_peer()
-				, end(m_policy.end_peer()); i != end; ++i)
-			{
-				(*i)->last_connected = 0;
-			}
+			m_policy.reset_last_connected();
 
 			// send_block_requests on all peers
 			for (std::set<peer_connection*>::iterator i = m_connections.begin()
@@ -1127,6 +1202,10 @@ namespace libtorrent
 
 		TORRENT_ASSERT(j.piece >= 0);
 
+		// the piece was dropped from volatile storage after the read
+		// was issued. The storage is fine, only the read failed
+		if (j.error == error_code(errors::piece_dropped)) return;
+
 		piece_block block_finished(j.piece, j.offset / block_size());
 
 		if (j.action == disk_io_job::write)
@@ -1145,6 +1224,16 @@ namespace libtorrent
 #endif
 			)
 		{
+			storage_interface* st = get_storage();
+			if (j.action == disk_io_job::write && st && st->is_volatile())
+			{
+				// volatile storage is full (see ram_storage::writev). This
+				// is not the peer's fault. The block is dropped and
+				// write_failed() above made it pickable again
+				on_volatile_storage_full(j.piece);
+				return;
+			}
+
 			if (alerts().should_post<file_error_alert>())
 				alerts().post_alert(file_error_alert(j.error_file, get_handle(), j.error));
 			if (c) c->disconnect(errors::no_memory);
@@ -1190,6 +1279,7 @@ namespace libtorrent
 		--rp->blocks_left;
 		if (ret != r.length)
 		{
+			if (!rp->fail) rp->error = j.error;
 			rp->fail = true;
 			handle_disk_error(j);
 		}
@@ -1200,15 +1290,17 @@ namespace libtorrent
 
 		if (rp->blocks_left == 0)
 		{
-			int size = m_torrent_file->piece_size(r.piece);
 			if (rp->fail)
 			{
-				rp->piece_data.reset();
-				size = 0;
+				if (!rp->error) rp->error = errors::file_too_short;
+				m_ses.m_alerts.post_alert(read_piece_alert(
+					get_handle(), r.piece, rp->error));
+			}
+			else
+			{
+				m_ses.m_alerts.post_alert(read_piece_alert(get_handle(), r.piece
+					, rp->piece_data, m_torrent_file->piece_size(r.piece)));
 			}
-
-			m_ses.m_alerts.post_alert(read_piece_alert(
-				get_handle(), r.piece, rp->piece_data, size));
 			delete rp;
 		}
 	}
@@ -1817,6 +1909,21 @@ namespace libtorrent
 				}
 			}
 
+			// the peers that gave us good download rates the last
+			// time we were running. They're tried first, to get
+			// up to speed quickly
+			if (lazy_entry const* good_peers_entry = m_resume_entry.dict_find_string("good_peers"))
+			{
+				int num_peers = good_peers_entry->string_length() / (sizeof(address_v4::bytes_type) + 2);
+				char const* ptr = good_peers_entry->string_ptr();
+				for (int i = 0; i < num_peers; ++i)
+				{
+					policy::peer* p = m_policy.add_peer(read_v4_endpoint<tcp::endpoint>(ptr)
+						, id, peer_info::resume_data, 0);
+					if (p) m_policy.set_proven(p, true);
+				}
+			}
+
 #if TORRENT_USE_IPV6
 			if (lazy_entry const* peers6_entry = m_resume_entry.dict_find_string("peers6"))
 			{
@@ -1840,6 +1947,18 @@ namespace libtorrent
 					if (p) m_policy.ban_peer(p);
 				}
 			}
+
+			if (lazy_entry const* good_peers6_entry = m_resume_entry.dict_find_string("good_peers6"))
+			{
+				int num_peers = good_peers6_entry->string_length() / (sizeof(address_v6::bytes_type) + 2);
+				char const* ptr = good_peers6_entry->string_ptr();
+				for (int i = 0; i < num_peers; ++i)
+				{
+					policy::peer* p = m_policy.add_peer(read_v6_endpoint<tcp::endpoint>(ptr)
+						, id, peer_info::resume_data, 0);
+					if (p) m_policy.set_proven(p, true);
+				}
+			}
 #endif
 
 			// parse out "peers" from the resume data and add them to the peer list
@@ -2219,6 +2338,12 @@ namespace libtorrent
 		int port = m_ses.listen_port();
 #endif
 
+		// if we don't have any peers, connect to the ones the
+		// first DHT node to respond gives us right away. The DHT
+		// hands them over as each node responds, the lookup
+		// carries on after that
+		if (m_connections.empty()) m_need_connect_boost = true;
+
 		boost::weak_ptr<torrent> self(shared_from_this());
 		m_ses.m_dht->announce(m_torrent_file->info_hash()
 			, port, is_seed()
@@ -2250,6 +2375,8 @@ namespace libtorrent
 		std::for_each(peers.begin(), peers.end(), boost::bind(
 			&policy::add_peer, boost::ref(m_policy), _1, peer_id(0)
 			, peer_info::dht, 0));
+
+		do_connect_boost();
 	}
 
 #endif
@@ -2353,6 +2480,14 @@ namespace libtorrent
 		// have we sent an announce in this tier yet?
 		bool sent_announce = false;
 
+		// the announces to send, and the response time of the
+		// tracker each one goes to. They're sent once all the
+		// trackers have been considered, the fastest trackers
+		// first, so that their responses aren't held up behind
+		// slow trackers in the DNS lookups and connection queue
+		typedef std::pair<int, tracker_request> announce_t;
+		std::vector<announce_t> announces;
+
 		for (int i = 0; i < int(m_trackers.size()); ++i)
 		{
 			announce_entry& ae = m_trackers[i];
@@ -2437,27 +2572,13 @@ namespace libtorrent
 					continue;
 				}
 			}
-#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
-			debug_log("==> TRACKER REQUEST \"%s\" event: %s abort: %d"
-				, req.url.c_str()
-				, (req.event==tracker_request::stopped?"stopped"
-					:req.event==tracker_request::started?"started":"")
-				, m_abort);
 
-			if (m_abort)
-			{
-				boost::shared_ptr<aux::tracker_logger> tl(new aux::tracker_logger(m_ses));
-				m_ses.m_tracker_manager.queue_request(m_ses.m_io_service, m_ses.m_half_open, req
-					, tracker_login(), tl);
-			}
-			else
-#endif
-			{
-				m_ses.m_tracker_manager.queue_request(m_ses.m_io_service, m_ses.m_half_open, req
-					, tracker_login() , shared_from_this());
-			}
+			// trackers that haven't responded yet go last
+			announces.push_back(announce_t(ae.response_time < 0
+				? INT_MAX : ae.response_time, req));
 
 			ae.updating = true;
+			ae.announce_sent = now;
 			ae.next_announce = now + seconds(20);
 			ae.min_announce = now + seconds(10);
 
@@ -2473,6 +2594,40 @@ namespace libtorrent
 				&& !settings().announce_to_all_tiers)
 				break;
 		}
+
+		std::stable_sort(announces.begin(), announces.end()
+			, boost::bind(&announce_t::first, _1) < boost::bind(&announce_t::first, _2));
+
+		for (std::vector<announce_t>::iterator i = announces.begin()
+			, end(announces.end()); i != end; ++i)
+		{
+#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
+			debug_log("==> TRACKER REQUEST \"%s\" event: %s abort: %d"
+				, i->second.url.c_str()
+				, (i->second.event==tracker_request::stopped?"stopped"
+					:i->second.event==tracker_request::started?"started":"")
+				, m_abort);
+
+			if (m_abort)
+			{
+				boost::shared_ptr<aux::tracker_logger> tl(new aux::tracker_logger(m_ses));
+				m_ses.m_tracker_manager.queue_request(m_ses.m_io_service, m_ses.m_half_open
+					, i->second, tracker_login(), tl);
+			}
+			else
+#endif
+			{
+				m_ses.m_tracker_manager.queue_request(m_ses.m_io_service, m_ses.m_half_open
+					, i->second, tracker_login() , shared_from_this());
+			}
+		}
+
+		// if we don't have any peers, connect to the ones
+		// the first tracker to respond gives us right away
+		if (!announces.empty() && e != tracker_request::stopped
+			&& m_connections.empty())
+			m_need_connect_boost = true;
+
 		update_tracker_timer(now);
 	}
 
@@ -2566,6 +2721,7 @@ namespace libtorrent
 			ae->verified = true;
 			ae->updating = false;
 			ae->fails = 0;
+			ae->response_time = total_milliseconds(time_now_hires() - ae->announce_sent);
 			ae->next_announce = now + seconds(interval);
 			ae->min_announce = now + seconds(min_interval);
 			int tracker_index = ae - &m_trackers[0];
@@ -2603,6 +2759,7 @@ namespace libtorrent
 		std::copy(tracker_ips.begin(), tracker_ips.end(), std::ostream_iterator<address>(s, " "));
 		s << "\n";
 		s << "we connected to: " << tracker_ip << "\n";
+		if (ae) s << "response time: " << ae->response_time << " ms\n";
 		debug_log("%s", s.str().c_str());
 #endif
 		// for each of the peers we got from the tracker
@@ -2644,9 +2801,9 @@ namespace libtorrent
 #if defined TORRENT_ASIO_DEBUGGING
 					add_outstanding_async("torrent::on_peer_name_lookup");
 #endif
-					tcp::resolver::query q(i->ip, to_string(i->port).elems);
-					m_host_resolver.async_resolve(q,
-						boost::bind(&torrent::on_peer_name_lookup, shared_from_this(), _1, _2, i->pid));
+					m_ses.m_host_resolver.async_resolve(i->ip,
+						boost::bind(&torrent::on_peer_name_lookup, shared_from_this()
+							, _1, _2, i->port, i->pid), this);
 				}
 			}
 			else
@@ -2706,31 +2863,35 @@ namespace libtorrent
 			}
 		}
 
-		if (m_need_connect_boost)
-		{
-			m_need_connect_boost = false;
-			// this is the first tracker response for this torrent
-			// instead of waiting one second for session_impl::on_tick()
-			// to be called, connect to a few peers immediately
-			int conns = (std::min)((std::min)((std::min)(m_ses.m_settings.torrent_connect_boost
-				, m_ses.m_settings.connections_limit - m_ses.num_connections())
-				, m_ses.m_half_open.free_slots())
-				, m_ses.m_boost_connections - m_ses.m_settings.connection_speed);
-
-			while (want_more_peers() && conns > 0)
-			{
-				if (!m_policy.connect_one_peer(m_ses.session_time())) break;
-				// increase m_ses.m_boost_connections for each connection
-				// attempt. This will be deducted from the connect speed
-				// the next time session_impl::on_tick() is triggered
-				--conns;
-				++m_ses.m_boost_connections;
-			}
-		}
+		do_connect_boost();
 
 		state_updated();
 	}
 
+	void torrent::do_connect_boost()
+	{
+		if (!m_need_connect_boost) return;
+
+		m_need_connect_boost = false;
+		// this is the first tracker or DHT response for this torrent
+		// (or since it ran out of peers)
+		// instead of waiting one second for session_impl::on_tick()
+		// to be called, connect to a few peers immediately
+		int conns = (std::min)((std::min)(m_ses.m_settings.torrent_connect_boost
+			, m_ses.m_settings.connections_limit - m_ses.num_connections())
+			, m_ses.m_half_open.free_slots());
+
+		while (want_more_peers() && conns > 0)
+		{
+			if (!m_policy.connect_one_peer(m_ses.session_time())) break;
+			// increase m_ses.m_boost_connections for each connection
+			// attempt. This will be deducted from the connect speed
+			// the next time session_impl::on_tick() is triggered
+			--conns;
+			++m_ses.m_boost_connections;
+		}
+	}
+
 	ptime torrent::next_announce() const
 	{
 		return m_waiting_tracker?m_tracker_timer.expires_at():min_time();
@@ -2775,8 +2936,8 @@ namespace libtorrent
 	}
 #endif
 
-	void torrent::on_peer_name_lookup(error_code const& e, tcp::resolver::iterator host
-		, peer_id pid)
+	void torrent::on_peer_name_lookup(error_code const& e
+		, std::vector<address> const& host, int port, peer_id pid)
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
 
@@ -2790,22 +2951,21 @@ namespace libtorrent
 		if (e)
 			debug_log("peer name lookup error: %s", e.message().c_str());
 #endif
-		if (e || host == tcp::resolver::iterator() ||
-			m_ses.is_aborted()) return;
+		if (e || host.empty() || m_abort || m_ses.is_aborted()) return;
 
 		if (m_apply_ip_filter
-			&& m_ses.m_ip_filter.access(host->endpoint().address()) & ip_filter::blocked)
+			&& m_ses.m_ip_filter.access(host.front()) & ip_filter::blocked)
 		{
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
 			error_code ec;
-			debug_log("blocked ip from tracker: %s", host->endpoint().address().to_string(ec).c_str());
+			debug_log("blocked ip from tracker: %s", host.front().to_string(ec).c_str());
 #endif
 			if (m_ses.m_alerts.should_post<peer_blocked_alert>())
-				m_ses.m_alerts.post_alert(peer_blocked_alert(get_handle(), host->endpoint().address()));
+				m_ses.m_alerts.post_alert(peer_blocked_alert(get_handle(), host.front()));
 			return;
 		}
 			
-		m_policy.add_peer(*host, pid, peer_info::tracker, 0);
+		m_policy.add_peer(tcp::endpoint(host.front(), port), pid, peer_info::tracker, 0);
 	}
 
 	size_type torrent::bytes_left() const
@@ -3215,6 +3375,159 @@ namespace libtorrent
 		}
 
 		m_picker->we_have(index);
+
+		storage_interface* st = get_storage();
+		if (st && st->is_volatile()) trim_volatile_pieces(index);
+	}
+
+	void torrent::we_dont_have(int index)
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+		TORRENT_ASSERT(m_picker);
+		if (!m_picker->have_piece(index)) return;
+
+		const int piece_size = m_torrent_file->piece_length();
+		size_type off = size_type(index) * piece_size;
+		file_storage::iterator f = m_torrent_file->files().file_at_offset(off);
+		int size = m_torrent_file->piece_size(index);
+		int file_index = f - m_torrent_file->files().begin();
+		for (; size > 0; ++f, ++file_index)
+		{
+			size_type file_offset = off - f->offset;
+			TORRENT_ASSERT(f != m_torrent_file->files().end());
+			int sub = (std::min)(f->size - file_offset, (size_type)size);
+			m_file_progress[file_index] -= sub;
+			TORRENT_ASSERT(m_file_progress[file_index] >= 0);
+			size -= sub;
+			off += sub;
+		}
+
+		m_picker->we_dont_have(index);
+		m_need_save_resume_data = true;
+		state_updated();
+
+		if ((m_state == torrent_status::finished
+			|| m_state == torrent_status::seeding)
+			&& !is_finished())
+			resume_download();
+	}
+
+	int torrent::playhead_piece() const
+	{
+		if (!m_time_critical_pieces.empty())
+			return m_time_critical_pieces.front().piece;
+		if (m_last_read_piece >= 0) return m_last_read_piece;
+		if (has_picker()) return m_picker->cursor();
+		return 0;
+	}
+
+	void torrent::trim_volatile_pieces(int keep)
+	{
+		TORRENT_ASSERT(has_picker());
+		TORRENT_ASSERT(m_storage);
+
+		release_held_off_pieces();
+
+		// the pieces being downloaded are held by the storage too, and
+		// count against the same limit (see ram_storage::writev)
+		int const budget = (std::max)(settings().ram_storage_size
+			/ m_torrent_file->piece_length(), 2);
+		int const limit = (std::max)(budget - m_picker->num_downloading_pieces(), 1);
+		if (m_picker->num_have() <= limit) return;
+
+		int const playhead = playhead_piece();
+		int const num_pieces = m_torrent_file->num_pieces();
+		while (m_picker->num_have() > limit)
+		{
+			// prefer the piece furthest behind the playhead. If there's
+			// nothing behind it, drop the one furthest ahead of it that
+			// nobody wants, or that is beyond the window
+			// release_held_off_pieces() keeps. Wanted pieces within that
+			// window are kept, even if that leaves us over the limit
+			int victim = -1;
+			for (int i = 0; i < playhead && i < num_pieces; ++i)
+			{
+				if (i == keep || !m_picker->have_piece(i)) continue;
+				victim = i;
+				break;
+			}
+			for (int i = num_pieces - 1; victim == -1 && i > playhead; --i)
+			{
+				if (i == keep || !m_picker->have_piece(i)) continue;
+				if (i < playhead + budget / 2
+					&& m_picker->piece_priority(i) != 0) continue;
+				victim = i;
+			}
+			if (victim == -1) break;
+
+#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
+			debug_log("dropping piece %d from volatile storage (playhead: %d)"
+				, victim, playhead);
+#endif
+			// we_dont_have() would make the piece pickable again, and
+			// it would just be downloaded and dropped over and over.
+			// Hold it off until the playhead gets close to it
+			hold_off_piece(victim);
+			we_dont_have(victim);
+
+			// peers may have requests for this piece queued up
+			for (peer_iterator i = begin(); i != end(); ++i)
+				(*i)->reject_piece(victim);
+
+			// the storage is only touched from the disk thread, which
+			// may still be reading this piece
+			m_storage->async_drop_piece(victim);
+		}
+	}
+
+	void torrent::hold_off_piece(int index)
+	{
+		TORRENT_ASSERT(index >= 0 && index < m_torrent_file->num_pieces());
+		m_held_off_pieces.insert(index);
+	}
+
+	void torrent::mask_held_off_pieces(bitfield& pieces) const
+	{
+		for (std::set<int>::const_iterator i = m_held_off_pieces.begin()
+			, end(m_held_off_pieces.end()); i != end; ++i)
+		{
+			if (*i < int(pieces.size())) pieces.clear_bit(*i);
+		}
+	}
+
+	void torrent::on_volatile_storage_full(int piece)
+	{
+		if (!has_picker() || m_picker->have_piece(piece)) return;
+
+		// make room by dropping pieces furthest from the playhead
+		trim_volatile_pieces(piece);
+
+		// if the piece is too far ahead to be kept anyway, stop asking
+		// peers for it until the playhead gets close to it. Otherwise
+		// its blocks would keep arriving only to be thrown away
+		int const budget = (std::max)(settings().ram_storage_size
+			/ m_torrent_file->piece_length(), 2);
+		if (piece < playhead_piece() + budget / 2) return;
+
+#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
+		debug_log("volatile storage full, holding off piece %d (playhead: %d)"
+			, piece, playhead_piece());
+#endif
+		hold_off_piece(piece);
+	}
+
+	void torrent::release_held_off_pieces()
+	{
+		if (m_held_off_pieces.empty() || !has_picker()) return;
+
+		// the other half of the budget is left for the pieces
+		// being downloaded further ahead
+		int const budget = (std::max)(settings().ram_storage_size
+			/ m_torrent_file->piece_length(), 2);
+		int const playhead = playhead_piece();
+
+		m_held_off_pieces.erase(m_held_off_pieces.lower_bound(playhead)
+			, m_held_off_pieces.lower_bound(playhead + budget / 2));
 	}
 
 	void torrent::piece_passed(int index)
@@ -3571,6 +3884,9 @@ namespace libtorrent
 
 		m_owning_storage = 0;
 		m_host_resolver.cancel();
+		// the peer and web seed lookups go through the session's
+		// resolver, which other torrents may be waiting on too
+		m_ses.m_host_resolver.cancel(this);
 	}
 
 	void torrent::super_seeding(bool on)
@@ -3772,6 +4088,9 @@ namespace libtorrent
 				std::iter_swap(i, boost::prior(i));
 				--i;
 			}
+			// the playhead may have moved back to pieces that were
+			// dropped from volatile storage
+			release_held_off_pieces();
 			// just in case this piece had priority 0
 			if (m_picker->piece_priority(piece) == 0)
 				m_picker->set_piece_priority(piece, 1);
@@ -3789,6 +4108,7 @@ namespace libtorrent
 			, m_time_critical_pieces.end(), p);
 		m_time_critical_pieces.insert(i, p);
 
+		release_held_off_pieces();
 		// just in case this piece had priority 0
 		if (m_picker->piece_priority(piece) == 0)
 			m_picker->set_piece_priority(piece, 1);
@@ -3817,6 +4137,21 @@ namespace libtorrent
 		remove_time_critical_piece(piece);
 	}
 
+	void torrent::clear_piece_deadlines()
+	{
+		for (std::deque<time_critical_piece>::iterator i = m_time_critical_pieces.begin()
+			, end(m_time_critical_pieces.end()); i != end; ++i)
+		{
+			if (i->flags & torrent_handle::alert_when_available)
+			{
+				// post an empty read_piece_alert to indicate it failed
+				m_ses.m_alerts.post_alert(read_piece_alert(
+					get_handle(), i->piece, boost::shared_array<char>(), 0));
+			}
+		}
+		m_time_critical_pieces.clear();
+	}
+
 	void torrent::remove_time_critical_piece(int piece, bool finished)
 	{
 		for (std::deque<time_critical_piece>::iterator i = m_time_critical_pieces.begin()
@@ -4489,11 +4824,57 @@ namespace libtorrent
 			peer->set_peer_info(0);
 		}
 		if (has_picker()) picker().clear_peer(&web->peer_info);
-					
+
+		for (std::deque<policy::peer>::iterator i = web->extra_peer_info.begin()
+			, end(web->extra_peer_info.end()); i != end; ++i)
+		{
+			if (i->connection) i->connection->set_peer_info(0);
+			if (has_picker()) picker().clear_peer(&*i);
+		}
 
 		m_web_seeds.erase(web);
 	}
 
+	std::list<web_seed_entry>::iterator torrent::find_web_seed(
+		peer_connection const* p, policy::peer** pi)
+	{
+		for (std::list<web_seed_entry>::iterator i = m_web_seeds.begin()
+			, end(m_web_seeds.end()); i != end; ++i)
+		{
+			if (i->peer_info.connection == p)
+			{
+				if (pi) *pi = &i->peer_info;
+				return i;
+			}
+			for (std::deque<policy::peer>::iterator j = i->extra_peer_info.begin()
+				, end2(i->extra_peer_info.end()); j != end2; ++j)
+			{
+				if (j->connection != p) continue;
+				if (pi) *pi = &*j;
+				return i;
+			}
+		}
+		return m_web_seeds.end();
+	}
+
+	bool torrent::want_web_seed_connection(web_seed_entry const& web) const
+	{
+		int num_connections = 0;
+		if (web.peer_info.connection)
+		{
+			if (web.peer_info.connection->is_connecting()) return false;
+			++num_connections;
+		}
+		for (std::deque<policy::peer>::const_iterator i = web.extra_peer_info.begin()
+			, end(web.extra_peer_info.end()); i != end; ++i)
+		{
+			if (!i->connection) continue;
+			if (i->connection->is_connecting()) return false;
+			++num_connections;
+		}
+		return num_connections < (std::max)(settings().urlseed_max_connections, 1);
+	}
+
 	void torrent::connect_to_url_seed(std::list<web_seed_entry>::iterator web)
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
@@ -4530,7 +4911,12 @@ namespace libtorrent
 			return;
 		}
 
-		if (web->peer_info.banned)
+		bool banned = web->peer_info.banned;
+		for (std::deque<policy::peer>::const_iterator i = web->extra_peer_info.begin()
+			, end(web->extra_peer_info.end()); i != end; ++i)
+			banned |= i->banned;
+
+		if (banned)
 		{
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
 			debug_log("banned web seed: %s", web->url.c_str());
@@ -4614,9 +5000,9 @@ namespace libtorrent
 
 			// use proxy
 			web->resolving = true;
-			tcp::resolver::query q(ps.hostname, to_string(ps.port).elems);
-			m_host_resolver.async_resolve(q,
-				boost::bind(&torrent::on_proxy_name_lookup, shared_from_this(), _1, _2, web));
+			m_ses.m_host_resolver.async_resolve(ps.hostname,
+				boost::bind(&torrent::on_proxy_name_lookup, shared_from_this()
+					, _1, _2, web, int(ps.port)), this);
 		}
 		else if (ps.proxy_hostnames
 			&& (ps.type == proxy_settings::socks5
@@ -4631,15 +5017,15 @@ namespace libtorrent
 #endif
 
 			web->resolving = true;
-			tcp::resolver::query q(hostname, to_string(port).elems);
-			m_host_resolver.async_resolve(q,
+			m_ses.m_host_resolver.async_resolve(hostname,
 				boost::bind(&torrent::on_name_lookup, shared_from_this(), _1, _2, web
-					, tcp::endpoint()));
+					, tcp::endpoint(), port), this);
 		}
 	}
 
-	void torrent::on_proxy_name_lookup(error_code const& e, tcp::resolver::iterator host
-		, std::list<web_seed_entry>::iterator web)
+	void torrent::on_proxy_name_lookup(error_code const& e
+		, std::vector<address> const& host
+		, std::list<web_seed_entry>::iterator web, int proxy_port)
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
 
@@ -4666,7 +5052,7 @@ namespace libtorrent
 
 		if (m_abort) return;
 
-		if (e || host == tcp::resolver::iterator())
+		if (e || host.empty())
 		{
 			if (m_ses.m_alerts.should_post<url_seed_alert>())
 			{
@@ -4683,18 +5069,14 @@ namespace libtorrent
 		if (m_ses.is_aborted()) return;
 
 #ifndef TORRENT_DISABLE_GEO_IP
-		int as = m_ses.as_for_ip(host->endpoint().address());
-#ifdef TORRENT_DEBUG
-		web->peer_info.inet_as_num = as;
-#endif
-		web->peer_info.inet_as = m_ses.lookup_as(as);
+		web->peer_info.inet_as = m_ses.lookup_as(m_ses.as_for_ip(host.front()));
 #endif
 
 		if (int(m_connections.size()) >= m_max_connections
 			|| m_ses.num_connections() >= m_ses.settings().connections_limit)
 			return;
 
-		tcp::endpoint a(host->endpoint());
+		tcp::endpoint a(host.front(), proxy_port);
 
 		using boost::tuples::ignore;
 		std::string hostname;
@@ -4723,13 +5105,13 @@ namespace libtorrent
 		}
 
 		web->resolving = true;
-		tcp::resolver::query q(hostname, to_string(port).elems);
-		m_host_resolver.async_resolve(q,
-			boost::bind(&torrent::on_name_lookup, shared_from_this(), _1, _2, web, a));
+		m_ses.m_host_resolver.async_resolve(hostname,
+			boost::bind(&torrent::on_name_lookup, shared_from_this(), _1, _2, web, a, port)
+			, this);
 	}
 
-	void torrent::on_name_lookup(error_code const& e, tcp::resolver::iterator host
-		, std::list<web_seed_entry>::iterator web, tcp::endpoint proxy)
+	void torrent::on_name_lookup(error_code const& e, std::vector<address> const& host
+		, std::list<web_seed_entry>::iterator web, tcp::endpoint proxy, int port)
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
 
@@ -4751,7 +5133,7 @@ namespace libtorrent
 
 		if (m_abort) return;
 
-		if (e || host == tcp::resolver::iterator())
+		if (e || host.empty())
 		{
 			if (m_ses.m_alerts.should_post<url_seed_alert>())
 				m_ses.m_alerts.post_alert(url_seed_alert(get_handle(), web->url, e));
@@ -4765,7 +5147,7 @@ namespace libtorrent
 			return;
 		}
 
-		tcp::endpoint a(host->endpoint());
+		tcp::endpoint a(host.front(), port);
 
 		// fill in the peer struct's address field
 		web->endpoint = a;
@@ -4789,7 +5171,6 @@ namespace libtorrent
 		}
 		
 		TORRENT_ASSERT(web->resolving == false);
-		TORRENT_ASSERT(web->peer_info.connection == 0);
 
 		web->endpoint = a;
 
@@ -4856,17 +5237,33 @@ namespace libtorrent
 			return;
 		}
 
+		// the first connection uses peer_info, additional
+		// ones use (and add) entries in extra_peer_info
+		policy::peer* pi = &web->peer_info;
+		if (pi->connection)
+		{
+			std::deque<policy::peer>::iterator i = web->extra_peer_info.begin();
+			while (i != web->extra_peer_info.end() && i->connection) ++i;
+			if (i == web->extra_peer_info.end())
+			{
+				web->extra_peer_info.push_back(policy::peer(0, true, 0));
+				web->extra_peer_info.back().web_seed = true;
+				i = web->extra_peer_info.end() - 1;
+			}
+			pi = &*i;
+		}
+
 		boost::intrusive_ptr<peer_connection> c;
 		if (web->type == web_seed_entry::url_seed)
 		{
 			c = new (std::nothrow) web_peer_connection(
-				m_ses, shared_from_this(), s, a, web->url, &web->peer_info, // TODO: pass in web
+				m_ses, shared_from_this(), s, a, web->url, pi, // TODO: pass in web
 				web->auth, web->extra_headers);
 		}
 		else if (web->type == web_seed_entry::http_seed)
 		{
 			c = new (std::nothrow) http_seed_connection(
-				m_ses, shared_from_this(), s, a, web->url, &web->peer_info, // TODO: pass in web
+				m_ses, shared_from_this(), s, a, web->url, pi, // TODO: pass in web
 				web->auth, web->extra_headers);
 		}
 		if (!c) return;
@@ -4891,16 +5288,16 @@ namespace libtorrent
 			m_connections.insert(boost::get_pointer(c));
 			m_ses.m_connections.insert(c);
 
-			TORRENT_ASSERT(!web->peer_info.connection);
-			web->peer_info.connection = c.get();
+			TORRENT_ASSERT(!pi->connection);
+			pi->connection = c.get();
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
-			web->peer_info.in_use = true;
+			pi->in_use = true;
 #endif
 
-			c->add_stat(size_type(web->peer_info.prev_amount_download) << 10
-				, size_type(web->peer_info.prev_amount_upload) << 10);
-			web->peer_info.prev_amount_download = 0;
-			web->peer_info.prev_amount_upload = 0;
+			c->add_stat(size_type(pi->prev_amount_download) << 10
+				, size_type(pi->prev_amount_upload) << 10);
+			pi->prev_amount_download = 0;
+			pi->prev_amount_upload = 0;
 #if defined TORRENT_VERBOSE_LOGGING 
 			debug_log("web seed connection started: %s", web->url.c_str());
 #endif
@@ -5436,9 +5833,11 @@ namespace libtorrent
 
 		std::back_insert_iterator<entry::string_type> peers(ret["peers"].string());
 		std::back_insert_iterator<entry::string_type> banned_peers(ret["banned_peers"].string());
+		std::back_insert_iterator<entry::string_type> good_peers(ret["good_peers"].string());
 #if TORRENT_USE_IPV6
 		std::back_insert_iterator<entry::string_type> peers6(ret["peers6"].string());
 		std::back_insert_iterator<entry::string_type> banned_peers6(ret["banned_peers6"].string());
+		std::back_insert_iterator<entry::string_type> good_peers6(ret["good_peers6"].string());
 #endif
 
 		// failcount is a 5 bit value
@@ -5446,6 +5845,10 @@ namespace libtorrent
 
 		int num_saved_peers = 0;
 
+		// the peers we've downloaded from, and their scores
+		typedef std::pair<size_type, policy::peer const*> scored_peer;
+		std::vector<scored_peer> ranked_peers;
+
 		for (policy::const_iterator i = m_policy.begin_peer()
 			, end(m_policy.end_peer()); i != end; ++i)
 		{
@@ -5481,6 +5884,30 @@ namespace libtorrent
 			// don't save peers that don't work
 			if (int(p->failcount) >= max_failcount) continue;
 
+			// the score of a peer is the number of bytes we've downloaded
+			// from it, plus half a minute worth of its current download rate,
+			// scaled down by the round-trip time of its connection. A round-
+			// trip time of 0 means we don't know it (the peer connected to us).
+			// Peers the resume data said were good, that we haven't tried
+			// yet, keep their place with the lowest score
+			size_type downloaded = p->total_download();
+			if (downloaded >= block_size())
+			{
+				size_type score = downloaded;
+				int rtt = 0;
+				if (p->connection)
+				{
+					score += size_type(p->connection->statistics().download_payload_rate()) * 30;
+					rtt = p->connection->rtt();
+				}
+				ranked_peers.push_back(scored_peer(score * 100 / (100 + rtt), p));
+			}
+			else if (p->proven && p->failcount == 0 && downloaded == 0
+				&& p->connection == 0 && p->last_connected == 0)
+			{
+				ranked_peers.push_back(scored_peer(0, p));
+			}
+
 			// the more peers we've saved, the more picky we get
 			// about which ones are worth saving
 			if (num_saved_peers > 10
@@ -5508,6 +5935,30 @@ namespace libtorrent
 			++num_saved_peers;
 		}
 
+		// save the best peers we've downloaded from, best first
+		const int max_good_peers = 20;
+		int num_good_peers = (std::min)(int(ranked_peers.size()), max_good_peers);
+		std::partial_sort(ranked_peers.begin(), ranked_peers.begin() + num_good_peers
+			, ranked_peers.end()
+			, boost::bind(&scored_peer::first, _1) > boost::bind(&scored_peer::first, _2));
+		for (int i = 0; i < num_good_peers; ++i)
+		{
+			policy::peer const* p = ranked_peers[i].second;
+			address addr = p->address();
+#if TORRENT_USE_IPV6
+			if (addr.is_v6())
+			{
+				write_address(addr, good_peers6);
+				write_uint16(p->port, good_peers6);
+			}
+			else
+#endif
+			{
+				write_address(addr, good_peers);
+				write_uint16(p->port, good_peers);
+			}
+		}
+
 		ret["upload_rate_limit"] = upload_limit();
 		ret["download_rate_limit"] = download_limit();
 		ret["max_connections"] = max_connections();
@@ -5672,7 +6123,7 @@ namespace libtorrent
 		TORRENT_ASSERT(peerinfo);
 		TORRENT_ASSERT(peerinfo->connection == 0);
 
-		peerinfo->last_connected = m_ses.session_time();
+		m_policy.set_last_connected(peerinfo, m_ses.session_time());
 #ifdef TORRENT_DEBUG
 		if (!settings().allow_multiple_connections_per_ip)
 		{
@@ -5700,12 +6151,13 @@ namespace libtorrent
 		TORRENT_ASSERT(!m_apply_ip_filter
 			|| (m_ses.m_ip_filter.access(peerinfo->address()) & ip_filter::blocked) == 0);
 
-		boost::shared_ptr<socket_type> s(new socket_type(m_ses.m_io_service));
+		boost::shared_ptr<socket_type> s;
 
 #if TORRENT_USE_I2P
 		bool i2p = peerinfo->is_i2p_addr;
 		if (i2p)
 		{
+			s.reset(new socket_type(m_ses.m_io_service));
 			bool ret = instantiate_connection(m_ses.m_io_service, m_ses.i2p_proxy(), *s);
 			(void)ret;
 			TORRENT_ASSERT(ret);
@@ -5745,7 +6197,22 @@ namespace libtorrent
 			}
 #endif
 
-			bool ret = instantiate_connection(m_ses.m_io_service, m_ses.proxy(), *s, userdata, sm, true);
+			// plain TCP connections may be serviced by one of the network
+			// shard threads. uTP sockets are driven by the main thread's
+			// udp socket, and SSL and proxied sockets run composed operations
+			// on the stream, so those stay on the main network thread
+			proxy_settings const& ps = m_ses.proxy();
+			bool plain_tcp = sm == 0 && userdata == 0
+				&& (ps.type == proxy_settings::none
+					|| (!ps.proxy_peer_connections
+#if TORRENT_USE_I2P
+						&& ps.type != proxy_settings::i2p_proxy
+#endif
+						));
+			io_service& ios = plain_tcp ? m_ses.peer_io_service() : m_ses.m_io_service;
+			s.reset(new socket_type(ios));
+
+			bool ret = instantiate_connection(ios, ps, *s, userdata, sm, true);
 			(void)ret;
 			TORRENT_ASSERT(ret);
 
@@ -5808,10 +6275,12 @@ namespace libtorrent
 
 		TORRENT_TRY
 		{
+			// connection attempts for streaming torrents
+			// skip ahead of the others in the queue
 			m_ses.m_half_open.enqueue(
 				boost::bind(&peer_connection::on_connect, c, _1)
 				, boost::bind(&peer_connection::on_timeout, c)
-				, seconds(timeout));
+				, seconds(timeout), is_streaming() ? 1 : 0);
 		}
 		TORRENT_CATCH (std::exception&)
 		{
@@ -7688,9 +8157,9 @@ namespace libtorrent
 				i != m_web_seeds.end();)
 			{
 				std::list<web_seed_entry>::iterator w = i++;
-				if (w->peer_info.connection) continue;
 				if (w->retry > time_now()) continue;
 				if (w->resolving) continue;
+				if (!want_web_seed_connection(*w)) continue;
 
 				connect_to_url_seed(w);
 			}
@@ -8067,6 +8536,10 @@ namespace libtorrent
 				break;
 			}
 
+			// too far ahead of the playhead to be kept in volatile
+			// storage. See hold_off_piece()
+			if (is_held_off(i->piece)) continue;
+
 			piece_picker::downloading_piece pi;
 			m_picker->piece_info(i->piece, pi);
 
@@ -8222,8 +8695,8 @@ namespace libtorrent
 
 	void torrent::disconnect_web_seed(peer_connection* p)
 	{
-		std::list<web_seed_entry>::iterator i = std::find_if(m_web_seeds.begin(), m_web_seeds.end()
-			, (boost::bind(&policy::peer::connection, boost::bind(&web_seed_entry::peer_info, _1)) == p));
+		policy::peer* pi = 0;
+		std::list<web_seed_entry>::iterator i = find_web_seed(p, &pi);
 		// this happens if the web server responded with a redirect
 		// or with something incorrect, so that we removed the web seed
 		// immediately, before we disconnected
@@ -8234,26 +8707,27 @@ namespace libtorrent
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_ERROR_LOGGING
 		debug_log("disconnect web seed: \"%s\"", i->url.c_str());
 #endif
-		TORRENT_ASSERT(i->peer_info.connection);
-		i->peer_info.connection = 0;
+		TORRENT_ASSERT(pi->connection);
+		pi->connection = 0;
 	}
 
 	void torrent::remove_web_seed(peer_connection* p)
 	{
-		std::list<web_seed_entry>::iterator i = std::find_if(m_web_seeds.begin(), m_web_seeds.end()
-			, (boost::bind(&policy::peer::connection, boost::bind(&web_seed_entry::peer_info, _1)) == p));
+		policy::peer* pi = 0;
+		std::list<web_seed_entry>::iterator i = find_web_seed(p, &pi);
 		TORRENT_ASSERT(i != m_web_seeds.end());
 		if (i == m_web_seeds.end()) return;
 		p->set_peer_info(0);
-		if (has_picker()) picker().clear_peer(&i->peer_info);
-		m_web_seeds.erase(i);
+		pi->connection = 0;
+		if (has_picker()) picker().clear_peer(pi);
+		// this also detaches any other connections to this web seed
+		remove_web_seed(i);
 	}
 
 	void torrent::retry_web_seed(peer_connection* p, int retry)
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
-		std::list<web_seed_entry>::iterator i = std::find_if(m_web_seeds.begin(), m_web_seeds.end()
-			, (boost::bind(&policy::peer::connection, boost::bind(&web_seed_entry::peer_info, _1)) == p));
+		std::list<web_seed_entry>::iterator i = find_web_seed(p);
 
 		TORRENT_ASSERT(i != m_web_seeds.end());
 		if (i == m_web_seeds.end()) return;
@@ -8300,8 +8774,19 @@ namespace libtorrent
 		}
 #endif
 
+		// time critical pieces are hashed ahead of the regular
+		// disk job queue, so they can be handed out sooner
+		ptime deadline = min_time();
+		for (std::deque<time_critical_piece>::iterator i = m_time_critical_pieces.begin()
+			, end(m_time_critical_pieces.end()); i != end; ++i)
+		{
+			if (i->piece != piece_index) continue;
+			deadline = i->deadline;
+			break;
+		}
+
 		m_storage->async_hash(piece_index, boost::bind(&torrent::on_piece_verified
-			, shared_from_this(), _1, _2, f));
+			, shared_from_this(), _1, _2, f), deadline);
 #if defined TORRENT_DEBUG && !defined TORRENT_DISABLE_INVARIANT_CHECKS
 		check_invariant();
 #endif
@@ -971,6 +971,12 @@ namespace libtorrent
 		TORRENT_ASYNC_CALL1(reset_piece_deadline, index);
 	}
 
+	void torrent_handle::clear_piece_deadlines() const
+	{
+		INVARIANT_CHECK;
+		TORRENT_ASYNC_CALL(clear_piece_deadlines);
+	}
+
 	boost::shared_ptr<torrent> torrent_handle::native_handle() const
 	{
 		return m_torrent.lock();
@@ -484,6 +484,8 @@ namespace libtorrent
 		: url(u)
 		, next_announce(min_time())
 		, min_announce(min_time())
+		, announce_sent(min_time())
+		, response_time(-1)
 		, tier(0)
 		, fail_limit(0)
 		, fails(0)
@@ -498,6 +500,8 @@ namespace libtorrent
 	announce_entry::announce_entry()
 		: next_announce(min_time())
 		, min_announce(min_time())
+		, announce_sent(min_time())
+		, response_time(-1)
 		, tier(0)
 		, fail_limit(0)
 		, fails(0)
@@ -51,8 +51,50 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/debug.hpp"
 #endif
 
+#if TORRENT_USE_MMSG
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
 using namespace libtorrent;
 
+#if TORRENT_USE_MMSG
+namespace
+{
+	// not every C library we build against declares struct mmsghdr
+	// or the recvmmsg()/sendmmsg() wrappers, so use the kernel's
+	// layout and invoke the system calls directly
+	struct mmsg_hdr
+	{
+		msghdr msg_hdr;
+		unsigned int msg_len;
+	};
+
+	int recv_mmsg(int fd, mmsg_hdr* msgs, unsigned int num)
+	{
+#ifdef __NR_recvmmsg
+		return syscall(__NR_recvmmsg, fd, msgs, num, MSG_DONTWAIT, 0);
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	}
+
+	int send_mmsg(int fd, mmsg_hdr* msgs, unsigned int num)
+	{
+#ifdef __NR_sendmmsg
+		return syscall(__NR_sendmmsg, fd, msgs, num, MSG_DONTWAIT);
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	}
+}
+#endif
+
 udp_socket::udp_socket(asio::io_service& ios
 	, udp_socket::callback_t const& c
 	, udp_socket::callback2_t const& c2
@@ -83,6 +125,18 @@ udp_socket::udp_socket(asio::io_service& ios
 	, m_force_proxy(false)
 	, m_abort(false)
 	, m_outstanding_ops(0)
+#if TORRENT_USE_MMSG
+	, m_send_batch(0)
+	, m_num_batched(0)
+	, m_flush_posted(false)
+	, m_recv_batch(0)
+	, m_recv_batch_size(0)
+	, m_mmsg_supported(true)
+#endif
+	, m_packets_in(0)
+	, m_recv_calls(0)
+	, m_packets_out(0)
+	, m_send_calls(0)
 {
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 	m_magic = 0x1337;
@@ -93,6 +147,7 @@ udp_socket::udp_socket(asio::io_service& ios
 	m_outstanding_timeout = 0;
 	m_outstanding_resolve = 0;
 	m_outstanding_socks = 0;
+	m_outstanding_flush = 0;
 #if defined BOOST_HAS_PTHREADS
 	m_thread = 0;
 #endif
@@ -111,6 +166,12 @@ udp_socket::~udp_socket()
 	free(m_v4_buf);
 #if TORRENT_USE_IPV6
 	free(m_v6_buf);
+#endif
+#if TORRENT_USE_MMSG
+	delete[] m_send_batch;
+	free(m_recv_batch);
+#endif
+#if TORRENT_USE_IPV6
 	TORRENT_ASSERT_VAL(m_v6_outstanding == 0, m_v6_outstanding);
 #endif
 	TORRENT_ASSERT_VAL(m_v4_outstanding == 0, m_v4_outstanding);
@@ -221,6 +282,36 @@ void udp_socket::send(udp::endpoint const& ep, char const* p, int len
 
 	if (m_force_proxy) return;
 
+#if TORRENT_USE_MMSG
+	if ((flags & batch) && m_mmsg_supported && len <= max_batched_packet)
+	{
+		if (m_send_batch == 0)
+			m_send_batch = new (std::nothrow) batched_packet[batch_size];
+		if (m_send_batch != 0)
+		{
+			if (m_num_batched == batch_size) flush_batch();
+			batched_packet& bp = m_send_batch[m_num_batched++];
+			bp.ep = ep;
+			bp.len = len;
+			memcpy(bp.buf, p, len);
+			if (!m_flush_posted)
+			{
+				m_flush_posted = true;
+#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
+				++m_outstanding_flush;
+#endif
+				++m_outstanding_ops;
+				get_io_service().post(boost::bind(&udp_socket::on_flush_batch, this));
+			}
+			return;
+		}
+	}
+	// don't let this packet overtake the ones already queued
+	flush_batch();
+#endif
+
+	++m_send_calls;
+	++m_packets_out;
 #if TORRENT_USE_IPV6
 	if (ep.address().is_v4() && m_ipv4_sock.is_open())
 #endif
@@ -345,12 +436,7 @@ void udp_socket::on_read(udp::socket* s, error_code const& e, std::size_t bytes_
 		{
 			maybe_realloc_buffers(2);
 			if (m_abort) return;
-#if defined TORRENT_ASIO_DEBUGGING
-			add_outstanding_async("udp_socket::on_read");
-#endif
-			++m_v6_outstanding;
-			s->async_receive_from(asio::buffer(m_v6_buf, m_v6_buf_size)
-				, m_v6_ep, boost::bind(&udp_socket::on_read, this, s, _1, _2));
+			setup_read(s);
 		}
 		else
 #endif
@@ -358,12 +444,7 @@ void udp_socket::on_read(udp::socket* s, error_code const& e, std::size_t bytes_
 		{
 			maybe_realloc_buffers(1);
 			if (m_abort) return;
-#if defined TORRENT_ASIO_DEBUGGING
-			add_outstanding_async("udp_socket::on_read");
-#endif
-			++m_v4_outstanding;
-			s->async_receive_from(asio::buffer(m_v4_buf, m_v4_buf_size)
-				, m_v4_ep, boost::bind(&udp_socket::on_read, this, s, _1, _2));
+			setup_read(s);
 		}
 
 #ifdef TORRENT_DEBUG
@@ -372,6 +453,9 @@ void udp_socket::on_read(udp::socket* s, error_code const& e, std::size_t bytes_
 		return;
 	}
 
+	++m_recv_calls;
+	++m_packets_in;
+
 #if TORRENT_USE_IPV6
 	if (s == &m_ipv6_sock)
 	{
@@ -397,12 +481,7 @@ void udp_socket::on_read(udp::socket* s, error_code const& e, std::size_t bytes_
 			maybe_realloc_buffers(2);
 			if (m_abort) return;
 
-#if defined TORRENT_ASIO_DEBUGGING
-			add_outstanding_async("udp_socket::on_read");
-#endif
-			++m_v6_outstanding;
-			s->async_receive_from(asio::buffer(m_v6_buf, m_v6_buf_size)
-				, m_v6_ep, boost::bind(&udp_socket::on_read, this, s, _1, _2));
+			setup_read(s);
 		}
 	}
 	else
@@ -431,13 +510,118 @@ void udp_socket::on_read(udp::socket* s, error_code const& e, std::size_t bytes_
 			maybe_realloc_buffers(1);
 			if (m_abort) return;
 
+			setup_read(s);
+		}
+	}
+
+#ifdef TORRENT_DEBUG
+	m_started = true;
+#endif
+}
+
+void udp_socket::setup_read(udp::socket* s)
+{
 #if defined TORRENT_ASIO_DEBUGGING
-			add_outstanding_async("udp_socket::on_read");
+	add_outstanding_async("udp_socket::on_read");
+#endif
+#if TORRENT_USE_IPV6
+	if (s == &m_ipv6_sock) ++m_v6_outstanding;
+	else
 #endif
-			++m_v4_outstanding;
-			s->async_receive_from(asio::buffer(m_v4_buf, m_v4_buf_size)
-				, m_v4_ep, boost::bind(&udp_socket::on_read, this, s, _1, _2));
+		++m_v4_outstanding;
+
+#if TORRENT_USE_MMSG
+	if (m_mmsg_supported)
+	{
+		// wait for the socket to become readable, then
+		// receive everything queued on it with recvmmsg()
+		s->async_receive(asio::null_buffers()
+			, boost::bind(&udp_socket::on_read_ready, this, s, _1));
+		return;
+	}
+#endif
+
+#if TORRENT_USE_IPV6
+	if (s == &m_ipv6_sock)
+		s->async_receive_from(asio::buffer(m_v6_buf, m_v6_buf_size)
+			, m_v6_ep, boost::bind(&udp_socket::on_read, this, s, _1, _2));
+	else
+#endif
+		s->async_receive_from(asio::buffer(m_v4_buf, m_v4_buf_size)
+			, m_v4_ep, boost::bind(&udp_socket::on_read, this, s, _1, _2));
+}
+
+void udp_socket::dispatch_packet(udp::endpoint const& ep, char* buf, int size)
+{
+	TORRENT_TRY {
+
+		if (m_tunnel_packets)
+		{
+			// if the source IP doesn't match the proxy's, ignore the packet
+			if (ep == m_udp_proxy_addr)
+				unwrap(error_code(), buf, size);
 		}
+		else
+		{
+			m_callback(error_code(), ep, buf, size);
+		}
+
+	} TORRENT_CATCH (std::exception&) {}
+}
+
+#if TORRENT_USE_MMSG
+void udp_socket::on_read_ready(udp::socket* s, error_code const& e)
+{
+	// errors and aborts are handled the same way
+	// as for a regular read
+	if (e || m_abort || !m_callback)
+	{
+		on_read(s, e, 0);
+		return;
+	}
+
+#if defined TORRENT_ASIO_DEBUGGING
+	complete_async("udp_socket::on_read");
+#endif
+
+	TORRENT_ASSERT(m_magic == 0x1337);
+	TORRENT_ASSERT(is_single_thread());
+
+#if TORRENT_USE_IPV6
+	if (s == &m_ipv6_sock)
+	{
+		TORRENT_ASSERT(m_v6_outstanding > 0);
+		--m_v6_outstanding;
+	}
+	else
+#endif
+	{
+		TORRENT_ASSERT(m_v4_outstanding > 0);
+		--m_v4_outstanding;
+	}
+
+	CHECK_MAGIC;
+
+	read_batch(s);
+	if (m_abort) return;
+
+#if TORRENT_USE_IPV6
+	if (s == &m_ipv6_sock)
+	{
+		if (num_outstanding() == 0)
+		{
+			maybe_realloc_buffers(2);
+			if (m_abort) return;
+			setup_read(s);
+		}
+	}
+	else
+#endif
+	if (m_v4_outstanding == 0)
+	{
+		maybe_realloc_buffers(1);
+		if (m_abort) return;
+		setup_read(s);
 	}
 
 #ifdef TORRENT_DEBUG
@@ -445,6 +629,212 @@ void udp_socket::on_read(udp::socket* s, error_code const& e, std::size_t bytes_
 #endif
 }
 
+void udp_socket::read_batch(udp::socket* s)
+{
+#if TORRENT_USE_IPV6
+	udp::endpoint& last_ep = s == &m_ipv6_sock ? m_v6_ep : m_v4_ep;
+	char* single_buf = s == &m_ipv6_sock ? m_v6_buf : m_v4_buf;
+	int buf_size = s == &m_ipv6_sock ? m_v6_buf_size : m_v4_buf_size;
+#else
+	udp::endpoint& last_ep = m_v4_ep;
+	char* single_buf = m_v4_buf;
+	int buf_size = m_v4_buf_size;
+#endif
+
+	if (m_recv_batch_size < buf_size * batch_size)
+	{
+		void* tmp = realloc(m_recv_batch, buf_size * batch_size);
+		if (tmp != 0)
+		{
+			m_recv_batch = (char*)tmp;
+			m_recv_batch_size = buf_size * batch_size;
+		}
+	}
+
+	int num = -1;
+	if (m_recv_batch_size >= buf_size * batch_size)
+	{
+		udp::endpoint eps[batch_size];
+		iovec iov[batch_size];
+		mmsg_hdr msgs[batch_size];
+		memset(msgs, 0, sizeof(msgs));
+		for (int i = 0; i < batch_size; ++i)
+		{
+			iov[i].iov_base = m_recv_batch + i * buf_size;
+			iov[i].iov_len = buf_size;
+			msgs[i].msg_hdr.msg_name = eps[i].data();
+			msgs[i].msg_hdr.msg_namelen = eps[i].capacity();
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		num = recv_mmsg(s->native_handle(), msgs, batch_size);
+		++m_recv_calls;
+		if (num > 0)
+		{
+			m_packets_in += num;
+			for (int i = 0; i < num; ++i)
+			{
+				// the packet didn't fit in the buffer
+				if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) continue;
+				eps[i].resize(msgs[i].msg_hdr.msg_namelen);
+				last_ep = eps[i];
+				dispatch_packet(eps[i], (char*)iov[i].iov_base, msgs[i].msg_len);
+				if (m_abort || !m_callback) return;
+			}
+			return;
+		}
+		if (num < 0 && errno != ENOSYS)
+		{
+			// EAGAIN means someone else drained the socket
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+			TORRENT_TRY {
+				m_callback(error_code(errno, get_posix_category()), last_ep, 0, 0);
+			} TORRENT_CATCH (std::exception&) {}
+			return;
+		}
+		if (num < 0) m_mmsg_supported = false;
+	}
+
+	// either the kernel doesn't support recvmmsg() or we're
+	// out of memory. The socket is readable, so a regular
+	// receive won't block
+	error_code ec;
+	std::size_t size = s->receive_from(asio::buffer(single_buf, buf_size), last_ep, 0, ec);
+	++m_recv_calls;
+	if (ec)
+	{
+		if (ec == asio::error::would_block) return;
+		TORRENT_TRY {
+			m_callback(ec, last_ep, 0, 0);
+		} TORRENT_CATCH (std::exception&) {}
+		return;
+	}
+	++m_packets_in;
+	dispatch_packet(last_ep, single_buf, size);
+}
+
+void udp_socket::flush_batch()
+{
+	int start = 0;
+	while (start < m_num_batched)
+	{
+		// sendmmsg() sends on a single socket, so send runs
+		// of packets to the same address family at a time
+		udp::socket* s = &m_ipv4_sock;
+#if TORRENT_USE_IPV6
+		if (!m_send_batch[start].ep.address().is_v4() || !m_ipv4_sock.is_open())
+			s = &m_ipv6_sock;
+#endif
+		int end = start + 1;
+#if TORRENT_USE_IPV6
+		while (end < m_num_batched
+			&& (m_send_batch[end].ep.address().is_v4() && m_ipv4_sock.is_open())
+				== (s == &m_ipv4_sock))
+			++end;
+#else
+		end = m_num_batched;
+#endif
+
+		int num = end - start;
+		iovec iov[batch_size];
+		mmsg_hdr msgs[batch_size];
+		memset(msgs, 0, sizeof(msgs));
+		for (int i = 0; i < num; ++i)
+		{
+			batched_packet& bp = m_send_batch[start + i];
+			iov[i].iov_base = bp.buf;
+			iov[i].iov_len = bp.len;
+			msgs[i].msg_hdr.msg_name = bp.ep.data();
+			msgs[i].msg_hdr.msg_namelen = bp.ep.size();
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int ret = send_mmsg(s->native_handle(), msgs, num);
+		++m_send_calls;
+		if (ret < 0 && errno == ENOSYS)
+		{
+			m_mmsg_supported = false;
+			for (int i = start; i < m_num_batched; ++i)
+			{
+				batched_packet& bp = m_send_batch[i];
+				error_code ec;
+#if TORRENT_USE_IPV6
+				if (bp.ep.address().is_v4() && m_ipv4_sock.is_open())
+#endif
+					m_ipv4_sock.send_to(asio::buffer(bp.buf, bp.len), bp.ep, 0, ec);
+#if TORRENT_USE_IPV6
+				else
+					m_ipv6_sock.send_to(asio::buffer(bp.buf, bp.len), bp.ep, 0, ec);
+#endif
+				++m_send_calls;
+				if (!ec) ++m_packets_out;
+			}
+			break;
+		}
+		if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK
+			&& errno != ENOBUFS && errno != EINTR)
+		{
+			// sendmmsg() only fails if the first packet can't be
+			// sent. Skip just that one, the rest of the run may be
+			// going somewhere else. Its sender is told once we're
+			// out of here (see on_flush_batch())
+			m_send_errors.push_back(std::make_pair(m_send_batch[start].ep
+				, error_code(errno, get_posix_category())));
+			ret = 1;
+		}
+		// if the socket buffer is full, drop the rest of
+		// the run. uTP treats it as packet loss
+		else if (ret <= 0) ret = num;
+		else m_packets_out += ret;
+		start += ret;
+	}
+	m_num_batched = 0;
+}
+
+void udp_socket::on_flush_batch()
+{
+#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
+	TORRENT_ASSERT(m_outstanding_flush > 0);
+	--m_outstanding_flush;
+#endif
+	TORRENT_ASSERT(m_outstanding_ops > 0);
+	--m_outstanding_ops;
+	TORRENT_ASSERT(m_outstanding_ops == m_outstanding_connect
+		+ m_outstanding_timeout
+		+ m_outstanding_resolve
+		+ m_outstanding_connect_queue
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
+
+	m_flush_posted = false;
+	if (m_abort)
+	{
+		m_num_batched = 0;
+		m_send_errors.clear();
+		maybe_clear_callback();
+		return;
+	}
+	CHECK_MAGIC;
+	flush_batch();
+
+	// this includes the errors of the flushes made from within
+	// send() since this handler was posted
+	if (m_send_errors.empty()) return;
+	std::vector<std::pair<udp::endpoint, error_code> > errors;
+	errors.swap(m_send_errors);
+	if (!m_send_error_callback) return;
+	for (std::vector<std::pair<udp::endpoint, error_code> >::iterator i
+		= errors.begin(), end(errors.end()); i != end; ++i)
+	{
+		TORRENT_TRY {
+			m_send_error_callback(i->second, i->first);
+		} TORRENT_CATCH (std::exception&) {}
+	}
+}
+#endif // TORRENT_USE_MMSG
+
 void udp_socket::wrap(udp::endpoint const& ep, char const* p, int len, error_code& ec)
 {
 	CHECK_MAGIC;
@@ -555,6 +945,12 @@ void udp_socket::close()
 	TORRENT_ASSERT(is_single_thread());
 	TORRENT_ASSERT(m_magic == 0x1337);
 
+#if TORRENT_USE_MMSG
+	// send whatever is still queued up before the
+	// sockets are shut down
+	if (is_open()) flush_batch();
+#endif
+
 	error_code ec;
 	// if we close the socket here, we can't shut down
 	// utp connections or NAT-PMP. We need to cancel the
@@ -598,7 +994,8 @@ void udp_socket::close()
 			+ m_outstanding_timeout
 			+ m_outstanding_resolve
 			+ m_outstanding_connect_queue
-			+ m_outstanding_socks);
+			+ m_outstanding_socks
+			+ m_outstanding_flush);
 
 		if (m_abort)
 		{
@@ -647,13 +1044,7 @@ void udp_socket::bind(udp::endpoint const& ep, error_code& ec)
 		{
 			maybe_realloc_buffers(1);
 			if (m_abort) return;
-#if defined TORRENT_ASIO_DEBUGGING
-			add_outstanding_async("udp_socket::on_read");
-#endif
-			++m_v4_outstanding;
-			m_ipv4_sock.async_receive_from(asio::buffer(m_v4_buf, m_v4_buf_size)
-				, m_v4_ep, boost::bind(&udp_socket::on_read, this, &m_ipv4_sock
-				, _1, _2));
+			setup_read(&m_ipv4_sock);
 		}
 	}
 
@@ -674,13 +1065,7 @@ void udp_socket::bind(udp::endpoint const& ep, error_code& ec)
 		{
 			maybe_realloc_buffers(2);
 			if (m_abort) return;
-#if defined TORRENT_ASIO_DEBUGGING
-			add_outstanding_async("udp_socket::on_read");
-#endif
-			++m_v6_outstanding;
-			m_ipv6_sock.async_receive_from(asio::buffer(m_v6_buf, m_v6_buf_size)
-				, m_v6_ep, boost::bind(&udp_socket::on_read, this, &m_ipv6_sock
-				, _1, _2));
+			setup_read(&m_ipv6_sock);
 		}
 	}
 #endif
@@ -711,25 +1096,16 @@ void udp_socket::bind(int port)
 	m_ipv4_sock.open(udp::v4(), ec);
 	if (!ec)
 	{
-#if defined TORRENT_ASIO_DEBUGGING
-		add_outstanding_async("udp_socket::on_read");
-#endif
 		m_ipv4_sock.bind(udp::endpoint(address_v4::any(), port), ec);
 		if (m_v4_outstanding == 0)
 		{
-			++m_v4_outstanding;
-			m_ipv4_sock.async_receive_from(asio::buffer(m_v4_buf, m_v4_buf_size)
-				, m_v4_ep, boost::bind(&udp_socket::on_read, this, &m_ipv4_sock
-				, _1, _2));
+			setup_read(&m_ipv4_sock);
 		}
 	}
 #if TORRENT_USE_IPV6
 	m_ipv6_sock.open(udp::v6(), ec);
 	if (!ec)
 	{
-#if defined TORRENT_ASIO_DEBUGGING
-		add_outstanding_async("udp_socket::on_read");
-#endif
 #ifdef IPV6_V6ONLY
 		m_ipv6_sock.set_option(v6only(true), ec);
 		ec.clear();
@@ -738,10 +1114,7 @@ void udp_socket::bind(int port)
 
 		if (m_v6_outstanding == 0)
 		{
-			++m_v6_outstanding;
-			m_ipv6_sock.async_receive_from(asio::buffer(m_v6_buf, m_v6_buf_size)
-				, m_v6_ep, boost::bind(&udp_socket::on_read, this, &m_ipv6_sock
-				, _1, _2));
+			setup_read(&m_ipv6_sock);
 		}
 	}
 #endif // TORRENT_USE_IPV6
@@ -793,7 +1166,8 @@ void udp_socket::on_name_lookup(error_code const& e, tcp::resolver::iterator i)
 		+ m_outstanding_timeout
 		+ m_outstanding_resolve
 		+ m_outstanding_connect_queue
-		+ m_outstanding_socks);
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
 
 	if (m_abort)
 	{
@@ -854,7 +1228,8 @@ void udp_socket::on_timeout()
 		+ m_outstanding_timeout
 		+ m_outstanding_resolve
 		+ m_outstanding_connect_queue
-		+ m_outstanding_socks);
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
 
 	m_queue_packets = false;
 
@@ -884,7 +1259,8 @@ void udp_socket::on_connect(int ticket)
 		+ m_outstanding_timeout
 		+ m_outstanding_resolve
 		+ m_outstanding_connect_queue
-		+ m_outstanding_socks);
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
 
 	if (ticket == -1)
 	{
@@ -898,7 +1274,8 @@ void udp_socket::on_connect(int ticket)
 			+ m_outstanding_timeout
 			+ m_outstanding_resolve
 			+ m_outstanding_connect_queue
-			+ m_outstanding_socks);
+			+ m_outstanding_socks
+			+ m_outstanding_flush);
 		close();
 		return;
 	}
@@ -943,7 +1320,8 @@ void udp_socket::on_connected(error_code const& e)
 		+ m_outstanding_timeout
 		+ m_outstanding_resolve
 		+ m_outstanding_connect_queue
-		+ m_outstanding_socks);
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
 
 	if (m_abort)
 	{
@@ -955,7 +1333,8 @@ void udp_socket::on_connected(error_code const& e)
 	if (e == asio::error::operation_aborted) return;
 
 	TORRENT_ASSERT(is_single_thread());
-	m_cc.done(m_connection_ticket);
+	m_cc.done(m_connection_ticket, !e || e == boost::system::errc::connection_refused
+		? connection_queue::responded : connection_queue::failed);
 	m_connection_ticket = -1;
 
 	// we just called done, which means on_timeout
@@ -971,7 +1350,8 @@ void udp_socket::on_connected(error_code const& e)
 		+ m_outstanding_timeout
 		+ m_outstanding_resolve
 		+ m_outstanding_connect_queue
-		+ m_outstanding_socks);
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
 
 	if (m_abort)
 	{
@@ -1031,7 +1411,8 @@ void udp_socket::handshake1(error_code const& e)
 		+ m_outstanding_timeout
 		+ m_outstanding_resolve
 		+ m_outstanding_connect_queue
-		+ m_outstanding_socks);
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
 
 	if (m_abort)
 	{
@@ -1073,7 +1454,8 @@ void udp_socket::handshake2(error_code const& e)
 		+ m_outstanding_timeout
 		+ m_outstanding_resolve
 		+ m_outstanding_connect_queue
-		+ m_outstanding_socks);
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
 
 	if (m_abort)
 	{
@@ -1160,7 +1542,8 @@ void udp_socket::handshake3(error_code const& e)
 		+ m_outstanding_timeout
 		+ m_outstanding_resolve
 		+ m_outstanding_connect_queue
-		+ m_outstanding_socks);
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
 
 	if (m_abort)
 	{
@@ -1202,7 +1585,8 @@ void udp_socket::handshake4(error_code const& e)
 		+ m_outstanding_timeout
 		+ m_outstanding_resolve
 		+ m_outstanding_connect_queue
-		+ m_outstanding_socks);
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
 
 	if (m_abort)
 	{
@@ -1274,7 +1658,8 @@ void udp_socket::connect1(error_code const& e)
 		+ m_outstanding_timeout
 		+ m_outstanding_resolve
 		+ m_outstanding_connect_queue
-		+ m_outstanding_socks);
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
 
 	if (m_abort)
 	{
@@ -1316,7 +1701,8 @@ void udp_socket::connect2(error_code const& e)
 		+ m_outstanding_timeout
 		+ m_outstanding_resolve
 		+ m_outstanding_connect_queue
-		+ m_outstanding_socks);
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
 
 	if (m_abort)
 	{
@@ -1389,7 +1775,8 @@ void udp_socket::hung_up(error_code const& e)
 		+ m_outstanding_timeout
 		+ m_outstanding_resolve
 		+ m_outstanding_connect_queue
-		+ m_outstanding_socks);
+		+ m_outstanding_socks
+		+ m_outstanding_flush);
 
 	if (m_abort)
 	{
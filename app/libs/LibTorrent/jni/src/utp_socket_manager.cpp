@@ -38,25 +38,181 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/broadcast_socket.hpp" // for is_teredo
 #include "libtorrent/random.hpp"
 
+#include <cstdlib> // for malloc and free
+
 // #define TORRENT_DEBUG_MTU 1135
 
 namespace libtorrent
 {
+	packet_pool::packet_pool()
+		: m_allocations(0)
+		, m_hits(0)
+		, m_outstanding(0)
+	{
+		for (int i = 0; i < num_size_classes; ++i)
+		{
+			m_free[i] = 0;
+			m_num_free[i] = 0;
+		}
+	}
+
+	packet_pool::~packet_pool()
+	{
+		for (std::vector<slab*>::iterator i = m_slabs.begin()
+			, end(m_slabs.end()); i != end; ++i)
+			std::free(*i);
+	}
+
+	int packet_pool::block_size(int size_class) const
+	{
+		// enough for ACKs, for small payloads and for MTU sized
+		// packets. The header and the packet struct are included
+		static const int sizes[num_size_classes] = { 96, 512, 1600 };
+		TORRENT_ASSERT(size_class >= 0 && size_class < num_size_classes);
+		return sizes[size_class] + sizeof(block_header);
+	}
+
+	void* packet_pool::allocate(int size)
+	{
+		++m_allocations;
+		int size_class = 0;
+		while (size_class < num_size_classes
+			&& block_size(size_class) - int(sizeof(block_header)) < size)
+			++size_class;
+
+		block_header* b;
+		if (size_class == num_size_classes)
+		{
+			b = (block_header*)std::malloc(sizeof(block_header) + size);
+			if (b == 0) return 0;
+			b->owner = 0;
+			++m_outstanding;
+			return b + 1;
+		}
+
+		if (m_free[size_class] == 0)
+		{
+			// carve a new slab into free blocks
+			int bs = block_size(size_class);
+			int num_blocks = (slab_size - sizeof(slab)) / bs;
+			slab* sl = (slab*)std::malloc(sizeof(slab) + num_blocks * bs);
+			if (sl == 0) return 0;
+			sl->size_class = size_class;
+			sl->num_blocks = num_blocks;
+			sl->in_use = 0;
+			m_slabs.push_back(sl);
+			char* blocks = (char*)(sl + 1);
+			for (int i = num_blocks - 1; i >= 0; --i)
+			{
+				block_header* fb = (block_header*)(blocks + i * bs);
+				fb->owner = sl;
+				*(void**)(fb + 1) = m_free[size_class];
+				m_free[size_class] = fb + 1;
+			}
+			m_num_free[size_class] += num_blocks;
+		}
+		else
+		{
+			++m_hits;
+		}
+
+		void* ret = m_free[size_class];
+		m_free[size_class] = *(void**)ret;
+		--m_num_free[size_class];
+		b = (block_header*)ret - 1;
+		++b->owner->in_use;
+		++m_outstanding;
+		return ret;
+	}
+
+	void packet_pool::free(void* p)
+	{
+		if (p == 0) return;
+		TORRENT_ASSERT(m_outstanding > 0);
+		--m_outstanding;
+		block_header* b = (block_header*)p - 1;
+		if (b->owner == 0)
+		{
+			std::free(b);
+			return;
+		}
+		slab* sl = b->owner;
+		TORRENT_ASSERT(sl->in_use > 0);
+		--sl->in_use;
+		*(void**)p = m_free[sl->size_class];
+		m_free[sl->size_class] = p;
+		++m_num_free[sl->size_class];
+	}
+
+	void packet_pool::trim(int max_free)
+	{
+		int free_bytes = 0;
+		for (int i = 0; i < num_size_classes; ++i)
+			free_bytes += m_num_free[i] * block_size(i);
+		if (free_bytes <= max_free) return;
+
+		// unlink the blocks of idle slabs from the free-lists,
+		// then release the slabs
+		for (int i = 0; i < num_size_classes; ++i)
+		{
+			void** prev = &m_free[i];
+			while (*prev)
+			{
+				block_header* b = (block_header*)*prev - 1;
+				if (b->owner->in_use == 0)
+				{
+					*prev = *(void**)*prev;
+					--m_num_free[i];
+				}
+				else
+				{
+					prev = (void**)*prev;
+				}
+			}
+		}
+		for (std::vector<slab*>::iterator i = m_slabs.begin(); i != m_slabs.end();)
+		{
+			if ((*i)->in_use > 0)
+			{
+				++i;
+				continue;
+			}
+			std::free(*i);
+			i = m_slabs.erase(i);
+		}
+	}
+
+	void packet_pool::get_status(utp_status& s) const
+	{
+		s.packet_allocations = m_allocations;
+		s.packet_pool_hits = m_hits;
+		s.packets_outstanding = m_outstanding;
+	}
 
 	utp_socket_manager::utp_socket_manager(session_settings const& sett, udp_socket& s
 		, incoming_utp_callback_t cb)
 		: m_sock(s)
 		, m_cb(cb)
+		, m_index_size(0)
+		, m_index_used(0)
 		, m_last_socket(0)
 		, m_new_connection(-1)
 		, m_sett(sett)
 		, m_last_route_update(min_time())
 		, m_last_if_update(min_time())
 		, m_sock_buf_size(0)
-	{}
+	{
+#if TORRENT_USE_MMSG
+		m_sock.set_send_error_handler(boost::bind(
+			&utp_socket_manager::send_failed, this, _1, _2));
+#endif
+	}
 
 	utp_socket_manager::~utp_socket_manager()
 	{
+#if TORRENT_USE_MMSG
+		m_sock.set_send_error_handler(udp_socket::send_error_callback_t());
+#endif
 		for (socket_map_t::iterator i = m_utp_sockets.begin()
 			, end(m_utp_sockets.end()); i != end; ++i)
 		{
@@ -71,6 +227,9 @@ namespace libtorrent
 		s.num_connected = 0;
 		s.num_fin_sent = 0;
 		s.num_close_wait = 0;
+		s.packets_per_recv_call = m_sock.packets_per_recv_call();
+		s.packets_per_send_call = m_sock.packets_per_send_call();
+		m_packets.get_status(s);
 
 		for (socket_map_t::const_iterator i = m_utp_sockets.begin()
 			, end(m_utp_sockets.end()); i != end; ++i)
@@ -95,6 +254,7 @@ namespace libtorrent
 		{
 			if (should_delete(i->second))
 			{
+				index_erase(i->second);
 				delete_utp_impl(i->second);
 				if (m_last_socket == i->second) m_last_socket = 0;
 				m_utp_sockets.erase(i++);
@@ -103,6 +263,10 @@ namespace libtorrent
 			tick_utp_impl(i->second, now);
 			++i;
 		}
+
+		// don't hold on to more than this many bytes of
+		// idle packet buffers
+		m_packets.trim(256 * 1024);
 	}
 
 	void utp_socket_manager::mtu_for_dest(address const& addr, int& link_mtu, int& utp_mtu)
@@ -186,15 +350,38 @@ namespace libtorrent
 #ifdef TORRENT_HAS_DONT_FRAGMENT
 		error_code tmp;
 		if (flags & utp_socket_manager::dont_fragment)
+		{
+#if TORRENT_USE_MMSG
+			// the batched packets must not be sent with
+			// the don't fragment bit set
+			m_sock.flush_batch();
+#endif
 			m_sock.set_option(libtorrent::dont_fragment(true), tmp);
+		}
 #endif
-		m_sock.send(ep, p, len, ec);
+		// packets that don't need the don't fragment bit (i.e.
+		// aren't MTU probes) may be batched with others
+		m_sock.send(ep, p, len, ec, (flags & utp_socket_manager::dont_fragment)
+			? 0 : udp_socket::batch);
 #ifdef TORRENT_HAS_DONT_FRAGMENT
 		if (flags & utp_socket_manager::dont_fragment)
 			m_sock.set_option(libtorrent::dont_fragment(false), tmp);
 #endif
 	}
 
+	void utp_socket_manager::send_failed(error_code const& ec, udp::endpoint const& ep)
+	{
+		// the packet doesn't say which socket sent it. Fail all the
+		// sockets talking to that endpoint, just like a failed send
+		// fails the socket that sent it
+		for (socket_map_t::iterator i = m_utp_sockets.begin()
+			, end(m_utp_sockets.end()); i != end; ++i)
+		{
+			if (utp_remote_endpoint(i->second) != ep) continue;
+			utp_send_failed(i->second, ec);
+		}
+	}
+
 	int utp_socket_manager::local_port(error_code& ec) const
 	{
 		return m_sock.local_endpoint(ec).port();
@@ -282,14 +469,27 @@ namespace libtorrent
 			return utp_incoming_packet(m_last_socket, p, size, ep, receive_time);
 		}
 
-		std::pair<socket_map_t::iterator, socket_map_t::iterator> r =
-			m_utp_sockets.equal_range(id);
+		utp_socket_impl* s = index_find(ep, id);
+		if (s == 0)
+		{
+			// this may be the first packet matched to this socket,
+			// in which case it's not in the index yet
+			std::pair<socket_map_t::iterator, socket_map_t::iterator> r =
+				m_utp_sockets.equal_range(id);
+
+			for (; r.first != r.second; ++r.first)
+			{
+				if (!utp_match(r.first->second, ep, id)) continue;
+				s = r.first->second;
+				index_insert(s, ep, id);
+				break;
+			}
+		}
 
-		for (; r.first != r.second; ++r.first)
+		if (s)
 		{
-			if (!utp_match(r.first->second, ep, id)) continue;
-			bool ret = utp_incoming_packet(r.first->second, p, size, ep, receive_time);
-			if (ret) m_last_socket = r.first->second;
+			bool ret = utp_incoming_packet(s, p, size, ep, receive_time);
+			if (ret) m_last_socket = s;
 			return ret;
 		}
 
@@ -336,10 +536,126 @@ namespace libtorrent
 		return false;
 	}
 
+	namespace
+	{
+		boost::uint32_t hash_endpoint(udp::endpoint const& ep, boost::uint16_t id)
+		{
+			boost::uint32_t h = (boost::uint32_t(id) << 16) | ep.port();
+			if (ep.address().is_v4())
+			{
+				h ^= ep.address().to_v4().to_ulong() * 0x9e3779b1;
+			}
+#if TORRENT_USE_IPV6
+			else
+			{
+				address_v6::bytes_type b = ep.address().to_v6().to_bytes();
+				for (int i = 0; i < int(b.size()); ++i)
+					h = (h * 31) ^ b[i];
+			}
+#endif
+			// mix the high bits into the low ones, which
+			// are the ones used to pick a slot
+			h ^= h >> 16;
+			h *= 0x85ebca6b;
+			h ^= h >> 13;
+			return h;
+		}
+	}
+
+	utp_socket_impl* utp_socket_manager::index_find(udp::endpoint const& ep
+		, boost::uint16_t id) const
+	{
+		if (m_socket_index.empty()) return 0;
+		int mask = m_socket_index.size() - 1;
+		for (int i = hash_endpoint(ep, id) & mask;; i = (i + 1) & mask)
+		{
+			index_slot const& e = m_socket_index[i];
+			if (e.sock == 0 && !e.deleted) return 0;
+			if (e.sock && e.id == id && e.ep == ep) return e.sock;
+		}
+	}
+
+	void utp_socket_manager::index_insert(utp_socket_impl* s
+		, udp::endpoint const& ep, boost::uint16_t id)
+	{
+		TORRENT_ASSERT(index_find(ep, id) == 0);
+
+		// keep the load factor (including deleted
+		// slots) at or below one half
+		if ((m_index_used + 1) * 2 > int(m_socket_index.size()))
+		{
+			int capacity = m_socket_index.empty() ? 64 : m_socket_index.size();
+			while ((m_index_size + 1) * 2 > capacity) capacity *= 2;
+			index_rehash(capacity);
+		}
+
+		int mask = m_socket_index.size() - 1;
+		int i = hash_endpoint(ep, id) & mask;
+		while (m_socket_index[i].sock) i = (i + 1) & mask;
+		index_slot& e = m_socket_index[i];
+		if (!e.deleted) ++m_index_used;
+		e.sock = s;
+		e.ep = ep;
+		e.id = id;
+		e.deleted = false;
+		++m_index_size;
+	}
+
+	void utp_socket_manager::index_erase(utp_socket_impl* s)
+	{
+		if (m_index_size == 0) return;
+
+		// the socket is indexed under its endpoint and ID,
+		// unless it never received a packet
+		udp::endpoint ep = utp_remote_endpoint(s);
+		boost::uint16_t id = utp_receive_id(s);
+		int mask = m_socket_index.size() - 1;
+		int i = hash_endpoint(ep, id) & mask;
+		for (; m_socket_index[i].sock || m_socket_index[i].deleted; i = (i + 1) & mask)
+		{
+			if (m_socket_index[i].sock == s) break;
+		}
+
+		if (m_socket_index[i].sock != s)
+		{
+			// the socket is being deleted, so make absolutely
+			// sure we don't keep a dangling pointer to it
+			for (i = 0; i <= mask; ++i)
+				if (m_socket_index[i].sock == s) break;
+			if (i > mask) return;
+		}
+
+		index_slot& e = m_socket_index[i];
+		e.sock = 0;
+		e.deleted = true;
+		--m_index_size;
+	}
+
+	void utp_socket_manager::index_rehash(int capacity)
+	{
+		TORRENT_ASSERT((capacity & (capacity - 1)) == 0);
+		std::vector<index_slot> old(capacity);
+		old.swap(m_socket_index);
+		m_index_size = 0;
+		m_index_used = 0;
+		int mask = capacity - 1;
+		for (std::vector<index_slot>::iterator i = old.begin()
+			, end(old.end()); i != end; ++i)
+		{
+			if (i->sock == 0) continue;
+			int k = hash_endpoint(i->ep, i->id) & mask;
+			while (m_socket_index[k].sock) k = (k + 1) & mask;
+			m_socket_index[k] = *i;
+			++m_index_size;
+			++m_index_used;
+		}
+	}
+
 	void utp_socket_manager::remove_socket(boost::uint16_t id)
 	{
 		socket_map_t::iterator i = m_utp_sockets.find(id);
 		if (i == m_utp_sockets.end()) return;
+		index_erase(i->second);
 		delete_utp_impl(i->second);
 		if (m_last_socket == i->second) m_last_socket = 0;
 		m_utp_sockets.erase(i);
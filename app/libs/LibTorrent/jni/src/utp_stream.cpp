@@ -231,9 +231,12 @@ struct utp_socket_impl
 		, m_write_timeout()
 		, m_timeout(time_now_hires() + milliseconds(m_sm->connect_timeout()))
 		, m_last_cwnd_hit(time_now())
+		, m_slowdown_start(min_time())
+		, m_next_slowdown(max_time())
 		, m_ack_timer(time_now() + minutes(10))
 		, m_last_history_step(time_now_hires())
 		, m_cwnd(TORRENT_ETHERNET_MTU << 16)
+		, m_ssthres(0)
 		, m_buffered_incoming_bytes(0)
 		, m_reply_micro(0)
 		, m_adv_wnd(TORRENT_ETHERNET_MTU)
@@ -248,6 +251,7 @@ struct utp_socket_impl
 		, m_out_packets(0)
 		, m_send_delay(0)
 		, m_recv_delay(0)
+		, m_lowest_rtt(UINT_MAX)
 		, m_port(0)
 		, m_send_id(send_id)
 		, m_recv_id(recv_id)
@@ -311,6 +315,8 @@ struct utp_socket_impl
 	void write_sack(char* buf, int size) const;
 	void incoming(char const* buf, int size, packet* p, ptime now);
 	void do_ledbat(int acked_bytes, int delay, int in_flight, ptime const now);
+	boost::int64_t ledbat_plus_plus_gain(int acked_bytes, int delay
+		, boost::int64_t window_factor, ptime const now);
 	int packet_timeout() const;
 	bool test_socket_state();
 	void maybe_trigger_receive_callback(ptime now);
@@ -418,6 +424,15 @@ struct utp_socket_impl
 	// not sending fast enough to need it bigger
 	ptime m_last_cwnd_hit;
 
+	// LEDBAT++ periodic slowdown state. m_slowdown_start is set when
+	// the cwnd is dropped to 2 packets to let the bottleneck queue drain
+	// (so that the base delay can be re-measured) and is reset to
+	// min_time() once we've slow-started back up to m_ssthres.
+	// m_next_slowdown is when the next slowdown is due, max_time() if
+	// none is scheduled yet
+	ptime m_slowdown_start;
+	ptime m_next_slowdown;
+
 	// the next time we need to send an ACK the latest
 	// updated every time we send an ACK and every time we
 	// put off sending an ACK for a received packet
@@ -432,6 +447,10 @@ struct utp_socket_impl
 	// it in do_ledbat() are signed.
 	boost::int64_t m_cwnd;
 
+	// the cwnd before the last LEDBAT++ slowdown. After the slowdown we
+	// slow-start back up to this size. Same fixed point format as m_cwnd
+	boost::int64_t m_ssthres;
+
 	timestamp_history m_delay_hist;
 	timestamp_history m_their_delay_hist;
 
@@ -492,6 +511,10 @@ struct utp_socket_impl
 	// average RTT
 	sliding_average<16> m_rtt;
 
+	// the lowest RTT we've seen on this socket, in microseconds. Half of
+	// this is used as the base delay estimate for LEDBAT++'s dynamic gain
+	boost::uint32_t m_lowest_rtt;
+
 	// port of destination endpoint
 	boost::uint16_t m_port;
 
@@ -696,6 +719,20 @@ int utp_socket_state(utp_socket_impl const* s)
 	return s->m_state;
 }
 
+void utp_send_failed(utp_socket_impl* s, error_code const& ec)
+{
+	// a batched packet of this socket failed to send. Treat it the
+	// same way as when the send fails right away
+	if (s->m_state == utp_socket_impl::UTP_STATE_NONE
+		|| s->m_state == utp_socket_impl::UTP_STATE_ERROR_WAIT
+		|| s->m_state == utp_socket_impl::UTP_STATE_DELETE) return;
+
+	UTP_LOGV("%8p: send failed: %s\n", s, ec.message().c_str());
+	s->m_error = ec;
+	s->m_state = utp_socket_impl::UTP_STATE_ERROR_WAIT;
+	s->test_socket_state();
+}
+
 int utp_stream::send_delay() const
 {
 	return m_impl ? m_impl->m_send_delay : 0;
@@ -957,7 +994,7 @@ size_t utp_stream::read_some(bool clear_buffers)
 		// Consumed entire packet
 		if (p->header_size == p->size)
 		{
-			free(p);
+			m_impl->m_sm->free_packet(p);
 			++pop_packets;
 			*i = 0;
 			++i;
@@ -1046,20 +1083,20 @@ utp_socket_impl::~utp_socket_impl()
 		i != end; i = (i + 1) & ACK_MASK)
 	{
 		void* p = m_inbuf.remove(i);
-		free(p);
+		m_sm->free_packet(p);
 	}
 	for (boost::uint16_t i = m_outbuf.cursor(), end((m_outbuf.cursor()
 		+ m_outbuf.capacity()) & ACK_MASK);
 		i != end; i = (i + 1) & ACK_MASK)
 	{
 		void* p = m_outbuf.remove(i);
-		free(p);
+		m_sm->free_packet(p);
 	}
 
 	for (std::vector<packet*>::iterator i = m_receive_buffer.begin()
 		, end = m_receive_buffer.end(); i != end; ++i)
 	{
-		free(*i);
+		m_sm->free_packet(*i);
 	}
 }
 
@@ -1165,7 +1202,7 @@ void utp_socket_impl::send_syn()
 	m_ack_nr = 0;
 	m_fast_resend_seq_nr = m_seq_nr;
 
-	packet* p = (packet*)malloc(sizeof(packet) + sizeof(utp_header));
+	packet* p = (packet*)m_sm->alloc_packet(sizeof(packet) + sizeof(utp_header));
 	p->size = sizeof(utp_header);
 	p->header_size = sizeof(utp_header);
 	p->num_transmissions = 1;
@@ -1202,7 +1239,7 @@ void utp_socket_impl::send_syn()
 
 	if (ec)
 	{
-		free(p);
+		m_sm->free_packet(p);
 		m_error = ec;
 		m_state = UTP_STATE_ERROR_WAIT;
 		test_socket_state();
@@ -1227,7 +1264,7 @@ void utp_socket_impl::send_fin()
 
 	// we need a heap allocated packet in order to stick it
 	// in the send buffer, so that we can resend it
-	packet* p = (packet*)malloc(sizeof(packet) + sizeof(utp_header));
+	packet* p = (packet*)m_sm->alloc_packet(sizeof(packet) + sizeof(utp_header));
 
 	p->size = sizeof(utp_header);
 	p->header_size = sizeof(utp_header);
@@ -1267,7 +1304,7 @@ void utp_socket_impl::send_fin()
 		m_error = ec;
 		m_state = UTP_STATE_ERROR_WAIT;
 		test_socket_state();
-		free(p);
+		m_sm->free_packet(p);
 		return;
 	}
 
@@ -1282,7 +1319,7 @@ void utp_socket_impl::send_fin()
 	if (old)
 	{
 		if (!old->need_resend) m_bytes_in_flight -= old->size - old->header_size;
-		free(old);
+		m_sm->free_packet(old);
 	}
 	m_seq_nr = (m_seq_nr + 1) & ACK_MASK;
 	m_fast_resend_seq_nr = m_seq_nr;
@@ -1608,7 +1645,7 @@ bool utp_socket_impl::send_pkt(bool ack)
 	packet* p;
 	// we only need a heap allocation if we have payload and
 	// need to keep the packet around (in the outbuf)
-	if (payload_size) p = (packet*)malloc(sizeof(packet) + packet_size);
+	if (payload_size) p = (packet*)m_sm->alloc_packet(sizeof(packet) + packet_size);
 	else
 	{
 		// this alloca() statement won't necessarily produce
@@ -1696,7 +1733,7 @@ bool utp_socket_impl::send_pkt(bool ack)
 		m_error = ec;
 		m_state = UTP_STATE_ERROR_WAIT;
 		test_socket_state();
-		if (payload_size) free(p);
+		if (payload_size) m_sm->free_packet(p);
 		return false;
 	}
 
@@ -1719,7 +1756,7 @@ bool utp_socket_impl::send_pkt(bool ack)
 		if (old)
 		{
 			if (!old->need_resend) m_bytes_in_flight -= old->size - old->header_size;
-			free(old);
+			m_sm->free_packet(old);
 		}
 		m_seq_nr = (m_seq_nr + 1) & ACK_MASK;
 		TORRENT_ASSERT(payload_size >= 0);
@@ -1923,7 +1960,8 @@ void utp_socket_impl::ack_packet(packet* p, ptime const& receive_time
 
 	m_rtt.add_sample(rtt / 1000);
 	if (rtt < min_rtt) min_rtt = rtt;
-	free(p);
+	if (rtt < m_lowest_rtt) m_lowest_rtt = rtt;
+	m_sm->free_packet(p);
 }
 
 void utp_socket_impl::incoming(char const* buf, int size, packet* p, ptime now)
@@ -1962,7 +2000,7 @@ void utp_socket_impl::incoming(char const* buf, int size, packet* p, ptime now)
 		if (size == 0)
 		{
 			TORRENT_ASSERT(p == 0 || p->header_size == p->size);
-			free(p);
+			m_sm->free_packet(p);
 			maybe_trigger_receive_callback(now);
 			return;
 		}
@@ -1973,7 +2011,7 @@ void utp_socket_impl::incoming(char const* buf, int size, packet* p, ptime now)
 	if (!p)
 	{
 		TORRENT_ASSERT(buf);
-		p = (packet*)malloc(sizeof(packet) + size);
+		p = (packet*)m_sm->alloc_packet(sizeof(packet) + size);
 		p->size = size;
 		p->header_size = 0;
 		memcpy(p->buf, buf, size);
@@ -2089,7 +2127,7 @@ bool utp_socket_impl::consume_incoming_data(
 		}
 
 		// we don't need to save the packet header, just the payload
-		packet* p = (packet*)malloc(sizeof(packet) + payload_size);
+		packet* p = (packet*)m_sm->alloc_packet(sizeof(packet) + payload_size);
 		p->size = payload_size;
 		p->header_size = 0;
 		p->num_transmissions = 0;
@@ -2852,24 +2890,31 @@ void utp_socket_impl::do_ledbat(int acked_bytes, int delay, int in_flight, ptime
 	boost::int64_t delay_factor = (boost::int64_t(target_delay - delay) << 16) / target_delay;
 	boost::int64_t scaled_gain;
   
-	if (delay >= target_delay)
-	{
-		UTP_LOGV("%8p: off_target: %d slow_start -> 0\n", this, target_delay - delay);
-		m_slow_start = false;
-	}
-
-	boost::int64_t linear_gain = (window_factor * delay_factor) >> 16;
-	linear_gain *= boost::int64_t(m_sm->gain_factor());
-
-	if (m_slow_start)
+	if (m_sm->ledbat_plus_plus())
 	{
-		// mimic TCP slow-start by adding the number of acked
-		// bytes to cwnd
-		scaled_gain = (std::max)(boost::int64_t(acked_bytes) << 16, linear_gain);
+		scaled_gain = ledbat_plus_plus_gain(acked_bytes, delay, window_factor, now);
 	}
 	else
 	{
-		scaled_gain = linear_gain;
+		if (delay >= target_delay)
+		{
+			UTP_LOGV("%8p: off_target: %d slow_start -> 0\n", this, target_delay - delay);
+			m_slow_start = false;
+		}
+
+		boost::int64_t linear_gain = (window_factor * delay_factor) >> 16;
+		linear_gain *= boost::int64_t(m_sm->gain_factor());
+
+		if (m_slow_start)
+		{
+			// mimic TCP slow-start by adding the number of acked
+			// bytes to cwnd
+			scaled_gain = (std::max)(boost::int64_t(acked_bytes) << 16, linear_gain);
+		}
+		else
+		{
+			scaled_gain = linear_gain;
+		}
 	}
 
 	// make sure we don't wrap the cwnd
@@ -2921,6 +2966,105 @@ void utp_socket_impl::do_ledbat(int acked_bytes, int delay, int in_flight, ptime
 		m_slow_start = false;
 }
 
+// LEDBAT++ (draft-irtf-iccrg-ledbat-plus-plus). Returns the change to
+// apply to m_cwnd (16.16 fixed point) for this ACK. The differences from
+// plain LEDBAT are:
+// * the gain is scaled down on links with a small base delay, to avoid
+//   overshooting the target on short paths
+// * slow start is left as soon as the delay exceeds 3/4 of the target
+// * above target, the window is decreased multiplicatively (by at most
+//   half per RTT) instead of linearly
+// * periodically the window is dropped to 2 packets for 2 RTTs, to let
+//   the queue drain and allow the base delay to be re-measured. This is
+//   what solves the latecomer problem
+boost::int64_t utp_socket_impl::ledbat_plus_plus_gain(int acked_bytes
+	, int delay, boost::int64_t window_factor, ptime const now)
+{
+	int target_delay = m_sm->target_delay();
+	int rtt = (std::max)(m_rtt.mean(), 1);
+	boost::int64_t min_cwnd = boost::int64_t(m_mtu * 2) << 16;
+
+	// the slowdown is over once we've left slow start again, either by
+	// reaching m_ssthres, by the delay getting too high or by a loss
+	if (m_slowdown_start != min_time() && !m_slow_start)
+	{
+		time_duration slowdown = now - m_slowdown_start;
+		m_next_slowdown = now + slowdown * 9;
+		m_slowdown_start = min_time();
+		UTP_LOGV("%8p: slowdown done (%d ms) next in %d ms\n", this
+			, int(total_milliseconds(slowdown))
+			, int(total_milliseconds(m_next_slowdown - now)));
+	}
+	else if (m_slowdown_start == min_time() && !m_slow_start
+		&& m_next_slowdown == max_time())
+	{
+		// the first slowdown is 2 RTTs after the initial slow start
+		m_next_slowdown = now + milliseconds(rtt * 2);
+	}
+
+	if (m_slowdown_start == min_time() && !m_slow_start
+		&& now >= m_next_slowdown)
+	{
+		UTP_LOGV("%8p: slowdown cwnd:%d -> %d\n", this, int(m_cwnd >> 16)
+			, int(min_cwnd >> 16));
+		m_ssthres = m_cwnd;
+		m_cwnd = (std::min)(m_cwnd, min_cwnd);
+		m_slowdown_start = now;
+		m_next_slowdown = max_time();
+		m_slow_start = true;
+		return 0;
+	}
+
+	// keep the window frozen for 2 RTTs at the start of a slowdown
+	if (m_slowdown_start != min_time()
+		&& now < m_slowdown_start + milliseconds(rtt * 2))
+		return 0;
+
+	// GAIN = 1 / min(16, ceil(2 * target / base_delay)). We can't measure
+	// the one-way base delay in absolute terms (the clocks are not in sync)
+	// so half of the lowest RTT is used instead
+	int base_delay = m_lowest_rtt == UINT_MAX ? target_delay
+		: int((std::max)(m_lowest_rtt / 2, boost::uint32_t(1)));
+	int gain_div = (std::min)(16, (2 * target_delay + base_delay - 1) / base_delay);
+	if (gain_div < 1) gain_div = 1;
+
+	if (m_slow_start && delay > target_delay * 3 / 4)
+	{
+		UTP_LOGV("%8p: off_target: %d slow_start -> 0\n", this, target_delay - delay);
+		m_slow_start = false;
+	}
+
+	if (m_slow_start)
+	{
+		boost::int64_t gain = (boost::int64_t(acked_bytes) << 16) / gain_div;
+		if (m_slowdown_start != min_time() && m_cwnd + gain >= m_ssthres)
+		{
+			// we're back to where we were before the slowdown
+			gain = (std::max)(m_ssthres - m_cwnd, boost::int64_t(0));
+			m_slow_start = false;
+		}
+		return gain;
+	}
+
+	if (delay <= target_delay)
+	{
+		// additive increase, scaled by the fraction of the window that was
+		// acked, i.e. gain_factor / gain_div bytes per RTT at most
+		boost::int64_t delay_factor = (boost::int64_t(target_delay - delay) << 16) / target_delay;
+		boost::int64_t gain = (window_factor * delay_factor) >> 16;
+		return gain * boost::int64_t(m_sm->gain_factor()) / gain_div;
+	}
+
+	// multiplicative decrease, cwnd * (delay / target - 1) per RTT, but
+	// never more than half the window
+	int off_target = (std::min)(delay - target_delay, target_delay / 2);
+	boost::int64_t decrease = m_cwnd * off_target / target_delay;
+	decrease = (decrease * window_factor) >> 16;
+	if (m_cwnd - decrease < min_cwnd)
+		decrease = (std::max)(m_cwnd - min_cwnd, boost::int64_t(0));
+	return -decrease;
+}
+
 void utp_stream::bind(endpoint_type const& ep, error_code& ec) { }
 
 // returns the number of milliseconds a packet would have before
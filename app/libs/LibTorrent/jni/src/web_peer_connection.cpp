@@ -88,7 +88,8 @@ namespace libtorrent
 		// we always prefer downloading 1 MiB chunks
 		// from web seeds, or whole pieces if pieces
 		// are larger than a MiB
-		prefer_whole_pieces((std::max)((1024 * 1024) / tor->torrent_file().piece_length(), 1));
+		int pieces_per_range = (std::max)((1024 * 1024) / tor->torrent_file().piece_length(), 1);
+		prefer_whole_pieces(pieces_per_range);
 		
 		// we want large blocks as well, so
 		// we can request more bytes at once
@@ -96,6 +97,16 @@ namespace libtorrent
 		// into single larger ones
 		request_large_blocks(true);
 
+		// urlseed_pipeline_size is the number of ranges we may have
+		// requested at once. Keep at least two of them in flight from
+		// the start (rather than waiting to learn the download rate)
+		// so that the server always has the next range to send
+		int blocks_per_range = pieces_per_range
+			* tor->torrent_file().piece_length() / tor->block_size();
+		int pipeline_size = (std::max)(ses.settings().urlseed_pipeline_size, 1);
+		m_max_out_request_queue = pipeline_size * blocks_per_range;
+		m_min_out_request_queue = (std::min)(pipeline_size, 2) * blocks_per_range;
+
 #ifdef TORRENT_VERBOSE_LOGGING
 		peer_log("*** web_peer_connection %s", url.c_str());
 #endif
@@ -46,7 +46,8 @@ public class LibTorrent {
 
 	/**
 	 * StorageMode: 0-storage_mode_allocate 1-storage_mode_sparse
-	 * 2-storage_mode_compact
+	 * 2-storage_mode_compact 3-storage_mode_sparse through mmap
+	 * 4-pieces kept in RAM only, nothing is written to SavePath
 	 */
 	public native boolean AddTorrent(String SavePath, String TorentFile, int StorageMode, boolean IsMagnet);
 
@@ -59,6 +60,24 @@ public class LibTorrent {
 	// -----------------------------------------------------------------------------
 	public native boolean AbortSession();
 
+	/**
+	 * Looks up the host name in the background, so that trackers and web
+	 * seeds on that host can be contacted without waiting for DNS
+	 */
+	public native boolean PrefetchHostName(String HostName);
+
+	/**
+	 * Saves the DHT state, the node ID and routing table, so that the
+	 * next session can start from it. Call before AbortSession
+	 */
+	public native boolean SaveSessionState(String StateFile);
+
+	/**
+	 * Restores the state saved by SaveSessionState. Call after SetSession.
+	 * A DHT that is already running is restarted from the loaded state
+	 */
+	public native boolean LoadSessionState(String StateFile);
+
 	// -----------------------------------------------------------------------------
 	public native boolean RemoveTorrent(String ContentFile);
 
@@ -137,4 +156,16 @@ public class LibTorrent {
 	 * piece size for the index piece in bytes (all the same except the last)
 	 */
 	public native long GetPieceSize(String ContentFile, int PieceIndex); // +
+
+	/**
+	 * asks for the piece to be downloaded within Deadline milliseconds. A
+	 * torrent with piece deadlines is streaming, and gets a reserved share of
+	 * the download rate
+	 */
+	public native boolean SetPieceDeadline(String ContentFile, int PieceIndex, int Deadline);
+
+	/**
+	 * removes the deadlines of all pieces, the torrent stops streaming
+	 */
+	public native boolean ClearPieceDeadlines(String ContentFile);
 }
@@ -4,4 +4,6 @@ public class StorageMode {
 	public static final int ALLOCATE = 0;
 	public static final int SPARSE = 1;
 	public static final int COMPACT = 2;
+	public static final int MMAP = 3;
+	public static final int RAM = 4;
 }
\ No newline at end of file
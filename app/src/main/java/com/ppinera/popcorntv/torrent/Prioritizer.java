@@ -5,11 +5,17 @@ import android.util.Log;
 import com.softwarrior.libtorrent.LibTorrent;
 import com.softwarrior.libtorrent.Priority;
 
+import java.util.HashSet;
+import java.util.Set;
+
 public class Prioritizer {
 
 	private final int ACTIVE_PIECE_COUNT = 5;
 	private final int PREPARE_PIECE_COUNT = 3;
 	private final int UPDATE_TIME = 500;
+	// the deadline of the next piece to play, in milliseconds. Each
+	// piece after it gets this much more time
+	private final int PIECE_DEADLINE = 2000;
 
 	private LibTorrent libTorrent;
 	private String contentFile;
@@ -22,6 +28,9 @@ public class Prioritizer {
 
 	private boolean isStart;
 	private int cPreparePieceCount;
+	// the pieces we've set a deadline for. A deadline is only set once,
+	// setting it again on every update would keep pushing it back
+	private Set<Integer> deadlinePieces = new HashSet<Integer>();
 
 	public Prioritizer(LibTorrent libTorrent) {
 		this.libTorrent = libTorrent;
@@ -35,6 +44,7 @@ public class Prioritizer {
 		cPreparePieceCount = PREPARE_PIECE_COUNT;
 		firstPieceIndex = -1;
 		lastPieceIndex = -1;
+		deadlinePieces.clear();
 		int[] priorities = libTorrent.GetPiecePriorities(contentFile);
 		for (int i = 0; i < priorities.length; i++) {
 			if (priorities[i] != Priority.DONT_DOWNLOAD) {
@@ -71,6 +81,13 @@ public class Prioritizer {
 		}
 		libTorrent.SetPiecePriorities(contentFile, priorities);
 
+		// the torrent is streaming while it has piece deadlines, and gets
+		// the reserved share of the download rate
+		for (int i = 0; i < cPreparePieceCount; i++) {
+			setPieceDeadline(firstPieceIndex + i, PIECE_DEADLINE * (i + 1));
+			setPieceDeadline(lastPieceIndex - i, PIECE_DEADLINE * (i + 1));
+		}
+
 		return true;
 	}
 
@@ -119,6 +136,10 @@ public class Prioritizer {
 
 	public void stop() {
 		handler.removeCallbacks(updater);
+		if (contentFile != null) {
+			libTorrent.ClearPieceDeadlines(contentFile);
+		}
+		deadlinePieces.clear();
 		if (firstPieceIndex != -1 && lastPieceIndex != -1) {
 			int[] piecePriorities = libTorrent.GetPiecePriorities(contentFile);
 			if (piecePriorities == null) {
@@ -171,6 +192,11 @@ public class Prioritizer {
 					}
 					// zzz += i + " | ";
 					count++;
+					// the pieces just ahead of the playback position are due first
+					setPieceDeadline(i, PIECE_DEADLINE * count);
+				} else {
+					// a piece dropped from memory later needs a new deadline
+					deadlinePieces.remove(i);
 				}
 
 				if (count >= ACTIVE_PIECE_COUNT) {
@@ -185,6 +211,12 @@ public class Prioritizer {
 		}
 	}
 
+	private void setPieceDeadline(int piece, int deadline) {
+		if (deadlinePieces.add(piece)) {
+			libTorrent.SetPieceDeadline(contentFile, piece, deadline);
+		}
+	}
+
 	private Runnable updater = new Runnable() {
 
 		@Override
@@ -54,6 +54,9 @@ public class TorrentService extends IntentService {
 
 	private static final String LAST_CONTENT = "last-content";
 	private static final String LAST_FILE = "last-file";
+	private static final String SESSION_STATE_FILE_NAME = "session.state";
+
+	private static String sessionStateFile;
 
 	public TorrentService() {
 		super(TorrentService.class.getName());
@@ -292,6 +295,8 @@ public class TorrentService extends IntentService {
 		LibTorrent.SetSessionOptions(false, true, false);
 		SharedPreferences prefs = context.getSharedPreferences(PopcornApplication.POPCORN_PREFERENCES, Activity.MODE_PRIVATE);
 		setProxy(prefs.getBoolean(IS_PROXY_ENABLE_KEY, PROXY_DEFAULT));
+		sessionStateFile = new File(context.getFilesDir(), SESSION_STATE_FILE_NAME).getAbsolutePath();
+		LibTorrent.LoadSessionState(sessionStateFile);
 		LibTorrent.ResumeSession();
 
 		Intent intent = new Intent(context, TorrentService.class);
@@ -301,6 +306,9 @@ public class TorrentService extends IntentService {
 
 	public static void stop() {
 		LibTorrent.PauseSession();
+		if (sessionStateFile != null) {
+			LibTorrent.SaveSessionState(sessionStateFile);
+		}
 		LibTorrent.AbortSession();
 	}
 